@@ -0,0 +1,393 @@
+/**
+ * @file HardwareBenchmark.cpp
+ * @brief Implementation of the on-device benchmark
+ */
+
+#include <Preferences.h>
+#include <SD.h>
+#include <SD_MMC.h>
+
+#include "HardwareBenchmark.h"
+#include "AudioBufferPool.h"
+#include "AudioManager.h"
+#include "BackendClient.h"
+#include "FileSystem.h"
+#include "LEDManager.h"
+#include "LogManager.h"
+#include "Metrics.h"
+#include "PowerManager.h"
+#include "TimeManager.h"
+#include "UploadQueue.h"
+#include "WifiManager.h"
+
+// Revision in the results, set by the bench environment from git
+#define BENCH_STRINGIFY(x) #x
+#define BENCH_TO_STRING(x) BENCH_STRINGIFY(x)
+#ifdef BENCH_FIRMWARE_REV
+#define BENCH_REVISION BENCH_TO_STRING(BENCH_FIRMWARE_REV)
+#else
+#define BENCH_REVISION __DATE__ " " __TIME__
+#endif
+
+#define BENCH_SD_FILE BENCH_DIR "/sd.bin"
+#define BENCH_UPLOAD_FILE BENCH_DIR "/upload.bin"
+#define BENCH_RESULTS_HEADER "run,firmware,card,bus,phase,test,parameter,value,unit\n"
+
+Application* HardwareBenchmark::app = nullptr;
+uint32_t HardwareBenchmark::runNumber = 0;
+String HardwareBenchmark::card = "";
+String HardwareBenchmark::bus = "";
+const char* HardwareBenchmark::phaseName = "";
+uint32_t HardwareBenchmark::phaseStartMs = 0;
+float HardwareBenchmark::phaseStartVoltage = 0.0f;
+String HardwareBenchmark::pendingRows = "";
+portMUX_TYPE HardwareBenchmark::currentLock = portMUX_INITIALIZER_UNLOCKED;
+uint64_t HardwareBenchmark::currentSum = 0;
+uint32_t HardwareBenchmark::currentSamples = 0;
+uint32_t HardwareBenchmark::currentMax = 0;
+
+bool HardwareBenchmark::init(Application* appInstance) {
+    app = appInstance ? appInstance : Application::getInstance();
+
+    Preferences preferences;
+    if (preferences.begin("bench", false)) {
+        runNumber = preferences.getUInt("run", 0) + 1;
+        preferences.putUInt("run", runNumber);
+        preferences.end();
+    }
+
+    // The same order as Application::init(), without the tasks of the normal operation
+    if (!LogManager::init(app)) {
+        Serial.println("Failed to initialize LogManager");
+        return false;
+    }
+    TimeManager::applyTimezone();
+    LogManager::setTimestampProvider(TimeManager::formatTimestamp);
+    app->log("\n\n\n======= Benchmark run: " + String(runNumber) + ", firmware " + BENCH_REVISION + " =======");
+
+    if (!PowerManager::init(app) || !LEDManager::init(app)) {
+        app->log("Failed to initialize PowerManager or LEDManager");
+        return false;
+    }
+    app->setLEDState(false);
+
+    if (!FileSystem::init(app) || !TimeManager::init(app) || !UploadQueue::init(app) || !Metrics::init(app)) {
+        app->log("Failed to initialize storage");
+        return false;
+    }
+    if (!LogManager::startLogTask() || !PowerManager::startBatteryMonitorTask()) {
+        app->log("Failed to start the log or battery task");
+        return false;
+    }
+    if (!FileSystem::ensureDirectory(BENCH_DIR)) {
+        return false;
+    }
+
+    uint8_t cardType;
+    uint64_t cardSize;
+    if (FileSystem::isSDMMC()) {
+        cardType = SD_MMC.cardType();
+        cardSize = SD_MMC.cardSize();
+        bus = "SDMMC";
+    } else {
+        cardType = SD.cardType();
+        cardSize = SD.cardSize();
+        bus = "SPI";
+    }
+    card = cardType == CARD_MMC ? "MMC" : (cardType == CARD_SD ? "SDSC" : (cardType == CARD_SDHC ? "SDHC" : "UNKNOWN"));
+    card += " " + String((unsigned long)(cardSize / (1024 * 1024))) + "MB";
+
+    if (BENCH_CURRENT_PIN >= 0) {
+        pinMode(BENCH_CURRENT_PIN, INPUT);
+        if (xTaskCreatePinnedToCore(currentTask, "BenchCurrent", 2048, NULL, 3, NULL, 0) != pdPASS) {
+            app->log("Failed to start current sampling task");
+            return false;
+        }
+    }
+    return true;
+}
+
+void HardwareBenchmark::run() {
+    benchmarkIdle();
+    benchmarkSD();
+    benchmarkCapture();
+    benchmarkUpload();
+    app->log("Benchmark run " + String(runNumber) + " complete, results in " + String(BENCH_RESULTS_FILE));
+    LogManager::flush();
+}
+
+//-------------------------------------------------------------------------
+// Phases
+//-------------------------------------------------------------------------
+void HardwareBenchmark::benchmarkSD() {
+    const uint32_t spiSpeeds[] = BENCH_SD_SPI_SPEEDS_KHZ;
+    const uint32_t mmcSpeeds[] = BENCH_SD_MMC_SPEEDS_KHZ;
+    const size_t blockSizes[] = BENCH_SD_BLOCK_SIZES;
+    const uint32_t* speeds = FileSystem::isSDMMC() ? mmcSpeeds : spiSpeeds;
+    size_t speedCount = FileSystem::isSDMMC() ? sizeof(mmcSpeeds) / sizeof(mmcSpeeds[0])
+                                              : sizeof(spiSpeeds) / sizeof(spiSpeeds[0]);
+
+    beginPhase("sd");
+    for (size_t s = 0; s < speedCount; s++) {
+        if (!FileSystem::remount(speeds[s])) {
+            record("mount", "clock=" + String(speeds[s]) + "kHz", 0, "ok");
+            continue;
+        }
+        for (size_t b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++) {
+            String parameter = "clock=" + String(speeds[s]) + "kHz block=" + String(blockSizes[b]);
+            float writeMBps = 0;
+            float readMBps = 0;
+            if (!measureSD(blockSizes[b], writeMBps, readMBps)) {
+                app->log("SD benchmark failed at " + parameter);
+            }
+            record("write", parameter, writeMBps, "MB/s");
+            record("read", parameter, readMBps, "MB/s");
+        }
+    }
+
+    // Back to the clock the firmware runs at
+    FileSystem::remount(FileSystem::isSDMMC() ? SD_MMC_FREQ_KHZ : SD_SPEED / 1000);
+    endPhase();
+}
+
+bool HardwareBenchmark::measureSD(size_t blockSize, float& writeMBps, float& readMBps) {
+    uint8_t* block = (uint8_t*)malloc(blockSize);
+    if (!block) {
+        return false;
+    }
+    for (size_t i = 0; i < blockSize; i++) {
+        block[i] = (uint8_t)i;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        free(block);
+        return false;
+    }
+
+    // Including the close, which writes back the FAT and the directory entry
+    size_t written = 0;
+    int64_t start = esp_timer_get_time();
+    File file = FileSystem::card().open(BENCH_SD_FILE, FILE_WRITE);
+    if (file) {
+        while (written < BENCH_SD_FILE_BYTES && file.write(block, blockSize) == blockSize) {
+            written += blockSize;
+        }
+        file.close();
+    }
+    int64_t writeUs = esp_timer_get_time() - start;
+
+    size_t read = 0;
+    start = esp_timer_get_time();
+    file = FileSystem::card().open(BENCH_SD_FILE, FILE_READ);
+    if (file) {
+        size_t count;
+        while ((count = file.read(block, blockSize)) > 0) {
+            read += count;
+        }
+        file.close();
+    }
+    int64_t readUs = esp_timer_get_time() - start;
+
+    FileSystem::card().remove(BENCH_SD_FILE);
+    free(block);
+
+    // Bytes per microsecond equal MB/s
+    writeMBps = writeUs > 0 ? (float)written / writeUs : 0;
+    readMBps = readUs > 0 ? (float)read / readUs : 0;
+    return written >= BENCH_SD_FILE_BYTES && read == written;
+}
+
+void HardwareBenchmark::benchmarkCapture() {
+    beginPhase("capture");
+    if (!AudioManager::init(app) || !AudioManager::startRecordingTask() || !AudioManager::startAudioFileTask()) {
+        app->log("Failed to start audio capture");
+        record("capture", "started", 0, "ok");
+        endPhase();
+        return;
+    }
+
+    uint32_t segmentsBefore = AudioManager::getVadKeptSegmentCount() + AudioManager::getVadDroppedSegmentCount();
+    app->setRecordingRequested(true);
+    vTaskDelay(pdMS_TO_TICKS(BENCH_CAPTURE_SECONDS * 1000UL));
+    app->setRecordingRequested(false);
+
+    // The last segment is still being written
+    for (int i = 0; i < 100 && (AudioManager::isRecordingActive() ||
+                                uxQueueMessagesWaiting(AudioManager::getAudioQueue()) > 0); i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    uint32_t overrun = AudioManager::getOverrunSampleCount();
+    uint32_t dropped = AudioManager::getDroppedSampleCount();
+    uint32_t recorded = AudioManager::getVadKeptSampleCount() + AudioManager::getVadDroppedSampleCount();
+    String parameter = "seconds=" + String(BENCH_CAPTURE_SECONDS);
+    record("recorded", parameter, (float)recorded / SAMPLING_RATE, "s");
+    record("overrun", parameter, overrun, "samples");
+    record("dropped", parameter, dropped, "samples");
+    record("read_errors", parameter, AudioManager::getReadErrorCount(), "count");
+    record("pool_exhausted", parameter, AudioBufferPool::getExhaustionCount(), "count");
+    record("pool_high_water", parameter, AudioBufferPool::getHighWaterMark(), "buffers");
+    record("segments", parameter,
+           AudioManager::getVadKeptSegmentCount() + AudioManager::getVadDroppedSegmentCount() - segmentsBefore, "count");
+    record("zero_drops", parameter, overrun == 0 && dropped == 0 ? 1 : 0, "ok");
+    endPhase();
+}
+
+void HardwareBenchmark::benchmarkUpload() {
+    beginPhase("upload");
+
+    // The sink of the backend, next to the upload endpoint unless configured
+#ifdef BENCH_UPLOAD_ENDPOINT
+    String url = BENCH_UPLOAD_ENDPOINT;
+#else
+    String url = String(API_ENDPOINT).substring(0, String(API_ENDPOINT).lastIndexOf('/')) + "/benchmarkUpload";
+#endif
+
+    // A file of the size of a few recordings, written before the radio is on
+    bool created = false;
+    {
+        uint8_t block[SD_WRITE_BLOCK_SIZE];
+        for (size_t i = 0; i < sizeof(block); i++) {
+            block[i] = (uint8_t)i;
+        }
+        SDLockGuard lock;
+        File file = lock.isLocked() ? FileSystem::card().open(BENCH_UPLOAD_FILE, FILE_WRITE) : File();
+        if (file) {
+            size_t written = 0;
+            while (written < BENCH_UPLOAD_BYTES && file.write(block, sizeof(block)) == sizeof(block)) {
+                written += sizeof(block);
+            }
+            file.close();
+            created = written >= BENCH_UPLOAD_BYTES;
+        }
+    }
+    if (!created || !WifiManager::init(app) || !BackendClient::init(app)) {
+        app->log("Upload benchmark could not be prepared");
+        record("upload", "prepared", 0, "ok");
+        endPhase();
+        return;
+    }
+
+    uint32_t start = millis();
+    WifiManager::enable();
+    while (!app->isWifiConnected() && millis() - start < BENCH_WIFI_TIMEOUT) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+    if (!app->isWifiConnected()) {
+        app->log("No WiFi connection, upload benchmark skipped");
+        record("wifi_connect", "ssid=" + String(SS_ID), 0, "ok");
+    } else {
+        record("wifi_time_to_ip", "rssi=" + String(WifiManager::getRSSI()), millis() - start, "ms");
+        measureUpload(url, BENCH_UPLOAD_FILE, BENCH_UPLOAD_BYTES, true);
+        measureUpload(url, BENCH_UPLOAD_FILE, BENCH_UPLOAD_BYTES, false);
+    }
+
+    BackendClient::closeConnection();
+    WifiManager::disable();
+    app->deleteFile(BENCH_UPLOAD_FILE);
+    endPhase();
+}
+
+void HardwareBenchmark::measureUpload(const String& url, const String& path, size_t size, bool keepAlive) {
+    BackendClient::ConnectionStats before = BackendClient::getConnectionStats();
+    String parameter = String(keepAlive ? "keepalive" : "close") + " bytes=" + String(size);
+
+    uint32_t succeeded = 0;
+    uint32_t elapsedMs = 0;
+    for (int i = 0; i < BENCH_UPLOAD_REQUESTS; i++) {
+        uint32_t start = millis();
+        int code = BackendClient::postFile(url.c_str(), path, size, keepAlive);
+        uint32_t elapsed = millis() - start;
+        if (code == HTTP_CODE_OK) {
+            succeeded++;
+            elapsedMs += elapsed;
+        } else {
+            app->log("Benchmark upload to " + url + " failed: " + String(code));
+        }
+    }
+
+    BackendClient::ConnectionStats after = BackendClient::getConnectionStats();
+    uint32_t handshakes = after.handshakes - before.handshakes;
+    record("requests_ok", parameter, succeeded, "count");
+    record("throughput", parameter, elapsedMs > 0 ? (float)size * succeeded / elapsedMs : 0, "KB/s");
+    record("request_time", parameter, succeeded > 0 ? (float)elapsedMs / succeeded : 0, "ms");
+    record("handshakes", parameter, handshakes, "count");
+    record("handshake_time", parameter,
+           handshakes > 0 ? (float)(after.totalHandshakeMs - before.totalHandshakeMs) / handshakes : 0, "ms");
+}
+
+void HardwareBenchmark::benchmarkIdle() {
+    beginPhase("idle");
+    vTaskDelay(pdMS_TO_TICKS(BENCH_IDLE_SECONDS * 1000UL));
+    endPhase();
+}
+
+//-------------------------------------------------------------------------
+// Phases and results
+//-------------------------------------------------------------------------
+void HardwareBenchmark::beginPhase(const char* name) {
+    phaseName = name;
+    phaseStartMs = millis();
+    phaseStartVoltage = PowerManager::getBatteryVoltage();
+    portENTER_CRITICAL(&currentLock);
+    currentSum = 0;
+    currentSamples = 0;
+    currentMax = 0;
+    portEXIT_CRITICAL(&currentLock);
+
+    // Marks the phase in the trace of an external meter
+    Serial.printf("PHASE,%s,begin,%lu\n", name, (unsigned long)phaseStartMs);
+    app->log("Benchmark phase " + String(name) + " started");
+}
+
+void HardwareBenchmark::endPhase() {
+    uint32_t endMs = millis();
+    Serial.printf("PHASE,%s,end,%lu\n", phaseName, (unsigned long)endMs);
+
+    portENTER_CRITICAL(&currentLock);
+    uint64_t sum = currentSum;
+    uint32_t samples = currentSamples;
+    uint32_t peak = currentMax;
+    portEXIT_CRITICAL(&currentLock);
+
+    record("duration", "", endMs - phaseStartMs, "ms");
+    record("battery_start", "", phaseStartVoltage * 1000.0f, "mV");
+    record("battery_end", "", PowerManager::getBatteryVoltage() * 1000.0f, "mV");
+    if (samples > 0) {
+        record("current_avg", "", (float)sum / samples / BENCH_CURRENT_MV_PER_MA, "mA");
+        record("current_max", "", peak / BENCH_CURRENT_MV_PER_MA, "mA");
+    }
+    storeResults();
+}
+
+void HardwareBenchmark::record(const char* test, const String& parameter, float value, const char* unit) {
+    String row = String(runNumber) + "," + BENCH_REVISION + "," + card + "," + bus + "," + phaseName + "," + test +
+                 "," + parameter + "," + String(value, 3) + "," + unit + "\n";
+    Serial.print("BENCH," + row);
+    pendingRows += row;
+}
+
+void HardwareBenchmark::storeResults() {
+    // First run on this card, start the file with the column names
+    size_t size = 0;
+    if (app->getFileSize(BENCH_RESULTS_FILE, size) && size == 0) {
+        pendingRows = BENCH_RESULTS_HEADER + pendingRows;
+    }
+    if (!FileSystem::addToFile(BENCH_RESULTS_FILE, pendingRows)) {
+        app->log("ERROR: Failed to store benchmark results");
+    }
+    pendingRows = "";
+}
+
+void HardwareBenchmark::currentTask(void* parameter) {
+    while (true) {
+        uint32_t millivolts = analogReadMilliVolts(BENCH_CURRENT_PIN);
+        portENTER_CRITICAL(&currentLock);
+        currentSum += millivolts;
+        currentSamples++;
+        currentMax = std::max(currentMax, millivolts);
+        portEXIT_CRITICAL(&currentLock);
+        vTaskDelay(pdMS_TO_TICKS(BENCH_CURRENT_SAMPLE_INTERVAL));
+    }
+}
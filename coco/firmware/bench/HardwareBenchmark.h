@@ -0,0 +1,139 @@
+/**
+ * @file HardwareBenchmark.h
+ * @brief On-device benchmark of the SD card, the microphone path and the radio
+ *
+ * Replaces main.cpp in the bench environment (pio run -e bench -t upload).
+ * The firmware modules are started one by one instead of through
+ * Application::init(), so each phase measures one subsystem:
+ *
+ * - idle: nothing running, the baseline of the current draw
+ * - sd: sequential write and read throughput at BENCH_SD_BLOCK_SIZES, at
+ *   every bus clock of the mounted bus
+ * - capture: BENCH_CAPTURE_SECONDS of real recording through AudioManager,
+ *   passed only if no sample was lost
+ * - upload: BackendClient posting a file to the upload sink of the backend
+ *   (/benchmarkUpload), with and without keep-alive
+ *
+ * Every phase also reports its duration and the battery voltage at its
+ * start and end. With a current sense amplifier on BENCH_CURRENT_PIN the
+ * average and peak current per phase are measured as well; without one,
+ * the phase markers on the serial port align the run with an external
+ * meter. Results are printed as "BENCH,<csv row>" lines and appended to
+ * BENCH_RESULTS_FILE, so runs from different cards and firmware revisions
+ * can be compared.
+ */
+
+#ifndef HARDWARE_BENCHMARK_H
+#define HARDWARE_BENCHMARK_H
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "Application.h"
+
+class HardwareBenchmark {
+public:
+    /**
+     * @brief Start the modules the phases share: logging, power, storage and time
+     * @param app Pointer to the Application instance (optional)
+     * @return true if all modules started, false otherwise
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Run all phases and store the results
+     */
+    static void run();
+
+private:
+    // Private constructor for static-only class
+    HardwareBenchmark() = default;
+
+    /**
+     * @brief Measure the SD card at every block size and bus clock
+     */
+    static void benchmarkSD();
+
+    /**
+     * @brief Write and read back BENCH_SD_FILE_BYTES in single operations of one size
+     * @param blockSize Bytes per write and read call
+     * @param writeMBps Receives the write throughput, including the final close
+     * @param readMBps Receives the read throughput
+     * @return true if the file was written and read completely
+     */
+    static bool measureSD(size_t blockSize, float& writeMBps, float& readMBps);
+
+    /**
+     * @brief Record through AudioManager and count every lost sample
+     */
+    static void benchmarkCapture();
+
+    /**
+     * @brief Post a file to the upload sink with and without keep-alive
+     */
+    static void benchmarkUpload();
+
+    /**
+     * @brief Post the upload file BENCH_UPLOAD_REQUESTS times in one connection mode
+     * @param url Upload sink
+     * @param path Upload file
+     * @param size Upload file size in bytes
+     * @param keepAlive Keep the connection open between the requests
+     */
+    static void measureUpload(const String& url, const String& path, size_t size, bool keepAlive);
+
+    /**
+     * @brief Let the device idle, the baseline of the current draw
+     */
+    static void benchmarkIdle();
+
+    /**
+     * @brief Start a phase: print its marker and reset the current statistics
+     * @param name Phase name, used in every result of the phase
+     */
+    static void beginPhase(const char* name);
+
+    /**
+     * @brief End the running phase, report its duration, battery and current, and store the results
+     */
+    static void endPhase();
+
+    /**
+     * @brief Report one result of the running phase
+     * @param test Measurement, e.g. "write"
+     * @param parameter Configuration it was measured with, e.g. "block=4096"
+     * @param value Result
+     * @param unit Unit of the result
+     */
+    static void record(const char* test, const String& parameter, float value, const char* unit);
+
+    /**
+     * @brief Append the results of the phase to BENCH_RESULTS_FILE
+     */
+    static void storeResults();
+
+    /**
+     * @brief Sample the current sense amplifier in a dedicated task
+     * @param parameter Task parameters (unused)
+     */
+    static void currentTask(void* parameter);
+
+    static Application* app;
+    static uint32_t runNumber;   // Counted across runs, tells the runs apart in the results
+    static String card;          // Card type and size
+    static String bus;           // Bus in use, SDMMC or SPI
+
+    // Running phase
+    static const char* phaseName;
+    static uint32_t phaseStartMs;
+    static float phaseStartVoltage;
+    static String pendingRows;   // CSV rows not yet stored
+
+    // Current sense statistics of the running phase
+    static portMUX_TYPE currentLock;
+    static uint64_t currentSum;
+    static uint32_t currentSamples;
+    static uint32_t currentMax;
+};
+
+#endif // HARDWARE_BENCHMARK_H
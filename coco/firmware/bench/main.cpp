@@ -0,0 +1,32 @@
+/**
+ * @file main.cpp
+ * @brief Entry point of the benchmark firmware (env:bench)
+ *
+ * Runs HardwareBenchmark once after every reset and then idles. Messages
+ * starting with "BENCH," carry the results, "PHASE," the phase markers.
+ */
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "Application.h"
+#include "HardwareBenchmark.h"
+
+void setup() {
+  Serial.begin(115200);
+  setCpuFrequencyMhz(CPU_FREQ_MHZ);
+
+  // Time to attach a serial monitor and an external meter
+  delay(BENCH_START_DELAY);
+
+  if (!HardwareBenchmark::init(Application::getInstance())) {
+    Serial.println("Benchmark initialization failed");
+    return;
+  }
+  HardwareBenchmark::run();
+  Serial.println("BENCH,done");
+}
+
+void loop() {
+  delay(1000);
+}
@@ -10,6 +10,12 @@
 
 #define CPU_FREQ_MHZ 80        // CPU frequency in MHz, // 80 is lowest stable frequency for this routine.
 
+// Power management (esp_pm), CPU_FREQ_MHZ only applies until it is configured
+#define PM_ENABLED true            // Scale the CPU frequency with the load and sleep when idle
+#define PM_MAX_CPU_FREQ_MHZ 160    // CPU frequency while the DSP or encoder holds the CPU lock (MHz)
+#define PM_MIN_CPU_FREQ_MHZ 40     // CPU frequency without any lock (MHz), SD, WiFi and I2S keep it at 80
+#define PM_LIGHT_SLEEP true        // Automatic light sleep when idle, needs CONFIG_FREERTOS_USE_TICKLESS_IDLE
+
 /**********************************
  *       PIN DEFINITIONS          *
  **********************************/
@@ -20,24 +26,89 @@
 /**********************************
  *    AUDIO RECORDING SETTINGS    *
  **********************************/
-#define RECORD_TIME 10          // Recording duration in seconds
-#define AUDIO_QUEUE_SIZE 10     // Size of the audio buffer queue
+#define RECORD_TIME 10          // Segment length without VAD, with VAD segments end at pauses in speech (s)
+#define SEGMENT_MIN_TIME 5      // Speech a segment holds before it may end at the next pause (s)
+#define SEGMENT_MAX_TIME 60     // Segments are cut here even without a pause in speech (s)
+#define AUDIO_QUEUE_SIZE 10     // Size of the audio block queue between recording and SD writer
 #define SAMPLING_RATE 16000     // 16kHz sampling rate (optimizing battery and quality)
+#define AUDIO_SAMPLE_BYTES 2    // 16-bit mono PCM
+#define AUDIO_DMA_BLOCK_SIZE 1024  // Bytes drained from I2S per read (512 samples, 32ms)
+#define AUDIO_RING_BUFFER_SIZE (SAMPLING_RATE * AUDIO_SAMPLE_BYTES * 4)  // PSRAM capture ring (4s of audio)
+#define AUDIO_GAP_QUEUE_SIZE 8  // Capture overruns the recording task can lag behind, keeps the block start times exact
+#define AUDIO_WRITE_BLOCK_SIZE (16 * 1024)  // PCM bytes per block handed to the SD writer (~0.5s)
+#define AUDIO_WAV_FLUSH_BYTES (64 * 1024)   // Flush open WAV files after this many appended bytes (~2s)
+#define AUDIO_WAV_PREALLOCATE true          // Reserve the clusters of a whole segment when its WAV file is created
+
+// Audio codecs for recorded files
+#define AUDIO_CODEC_PCM 0        // Uncompressed 16-bit PCM WAV
+#define AUDIO_CODEC_IMA_ADPCM 1  // 4-bit IMA-ADPCM WAV (format 0x11), ~4:1
+#define AUDIO_CODEC AUDIO_CODEC_IMA_ADPCM  // Codec used for new recordings
+
+// Audio conditioning
+#define DSP_ENABLED true            // Filter and amplify the captured audio before it is analyzed and stored
+#define DSP_DC_BLOCK_POLE 0.995f    // DC blocker pole, closer to 1 is a lower cutoff (~13Hz at 16kHz)
+#define DSP_HIGHPASS_HZ 80          // Cutoff of the high-pass that removes rumble and handling noise
+#define DSP_GAIN 4.0f               // Gain after filtering, saturated to 16 bit
+#define DSP_BENCHMARK_ON_BOOT false // Log the cycles per sample of every DSP implementation at boot
+
+// Voice activity detection
+#define VAD_ENABLED true            // Drop silent segments before they are written to SD
+#define VAD_FRAME_SAMPLES 320       // Analysis frame length in samples (20ms)
+#define VAD_ENERGY_THRESHOLD 200    // Minimum RMS amplitude of speech (16-bit full scale is 32767)
+#define VAD_SNR_FACTOR 3            // Speech must be this many times louder than the noise floor
+#define VAD_MAX_ZCR_PERCENT 35      // Frames with more zero crossings (% of samples) are treated as hiss
+#define VAD_HANGOVER_MS 800         // Speech state is held this long after the last voiced frame
+#define VAD_PREROLL_BLOCKS 1        // Silent blocks kept in front of detected speech
 
 /**********************************
  *    FILE & STORAGE SETTINGS     *
  **********************************/
 #define RECORDINGS_DIR "/recordings"     // Directory for audio recordings
-#define UPLOAD_QUEUE_FILE "/upload_queue.txt"  // File that stores the upload queue
+#define REJECTED_DIR "/rejected"         // Recordings the backend refused for good, kept off the upload queue
+#define UPLOAD_QUEUE_FILE "/upload_queue.bin"  // Record log that stores the upload queue
+#define UPLOAD_QUEUE_HEAD_FILE "/upload_queue.head"  // Persisted index of the first pending upload
+#define UPLOAD_QUEUE_LEGACY_FILE "/upload_queue.txt"  // Text queue of older firmware, migrated at boot
+#define UPLOAD_QUEUE_COMPACT_RECORDS 256  // Consumed records after which the queue log is rewritten, once they also outnumber the pending ones
+#define RECONCILE_ENABLED true           // Compare RECORDINGS_DIR with the upload queue after power-on
+#define RECONCILE_START_DELAY 2000       // Wait after boot before the reconciliation starts (ms)
+#define RECONCILE_BATCH_SIZE 16          // Directory or queue entries handled per SD access
 #define SD_SPEED 16000000       // SD card SPI frequency (16 MHz) default is 4MHz
+#define SD_BUS_SPI 0            // Mount the card over SPI
+#define SD_BUS_SDMMC 1          // Mount the card through the SDMMC host, SPI remains the fallback
+#define SD_BUS SD_BUS_SDMMC     // Bus used for the SD card, one of the above
+#define SD_MMC_4BIT false       // 4-bit SDMMC bus, the Sense board only routes CLK, CMD and D0
+#define SD_MMC_CLK_PIN 7        // SDMMC CLK (SPI SCK on the Sense board)
+#define SD_MMC_CMD_PIN 9        // SDMMC CMD (SPI MOSI on the Sense board)
+#define SD_MMC_D0_PIN 8         // SDMMC D0 (SPI MISO on the Sense board)
+#define SD_MMC_D1_PIN -1        // SDMMC D1, only used in 4-bit mode
+#define SD_MMC_D2_PIN -1        // SDMMC D2, only used in 4-bit mode
+#define SD_MMC_D3_PIN -1        // SDMMC D3, only used in 4-bit mode (CS 21 stays pulled up in 1-bit mode)
+#define SD_MMC_FREQ_KHZ 40000   // SDMMC bus frequency (kHz), retried at 20MHz
+#define SD_MAX_OPEN_FILES 8     // Files the FAT driver keeps open at the same time, incl. the kept open appenders
+#define SD_DIRECTORY_CACHE_SIZE 8  // Directories remembered as existing, so writes skip the check
+#define SD_BENCHMARK_BYTES (256 * 1024)  // Bytes written and read back to measure throughput after power-on, 0 disables
+#define SD_BENCHMARK_FILE "/sd_benchmark.bin"  // Scratch file of the throughput measurement
+#define SD_LOCK_TIMEOUT 2000    // Longest wait for the SD card before an operation fails (ms)
+#define SD_SCHEDULER_MAX_WAITERS 8  // Tasks of one priority that can wait for the SD card at the same time
+#define SD_WRITE_BLOCK_SIZE 4096  // Binary writes are issued in blocks aligned to this file offset (multiple of 512)
 #define LOG_FILE "/device.log"  // System log file path
+#define LOG_ROTATED_FILE "/device.log.1"  // Previous log, replaced at every rotation
+#define LOG_MAX_FILE_SIZE (256 * 1024)  // Log file size (bytes) at which it is rotated
 #define TIME_FILE "/time.txt"   // Stored time file path
+#define OPEN_RECORDING_FILE "/open_recording.txt"  // Path of the WAV file currently being written
 
 /**********************************
  *      TASK & QUEUE SETTINGS     *
  **********************************/
-#define LOG_QUEUE_SIZE 20       // Size of the log message queue
+#define LOG_RING_SIZE (32 * 1024)  // Log ring buffer size (bytes, PSRAM), messages are dropped while it is full
+#define LOG_MESSAGE_MAX 256     // Longest formatted log line (bytes), longer messages are truncated
+#define LOG_FLUSH_BYTES 4096    // Pending log bytes that trigger a write to the card
+#define LOG_FLUSH_INTERVAL 5000 // Longest time a log line waits for the card (ms)
 #define ENABLE_STACK_MONITORING false  // Enable/disable stack usage monitoring
+#define METRICS_ENABLED true    // Sample runtime metrics and send a snapshot with every upload
+#define METRICS_SAMPLE_INTERVAL 10000  // Interval of the heap, battery and CPU sampling (ms)
+#define METRICS_SNAPSHOT_SIZE 2048  // Buffer of the snapshot header (bytes), fits all metrics and METRICS_MAX_TASKS tasks
+#define METRICS_MAX_TASKS 24    // Tasks whose CPU share is reported, all are skipped when more exist
 #define WATCHDOG_TIMEOUT 10    // Watchdog timeout in seconds
 
 /**********************************
@@ -45,7 +116,8 @@
  **********************************/
 #define BUTTON_PRESS_TIME 1000   // Button press detection time (ms)
 #define SLEEP_TIMEOUT_SEC 6000   // Deep sleep period in seconds
-#define BATTERY_MONITOR_INTERVAL 60000  // Battery check interval (ms)
+#define BATTERY_MONITOR_INTERVAL 60000  // Battery report interval (ms)
+#define BATTERY_SAMPLE_INTERVAL 2000    // Battery sampling interval of the background filter (ms)
 #define TIME_PERSIST_INTERVAL 600000     // Time persistence interval (ms)
 #define DEEP_SLEEP_CHECK_INTERVAL 5000  // Deep sleep readiness check interval (ms)
 #define DEEP_SLEEP_DELAY 3000    // Short delay before deep sleep task starts (for button/other wakes) (ms)
@@ -56,20 +128,48 @@
  **********************************/
 #define DEFAULT_TIME 1740049200  // Default time: 2025-02-20 12:00:00 GMT+01:00
 #define TIMEZONE "GMT"           // Timezone setting
+#define TIMESTAMP_SIZE 32        // Buffer size of a formatted timestamp, including the terminator
+#define TIME_VALID_AFTER 1451606400  // Earlier system times were never set, timestamps read "unknown" (2016-01-01)
 
 /**********************************
  *    NETWORK & WIFI SETTINGS     *
  **********************************/
 #define MIN_SCAN_INTERVAL 5000   // Minimum interval between WiFi & Backend scans (ms)
 #define MAX_SCAN_INTERVAL 600000 // Maximum interval between WiFi & Backend scans (ms)
+#define WIFI_FAST_RECONNECT true  // Rejoin the last access point from the RTC cache without scanning
+#define WIFI_FAST_RECONNECT_STATIC_IP false  // Also reuse the last DHCP lease (skips DHCP, needs a stable lease)
+#define WIFI_FAST_CONNECT_TIMEOUT 4000  // Time a fast reconnect may take before falling back to a scan (ms)
+#define WIFI_ACTIVE_CURRENT_MA 120  // Assumed current draw with the radio on, for upload energy estimates (mA)
 #define HTTP_TIMEOUT 4000       // HTTP request timeout (ms)
 #define UPLOAD_CHECK_INTERVAL 2000 // Upload queue check interval (ms)
+#define UPLOAD_BATCH_ENABLED true  // Pack several queued files into one upload request
+#define UPLOAD_BATCH_MAX_FILES 8   // Maximum number of files per batch request
+#define UPLOAD_BATCH_MAX_BYTES (2 * 1024 * 1024)  // Batches stop growing at this body size (a single file may exceed it)
+#define UPLOAD_STREAM_BLOCK_SIZE 4096  // Bytes read from SD per block while streaming an upload
+#define UPLOAD_STREAM_BLOCKS 2     // Blocks read ahead of the network while streaming an upload
+
+/**********************************
+ *     UPLOAD SCHEDULING          *
+ **********************************/
+#define UPLOAD_POLICY_IMMEDIATE 0  // Switch the radio on as soon as a file is queued
+#define UPLOAD_POLICY_BACKLOG 1    // Wait for UPLOAD_BACKLOG_MIN_FILES files or UPLOAD_BACKLOG_MAX_AGE
+#define UPLOAD_POLICY_CHARGING 2   // Only upload while the battery is charging
+#define UPLOAD_POLICY UPLOAD_POLICY_BACKLOG  // Active upload policy, one of the above
+#define UPLOAD_BACKLOG_MIN_FILES 10  // Queued files that open an upload window (backlog policy)
+#define UPLOAD_BACKLOG_MAX_AGE 30    // Age (minutes) of the oldest queued file that opens a window (backlog policy)
+#define UPLOAD_WINDOW_MAX_DURATION 300000  // Longest upload window before the radio is switched off (ms)
+#define UPLOAD_WINDOW_RETRY_INTERVAL 900000  // Pause after a window that did not drain the queue (ms)
+#define UPLOAD_SCHEDULER_INTERVAL 60000  // Policy re-evaluation interval while files wait (ms)
 
 /**********************************
  *      LED SETTINGS              *
  **********************************/
 #define LED_FREQUENCY 2000       // LED PWM frequency
 #define LED_RESOLUTION 8         // LED PWM resolution
+#define LED_QUEUE_SIZE 8         // LED requests waiting for the LED task, requests return immediately
+#define LED_FADE_TIME 150        // Hardware fade between steady states, e.g. on a brightness change (ms)
+#define LED_BLINK_FADE_TIME 30   // Hardware fade of the edges of a blink (ms)
+#define LED_ERROR_LOW_DUTY 20    // Duty of the dark phase of the error pattern
 
 /**********************************
  *     BATTERY SETTINGS           *
@@ -79,5 +179,28 @@
 #define BATTERY_MIN_VOLTAGE 3.5f   // Minimum battery voltage (empty)
 #define BATTERY_MAX_VOLTAGE 4.0f   // Maximum battery voltage (full)
 #define VOLTAGE_DIVIDER_RATIO 2.0f // Based on the voltage divider used in the hardware
+#define BATTERY_EMA_ALPHA 0.1f     // Weight of a new sample in the battery voltage filter
+#define BATTERY_HYSTERESIS 0.1f    // Voltage (V) above a threshold needed to allow recording/upload again
+#define BATTERY_CHARGING_VOLTAGE 4.15f  // Battery voltage (V) only reached while on the charger
+#define BATTERY_SEED_SAMPLES 8     // Readings averaged at boot to seed the battery filter
+
+/**********************************
+ *  BENCHMARK FIRMWARE (env:bench) *
+ **********************************/
+#define BENCH_START_DELAY 5000   // Wait for a serial monitor before the first phase (ms)
+#define BENCH_DIR "/bench"       // Directory of the scratch files and the results
+#define BENCH_RESULTS_FILE "/bench/results.csv"  // One row per result, every run appends to it
+#define BENCH_SD_FILE_BYTES (1024 * 1024)  // Bytes written and read back per block size and bus clock
+#define BENCH_SD_BLOCK_SIZES { 512, 4096, 16384, 32768 }  // Sizes of the single writes and reads (bytes)
+#define BENCH_SD_SPI_SPEEDS_KHZ { 4000, 8000, 16000, 20000 }  // SD_SPEED values compared over SPI (kHz)
+#define BENCH_SD_MMC_SPEEDS_KHZ { 20000, 40000 }  // Bus clocks compared over SDMMC (kHz)
+#define BENCH_CAPTURE_SECONDS 120  // Length of the sustained capture, several segments (s)
+#define BENCH_UPLOAD_BYTES (512 * 1024)  // Size of the file posted to the upload sink (bytes)
+#define BENCH_UPLOAD_REQUESTS 5  // Requests per connection mode, with and without keep-alive
+#define BENCH_WIFI_TIMEOUT 30000  // Longest wait for an IP address before the upload phase is skipped (ms)
+#define BENCH_IDLE_SECONDS 10    // Length of the idle phase, the baseline of the current draw (s)
+#define BENCH_CURRENT_PIN -1     // ADC pin of an external current sense amplifier, -1 without one
+#define BENCH_CURRENT_MV_PER_MA 1.0f  // Output of the current sense amplifier (mV per mA)
+#define BENCH_CURRENT_SAMPLE_INTERVAL 10  // Current sampling interval (ms)
 
 #endif // CONFIG_H
@@ -10,6 +10,7 @@
 #include <Preferences.h>
 
 // ESP libraries
+#include <esp_timer.h>
 
 // Project includes
 #include "Application.h"
@@ -17,8 +18,12 @@
 #include "BackendClient.h"
 #include "FileSystem.h"
 #include "LogManager.h"
+#include "Metrics.h"
 #include "PowerManager.h"
+#include "RecordingReconciler.h"
 #include "TimeManager.h"
+#include "UploadQueue.h"
+#include "UploadScheduler.h"
 #include "WifiManager.h"
 
 // Initialize static instance
@@ -47,7 +52,6 @@ Application::Application()
       audioFileTaskHandle(NULL),
       wifiConnectionTaskHandle(NULL),
       uploadTaskHandle(NULL),
-      backendReachabilityTaskHandle(NULL),
       batteryMonitorTaskHandle(NULL),
       deepSleepTaskHandle(NULL),
       stackMonitorTaskHandle(NULL) {
@@ -55,6 +59,7 @@ Application::Application()
     // Create mutex
     ledMutex = xSemaphoreCreateMutex();
     httpMutex = xSemaphoreCreateMutex();
+    eventGroup = xEventGroupCreate();
 }
 
 // Initialization
@@ -68,116 +73,177 @@ bool Application::init() {
         // Increment boot session
         incrementBootSession();
         
-        // Initialize modules in the correct order (dependency chain)
-        if (!FileSystem::init(this)) {
-            Serial.println("Failed to initialize FileSystem");
+        // Capture first, the ring and the audio queue hold the audio until storage is ready
+        if (!initCapture()) {
             return false;
         }
+        int64_t captureReadyUs = esp_timer_get_time();
         
-        if (!TimeManager::init(this)) {
-            Serial.println("Failed to initialize TimeManager");
+        if (!initServices()) {
             return false;
         }
-        
-        if (!LogManager::init(this)) {
-            Serial.println("Failed to initialize LogManager");
-            return false;
-        }
-        
-        // Set the boot session for log messages
-        LogManager::setBootSession(bootSession);
-        
-        // Set TimeManager as the timestamp provider for LogManager
-        LogManager::setTimestampProvider(TimeManager::getTimestamp);
-        
-        // Log startup information
-        log("\n\n\n======= Boot session: " + String(bootSession) + "=======");
-        
-        // Log initial free heap
-        log("Initial free heap: " + String(ESP.getFreeHeap()) + " bytes");
-
-        // Reset audio file index on boot
-        audioFileIndex = 0;
-        
-        if (!PowerManager::init()) {
-            Serial.println("Failed to initialize PowerManager");
-            return false;
-        }
-        
-        // Initialize LED Manager
-        if (!LEDManager::init(this)) {
-            log("Failed to initialize LED Manager!");
-            return false;
-        }
-        
-        // Initialize additional modules needed for recording
-        if (!WifiManager::init(this)) {
-            log("Failed to initialize WifiManager");
-            return false;
-        }
-        
-        if (!AudioManager::init(this)) {
-            log("Failed to initialize AudioManager");
-            return false;
-        }
-        
-        if (!BackendClient::init(this)) {
-            log("Failed to initialize BackendClient");
-            return false;
-        }
-        
-        // Start the necessary tasks
-        if (!LogManager::startLogTask()) {
-            log("Failed to start log task");
-            return false;
-        }
-        
-        if (!TimeManager::startPersistenceTask()) {
-            log("Failed to start time persistence task");
-            return false;
-        }
-        
-        if (!AudioManager::startRecordingTask()) {
-            log("Failed to start audio recording task");
-            return false;
-        }
-        setRecordAudioTaskHandle(AudioManager::getRecordAudioTaskHandle());
-        
-        if (!AudioManager::startAudioFileTask()) {
-            log("Failed to start audio file task");
-            return false;
-        }
-        setAudioFileTaskHandle(AudioManager::getAudioFileTaskHandle());
-        
-        if (!WifiManager::startConnectionTask()) {
-            log("Failed to start WiFi connection task");
-            return false;
-        }
-        
-        if (!PowerManager::startBatteryMonitorTask()) {
-            log("Failed to start battery monitor task");
-            return false;
-        }
-        setBatteryMonitorTaskHandle(PowerManager::getBatteryMonitorTaskHandle());
-
-        // After starting all other tasks, start the deep sleep task
-        if (!startDeepSleepTask()) {
-            log("Failed to start deep sleep task");
-            return false;
-        }
-        
-        // Start stack monitoring task if enabled
-        if (!startStackMonitorTask()) {
-            log("Failed to start stack monitor task");
-            return false;
-        }
-        
+        log("Staged boot: capture ready after " + String((uint32_t)(captureReadyUs / 1000)) +
+            "ms, storage and services after " + String((uint32_t)(esp_timer_get_time() / 1000)) + "ms");
         return true;
     } else {
         return false;
     }
 }
 
+bool Application::initCapture() {
+    // Messages wait in the RAM ring until the log task can write them
+    if (!LogManager::init(this)) {
+        Serial.println("Failed to initialize LogManager");
+        return false;
+    }
+    
+    // Set the boot session for log messages
+    LogManager::setBootSession(bootSession);
+    
+    // Set TimeManager as the timestamp provider for LogManager, the RTC keeps the time through deep sleep
+    TimeManager::applyTimezone();
+    LogManager::setTimestampProvider(TimeManager::formatTimestamp);
+    
+    // Log startup information
+    log("\n\n\n======= Boot session: " + String(bootSession) + "=======");
+    
+    // Log initial free heap
+    log("Initial free heap: " + String(ESP.getFreeHeap()) + " bytes");
+    
+    // Reset audio file index on boot
+    audioFileIndex = 0;
+    
+    // The battery gate decides whether capture may start
+    if (!PowerManager::init()) {
+        Serial.println("Failed to initialize PowerManager");
+        return false;
+    }
+    
+    // Initialize LED Manager
+    if (!LEDManager::init(this)) {
+        log("Failed to initialize LED Manager!");
+        return false;
+    }
+    
+    if (!AudioManager::init(this)) {
+        log("Failed to initialize AudioManager");
+        return false;
+    }
+    
+    if (!AudioManager::startRecordingTask()) {
+        log("Failed to start audio recording task");
+        return false;
+    }
+    setRecordAudioTaskHandle(AudioManager::getRecordAudioTaskHandle());
+    return true;
+}
+
+bool Application::initServices() {
+    // Initialize modules in the correct order (dependency chain)
+    if (!FileSystem::init(this)) {
+        log("Failed to initialize FileSystem");
+        return false;
+    }
+    
+    if (!TimeManager::init(this)) {
+        log("Failed to initialize TimeManager");
+        return false;
+    }
+    
+    // Open the upload queue, repairing it if the last session was cut off
+    if (!UploadQueue::init(this)) {
+        log("Failed to initialize UploadQueue");
+        return false;
+    }
+    
+    // Initialize additional modules needed for uploading
+    if (!WifiManager::init(this)) {
+        log("Failed to initialize WifiManager");
+        return false;
+    }
+    
+    if (!BackendClient::init(this)) {
+        log("Failed to initialize BackendClient");
+        return false;
+    }
+    
+    if (!UploadScheduler::init(this)) {
+        log("Failed to initialize UploadScheduler");
+        return false;
+    }
+    
+    if (!RecordingReconciler::init(this)) {
+        log("Failed to initialize RecordingReconciler");
+        return false;
+    }
+    
+    if (!Metrics::init(this)) {
+        log("Failed to initialize Metrics");
+        return false;
+    }
+    
+    // Start the necessary tasks
+    if (!LogManager::startLogTask()) {
+        log("Failed to start log task");
+        return false;
+    }
+    
+    if (!TimeManager::startPersistenceTask()) {
+        log("Failed to start time persistence task");
+        return false;
+    }
+    
+    // Writes out whatever was captured while storage came up
+    if (!AudioManager::startAudioFileTask()) {
+        log("Failed to start audio file task");
+        return false;
+    }
+    setAudioFileTaskHandle(AudioManager::getAudioFileTaskHandle());
+    
+    // Sleeps until WiFi is up and a file is queued, so it runs for the whole session
+    if (!startFileUploadTask()) {
+        log("Failed to start file upload task");
+        return false;
+    }
+    
+    // Runs once in the background after power-on, recording does not wait for it
+    if (!RecordingReconciler::startReconcileTask()) {
+        log("Failed to start reconciliation task");
+        return false;
+    }
+    
+    // The scheduler switches WiFi on for upload windows
+    if (!UploadScheduler::startSchedulerTask()) {
+        log("Failed to start upload scheduler task");
+        return false;
+    }
+    
+    if (!PowerManager::startBatteryMonitorTask()) {
+        log("Failed to start battery monitor task");
+        return false;
+    }
+    setBatteryMonitorTaskHandle(PowerManager::getBatteryMonitorTaskHandle());
+    
+    if (!Metrics::startSamplerTask()) {
+        log("Failed to start metrics sampler task");
+        return false;
+    }
+
+    // After starting all other tasks, start the deep sleep task
+    if (!startDeepSleepTask()) {
+        log("Failed to start deep sleep task");
+        return false;
+    }
+    
+    // Start stack monitoring task if enabled
+    if (!startStackMonitorTask()) {
+        log("Failed to start stack monitor task");
+        return false;
+    }
+    
+    return true;
+}
+
 //-------------------------------------------------------------------------
 // State Management
 //-------------------------------------------------------------------------
@@ -187,6 +253,7 @@ bool Application::isRecordingRequested() const {
 
 void Application::setRecordingRequested(bool val) {
     recordingRequested = val;
+    updateEvents(EVENT_RECORDING_REQUESTED, val);
 }
 
 int Application::getBootSession() const {
@@ -252,12 +319,13 @@ void Application::stackMonitorTask(void* parameter) {
     Application* app = Application::getInstance();
     
     while (true) {
+        app->monitorStackUsage(AudioManager::getCaptureTaskHandle());
         app->monitorStackUsage(app->getRecordAudioTaskHandle());
         app->monitorStackUsage(app->getAudioFileTaskHandle());
         app->monitorStackUsage(app->getWifiConnectionTaskHandle());
         app->monitorStackUsage(app->getBatteryMonitorTaskHandle());
+        app->monitorStackUsage(LEDManager::getLEDTaskHandle());
         app->monitorStackUsage(app->getUploadTaskHandle());
-        app->monitorStackUsage(app->getReachabilityTaskHandle());
         app->monitorStackUsage(app->getDeepSleepTaskHandle());
         
         vTaskDelay(pdMS_TO_TICKS(10000)); // Check every 10 seconds
@@ -293,7 +361,6 @@ void Application::deepSleepTask(void* parameter) {
     
     // Record the task start time
     TickType_t startTime = xTaskGetTickCount();
-    bool initialDelayPassed = false;
     
     // Get singleton instance
     Application* app = Application::getInstance();
@@ -312,29 +379,22 @@ void Application::deepSleepTask(void* parameter) {
         app->log("Deep sleep task starting with short delay of " + String(delayMs) + "ms");
     }
 
+    // Sleep through the initial delay in one go
+    TickType_t elapsed = xTaskGetTickCount() - startTime;
+    if (elapsed < pdMS_TO_TICKS(delayMs)) {
+        vTaskDelay(pdMS_TO_TICKS(delayMs) - elapsed);
+    }
+    app->log("Deep sleep task initialization delay complete, monitoring can begin");
+    
     while (true) {
-        // Check if initial delay has passed
-        if (!initialDelayPassed) {
-            TickType_t currentTime = xTaskGetTickCount();
-            if ((currentTime - startTime) >= pdMS_TO_TICKS(delayMs)) {
-                // Mark initial delay as passed
-                initialDelayPassed = true;
-                app->log("Deep sleep task initialization delay complete, monitoring can begin");
-            } else {
-                // Still in delay period, wait and continue
-                vTaskDelay(pdMS_TO_TICKS(100)); // Short sleep before checking again
-                continue;
-            }
-        }
-        
         // Check if system is idle and can enter deep sleep
-        if (app->isSystemIdle() && initialDelayPassed) {
+        if (app->isSystemIdle()) {
             app->log("System is idle, preparing for deep sleep. Free heap: " + String(ESP.getFreeHeap()) + " bytes");
             app->initDeepSleep();
         }
         
-        // Check periodically
-        vTaskDelay(pdMS_TO_TICKS(DEEP_SLEEP_CHECK_INTERVAL));
+        // Woken early whenever an event bit is cleared, the interval covers the battery thresholds
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DEEP_SLEEP_CHECK_INTERVAL));
     }
 }
 
@@ -354,6 +414,21 @@ bool Application::isSystemIdle() const {
         return false;
     }
     
+    // An upload window is still connecting or draining the queue
+    if (UploadScheduler::isWindowOpen()) {
+        return false;
+    }
+    
+    // Queue repairs must not be cut off by deep sleep
+    if (RecordingReconciler::isRunning()) {
+        return false;
+    }
+    
+    // Uploaded files whose queue entry is gone would be uploaded again as orphans
+    if (BackendClient::hasPendingDeletes()) {
+        return false;
+    }
+    
     // Even if we can't record or upload, check if recording is active
     if (AudioManager::isRecordingActive()) {
         return false;
@@ -405,14 +480,6 @@ void Application::setUploadTaskHandle(TaskHandle_t handle) {
     uploadTaskHandle = handle;
 }
 
-TaskHandle_t Application::getReachabilityTaskHandle() const {
-    return backendReachabilityTaskHandle;
-}
-
-void Application::setReachabilityTaskHandle(TaskHandle_t handle) {
-    backendReachabilityTaskHandle = handle;
-}
-
 TaskHandle_t Application::getBatteryMonitorTaskHandle() const {
     return batteryMonitorTaskHandle;
 }
@@ -432,6 +499,23 @@ SemaphoreHandle_t Application::getHttpMutex() const {
     return httpMutex;
 }
 
+EventGroupHandle_t Application::getEventGroup() const {
+    return eventGroup;
+}
+
+void Application::updateEvents(EventBits_t bits, bool set) {
+    if (set) {
+        xEventGroupSetBits(eventGroup, bits);
+        return;
+    }
+    
+    xEventGroupClearBits(eventGroup, bits);
+    // Losing a reason to stay awake is when the system may have become idle
+    if (deepSleepTaskHandle != NULL) {
+        xTaskNotifyGive(deepSleepTaskHandle);
+    }
+}
+
 //-------------------------------------------------------------------------
 // External Wake Management
 //-------------------------------------------------------------------------
@@ -468,6 +552,7 @@ bool Application::hasWavFilesAvailable() const {
 
 void Application::setWavFilesAvailable(bool val) {
     wavFilesAvailable = val;
+    updateEvents(EVENT_UPLOAD_PENDING, val);
 }
 
 //-------------------------------------------------------------------------
@@ -479,6 +564,7 @@ bool Application::isWifiConnected() const {
 
 void Application::setWifiConnected(bool connected) {
     wifiConnected = connected;
+    updateEvents(EVENT_WIFI_CONNECTED, connected);
 }
 
 bool Application::isBackendReachable() const {
@@ -487,6 +573,7 @@ bool Application::isBackendReachable() const {
 
 void Application::setBackendReachable(bool val) {
     backendReachable = val;
+    updateEvents(EVENT_BACKEND_REACHABLE, val);
 }
 
 bool Application::isUploadInProgress() const {
@@ -510,11 +597,23 @@ bool Application::hasPendingLogs() {
     return LogManager::hasPendingLogs();
 }
 
+void Application::flushLogs() {
+    LogManager::flush();
+}
+
 // Time wrappers
 String Application::getTimestamp() {
     return TimeManager::getTimestamp();
 }
 
+size_t Application::formatTimestamp(char* buffer, size_t size, int64_t epochMicros) {
+    return TimeManager::formatTimestamp(buffer, size, epochMicros);
+}
+
+int64_t Application::toEpochMicros(int64_t timerMicros) {
+    return TimeManager::toEpochMicros(timerMicros);
+}
+
 bool Application::storeCurrentTime() {
     return TimeManager::storeCurrentTime();
 }
@@ -532,6 +631,14 @@ bool Application::overwriteFile(const String& filename, const String& content) {
     return FileSystem::overwriteFile(filename, content);
 }
 
+bool Application::writeFile(const String& filename, const uint8_t* data, size_t size) {
+    return FileSystem::writeFile(filename, data, size);
+}
+
+bool Application::writeFile(const String& filename, const FileSegment* segments, size_t segmentCount) {
+    return FileSystem::writeFile(filename, segments, segmentCount);
+}
+
 String Application::readFile(const String& filename) {
     return FileSystem::readFile(filename);
 }
@@ -540,6 +647,10 @@ bool Application::addToUploadQueue(const String& filename) {
     return FileSystem::addToUploadQueue(filename);
 }
 
+bool Application::isFileInUploadQueue(const String& filename) {
+    return FileSystem::isFileInUploadQueue(filename);
+}
+
 bool Application::createEmptyFile(const String& filename) {
     return FileSystem::createEmptyFile(filename);
 }
@@ -548,6 +659,10 @@ bool Application::addToFile(const String& filename, const String& content) {
     return FileSystem::addToFile(filename, content);
 }
 
+bool Application::appendFile(const String& filename, const FileSegment* segments, size_t segmentCount) {
+    return FileSystem::appendFile(filename, segments, segmentCount);
+}
+
 bool Application::readFileToBuffer(const String& filename, uint8_t** buffer, size_t& size) {
     return FileSystem::readFileToBuffer(filename, buffer, size);
 }
@@ -564,10 +679,30 @@ bool Application::removeFirstFromUploadQueue() {
     return FileSystem::removeFirstFromUploadQueue();
 }
 
+size_t Application::getNextUploadFiles(String* paths, uint32_t* ids, size_t maxCount) {
+    return FileSystem::getNextUploadFiles(paths, ids, maxCount);
+}
+
+bool Application::removeFromUploadQueue(uint32_t id) {
+    return FileSystem::removeFromUploadQueue(id);
+}
+
+bool Application::getFileSize(const String& path, size_t& size) {
+    return FileSystem::getFileSize(path, size);
+}
+
 bool Application::deleteFile(const String& filename) {
     return FileSystem::deleteFile(filename);
 }
 
+bool Application::renameFile(const String& from, const String& to) {
+    return FileSystem::renameFile(from, to);
+}
+
+void Application::logFileSystemStats(uint32_t recordedMs) {
+    FileSystem::logOperationStats(recordedMs);
+}
+
 // PowerManager wrappers
 void Application::initDeepSleep() {
     PowerManager::initDeepSleep();
@@ -581,6 +716,14 @@ float Application::getBatteryVoltage() {
     return PowerManager::getBatteryVoltage();
 }
 
+bool Application::isBatteryOkForRecording() {
+    return PowerManager::isBatteryOkForRecording();
+}
+
+bool Application::isBatteryOkForUpload() {
+    return PowerManager::isBatteryOkForUpload();
+}
+
 // LED Manager wrapper functions
 SemaphoreHandle_t Application::getLedMutex() {
     return LEDManager::getLEDMutex();
@@ -614,7 +757,6 @@ bool Application::timedErrorBlinkLED(int interval, unsigned long duration) {
 // BackendClient Wrappers
 //-------------------------------------------------------------------------
 bool Application::startFileUploadTask() {
-    // This function is still needed for the interface
     bool result = BackendClient::startUploadTask();
     if (result) {
         setUploadTaskHandle(BackendClient::getUploadTaskHandle());
@@ -622,27 +764,6 @@ bool Application::startFileUploadTask() {
     return result;
 }
 
-bool Application::stopFileUploadTask() {
-    // This function is still needed for the interface
-    bool result = BackendClient::stopUploadTask();
-    if (result) {
-        setUploadTaskHandle(NULL);
-    }
-    return result;
-}
-
-bool Application::startBackendReachabilityTask() {
-    bool result = BackendClient::startReachabilityTask();
-    if (result) {
-        setReachabilityTaskHandle(BackendClient::getReachabilityTaskHandle());
-    }
-    return result;
-}
-
-bool Application::stopBackendReachabilityTask() {
-    bool result = BackendClient::stopReachabilityTask();
-    if (result) {
-        setReachabilityTaskHandle(NULL);
-    }
-    return result;
+void Application::resetBackendHealth() {
+    BackendClient::resetHealth();
 }
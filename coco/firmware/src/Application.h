@@ -16,6 +16,7 @@
 #include <Arduino.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/event_groups.h>
 #include <esp_sleep.h>
 
 // Project includes
@@ -27,15 +28,33 @@ class FileSystem;
 class LogManager;
 class TimeManager;
 class PowerManager;
+struct FileSegment;
+
+// Application event bits, each one is set while its condition holds
+#define EVENT_RECORDING_REQUESTED (1 << 0) ///< The user asked for recording
+#define EVENT_AUDIO_READY         (1 << 1) ///< The capture task started a session, cleared by the record task
+#define EVENT_WIFI_CONNECTED      (1 << 2) ///< WiFi has an IP address
+#define EVENT_BACKEND_REACHABLE   (1 << 3) ///< The last backend check succeeded
+#define EVENT_UPLOAD_PENDING      (1 << 4) ///< Recordings are waiting in the upload queue
+#define EVENT_LOGS_PENDING        (1 << 5) ///< Log messages are waiting to be written, cleared by the log task
 
 /**
- * @brief Structure for handling audio data buffers
+ * @brief Structure for handling audio data blocks
+ *
+ * Recorded segments reach the audio file task as a series of blocks. The
+ * first block of a segment opens its WAV file and the last one closes it.
  */
 struct AudioBuffer {
-    uint8_t* buffer;    ///< Pointer to the audio data
-    size_t size;        ///< Size of the buffer in bytes
-    char timestamp[32]; ///< Timestamp string for the audio data
-    enum { START, MIDDLE, END } type; ///< Position in the audio stream
+    int handle;         ///< AudioBufferPool handle of the PCM block, or NO_BUFFER if it carries no audio
+    size_t size;        ///< Size of the PCM data in bytes
+    char timestamp[TIMESTAMP_SIZE]; ///< Start timestamp of the segment this block belongs to
+    int64_t startTime;  ///< Wall-clock time of the first sample of the block in microseconds since the epoch, 0 without audio
+    enum { START, MIDDLE, END } type; ///< Position of the segment in the audio stream
+    bool segmentStart;  ///< First block of a segment
+    bool segmentEnd;    ///< Last block of a segment
+    bool voiced;        ///< Voice activity was detected in this block
+    uint32_t overrunSamples; ///< Samples lost to capture ring overruns during the segment (set on the last block)
+    uint32_t droppedSamples; ///< Samples discarded just before this block (pool or queue exhaustion)
 };
 
 /**
@@ -51,6 +70,10 @@ public:
     
     /**
      * @brief Initializes the application and all its subsystems
+     *
+     * Boots in two stages, so a recording requested by the wake button
+     * starts capturing before the SD card is mounted: initCapture() first,
+     * then initServices().
      * @return True if initialization succeeded, false otherwise
      */
     bool init();
@@ -180,18 +203,6 @@ public:
      */
     void setUploadTaskHandle(TaskHandle_t handle);
     
-    /**
-     * @brief Gets the handle of the reachability task
-     * @return FreeRTOS task handle
-     */
-    TaskHandle_t getReachabilityTaskHandle() const;
-    
-    /**
-     * @brief Sets the handle of the reachability task
-     * @param handle FreeRTOS task handle
-     */
-    void setReachabilityTaskHandle(TaskHandle_t handle);
-    
     /**
      * @brief Gets the handle of the battery monitor task
      * @return FreeRTOS task handle
@@ -231,6 +242,15 @@ public:
      */
     SemaphoreHandle_t getHttpMutex() const;
     
+    /**
+     * @brief Gets the event group tasks block on instead of polling
+     *
+     * The state setters keep the EVENT_* bits in sync with the flags. Clearing
+     * a bit also wakes the deep sleep task, since the system may now be idle.
+     * @return FreeRTOS event group handle
+     */
+    EventGroupHandle_t getEventGroup() const;
+    
     //-------------------------------------------------------------------------
     // External Wake Management
     //-------------------------------------------------------------------------
@@ -340,6 +360,11 @@ public:
      */
     bool hasPendingLogs();
     
+    /**
+     * @brief Asks the log task to write all pending logs now
+     */
+    void flushLogs();
+    
     // Time wrappers
     /**
      * @brief Gets the current timestamp
@@ -347,6 +372,22 @@ public:
      */
     String getTimestamp();
     
+    /**
+     * @brief Formats a wall-clock time as a timestamp into a caller buffer, without allocating
+     * @param buffer Destination buffer
+     * @param size Size of the destination in bytes
+     * @param epochMicros Time in microseconds since the epoch
+     * @return Length of the timestamp, 0 if the buffer is too small
+     */
+    size_t formatTimestamp(char* buffer, size_t size, int64_t epochMicros);
+    
+    /**
+     * @brief Converts an esp_timer timestamp to wall-clock time
+     * @param timerMicros Value returned by esp_timer_get_time()
+     * @return Microseconds since the epoch
+     */
+    int64_t toEpochMicros(int64_t timerMicros);
+    
     /**
      * @brief Stores the current time to persistent storage
      * @return True if successful, false otherwise
@@ -375,6 +416,24 @@ public:
      */
     bool overwriteFile(const String& filename, const String& content);
     
+    /**
+     * @brief Overwrites a file with binary data
+     * @param filename Name of the file to write
+     * @param data Data to write to the file
+     * @param size Number of bytes to write
+     * @return True if successful, false otherwise
+     */
+    bool writeFile(const String& filename, const uint8_t* data, size_t size);
+    
+    /**
+     * @brief Overwrites a file with several binary segments written back to back
+     * @param filename Name of the file to write
+     * @param segments Segments to write, in file order
+     * @param segmentCount Number of segments
+     * @return True if successful, false otherwise
+     */
+    bool writeFile(const String& filename, const FileSegment* segments, size_t segmentCount);
+    
     /**
      * @brief Reads the content of a file
      * @param filename Name of the file to read
@@ -389,6 +448,13 @@ public:
      */
     bool addToUploadQueue(const String& filename);
     
+    /**
+     * @brief Checks if a file is already in the upload queue
+     * @param filename Name of the file to look for
+     * @return True if the file is queued, false otherwise
+     */
+    bool isFileInUploadQueue(const String& filename);
+    
     /**
      * @brief Creates an empty file
      * @param filename Name of the file to create
@@ -404,6 +470,15 @@ public:
      */
     bool addToFile(const String& filename, const String& content);
     
+    /**
+     * @brief Appends several binary segments to a file
+     * @param filename Name of the file to append to
+     * @param segments Segments to append, in file order
+     * @param segmentCount Number of segments
+     * @return True if successful, false otherwise
+     */
+    bool appendFile(const String& filename, const FileSegment* segments, size_t segmentCount);
+    
     /**
      * @brief Reads a file into a memory buffer
      * @param filename Name of the file to read
@@ -436,6 +511,30 @@ public:
      */
     bool removeFirstFromUploadQueue();
     
+    /**
+     * @brief Gets several files from the front of the upload queue
+     * @param paths Receives up to maxCount file paths
+     * @param ids Receives the queue entry id of each file
+     * @param maxCount Capacity of paths and ids
+     * @return Number of files returned
+     */
+    size_t getNextUploadFiles(String* paths, uint32_t* ids, size_t maxCount);
+    
+    /**
+     * @brief Removes a file returned by getNextUploadFiles from the upload queue
+     * @param id Queue entry id of the file
+     * @return True if successful, false otherwise
+     */
+    bool removeFromUploadQueue(uint32_t id);
+    
+    /**
+     * @brief Gets the size of a file
+     * @param path Path to the file
+     * @param size Receives the size in bytes, 0 if the file does not exist
+     * @return True if the card could be queried, false otherwise
+     */
+    bool getFileSize(const String& path, size_t& size);
+    
     /**
      * @brief Deletes a file
      * @param filename Name of the file to delete
@@ -443,6 +542,20 @@ public:
      */
     bool deleteFile(const String& filename);
     
+    /**
+     * @brief Renames a file, replacing the destination if it exists
+     * @param from Current name of the file
+     * @param to New name of the file
+     * @return True if successful, false otherwise
+     */
+    bool renameFile(const String& from, const String& to);
+    
+    /**
+     * @brief Logs the SD latency counters and resets them
+     * @param recordedMs Audio recorded since the last report
+     */
+    void logFileSystemStats(uint32_t recordedMs);
+    
     // PowerManager wrappers
     /**
      * @brief Prepares the system for deep sleep
@@ -461,6 +574,18 @@ public:
      */
     float getBatteryVoltage();
     
+    /**
+     * @brief Checks if the battery allows recording
+     * @return True above the recording threshold, with hysteresis
+     */
+    bool isBatteryOkForRecording();
+    
+    /**
+     * @brief Checks if the battery allows uploads
+     * @return True above the upload threshold, with hysteresis
+     */
+    bool isBatteryOkForUpload();
+    
     // LED Manager wrappers
     SemaphoreHandle_t getLedMutex();
     void setLEDState(bool state);
@@ -479,28 +604,34 @@ public:
     bool startFileUploadTask();
     
     /**
-     * @brief Stops the file upload background task
-     * @return true if task was successfully stopped, false otherwise
+     * @brief Forgets the backend health, e.g. after the WiFi connection was lost
      */
-    bool stopFileUploadTask();
+    void resetBackendHealth();
+    
+private:
+    // Private constructor and deleted copy/assignment for singleton pattern
+    Application();
+    Application(const Application&) = delete;
+    Application& operator=(const Application&) = delete;
     
     /**
-     * @brief Starts the backend reachability check background task
-     * @return true if task creation succeeds, false otherwise
+     * @brief Sets or clears event bits and wakes the deep sleep task when bits are cleared
+     * @param bits EVENT_* bits to change
+     * @param set True to set the bits, false to clear them
      */
-    bool startBackendReachabilityTask();
+    void updateEvents(EventBits_t bits, bool set);
     
     /**
-     * @brief Stops the backend reachability check background task
-     * @return true if task was successfully stopped, false otherwise
+     * @brief First boot stage: bring up only what audio capture needs, without touching the SD card
+     * @return True if capture is running, false otherwise
      */
-    bool stopBackendReachabilityTask();
+    bool initCapture();
     
-private:
-    // Private constructor and deleted copy/assignment for singleton pattern
-    Application();
-    Application(const Application&) = delete;
-    Application& operator=(const Application&) = delete;
+    /**
+     * @brief Second boot stage: mount storage and start everything else while capture is buffering
+     * @return True if all services started, false otherwise
+     */
+    bool initServices();
     
     // Member variables for application state
     static Application* instance;
@@ -519,7 +650,6 @@ private:
     TaskHandle_t audioFileTaskHandle;
     TaskHandle_t wifiConnectionTaskHandle;
     TaskHandle_t uploadTaskHandle;
-    TaskHandle_t backendReachabilityTaskHandle;
     TaskHandle_t batteryMonitorTaskHandle;
     TaskHandle_t deepSleepTaskHandle;
     TaskHandle_t stackMonitorTaskHandle;
@@ -528,6 +658,8 @@ private:
     SemaphoreHandle_t ledMutex;
     // Mutex for HTTP operations
     SemaphoreHandle_t httpMutex;
+    // State changes tasks wait for
+    EventGroupHandle_t eventGroup;
 };
 
 #endif // APPLICATION_H
@@ -0,0 +1,122 @@
+/**
+ * @file AudioBufferPool.cpp
+ * @brief Implementation of the preallocated audio buffer pool
+ */
+
+#include <esp_heap_caps.h>
+
+#include "AudioBufferPool.h"
+
+// Initialize static member variables
+bool AudioBufferPool::initialized = false;
+Application* AudioBufferPool::app = nullptr;
+uint8_t** AudioBufferPool::buffers = nullptr;
+int AudioBufferPool::bufferCount = 0;
+size_t AudioBufferPool::bufferSize = 0;
+QueueHandle_t AudioBufferPool::freeList = NULL;
+volatile int AudioBufferPool::highWaterMark = 0;
+volatile uint32_t AudioBufferPool::exhaustionCount = 0;
+volatile uint32_t AudioBufferPool::failedAcquireCount = 0;
+
+bool AudioBufferPool::init(int count, size_t size, Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    if (appInstance == nullptr) {
+        app = Application::getInstance();
+    } else {
+        app = appInstance;
+    }
+
+    if (count <= 0 || size == 0) {
+        app->log("AudioBufferPool: Invalid pool dimensions");
+        return false;
+    }
+
+    buffers = (uint8_t**)calloc(count, sizeof(uint8_t*));
+    freeList = xQueueCreate(count, sizeof(int));
+    if (!buffers || freeList == NULL) {
+        app->log("AudioBufferPool: Failed to create free list");
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        buffers[i] = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (!buffers[i]) {
+            app->log("AudioBufferPool: Failed to allocate buffer " + String(i + 1) + " of " + String(count) +
+                     " (" + String(size / 1024) + "KB each)");
+            for (int j = 0; j < i; j++) {
+                heap_caps_free(buffers[j]);
+                buffers[j] = nullptr;
+            }
+            return false;
+        }
+        xQueueSend(freeList, &i, 0);
+    }
+
+    bufferCount = count;
+    bufferSize = size;
+    initialized = true;
+    app->log("AudioBufferPool: Allocated " + String(count) + " x " + String(size / 1024) + "KB PSRAM audio buffers");
+    return true;
+}
+
+int AudioBufferPool::acquire(TickType_t wait) {
+    if (!initialized) {
+        return NO_BUFFER;
+    }
+
+    int handle = NO_BUFFER;
+    if (xQueueReceive(freeList, &handle, wait) != pdTRUE) {
+        failedAcquireCount++;
+        return NO_BUFFER;
+    }
+
+    int inUse = bufferCount - (int)uxQueueMessagesWaiting(freeList);
+    if (inUse > highWaterMark) {
+        highWaterMark = inUse;
+    }
+    if (inUse == bufferCount) {
+        exhaustionCount++;
+    }
+    return handle;
+}
+
+void AudioBufferPool::release(int handle) {
+    if (!initialized || handle < 0 || handle >= bufferCount) {
+        return;
+    }
+    xQueueSend(freeList, &handle, 0);
+}
+
+uint8_t* AudioBufferPool::data(int handle) {
+    if (!initialized || handle < 0 || handle >= bufferCount) {
+        return nullptr;
+    }
+    return buffers[handle];
+}
+
+size_t AudioBufferPool::getBufferSize() {
+    return bufferSize;
+}
+
+int AudioBufferPool::getBufferCount() {
+    return bufferCount;
+}
+
+int AudioBufferPool::getFreeCount() {
+    return initialized ? (int)uxQueueMessagesWaiting(freeList) : 0;
+}
+
+int AudioBufferPool::getHighWaterMark() {
+    return highWaterMark;
+}
+
+uint32_t AudioBufferPool::getExhaustionCount() {
+    return exhaustionCount;
+}
+
+uint32_t AudioBufferPool::getFailedAcquireCount() {
+    return failedAcquireCount;
+}
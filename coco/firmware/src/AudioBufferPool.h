@@ -0,0 +1,113 @@
+/**
+ * @file AudioBufferPool.h
+ * @brief Fixed pool of preallocated PSRAM audio buffers
+ *
+ * All chunk buffers are allocated once at startup and recycled through a
+ * free list, so long recording sessions never fragment the heap. Buffers are
+ * referenced by small integer handles that can be passed through FreeRTOS
+ * queues.
+ */
+
+#ifndef AUDIO_BUFFER_POOL_H
+#define AUDIO_BUFFER_POOL_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "config.h"
+#include "Application.h"
+
+class AudioBufferPool {
+public:
+    /**
+     * @brief Handle value returned when no buffer is available
+     */
+    static const int NO_BUFFER = -1;
+
+    /**
+     * @brief Allocate every buffer of the pool in PSRAM
+     * @param bufferCount Number of buffers to allocate
+     * @param bufferSize Size of each buffer in bytes
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if all buffers were allocated, false otherwise
+     */
+    static bool init(int bufferCount, size_t bufferSize, Application* app = nullptr);
+
+    /**
+     * @brief Take a buffer from the free list
+     * @param wait Maximum time to wait for a buffer to be released
+     * @return Handle of the buffer, or NO_BUFFER if none is free
+     */
+    static int acquire(TickType_t wait = 0);
+
+    /**
+     * @brief Return a buffer to the free list
+     * @param handle Handle obtained from acquire()
+     */
+    static void release(int handle);
+
+    /**
+     * @brief Get the memory behind a handle
+     * @param handle Handle obtained from acquire()
+     * @return Pointer to the buffer, or nullptr for an invalid handle
+     */
+    static uint8_t* data(int handle);
+
+    /**
+     * @brief Get the size of each buffer in the pool
+     * @return Buffer size in bytes
+     */
+    static size_t getBufferSize();
+
+    /**
+     * @brief Get the number of buffers in the pool
+     * @return Buffer count
+     */
+    static int getBufferCount();
+
+    /**
+     * @brief Get the number of buffers currently on the free list
+     * @return Free buffer count
+     */
+    static int getFreeCount();
+
+    /**
+     * @brief Get the highest number of buffers that were in use at the same time
+     * @return High-water mark since boot
+     */
+    static int getHighWaterMark();
+
+    /**
+     * @brief Get how often the last free buffer was handed out
+     * @return Number of times the pool ran empty since boot
+     */
+    static uint32_t getExhaustionCount();
+
+    /**
+     * @brief Get the number of acquire calls that found no free buffer
+     * @return Failed acquire count since boot
+     */
+    static uint32_t getFailedAcquireCount();
+
+private:
+    // Private constructor for static-only class
+    AudioBufferPool() = default;
+    AudioBufferPool(const AudioBufferPool&) = delete;
+    AudioBufferPool& operator=(const AudioBufferPool&) = delete;
+
+    // Static state
+    static bool initialized;
+    static Application* app;
+    static uint8_t** buffers;
+    static int bufferCount;
+    static size_t bufferSize;
+    static QueueHandle_t freeList;
+
+    // Sizing statistics
+    static volatile int highWaterMark;
+    static volatile uint32_t exhaustionCount;
+    static volatile uint32_t failedAcquireCount;
+};
+
+#endif // AUDIO_BUFFER_POOL_H
@@ -0,0 +1,166 @@
+/**
+ * @file AudioDSP.cpp
+ * @brief Implementation of the audio conditioning stage
+ */
+
+#include <math.h>
+#include <esp_cpu.h>
+
+#include "AudioDSP.h"
+
+#if AUDIO_DSP_USE_ESP_DSP
+#include <esp_dsp.h>
+#endif
+
+// Initialize static member variables
+bool AudioDSP::initialized = false;
+Application* AudioDSP::app = nullptr;
+float AudioDSP::dcCoef[5] = { 0 };
+float AudioDSP::hpCoef[5] = { 0 };
+float AudioDSP::dcState[2] = { 0 };
+float AudioDSP::hpState[2] = { 0 };
+
+namespace {
+
+inline int16_t saturate16(float value) {
+    if (value >= 32767.0f) return 32767;
+    if (value <= -32768.0f) return -32768;
+    return (int16_t)lrintf(value);
+}
+
+inline float biquad(float x, const float* coef, float* w) {
+    float d0 = x - coef[3] * w[0] - coef[4] * w[1];
+    float y = coef[0] * d0 + coef[1] * w[0] + coef[2] * w[1];
+    w[1] = w[0];
+    w[0] = d0;
+    return y;
+}
+
+}  // namespace
+
+bool AudioDSP::init(Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    if (appInstance == nullptr) {
+        app = Application::getInstance();
+    } else {
+        app = appInstance;
+    }
+
+    // DC blocker: y[n] = x[n] - x[n-1] + R * y[n-1]
+    dcCoef[0] = 1.0f;
+    dcCoef[1] = -1.0f;
+    dcCoef[2] = 0.0f;
+    dcCoef[3] = -DSP_DC_BLOCK_POLE;
+    dcCoef[4] = 0.0f;
+
+    // Butterworth high-pass (RBJ cookbook, Q = 1/sqrt(2))
+    const float w0 = 2.0f * (float)M_PI * DSP_HIGHPASS_HZ / SAMPLING_RATE;
+    const float alpha = sinf(w0) / (2.0f * 0.70710678f);
+    const float cosw0 = cosf(w0);
+    const float a0 = 1.0f + alpha;
+    hpCoef[0] = (1.0f + cosw0) / 2.0f / a0;
+    hpCoef[1] = -(1.0f + cosw0) / a0;
+    hpCoef[2] = (1.0f + cosw0) / 2.0f / a0;
+    hpCoef[3] = -2.0f * cosw0 / a0;
+    hpCoef[4] = (1.0f - alpha) / a0;
+
+    reset();
+    initialized = true;
+
+    app->log(String("AudioDSP initialized (") + (AUDIO_DSP_USE_ESP_DSP ? "esp-dsp" : "scalar") +
+             ", high-pass " + String(DSP_HIGHPASS_HZ) + "Hz, gain " + String(DSP_GAIN, 1) + ")");
+
+    if (DSP_BENCHMARK_ON_BOOT) {
+        benchmark();
+    }
+    return true;
+}
+
+void AudioDSP::reset() {
+    dcState[0] = dcState[1] = 0.0f;
+    hpState[0] = hpState[1] = 0.0f;
+}
+
+void AudioDSP::process(int16_t* samples, size_t count) {
+#if AUDIO_DSP_USE_ESP_DSP
+    processVector(samples, count);
+#else
+    processScalar(samples, count);
+#endif
+}
+
+void AudioDSP::processScalar(int16_t* samples, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float value = biquad((float)samples[i], dcCoef, dcState);
+        value = biquad(value, hpCoef, hpState);
+        samples[i] = saturate16(value * DSP_GAIN);
+    }
+}
+
+#if AUDIO_DSP_USE_ESP_DSP
+void AudioDSP::processVector(int16_t* samples, size_t count) {
+    // Kept in internal RAM and aligned for the vector loads
+    static float bufferA[AUDIO_DSP_SLICE_SAMPLES] __attribute__((aligned(16)));
+    static float bufferB[AUDIO_DSP_SLICE_SAMPLES] __attribute__((aligned(16)));
+
+    while (count > 0) {
+        int n = count < AUDIO_DSP_SLICE_SAMPLES ? (int)count : AUDIO_DSP_SLICE_SAMPLES;
+
+        for (int i = 0; i < n; i++) {
+            bufferA[i] = samples[i];
+        }
+        dsps_biquad_f32(bufferA, bufferB, n, dcCoef, dcState);
+        dsps_biquad_f32(bufferB, bufferA, n, hpCoef, hpState);
+        dsps_mulc_f32(bufferA, bufferB, n, DSP_GAIN, 1, 1);
+        for (int i = 0; i < n; i++) {
+            samples[i] = saturate16(bufferB[i]);
+        }
+
+        samples += n;
+        count -= n;
+    }
+}
+#endif
+
+float AudioDSP::measure(void (*fn)(int16_t*, size_t)) {
+    // One second of a 440Hz tone on top of a DC offset, processed in DMA-sized blocks
+    static int16_t block[AUDIO_DMA_BLOCK_SIZE / AUDIO_SAMPLE_BYTES];
+    const size_t blockSamples = sizeof(block) / sizeof(block[0]);
+    const size_t totalSamples = SAMPLING_RATE / blockSamples * blockSamples;
+
+    reset();
+    uint64_t cycles = 0;
+    for (size_t done = 0; done < totalSamples; done += blockSamples) {
+        for (size_t i = 0; i < blockSamples; i++) {
+            block[i] = (int16_t)(1200 + 4000 * sinf(2.0f * (float)M_PI * 440.0f * (done + i) / SAMPLING_RATE));
+        }
+        uint32_t start = esp_cpu_get_cycle_count();
+        fn(block, blockSamples);
+        cycles += esp_cpu_get_cycle_count() - start;
+    }
+    reset();
+
+    return (float)cycles / totalSamples;
+}
+
+void AudioDSP::benchmark() {
+    if (!app) {
+        app = Application::getInstance();
+    }
+
+    const uint32_t cpuMhz = getCpuFrequencyMhz();
+    auto report = [cpuMhz](const char* name, float cyclesPerSample) {
+        // Share of one core needed to keep up with the capture rate
+        float load = cyclesPerSample * SAMPLING_RATE / (cpuMhz * 1000000.0f) * 100.0f;
+        app->log(String("AudioDSP benchmark: ") + name + " " + String(cyclesPerSample, 1) +
+                 " cycles/sample at " + String(cpuMhz) + "MHz (" + String(load, 2) + "% of a core)");
+    };
+
+    report("scalar", measure(processScalar));
+#if AUDIO_DSP_USE_ESP_DSP
+    report("esp-dsp", measure(processVector));
+#endif
+}
@@ -0,0 +1,97 @@
+/**
+ * @file AudioDSP.h
+ * @brief Conditioning of the captured audio stream
+ *
+ * Every captured block runs through a DC blocker, a second order
+ * Butterworth high-pass and a saturating gain before it is analyzed and
+ * stored. On the ESP32-S3 the filters use the esp-dsp kernels, which are
+ * optimized for the S3's vector extensions; other targets or builds
+ * without esp-dsp use the scalar implementation.
+ */
+
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "Application.h"
+
+// Use the esp-dsp kernels where they are available
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && __has_include(<esp_dsp.h>)
+#define AUDIO_DSP_USE_ESP_DSP 1
+#else
+#define AUDIO_DSP_USE_ESP_DSP 0
+#endif
+
+// Samples converted to float at a time by the esp-dsp path
+#define AUDIO_DSP_SLICE_SAMPLES 256
+
+class AudioDSP {
+public:
+    /**
+     * @brief Compute the filter coefficients and clear the filter state
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if initialization was successful
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Clear the filter state, e.g. at the start of a recording session
+     */
+    static void reset();
+
+    /**
+     * @brief Condition samples in place with the fastest available implementation
+     * @param samples 16-bit mono samples
+     * @param count Number of samples
+     */
+    static void process(int16_t* samples, size_t count);
+
+    /**
+     * @brief Condition samples in place with the portable scalar implementation
+     * @param samples 16-bit mono samples
+     * @param count Number of samples
+     */
+    static void processScalar(int16_t* samples, size_t count);
+
+#if AUDIO_DSP_USE_ESP_DSP
+    /**
+     * @brief Condition samples in place with the esp-dsp kernels
+     * @param samples 16-bit mono samples
+     * @param count Number of samples
+     */
+    static void processVector(int16_t* samples, size_t count);
+#endif
+
+    /**
+     * @brief Measure and log the cost of every implementation in cycles per sample
+     */
+    static void benchmark();
+
+private:
+    // Private constructor for static-only class
+    AudioDSP() = default;
+    AudioDSP(const AudioDSP&) = delete;
+    AudioDSP& operator=(const AudioDSP&) = delete;
+
+    /**
+     * @brief Measure one implementation on a synthetic signal
+     * @param fn Implementation to measure
+     * @return Average cycles per sample
+     */
+    static float measure(void (*fn)(int16_t*, size_t));
+
+    static bool initialized;
+    static Application* app;
+
+    // Coefficients as b0, b1, b2, a1, a2 (a0 normalized to 1), the esp-dsp layout
+    static float dcCoef[5];
+    static float hpCoef[5];
+
+    // Filter state, direct form II like dsps_biquad_f32
+    static float dcState[2];
+    static float hpState[2];
+};
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,236 @@
+/**
+ * @file AudioEncoder.cpp
+ * @brief Implementation of the audio encoders
+ */
+
+#include "AudioEncoder.h"
+
+namespace {
+
+// IMA-ADPCM quantizer step sizes
+const int16_t kStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
+    34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+    157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// Step index adjustment per code magnitude
+const int8_t kIndexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+void putU16(uint8_t* dest, uint16_t value) {
+    memcpy(dest, &value, 2);
+}
+
+void putU32(uint8_t* dest, uint32_t value) {
+    memcpy(dest, &value, 4);
+}
+
+}  // namespace
+
+AudioEncoder* AudioEncoder::create() {
+#if AUDIO_CODEC == AUDIO_CODEC_IMA_ADPCM
+    return new ImaAdpcmEncoder();
+#else
+    return new PcmEncoder();
+#endif
+}
+
+const char* AudioEncoder::contentTypeForWav(const uint8_t* header, size_t size) {
+    // The format tag of the fmt chunk directly follows the RIFF/WAVE preamble
+    if (header != nullptr && size >= 22 && memcmp(header + 12, "fmt ", 4) == 0) {
+        uint16_t formatTag;
+        memcpy(&formatTag, header + 20, 2);
+        if (formatTag == WAV_FORMAT_IMA_ADPCM) {
+            return "audio/vnd.wave; codec=11";  // RFC 2361
+        }
+    }
+    return "audio/wav";
+}
+
+// PcmEncoder
+
+const char* PcmEncoder::getName() const {
+    return "PCM";
+}
+
+size_t PcmEncoder::getHeaderSize() const {
+    return WAV_HEADER_SIZE;
+}
+
+void PcmEncoder::writeHeader(uint8_t* header, size_t dataSize, uint32_t frames) const {
+    // See http://soundfile.sapp.org/doc/WaveFormat/ for the layout
+    memcpy(header, "RIFF", 4);
+    putU32(header + 4, dataSize + WAV_HEADER_SIZE - 8);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putU32(header + 16, 16);
+    putU16(header + 20, WAV_FORMAT_PCM);
+    putU16(header + 22, 1);  // Mono
+    putU32(header + 24, SAMPLING_RATE);
+    putU32(header + 28, SAMPLING_RATE * AUDIO_SAMPLE_BYTES);
+    putU16(header + 32, AUDIO_SAMPLE_BYTES);
+    putU16(header + 34, AUDIO_SAMPLE_BYTES * 8);
+    memcpy(header + 36, "data", 4);
+    putU32(header + 40, dataSize);
+}
+
+size_t PcmEncoder::getMaxEncodedSize(size_t pcmBytes) const {
+    return pcmBytes;
+}
+
+void PcmEncoder::begin() {
+    sampleFrames = 0;
+}
+
+size_t PcmEncoder::encode(const uint8_t* pcm, size_t pcmBytes, uint8_t* out) {
+    if (out != nullptr) {
+        memcpy(out, pcm, pcmBytes);
+    }
+    sampleFrames += pcmBytes / AUDIO_SAMPLE_BYTES;
+    return pcmBytes;
+}
+
+size_t PcmEncoder::finish(uint8_t* out) {
+    return 0;
+}
+
+uint32_t PcmEncoder::getSampleFrames() const {
+    return sampleFrames;
+}
+
+// ImaAdpcmEncoder
+
+const char* ImaAdpcmEncoder::getName() const {
+    return "IMA-ADPCM";
+}
+
+size_t ImaAdpcmEncoder::getHeaderSize() const {
+    return WAV_IMA_ADPCM_HEADER_SIZE;
+}
+
+void ImaAdpcmEncoder::writeHeader(uint8_t* header, size_t dataSize, uint32_t frames) const {
+    memcpy(header, "RIFF", 4);
+    putU32(header + 4, dataSize + WAV_IMA_ADPCM_HEADER_SIZE - 8);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putU32(header + 16, 20);
+    putU16(header + 20, WAV_FORMAT_IMA_ADPCM);
+    putU16(header + 22, 1);  // Mono
+    putU32(header + 24, SAMPLING_RATE);
+    putU32(header + 28, (uint32_t)((uint64_t)SAMPLING_RATE * IMA_ADPCM_BLOCK_SIZE / IMA_ADPCM_SAMPLES_PER_BLOCK));
+    putU16(header + 32, IMA_ADPCM_BLOCK_SIZE);
+    putU16(header + 34, 4);  // Bits per sample
+    putU16(header + 36, 2);  // Extension size
+    putU16(header + 38, IMA_ADPCM_SAMPLES_PER_BLOCK);
+    // The fact chunk holds the real sample count, the last block is padded
+    memcpy(header + 40, "fact", 4);
+    putU32(header + 44, 4);
+    putU32(header + 48, frames);
+    memcpy(header + 52, "data", 4);
+    putU32(header + 56, dataSize);
+}
+
+size_t ImaAdpcmEncoder::getMaxEncodedSize(size_t pcmBytes) const {
+    // Pending samples plus the new ones, rounded up to whole blocks
+    size_t samples = IMA_ADPCM_SAMPLES_PER_BLOCK + pcmBytes / AUDIO_SAMPLE_BYTES;
+    return (samples / IMA_ADPCM_SAMPLES_PER_BLOCK + 1) * IMA_ADPCM_BLOCK_SIZE;
+}
+
+void ImaAdpcmEncoder::begin() {
+    pendingCount = 0;
+    stepIndex = 0;
+    sampleFrames = 0;
+}
+
+size_t ImaAdpcmEncoder::encode(const uint8_t* pcm, size_t pcmBytes, uint8_t* out) {
+    size_t written = 0;
+    size_t count = pcmBytes / AUDIO_SAMPLE_BYTES;
+
+    for (size_t i = 0; i < count; i++) {
+        int16_t sample;
+        memcpy(&sample, pcm + i * AUDIO_SAMPLE_BYTES, sizeof(sample));
+        pending[pendingCount++] = sample;
+        if (pendingCount == IMA_ADPCM_SAMPLES_PER_BLOCK) {
+            encodeBlock(out + written);
+            written += IMA_ADPCM_BLOCK_SIZE;
+        }
+    }
+
+    sampleFrames += count;
+    return written;
+}
+
+size_t ImaAdpcmEncoder::finish(uint8_t* out) {
+    if (pendingCount == 0) {
+        return 0;
+    }
+
+    // Pad with the last sample, decoders stop at the count in the fact chunk
+    int16_t last = pending[pendingCount - 1];
+    while (pendingCount < IMA_ADPCM_SAMPLES_PER_BLOCK) {
+        pending[pendingCount++] = last;
+    }
+    encodeBlock(out);
+    return IMA_ADPCM_BLOCK_SIZE;
+}
+
+uint32_t ImaAdpcmEncoder::getSampleFrames() const {
+    return sampleFrames;
+}
+
+void ImaAdpcmEncoder::encodeBlock(uint8_t* out) {
+    // Block header: first sample verbatim and the current step index
+    int predictor = pending[0];
+    putU16(out, (uint16_t)pending[0]);
+    out[2] = (uint8_t)stepIndex;
+    out[3] = 0;
+
+    uint8_t* data = out + 4;
+    for (size_t i = 1; i < IMA_ADPCM_SAMPLES_PER_BLOCK; i++) {
+        int step = kStepTable[stepIndex];
+        int diff = pending[i] - predictor;
+        uint8_t code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+
+        // Quantize the difference and track exactly what the decoder will reconstruct
+        int delta = step >> 3;
+        if (diff >= step) {
+            code |= 4;
+            diff -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 2;
+            diff -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 1;
+            delta += step;
+        }
+
+        predictor += (code & 8) ? -delta : delta;
+        if (predictor > 32767) predictor = 32767;
+        if (predictor < -32768) predictor = -32768;
+
+        stepIndex += kIndexTable[code & 7];
+        if (stepIndex < 0) stepIndex = 0;
+        if (stepIndex > 88) stepIndex = 88;
+
+        // Two codes per byte, the earlier sample in the low nibble
+        size_t n = i - 1;
+        if (n & 1) {
+            data[n >> 1] |= code << 4;
+        } else {
+            data[n >> 1] = code;
+        }
+    }
+
+    pendingCount = 0;
+}
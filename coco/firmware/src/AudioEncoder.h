@@ -0,0 +1,164 @@
+/**
+ * @file AudioEncoder.h
+ * @brief Pluggable encoders for recorded audio
+ *
+ * An encoder turns the 16-bit PCM stream of one segment into the payload of
+ * a WAV file and knows how to describe that payload in the WAV header. The
+ * codec used for new recordings is selected with AUDIO_CODEC in config.h.
+ */
+
+#ifndef AUDIO_ENCODER_H
+#define AUDIO_ENCODER_H
+
+#include <Arduino.h>
+
+#include "config.h"
+
+// WAV format tags
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+
+// Size of the canonical PCM WAV header
+#define WAV_HEADER_SIZE 44
+
+// Size of the IMA-ADPCM WAV header (fmt chunk with extension and fact chunk)
+#define WAV_IMA_ADPCM_HEADER_SIZE 60
+
+// Bytes per IMA-ADPCM block, 1017 mono samples each (~64ms at 16kHz)
+#define IMA_ADPCM_BLOCK_SIZE 512
+#define IMA_ADPCM_SAMPLES_PER_BLOCK ((IMA_ADPCM_BLOCK_SIZE - 4) * 2 + 1)
+
+class AudioEncoder {
+public:
+    virtual ~AudioEncoder() = default;
+
+    /**
+     * @brief Create the encoder selected by AUDIO_CODEC
+     * @return New encoder instance, owned by the caller
+     */
+    static AudioEncoder* create();
+
+    /**
+     * @brief Get the HTTP Content-Type for a WAV file by looking at its header
+     * @param header Start of the file
+     * @param size Number of bytes available at header
+     * @return Content-Type string
+     */
+    static const char* contentTypeForWav(const uint8_t* header, size_t size);
+
+    /**
+     * @brief Get a short human readable name of the codec
+     * @return Codec name
+     */
+    virtual const char* getName() const = 0;
+
+    /**
+     * @brief Get the size of the WAV header written in front of the payload
+     * @return Header size in bytes
+     */
+    virtual size_t getHeaderSize() const = 0;
+
+    /**
+     * @brief Write the WAV header describing an encoded payload
+     * @param header Destination, must hold getHeaderSize() bytes
+     * @param dataSize Size of the encoded payload in bytes
+     * @param sampleFrames Number of audio samples in the payload
+     */
+    virtual void writeHeader(uint8_t* header, size_t dataSize, uint32_t sampleFrames) const = 0;
+
+    /**
+     * @brief Check if the payload is the unmodified PCM input
+     * @return true if encode() would only copy its input
+     */
+    virtual bool isPassthrough() const { return false; }
+
+    /**
+     * @brief Get the largest output encode() can produce for an input size
+     * @param pcmBytes Input size in bytes
+     * @return Required output capacity in bytes, including the finish() output
+     */
+    virtual size_t getMaxEncodedSize(size_t pcmBytes) const = 0;
+
+    /**
+     * @brief Reset the encoder state for a new segment
+     */
+    virtual void begin() = 0;
+
+    /**
+     * @brief Encode PCM samples, keeping an incomplete codec block for the next call
+     * @param pcm 16-bit little-endian mono samples
+     * @param pcmBytes Number of input bytes
+     * @param out Destination, must hold getMaxEncodedSize(pcmBytes) bytes. Passthrough
+     *            encoders accept nullptr and then only count the samples.
+     * @return Number of bytes written to out
+     */
+    virtual size_t encode(const uint8_t* pcm, size_t pcmBytes, uint8_t* out) = 0;
+
+    /**
+     * @brief Emit the last, padded codec block of a segment
+     * @param out Destination, must hold getMaxEncodedSize(0) bytes
+     * @return Number of bytes written to out
+     */
+    virtual size_t finish(uint8_t* out) = 0;
+
+    /**
+     * @brief Get the number of samples passed to encode() since begin()
+     * @return Sample count
+     */
+    virtual uint32_t getSampleFrames() const = 0;
+
+protected:
+    AudioEncoder() = default;
+
+private:
+    AudioEncoder(const AudioEncoder&) = delete;
+    AudioEncoder& operator=(const AudioEncoder&) = delete;
+};
+
+/**
+ * @brief Uncompressed 16-bit PCM, the payload is the captured stream itself
+ */
+class PcmEncoder : public AudioEncoder {
+public:
+    const char* getName() const override;
+    size_t getHeaderSize() const override;
+    void writeHeader(uint8_t* header, size_t dataSize, uint32_t sampleFrames) const override;
+    bool isPassthrough() const override { return true; }
+    size_t getMaxEncodedSize(size_t pcmBytes) const override;
+    void begin() override;
+    size_t encode(const uint8_t* pcm, size_t pcmBytes, uint8_t* out) override;
+    size_t finish(uint8_t* out) override;
+    uint32_t getSampleFrames() const override;
+
+private:
+    uint32_t sampleFrames = 0;
+};
+
+/**
+ * @brief 4-bit IMA-ADPCM as stored in WAV files (format 0x11), about 4:1
+ */
+class ImaAdpcmEncoder : public AudioEncoder {
+public:
+    const char* getName() const override;
+    size_t getHeaderSize() const override;
+    void writeHeader(uint8_t* header, size_t dataSize, uint32_t sampleFrames) const override;
+    size_t getMaxEncodedSize(size_t pcmBytes) const override;
+    void begin() override;
+    size_t encode(const uint8_t* pcm, size_t pcmBytes, uint8_t* out) override;
+    size_t finish(uint8_t* out) override;
+    uint32_t getSampleFrames() const override;
+
+private:
+    /**
+     * @brief Encode the pending samples as one block
+     * @param out Destination, must hold IMA_ADPCM_BLOCK_SIZE bytes
+     */
+    void encodeBlock(uint8_t* out);
+
+    int16_t pending[IMA_ADPCM_SAMPLES_PER_BLOCK];
+    size_t pendingCount = 0;
+    int stepIndex = 0;
+    uint32_t sampleFrames = 0;
+};
+
+#endif // AUDIO_ENCODER_H
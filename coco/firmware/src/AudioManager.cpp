@@ -3,17 +3,43 @@
  * @brief Implementation of audio recording and processing functionality
  */
 
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
 #include "AudioManager.h"
+#include "AudioBufferPool.h"
+#include "AudioDSP.h"
+#include "Metrics.h"
+#include "PowerManager.h"
+#include "SDScheduler.h"
 
 // Initialize static member variables
 bool AudioManager::initialized = false;
 Application* AudioManager::app = nullptr;
 I2SClass AudioManager::i2s;
+TaskHandle_t AudioManager::captureTaskHandle = NULL;
 TaskHandle_t AudioManager::recordAudioTaskHandle = NULL;
 TaskHandle_t AudioManager::audioFileTaskHandle = NULL;
 volatile bool AudioManager::isRecording = false;
 volatile bool AudioManager::wasRecording = false;
+volatile bool AudioManager::captureActive = false;
 unsigned long AudioManager::lastRecordStart = 0;
+StreamBufferHandle_t AudioManager::captureStream = NULL;
+StaticStreamBuffer_t AudioManager::captureStreamStruct;
+uint8_t* AudioManager::captureStreamStorage = nullptr;
+volatile uint32_t AudioManager::overrunSamples = 0;
+volatile uint32_t AudioManager::droppedSamples = 0;
+volatile uint32_t AudioManager::readErrors = 0;
+volatile int64_t AudioManager::firstSampleUs = 0;
+volatile int64_t AudioManager::sessionStartUs = 0;
+QueueHandle_t AudioManager::captureGaps = NULL;
+uint32_t AudioManager::sessionLostSamples = 0;
+uint32_t AudioManager::segmentOverrunStart = 0;
+VoiceActivityDetector AudioManager::vad;
+volatile uint32_t AudioManager::vadKeptSamples = 0;
+volatile uint32_t AudioManager::vadDroppedSamples = 0;
+volatile uint32_t AudioManager::vadKeptSegments = 0;
+volatile uint32_t AudioManager::vadDroppedSegments = 0;
 QueueHandle_t AudioManager::audioQueue = NULL;
 int AudioManager::audioFileIndex = 0;
 
@@ -30,37 +56,56 @@ bool AudioManager::init(Application* appInstance) {
     
     // Initialize audio queue if not already created
     if (audioQueue == NULL) {
-        audioQueue = xQueueCreate(10, sizeof(AudioBuffer));
+        audioQueue = xQueueCreate(AUDIO_QUEUE_SIZE, sizeof(AudioBuffer));
         if (audioQueue == NULL) {
             app->log("Failed to create audio queue!");
             return false;
         }
     }
     
+    if (captureGaps == NULL) {
+        captureGaps = xQueueCreate(AUDIO_GAP_QUEUE_SIZE, sizeof(CaptureGap));
+        if (captureGaps == NULL) {
+            app->log("Failed to create capture gap queue!");
+            return false;
+        }
+    }
+    
+    // Create the capture ring buffer with its storage in PSRAM
+    if (captureStream == NULL) {
+        // A stream buffer needs one extra byte of storage to tell full from empty
+        captureStreamStorage = (uint8_t*)heap_caps_malloc(AUDIO_RING_BUFFER_SIZE + 1, MALLOC_CAP_SPIRAM);
+        if (!captureStreamStorage) {
+            app->log("Failed to allocate PSRAM for capture ring buffer!");
+            return false;
+        }
+        captureStream = xStreamBufferCreateStatic(AUDIO_RING_BUFFER_SIZE, AUDIO_DMA_BLOCK_SIZE,
+                                                  captureStreamStorage, &captureStreamStruct);
+        if (captureStream == NULL) {
+            app->log("Failed to create capture ring buffer!");
+            return false;
+        }
+        app->log("Allocated " + String(AUDIO_RING_BUFFER_SIZE / 1024) + "KB PSRAM capture ring buffer");
+    }
+    
+    // Allocate all block buffers once, so recording never touches the heap afterwards
+    if (!AudioBufferPool::init(AUDIO_POOL_BUFFER_COUNT, AUDIO_WRITE_BLOCK_SIZE, app)) {
+        app->log("Failed to allocate audio buffer pool!");
+        return false;
+    }
+    
+    // Prepare the conditioning filters
+    if (DSP_ENABLED && !AudioDSP::init(app)) {
+        app->log("Failed to initialize audio DSP!");
+        return false;
+    }
+    
     // Initialize I2S for audio recording
     if (!initI2S()) {
         app->log("Failed to initialize I2S in AudioManager!");
         return false;
     }
 
-    // Ensure recordings directory exists
-    if (!app->ensureDirectory(RECORDINGS_DIR)) {
-        app->log("Failed to create recordings directory!");
-        return false;
-    }
-
-    // Ensure upload queue file exists
-    String queueContent = app->readFile(UPLOAD_QUEUE_FILE);
-    if (queueContent.length() == 0) {
-        // Create empty file if it doesn't exist
-        if (app->createEmptyFile(UPLOAD_QUEUE_FILE)) {
-            app->log("Created new upload queue file");
-        } else {
-            app->log("Failed to create upload queue file!");
-            return false;
-        }
-    }
-    
     initialized = true;
     app->log("AudioManager initialized successfully");
     return true;
@@ -98,6 +143,21 @@ bool AudioManager::startRecordingTask() {
         }
     }
     
+    // Create capture task. It runs above the recording task so the I2S DMA is
+    // always drained, even while a chunk is being handed off.
+    if (xTaskCreatePinnedToCore(
+        captureTask,
+        "I2S Capture",
+        4096,
+        NULL,
+        5,
+        &captureTaskHandle,
+        1  // Run on Core 1
+    ) != pdPASS) {
+        app->log("Failed to create I2S capture task!");
+        return false;
+    }
+    
     // Create recording task
     if (xTaskCreatePinnedToCore(
         recordAudioTask,
@@ -124,6 +184,15 @@ bool AudioManager::startAudioFileTask() {
         }
     }
     
+    // Capture may already be running, only the file side needs the SD card
+    if (!app->ensureDirectory(RECORDINGS_DIR)) {
+        app->log("Failed to create recordings directory!");
+        return false;
+    }
+    
+    // Repair the file that was being written when the device last reset
+    recoverOpenRecording();
+    
     // Create audio file handling task
     if (xTaskCreatePinnedToCore(
         audioFileTask,
@@ -145,10 +214,7 @@ bool AudioManager::startAudioFileTask() {
 bool AudioManager::isBatteryOkForRecording() {
     if (!app) return false;
     
-    float batteryVoltage = app->getBatteryVoltage();
-    bool isOk = batteryVoltage >= BATTERY_RECORDING_THRESHOLD;
-
-    return isOk;
+    return app->isBatteryOkForRecording();
 }
 
 bool AudioManager::canRecord() {
@@ -169,124 +235,503 @@ bool AudioManager::canRecord() {
     return canProceed;
 }
 
-void AudioManager::recordAudioTask(void* parameter) {
+void AudioManager::captureTask(void* parameter) {
     if (!initialized) {
         init();
     }
     
+    // DMA-sized staging block, kept in internal RAM
+    static uint8_t block[AUDIO_DMA_BLOCK_SIZE];
+    
+    // Position of the session in the ring, and the overrun not yet reported to the recording task
+    uint32_t sentSamples = 0;
+    CaptureGap gap = {};
+    
     while (true) {
+        if (!captureActive) {
+            // Only start a new session once the previous one has been fully cut into chunks
+            if (!app->isRecordingRequested()) {
+                // Sleep until the button asks for a recording
+                xEventGroupWaitBits(app->getEventGroup(), EVENT_RECORDING_REQUESTED, pdFALSE, pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            if (wasRecording || xStreamBufferIsEmpty(captureStream) != pdTRUE) {
+                // The record task notifies us once the previous session is fully cut into chunks
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            if (!canRecord()) {
+                continue;
+            }
+            // The recording task is idle, the timeline of the previous session is not needed anymore
+            xQueueReset(captureGaps);
+            sessionStartUs = 0;
+            sentSamples = 0;
+            gap = {};
+            captureActive = true;
+            xEventGroupSetBits(app->getEventGroup(), EVENT_AUDIO_READY);
+        }
+        
+        if (!app->isRecordingRequested()) {
+            // Everything sent so far belongs to the ending session
+            captureActive = false;
+            continue;
+        }
         
-        if (canRecord()) {
-            lastRecordStart = millis(); // Track when recording started
-            AudioBuffer audio;
+        size_t bytesRead = i2s.readBytes((char*)block, AUDIO_DMA_BLOCK_SIZE);
+        if (bytesRead == 0) {
+            readErrors++;
+            continue;
+        }
+        if (firstSampleUs == 0) {
+            firstSampleUs = esp_timer_get_time();
+        }
+        if (sessionStartUs == 0) {
+            // The read returns once the block is complete, its first sample is one block older
+            sessionStartUs = esp_timer_get_time() -
+                             (int64_t)(bytesRead / AUDIO_SAMPLE_BYTES) * 1000000 / SAMPLING_RATE;
+        }
+        
+        // Drop whole blocks on overrun so the stream stays sample aligned
+        if (xStreamBufferSpacesAvailable(captureStream) < bytesRead) {
+            overrunSamples += bytesRead / AUDIO_SAMPLE_BYTES;
+            Metrics::add(METRIC_CAPTURE_OVERRUN_SAMPLES, bytesRead / AUDIO_SAMPLE_BYTES);
+            if (gap.samples == 0) {
+                gap.position = sentSamples;
+            }
+            gap.samples += bytesRead / AUDIO_SAMPLE_BYTES;
+            continue;
+        }
+        // The recording task is seconds behind, reporting the gap with the next block is in time.
+        // While the gap queue is full the gap keeps growing and lands a little early.
+        if (gap.samples > 0 && xQueueSend(captureGaps, &gap, 0) == pdPASS) {
+            gap = {};
+        }
+        xStreamBufferSend(captureStream, block, bytesRead, 0);
+        sentSamples += bytesRead / AUDIO_SAMPLE_BYTES;
+    }
+}
 
-            // Use TimeManager for timestamp through Application wrapper
-            String ts = app->getTimestamp();
-            snprintf(audio.timestamp, sizeof(audio.timestamp), "%s", ts.c_str());
-            
-            // Use "start" marker for the first chunk, then MIDDLE afterwards.
-            if (!wasRecording) {
-                wasRecording = true;
-                audio.type = AudioBuffer::START;
-                app->log("Started audio recording");
-            } else {
-                audio.type = AudioBuffer::MIDDLE;
+int64_t AudioManager::captureTime(uint32_t position) {
+    // Every overrun in front of the position moves it further from the session start
+    CaptureGap gap;
+    while (xQueuePeek(captureGaps, &gap, 0) == pdTRUE && gap.position <= position) {
+        xQueueReceive(captureGaps, &gap, 0);
+        sessionLostSamples += gap.samples;
+    }
+    int64_t samples = (int64_t)position + sessionLostSamples;
+    return app->toEpochMicros(sessionStartUs + samples * 1000000 / SAMPLING_RATE);
+}
+
+void AudioManager::beginSegment(AudioBuffer& block) {
+    // Provisional, replaced by the time of the first sample once the segment receives audio
+    if (app->formatTimestamp(block.timestamp, sizeof(block.timestamp),
+                             app->toEpochMicros(esp_timer_get_time())) == 0) {
+        snprintf(block.timestamp, sizeof(block.timestamp), "unknown");
+    }
+    
+    // Use "start" marker for the first segment, then MIDDLE afterwards.
+    block.type = wasRecording ? AudioBuffer::MIDDLE : AudioBuffer::START;
+    block.segmentStart = true;
+    block.segmentEnd = false;
+    segmentOverrunStart = overrunSamples;
+}
+
+void AudioManager::deliverBlock(AudioBuffer& block, bool segmentEnd) {
+    static uint32_t pendingDropped = 0;
+    
+    block.segmentEnd = segmentEnd;
+    block.overrunSamples = segmentEnd ? overrunSamples - segmentOverrunStart : 0;
+    
+    if (block.handle == AudioBufferPool::NO_BUFFER && block.size > 0) {
+        // The pool stayed exhausted for this whole block, its samples were discarded
+        if (pendingDropped == 0) {
+            app->log("Failed to record audio: audio buffer pool exhausted (high-water mark " +
+                     String(AudioBufferPool::getHighWaterMark()) + "/" + String(AudioBufferPool::getBufferCount()) + ")");
+        }
+        droppedSamples += block.size / AUDIO_SAMPLE_BYTES;
+        pendingDropped += block.size / AUDIO_SAMPLE_BYTES;
+        Metrics::add(METRIC_CAPTURE_DROPPED_SAMPLES, block.size / AUDIO_SAMPLE_BYTES);
+        block.size = 0;
+    }
+    if (block.size == 0 && block.handle != AudioBufferPool::NO_BUFFER) {
+        AudioBufferPool::release(block.handle);
+        block.handle = AudioBufferPool::NO_BUFFER;
+    }
+    
+    // Blocks without audio are only sent when they open or close a segment
+    if (block.size > 0 || block.segmentStart || block.segmentEnd) {
+        block.droppedSamples = pendingDropped;
+        if (xQueueSend(audioQueue, &block, pdMS_TO_TICKS(1000)) != pdPASS) {
+            app->log("Failed to enqueue audio block!");
+            droppedSamples += block.size / AUDIO_SAMPLE_BYTES;
+            pendingDropped += block.size / AUDIO_SAMPLE_BYTES;
+            Metrics::add(METRIC_CAPTURE_DROPPED_SAMPLES, block.size / AUDIO_SAMPLE_BYTES);
+            AudioBufferPool::release(block.handle);
+        } else {
+            pendingDropped = 0;
+        }
+    }
+    
+    block.handle = AudioBufferPool::NO_BUFFER;
+    block.size = 0;
+    block.startTime = 0;
+    block.segmentStart = false;
+    block.voiced = false;
+}
+
+void AudioManager::recordAudioTask(void* parameter) {
+    if (!initialized) {
+        init();
+    }
+    
+    AudioBuffer block = {};
+    block.handle = AudioBufferPool::NO_BUFFER;
+    size_t segmentBytes = 0;
+    size_t speechStart = SIZE_MAX;  // Segment bytes in front of the first speech, SIZE_MAX without speech
+    uint32_t sessionSamples = 0;    // Samples of the session taken from the ring
+    
+    while (true) {
+        if (!wasRecording) {
+            // Wait for the capture task to start a session
+            if (!captureActive && xStreamBufferIsEmpty(captureStream) == pdTRUE) {
+                xEventGroupWaitBits(app->getEventGroup(), EVENT_AUDIO_READY, pdTRUE, pdTRUE, portMAX_DELAY);
+                continue;
             }
+            vad.reset();
+            AudioDSP::reset();
+            sessionSamples = 0;
+            sessionLostSamples = 0;
+            beginSegment(block);
+            segmentBytes = 0;
+            speechStart = SIZE_MAX;
+            wasRecording = true;
+            app->log("Started audio recording");
             
-            audio.buffer = i2s.recordWAV(RECORD_TIME, &audio.size);
-            
-            if (audio.buffer == NULL || audio.size == 0) {
-                app->log("Failed to record audio: buffer is empty");
-                free(audio.buffer); // Just in case
+            // Reported once per boot, the first session is the one a button wake asked for
+            static bool wakeReported = false;
+            if (!wakeReported && firstSampleUs > 0) {
+                wakeReported = true;
+                app->log("Wake to first sample: " + String((uint32_t)(firstSampleUs / 1000)) + "ms after boot");
+            }
+        }
+        
+        // Read the session state before draining, so every byte sent before the
+        // capture task stopped is guaranteed to be collected below.
+        bool sessionEnding = !captureActive;
+        
+        // While the pool is exhausted, let the capture ring absorb the backlog until it is
+        // almost full. Only then start discarding this block.
+        if (block.handle == AudioBufferPool::NO_BUFFER && block.size == 0) {
+            block.handle = AudioBufferPool::acquire();
+            if (block.handle == AudioBufferPool::NO_BUFFER && !sessionEnding &&
+                xStreamBufferSpacesAvailable(captureStream) > 2 * AUDIO_DMA_BLOCK_SIZE) {
                 vTaskDelay(pdMS_TO_TICKS(10));
                 continue;
             }
+        }
+        
+        // Receive directly into the block buffer, or into scratch space when no buffer is available
+        static uint8_t scratch[AUDIO_DMA_BLOCK_SIZE];
+        uint8_t* blockData = AudioBufferPool::data(block.handle);
+        size_t wanted = AUDIO_WRITE_BLOCK_SIZE - block.size;
+        if (wanted > AUDIO_SEGMENT_MAX_PCM_BYTES - segmentBytes) {
+            wanted = AUDIO_SEGMENT_MAX_PCM_BYTES - segmentBytes;
+        }
+        uint8_t* dest = blockData ? blockData + block.size : scratch;
+        if (!blockData && wanted > sizeof(scratch)) {
+            wanted = sizeof(scratch);
+        }
+        size_t received = xStreamBufferReceive(captureStream, dest, wanted, pdMS_TO_TICKS(100));
+        if (received > 0 && block.size == 0) {
+            block.startTime = captureTime(sessionSamples);
+            if (segmentBytes == 0) {
+                app->formatTimestamp(block.timestamp, sizeof(block.timestamp), block.startTime);
+            }
+        }
+        block.size += received;
+        segmentBytes += received;
+        sessionSamples += received / AUDIO_SAMPLE_BYTES;
+        
+        if (received > 0) {
+            // Run the signal processing at full speed, the CPU scales down while waiting for audio
+            PowerLockGuard cpuLock(POWER_LOCK_CPU);
             
-            if (xQueueSend(audioQueue, &audio, pdMS_TO_TICKS(1000)) != pdPASS) {
-                app->log("Failed to enqueue audio buffer!");
-                free(audio.buffer);
+            // Remove DC and rumble and apply gain before the audio is analyzed and stored
+            if (DSP_ENABLED) {
+                AudioDSP::process((int16_t*)dest, received / AUDIO_SAMPLE_BYTES);
             }
-        } else {
-            // If we were recording but recording is now off, record a final chunk with "end" marker.
-            if (wasRecording) {
-                AudioBuffer audio;
-                String ts = app->getTimestamp();
-                snprintf(audio.timestamp, sizeof(audio.timestamp), "%s", ts.c_str());
-                audio.type = AudioBuffer::END;
-                audio.buffer = i2s.recordWAV(RECORD_TIME, &audio.size);
-                
-                if (audio.buffer == NULL || audio.size == 0) {
-                    app->log("Failed to record final audio: buffer is empty");
-                    wasRecording = false;
-                    free(audio.buffer); // Just in case
-                    continue;
-                }
-                
-                if (xQueueSend(audioQueue, &audio, pdMS_TO_TICKS(1000)) != pdPASS) {
-                    app->log("Failed to enqueue final audio buffer!");
-                    free(audio.buffer);
+            
+            // Mark the block if any of it is speech, the audio file task decides what to keep
+            if (VAD_ENABLED && vad.process((const int16_t*)dest, received / AUDIO_SAMPLE_BYTES)) {
+                block.voiced = true;
+                if (speechStart == SIZE_MAX) {
+                    speechStart = segmentBytes - received;
                 }
+            }
+        }
+        
+        // With VAD, end the segment at a pause once it holds SEGMENT_MIN_TIME of speech. A segment
+        // without speech ends once it is SEGMENT_MIN_TIME long, it is dropped anyway. Cutting only
+        // between received chunks keeps the segment sample aligned.
+        bool pause = false;
+        if (VAD_ENABLED && received > 0 && !vad.isVoiced()) {
+            size_t speechBytes = speechStart == SIZE_MAX ? segmentBytes : segmentBytes - speechStart;
+            pause = speechBytes >= AUDIO_SEGMENT_MIN_PCM_BYTES;
+        }
+        
+        if (segmentBytes == AUDIO_SEGMENT_MAX_PCM_BYTES || pause) {
+            // Label the segment END if the session stopped exactly on the segment boundary
+            if (!captureActive && xStreamBufferIsEmpty(captureStream) == pdTRUE) {
+                block.type = AudioBuffer::END;
+            }
+            bool ended = (block.type == AudioBuffer::END);
+            deliverBlock(block, true);
+            
+            if (ended) {
                 wasRecording = false;
+                xTaskNotifyGive(captureTaskHandle);
                 app->log("Ended audio recording");
+                continue;
             }
+            
+            // Re-check battery state at every segment boundary; this stops the capture task if it is too low
+            canRecord();
+            beginSegment(block);
+            segmentBytes = 0;
+            speechStart = SIZE_MAX;
+        } else if (block.size == AUDIO_WRITE_BLOCK_SIZE) {
+            deliverBlock(block, false);
+        } else if (sessionEnding && received == 0 && xStreamBufferIsEmpty(captureStream) == pdTRUE) {
+            // Capture stopped and the ring is drained: the remainder closes the final segment
+            block.type = AudioBuffer::END;
+            deliverBlock(block, true);
+            segmentBytes = 0;
+            wasRecording = false;
+            xTaskNotifyGive(captureTaskHandle);
+            app->log("Ended audio recording (buffer pool high-water mark " +
+                     String(AudioBufferPool::getHighWaterMark()) + "/" + String(AudioBufferPool::getBufferCount()) +
+                     ", exhausted " + String(AudioBufferPool::getExhaustionCount()) + " times)");
         }
-        vTaskDelay(pdMS_TO_TICKS(1));
     }
 }
 
+bool AudioManager::openSegmentFile(WavWriter& writer, const AudioBuffer& block, int64_t startTime,
+                                   String& segmentBase) {
+    segmentBase = String(RECORDINGS_DIR) + "/" +
+                  String(app->getBootSession()) + "_" +
+                  String(app->getAudioFileIndex()) + "_" +
+                  String(block.timestamp);
+    app->setAudioFileIndex(app->getAudioFileIndex() + 1);
+    
+    // The final position is only known when the segment closes, so the
+    // file is renamed then if it differs from this provisional one.
+    String prefix = "_";
+    if (block.type == AudioBuffer::START)
+        prefix += "start";
+    else if (block.type == AudioBuffer::END)
+        prefix += "end";
+    else
+        prefix += "middle";
+    String fileName = segmentBase + prefix + ".wav";
+    
+    if (!writer.open(fileName, AUDIO_SEGMENT_MAX_PCM_BYTES, startTime)) {
+        app->log("Failed to create audio file: " + fileName);
+        return false;
+    }
+    
+    // Remember the open file, so it can be repaired if the device resets before it is closed
+    app->overwriteFile(OPEN_RECORDING_FILE, fileName);
+    return true;
+}
+
+void AudioManager::closeSegmentFile(WavWriter& writer, const String& segmentBase, const AudioBuffer& block) {
+    String openName = writer.getPath();
+    size_t dataSize = writer.getDataSize();
+    
+    if (!writer.close()) {
+        app->log("Failed to write audio data to file: " + openName);
+        return;
+    }
+    
+    String prefix = "_";
+    if (block.type == AudioBuffer::START)
+        prefix += "start";
+    else if (block.type == AudioBuffer::END)
+        prefix += "end";
+    else if (block.type == AudioBuffer::MIDDLE)
+        prefix += "middle";
+    String fileName = segmentBase + prefix + ".wav";
+    if (fileName != openName && !app->renameFile(openName, fileName)) {
+        fileName = openName;
+    }
+    
+    if (block.overrunSamples > 0) {
+        app->log("Audio file " + fileName + " lost " + String(block.overrunSamples) + " samples to capture overruns");
+    }
+    
+    // Add to upload queue
+    if (app->addToUploadQueue(fileName)) {
+        app->log("Audio recorded, saved and added to Uploadqueue: " + fileName +
+                 " (" + String(dataSize / 1024) + "KB)");
+    } else {
+        app->log("Audio recorded, and saved. FAILED to add to Uploadqueue: " + fileName);
+    }
+    app->deleteFile(OPEN_RECORDING_FILE);
+    app->setWavFilesAvailable(true);
+}
+
+void AudioManager::recoverOpenRecording() {
+    String openName = app->readFile(OPEN_RECORDING_FILE);
+    openName.trim();
+    if (openName.length() == 0) {
+        return;
+    }
+    
+    size_t dataSize = 0;
+    if (WavWriter::recover(openName, dataSize)) {
+        app->log("Recovered interrupted recording: " + openName + " (" +
+                 String(dataSize / (SAMPLING_RATE * AUDIO_SAMPLE_BYTES)) + "s of audio)");
+        if (!app->isFileInUploadQueue(openName) && !app->addToUploadQueue(openName)) {
+            app->log("Failed to add recovered recording to Uploadqueue: " + openName);
+        }
+        app->setWavFilesAvailable(true);
+    } else {
+        app->log("Discarded interrupted recording without audio: " + openName);
+    }
+    app->deleteFile(OPEN_RECORDING_FILE);
+}
+
+void AudioManager::writeHeldBlocks(WavWriter& writer, AudioBuffer* held, int& heldCount) {
+    for (int i = 0; i < heldCount; i++) {
+        writer.append(AudioBufferPool::data(held[i].handle), held[i].size);
+        vadKeptSamples += held[i].size / AUDIO_SAMPLE_BYTES;
+        AudioBufferPool::release(held[i].handle);
+    }
+    heldCount = 0;
+}
+
+void AudioManager::discardHeldBlocks(AudioBuffer* held, int& heldCount) {
+    for (int i = 0; i < heldCount; i++) {
+        vadDroppedSamples += held[i].size / AUDIO_SAMPLE_BYTES;
+        AudioBufferPool::release(held[i].handle);
+    }
+    heldCount = 0;
+}
+
 void AudioManager::audioFileTask(void* parameter) {
     if (!initialized) {
         init();
     }
     
+    // Recording writes are handed the card before any other waiting task
+    SDScheduler::setTaskPriority(SD_PRIORITY_AUDIO);
+
+    WavWriter writer;
+    app->log("Recording audio as " + String(writer.getEncoder().getName()) + " WAV");
+    String segmentBase;
+    AudioBuffer openSegment = {};
+    bool skipSegment = false;
     AudioBuffer audio;
     
+    // Silent blocks of the current segment, written in front of speech if it starts
+    static AudioBuffer held[VAD_PREROLL_BLOCKS > 0 ? VAD_PREROLL_BLOCKS : 1];
+    int heldCount = 0;
+    uint32_t reportedSamples = 0;
+    
     while (true) {
-        while (xQueueReceive(audioQueue, &audio, pdMS_TO_TICKS(10)) == pdTRUE) {
-            String prefix = "_";
-            if (audio.type == AudioBuffer::START)
-                prefix += "start";
-            else if (audio.type == AudioBuffer::END)
-                prefix += "end";
-            else if (audio.type == AudioBuffer::MIDDLE)
-                prefix += "middle";
-                
-            String fileName = String(RECORDINGS_DIR) + "/" +
-                              String(app->getBootSession()) + "_" +
-                              String(app->getAudioFileIndex()) + "_" +
-                              String(audio.timestamp) +
-                              prefix + ".wav";
-            app->setAudioFileIndex(app->getAudioFileIndex() + 1);
-
-            // Create a binary-safe string to hold the WAV data
-            String binaryData;
-            binaryData.reserve(audio.size);  // Reserve space to avoid reallocations
+        // Blocks until the record task delivers the next block
+        while (xQueueReceive(audioQueue, &audio, portMAX_DELAY) == pdTRUE) {
+            // Blocks still waiting behind this one, a growing depth means the card falls behind
+            Metrics::observe(METRIC_AUDIO_QUEUE_DEPTH, uxQueueMessagesWaiting(audioQueue));
+            if (audio.droppedSamples > 0) {
+                app->log("Audio lost " + String(audio.droppedSamples) + " samples before block of segment " +
+                         String(audio.timestamp));
+            }
+            
+            if (audio.segmentStart) {
+                if (writer.isOpen()) {
+                    // The end of the previous segment never arrived, close it as it is
+                    closeSegmentFile(writer, segmentBase, openSegment);
+                }
+                discardHeldBlocks(held, heldCount);
+                skipSegment = false;
+            }
             
-            // Manually copy binary data to the String 
-            for (size_t i = 0; i < audio.size; i++) {
-                binaryData += (char)audio.buffer[i];
+            // Open the file once the segment turns out to contain speech
+            bool voiced = audio.voiced || !VAD_ENABLED;
+            if (audio.size > 0 && voiced && !writer.isOpen() && !skipSegment) {
+                openSegment = audio;
+                // The held pre-roll goes in front of this block
+                int64_t startTime = heldCount > 0 ? held[0].startTime : audio.startTime;
+                skipSegment = !openSegmentFile(writer, audio, startTime, segmentBase);
+                if (writer.isOpen()) {
+                    writeHeldBlocks(writer, held, heldCount);
+                }
             }
             
-            // Write the binary data to file using Application wrapper
-            if (app->overwriteFile(fileName, binaryData)) {
-                // Add to upload queue
-                if (app->addToUploadQueue(fileName)) {
-                    app->log("Audio recorded, saved and added to Uploadqueue: " + fileName);
-                } else {
-                    app->log("Audio recorded, and saved. FAILED to add to Uploadqueue: " + fileName);
+            if (audio.size > 0 && writer.isOpen()) {
+                // Stream the block straight from the pool buffer to the card
+                writer.append(AudioBufferPool::data(audio.handle), audio.size);
+                vadKeptSamples += audio.size / AUDIO_SAMPLE_BYTES;
+                AudioBufferPool::release(audio.handle);
+            } else if (audio.size > 0 && !skipSegment && VAD_PREROLL_BLOCKS > 0) {
+                // Silence so far: hold the block as pre-roll, replacing the oldest one
+                if (heldCount == VAD_PREROLL_BLOCKS) {
+                    vadDroppedSamples += held[0].size / AUDIO_SAMPLE_BYTES;
+                    AudioBufferPool::release(held[0].handle);
+                    memmove(held, held + 1, sizeof(AudioBuffer) * (VAD_PREROLL_BLOCKS - 1));
+                    heldCount--;
                 }
-                app->setWavFilesAvailable(true);
+                held[heldCount++] = audio;
             } else {
-                app->log("Failed to write audio data to file: " + fileName);
+                vadDroppedSamples += audio.size / AUDIO_SAMPLE_BYTES;
+                AudioBufferPool::release(audio.handle);
             }
             
-            free(audio.buffer);
+            if (audio.segmentEnd) {
+                // Session markers are always kept, a silent one shrinks to its pre-roll
+                bool marker = (audio.type == AudioBuffer::START || audio.type == AudioBuffer::END);
+                if (!writer.isOpen() && !skipSegment && marker && heldCount > 0) {
+                    openSegment = held[0];
+                    if (openSegmentFile(writer, audio, held[0].startTime, segmentBase)) {
+                        writeHeldBlocks(writer, held, heldCount);
+                    }
+                }
+                
+                if (writer.isOpen()) {
+                    closeSegmentFile(writer, segmentBase, audio);
+                    vadKeptSegments++;
+                } else {
+                    discardHeldBlocks(held, heldCount);
+                    if (!skipSegment) {
+                        vadDroppedSegments++;
+                        app->log("Dropped silent audio segment " + String(audio.timestamp));
+                    }
+                }
+                
+                if (audio.type == AudioBuffer::END && VAD_ENABLED) {
+                    app->log("VAD kept " + String(vadKeptSegments) + " segments (" +
+                             String(vadKeptSamples / SAMPLING_RATE) + "s), dropped " +
+                             String(vadDroppedSegments) + " segments (" +
+                             String(vadDroppedSamples / SAMPLING_RATE) + "s) since boot");
+                }
+                
+                // Report the SD time of the session against the audio it recorded
+                if (audio.type == AudioBuffer::END) {
+                    uint32_t samples = vadKeptSamples + vadDroppedSamples;
+                    app->logFileSystemStats((uint64_t)(samples - reportedSamples) * 1000 / SAMPLING_RATE);
+                    reportedSamples = samples;
+                }
+            }
         }
-
-        vTaskDelay(pdMS_TO_TICKS(10));
     }
 }
 
+TaskHandle_t AudioManager::getCaptureTaskHandle() {
+    return captureTaskHandle;
+}
+
 TaskHandle_t AudioManager::getRecordAudioTaskHandle() {
     return recordAudioTaskHandle;
 }
@@ -296,18 +741,39 @@ TaskHandle_t AudioManager::getAudioFileTaskHandle() {
 }
 
 bool AudioManager::isRecordingActive() {
-    return wasRecording;
+    return wasRecording || captureActive;
 }
 
-I2SClass* AudioManager::getI2S() {
-    return &i2s;
+uint32_t AudioManager::getVadKeptSampleCount() {
+    return vadKeptSamples;
 }
 
-uint8_t* AudioManager::recordWAV(unsigned long recordTimeMs, size_t* size) {
-    if (!initialized) {
-        init();
-    }
-    return i2s.recordWAV(recordTimeMs, size);
+uint32_t AudioManager::getVadDroppedSampleCount() {
+    return vadDroppedSamples;
+}
+
+uint32_t AudioManager::getVadKeptSegmentCount() {
+    return vadKeptSegments;
+}
+
+uint32_t AudioManager::getVadDroppedSegmentCount() {
+    return vadDroppedSegments;
+}
+
+uint32_t AudioManager::getOverrunSampleCount() {
+    return overrunSamples;
+}
+
+uint32_t AudioManager::getDroppedSampleCount() {
+    return droppedSamples;
+}
+
+uint32_t AudioManager::getReadErrorCount() {
+    return readErrors;
+}
+
+I2SClass* AudioManager::getI2S() {
+    return &i2s;
 }
 
 QueueHandle_t AudioManager::getAudioQueue() {
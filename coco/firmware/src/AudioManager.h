@@ -5,6 +5,25 @@
  * This class handles I2S microphone initialization, audio recording,
  * and saving recordings to the file system. It follows a singleton pattern
  * and manages audio recording tasks.
+ *
+ * Capture runs as a two stage pipeline: a reader task continuously drains the
+ * I2S DMA into a ring buffer in PSRAM, and the recording task cuts that stream
+ * into START/MIDDLE/END segments, so no samples are lost between segments.
+ * With VAD a segment ends at the first pause after SEGMENT_MIN_TIME of
+ * speech, or at SEGMENT_MAX_TIME, so sentences are not split; segments
+ * without speech end after SEGMENT_MIN_TIME. Without VAD every segment
+ * is RECORD_TIME long.
+ * Segments are handed to the audio file task in small blocks and streamed to
+ * the SD card as they arrive, so memory use does not depend on the segment length.
+ *
+ * Every block carries the wall-clock time of its first sample. The capture
+ * task anchors a session at its first I2S read, the recording task counts
+ * the samples it takes from the ring plus the ones lost to overruns, so the
+ * start times stay sample accurate over any session length.
+ *
+ * init() and startRecordingTask() do not touch the SD card, so capture can
+ * run right after a button wake. Until startAudioFileTask() is called, once
+ * storage is mounted, the ring and the audio queue hold the audio.
  */
 
 #ifndef AUDIO_MANAGER_H
@@ -15,10 +34,29 @@
 // ESP libraries
 #include <Arduino.h>
 #include <ESP_I2S.h>
+#include <freertos/stream_buffer.h>
 
 // Project includes
 #include "config.h"
 #include "Application.h"
+#include "WavWriter.h"
+#include "VoiceActivityDetector.h"
+
+// PCM payload of the longest segment, and the speech a segment needs before it may end at a pause
+#define AUDIO_SEGMENT_MAX_PCM_BYTES \
+    ((size_t)(VAD_ENABLED ? SEGMENT_MAX_TIME : RECORD_TIME) * SAMPLING_RATE * AUDIO_SAMPLE_BYTES)
+#define AUDIO_SEGMENT_MIN_PCM_BYTES ((size_t)SEGMENT_MIN_TIME * SAMPLING_RATE * AUDIO_SAMPLE_BYTES)
+
+// One block per queue slot, the one being filled by the recording task and the VAD pre-roll
+#define AUDIO_POOL_BUFFER_COUNT (AUDIO_QUEUE_SIZE + 1 + VAD_PREROLL_BLOCKS)
+
+/**
+ * @brief Samples the capture task dropped at one position of the session
+ */
+struct CaptureGap {
+    uint32_t position;  ///< Samples of the session sent to the ring before the gap
+    uint32_t samples;   ///< Samples dropped
+};
 
 class AudioManager {
 public:
@@ -31,17 +69,29 @@ public:
     
     // Recording task management
     /**
-     * @brief Start the audio recording task
-     * @return true if task started successfully, false otherwise
+     * @brief Start the I2S capture task and the audio recording (segmenting) task
+     * @return true if both tasks started successfully, false otherwise
      */
     static bool startRecordingTask();
     
     /**
-     * @brief Record audio in a dedicated task
+     * @brief Continuously drain the I2S DMA into the capture ring buffer
+     * @param parameter Task parameters (unused)
+     */
+    static void captureTask(void* parameter);
+    
+    /**
+     * @brief Cut the captured audio stream into chunks in a dedicated task
      * @param parameter Task parameters (unused)
      */
     static void recordAudioTask(void* parameter);
     
+    /**
+     * @brief Get the handle for the I2S capture task
+     * @return TaskHandle_t for the capture task
+     */
+    static TaskHandle_t getCaptureTaskHandle();
+    
     /**
      * @brief Get the handle for the audio recording task
      * @return TaskHandle_t for the recording task
@@ -50,7 +100,7 @@ public:
     
     // Audio file management
     /**
-     * @brief Start the audio file handling task
+     * @brief Repair an interrupted recording and start the audio file handling task, the SD card must be mounted
      * @return true if task started successfully, false otherwise
      */
     static bool startAudioFileTask();
@@ -68,14 +118,6 @@ public:
     static TaskHandle_t getAudioFileTaskHandle();
 
     // Audio recording operations
-    /**
-     * @brief Record WAV audio for the specified duration
-     * @param recordTimeMs Time to record in milliseconds
-     * @param size Pointer to store the size of the recorded data
-     * @return Pointer to buffer containing recorded WAV data (must be freed by caller)
-     */
-    static uint8_t* recordWAV(unsigned long recordTimeMs, size_t* size);
-    
     /**
      * @brief Check if audio recording is currently active
      * @return true if recording is active, false otherwise
@@ -94,6 +136,50 @@ public:
      */
     static bool canRecord();
     
+    // Capture statistics
+    /**
+     * @brief Get the total number of samples lost because the capture ring was full
+     * @return Overrun sample count since boot
+     */
+    static uint32_t getOverrunSampleCount();
+    
+    /**
+     * @brief Get the total number of captured samples that could not be delivered as a chunk
+     * @return Dropped sample count since boot
+     */
+    static uint32_t getDroppedSampleCount();
+    
+    /**
+     * @brief Get the number of I2S reads that returned no data
+     * @return Failed read count since boot
+     */
+    static uint32_t getReadErrorCount();
+    
+    // Voice activity statistics
+    /**
+     * @brief Get the number of samples written to SD since boot
+     * @return Kept sample count
+     */
+    static uint32_t getVadKeptSampleCount();
+    
+    /**
+     * @brief Get the number of samples discarded as silence since boot
+     * @return Dropped sample count
+     */
+    static uint32_t getVadDroppedSampleCount();
+    
+    /**
+     * @brief Get the number of segments saved since boot
+     * @return Kept segment count
+     */
+    static uint32_t getVadKeptSegmentCount();
+    
+    /**
+     * @brief Get the number of silent segments that were not saved since boot
+     * @return Dropped segment count
+     */
+    static uint32_t getVadDroppedSegmentCount();
+    
     // I2S management
     /**
      * @brief Initialize the I2S interface for audio recording
@@ -143,17 +229,103 @@ private:
     static bool initialized;
     static Application* app;
     static I2SClass i2s;
+    static TaskHandle_t captureTaskHandle;
     static TaskHandle_t recordAudioTaskHandle;
     static TaskHandle_t audioFileTaskHandle;
     static volatile bool isRecording;
     
     // Audio recording state
     static volatile bool wasRecording;
+    static volatile bool captureActive;
     static unsigned long lastRecordStart;
     
+    // Capture ring buffer (storage lives in PSRAM)
+    static StreamBufferHandle_t captureStream;
+    static StaticStreamBuffer_t captureStreamStruct;
+    static uint8_t* captureStreamStorage;
+    
+    // Capture statistics
+    static volatile uint32_t overrunSamples;
+    static volatile uint32_t droppedSamples;
+    static volatile uint32_t readErrors;
+    static volatile int64_t firstSampleUs;  // Time of the first I2S read since boot, for the wake latency
+    
+    // Timeline of the capture session, for the block start times
+    static volatile int64_t sessionStartUs;   // esp_timer time of the first sample of the session, 0 before it
+    static QueueHandle_t captureGaps;         // Overruns of the session in stream order, CaptureGap entries
+    static uint32_t sessionLostSamples;       // Overrun samples in front of the recording task's position
+    
+    // Voice activity detection on the capture stream and its statistics
+    static VoiceActivityDetector vad;
+    static volatile uint32_t vadKeptSamples;
+    static volatile uint32_t vadDroppedSamples;
+    static volatile uint32_t vadKeptSegments;
+    static volatile uint32_t vadDroppedSegments;
+    
     // Audio queue and file index
     static QueueHandle_t audioQueue;
     static int audioFileIndex;
+    
+    // Start of the overrun counter for the segment being recorded
+    static uint32_t segmentOverrunStart;
+    
+    /**
+     * @brief Get the wall-clock time of a sample of the capture session (recording task only)
+     * @param position Samples of the session taken from the ring before it
+     * @return Microseconds since the epoch
+     */
+    static int64_t captureTime(uint32_t position);
+    
+    /**
+     * @brief Stamp the next block as the first of a new segment
+     * @param block Block to prepare
+     */
+    static void beginSegment(AudioBuffer& block);
+    
+    /**
+     * @brief Hand a block to the audio file task and reset it for the next one
+     * @param block Block to deliver
+     * @param segmentEnd true if this block completes its segment
+     */
+    static void deliverBlock(AudioBuffer& block, bool segmentEnd);
+    
+    /**
+     * @brief Create the WAV file for the segment a block belongs to
+     * @param writer Writer to open
+     * @param block First block with audio of the segment
+     * @param startTime Wall-clock time of the first sample written to the file
+     * @param segmentBase Receives the segment path without its position suffix
+     * @return true if the file was created, false otherwise
+     */
+    static bool openSegmentFile(WavWriter& writer, const AudioBuffer& block, int64_t startTime, String& segmentBase);
+    
+    /**
+     * @brief Finalize the open segment file and add it to the upload queue
+     * @param writer Writer holding the open file
+     * @param segmentBase Segment path without its position suffix
+     * @param block Block that carries the final position and statistics of the segment
+     */
+    static void closeSegmentFile(WavWriter& writer, const String& segmentBase, const AudioBuffer& block);
+    
+    /**
+     * @brief Write an open segment's held pre-roll blocks and return them to the pool
+     * @param writer Writer holding the open file
+     * @param held Blocks waiting for voice activity
+     * @param heldCount Number of held blocks, reset to 0
+     */
+    static void writeHeldBlocks(WavWriter& writer, AudioBuffer* held, int& heldCount);
+    
+    /**
+     * @brief Return held pre-roll blocks to the pool without writing them
+     * @param held Blocks waiting for voice activity
+     * @param heldCount Number of held blocks, reset to 0
+     */
+    static void discardHeldBlocks(AudioBuffer* held, int& heldCount);
+    
+    /**
+     * @brief Repair and queue the recording that was open when the device last reset
+     */
+    static void recoverOpenRecording();
 };
 
 #endif // AUDIO_MANAGER_H
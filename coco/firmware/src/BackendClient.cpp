@@ -3,26 +3,36 @@
  * @brief Implementation of the BackendClient class
  *
  * This file contains the implementation of all BackendClient methods,
- * including background task functions for file uploads and backend
- * connectivity monitoring.
+ * including the upload task and the backend health state machine.
  */
 
 #include <HTTPClient.h>
 #include <WiFi.h>
+#include <WiFiClientSecure.h>
 
 #include "BackendClient.h"
+#include "UploadScheduler.h"
+#include "AudioEncoder.h"
+#include "Metrics.h"
+#include "PowerManager.h"
+#include "SDScheduler.h"
 
 // Initialize static variables
 bool BackendClient::initialized = false;
 TaskHandle_t BackendClient::uploadTaskHandle = nullptr;
-TaskHandle_t BackendClient::reachabilityTaskHandle = nullptr;
 Application* BackendClient::app = nullptr;
 SemaphoreHandle_t BackendClient::uploadMutex = nullptr;
 unsigned long BackendClient::nextBackendCheckTime = 0;
 unsigned long BackendClient::currentBackendInterval = MIN_SCAN_INTERVAL;
-uint8_t* BackendClient::uploadBuffer = nullptr;
+UploadStream* BackendClient::uploadStream = nullptr;
 int BackendClient::consecutiveUploadFailures = 0;
-bool BackendClient::shouldRestartReachabilityTask = false;
+volatile BackendClient::HealthState BackendClient::healthState = BackendClient::HEALTH_UNKNOWN;
+volatile bool BackendClient::connectionStale = false;
+WiFiClient* BackendClient::connectionClient = nullptr;
+HTTPClient* BackendClient::httpClient = nullptr;
+String BackendClient::connectionHost = "";
+uint16_t BackendClient::connectionPort = 0;
+BackendClient::ConnectionStats BackendClient::connectionStats = {};
 
 bool BackendClient::init(Application* application) {
     // Check if already initialized
@@ -48,20 +58,37 @@ bool BackendClient::init(Application* application) {
         return false;
     }
     
-    // Allocate fixed buffer in PSRAM
-    uploadBuffer = (uint8_t*)heap_caps_malloc(UPLOAD_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
-    if (!uploadBuffer) {
-        app->log("BackendClient: Failed to allocate PSRAM for upload buffer");
+    // Uploads are streamed from the card one block at a time
+    uploadStream = new UploadStream();
+    if (!uploadStream || !uploadStream->begin()) {
+        app->log("BackendClient: Failed to start upload stream");
         return false;
     }
-    app->log("BackendClient: Allocated " + String(UPLOAD_BUFFER_SIZE / 1024) + "KB PSRAM buffer for uploads");
+    
+    // Create the long-lived connection, https endpoints get a TLS client
+    if (String(API_ENDPOINT).startsWith("https://")) {
+        WiFiClientSecure* secureClient = new WiFiClientSecure();
+#ifdef BACKEND_CA_CERT
+        secureClient->setCACert(BACKEND_CA_CERT);
+#else
+        secureClient->setInsecure();
+        app->log("BackendClient: No BACKEND_CA_CERT set, the server certificate is not verified");
+#endif
+        connectionClient = secureClient;
+    } else {
+        connectionClient = new WiFiClient();
+    }
+    httpClient = new HTTPClient();
+    httpClient->setReuse(true);
+    httpClient->setTimeout(HTTP_TIMEOUT);
+    httpClient->setConnectTimeout(HTTP_TIMEOUT);
     
     nextBackendCheckTime = 0;
     currentBackendInterval = MIN_SCAN_INTERVAL;
     
     // Initialize failure counter
     consecutiveUploadFailures = 0;
-    shouldRestartReachabilityTask = false;
+    healthState = HEALTH_UNKNOWN;
     
     app->log("BackendClient: Initialized");
     initialized = true;
@@ -97,67 +124,13 @@ bool BackendClient::startUploadTask() {
     }
     
     app->log("BackendClient: File upload task started");
-    
-    // Reset failure counter when starting upload task
-    resetConsecutiveUploadFailures();
-    
-    return true;
-}
-
-bool BackendClient::startReachabilityTask() {
-    if (!initialized) {
-        app->log("BackendClient: Not initialized, can't start reachability task");
-        return false;
-    }
-    
-    // Create the backend reachability check task
-    BaseType_t result = xTaskCreatePinnedToCore(
-        backendReachabilityTaskFunction,
-        "BackendCheck",
-        4096,
-        nullptr,
-        1,
-        &reachabilityTaskHandle,
-        0 // Core 0
-    );
-    
-    if (result != pdPASS) {
-        app->log("BackendClient: Failed to create backend reachability task");
-        return false;
-    }
-    
-    app->log("BackendClient: Backend reachability task started");
     return true;
 }
 
-bool BackendClient::stopUploadTask() {
-    if (uploadTaskHandle != nullptr) {
-        app->log("BackendClient: Stopping file upload task");
-        vTaskDelete(uploadTaskHandle);
-        uploadTaskHandle = nullptr;
-        return true;
-    }
-    return false;  // Task wasn't running
-}
-
-bool BackendClient::stopReachabilityTask() {
-    if (reachabilityTaskHandle != nullptr) {
-        app->log("BackendClient: Stopping backend reachability task");
-        vTaskDelete(reachabilityTaskHandle);
-        reachabilityTaskHandle = nullptr;
-        return true;
-    }
-    return false;  // Task wasn't running
-}
-
 TaskHandle_t BackendClient::getUploadTaskHandle() {
     return uploadTaskHandle;
 }
 
-TaskHandle_t BackendClient::getReachabilityTaskHandle() {
-    return reachabilityTaskHandle;
-}
-
 SemaphoreHandle_t BackendClient::getUploadMutex() {
     return uploadMutex;
 }
@@ -190,11 +163,10 @@ void BackendClient::uploadFile(const String& filename) {
 bool BackendClient::isBatteryOkForUpload() {
     if (!app) return false;
     
-    float batteryVoltage = app->getBatteryVoltage();
-    bool isOk = batteryVoltage >= BATTERY_UPLOAD_THRESHOLD;
+    bool isOk = app->isBatteryOkForUpload();
     
     if (!isOk) {
-        app->log("Battery voltage too low for upload: " + String(batteryVoltage) + "V (threshold: " + 
+        app->log("Battery voltage too low for upload: " + String(app->getBatteryVoltage()) + "V (threshold: " + 
                 String(BATTERY_UPLOAD_THRESHOLD) + "V)");
     }
     
@@ -204,85 +176,95 @@ bool BackendClient::isBatteryOkForUpload() {
 bool BackendClient::canUploadFiles() {
     if (!app) return false;
     
-    // Check all conditions required for file upload
+    // Check all conditions required for file upload, an unknown backend is tried right away
     bool wifiConnected = app->isWifiConnected();
-    bool backendReachable = app->isBackendReachable();
+    bool backendAvailable = healthState != HEALTH_UNREACHABLE || (long)(millis() - nextBackendCheckTime) >= 0;
     bool filesInQueue = app->hasWavFilesAvailable();
     bool batteryOk = isBatteryOkForUpload();
     
-    bool canUpload = wifiConnected && backendReachable && filesInQueue && batteryOk;
+    bool canUpload = wifiConnected && backendAvailable && filesInQueue && batteryOk;
 
     return canUpload;
 }
 
-bool BackendClient::shouldStartUploadTask() {
-    // Only start the upload task if these conditions are met:
-    // 1. Backend is reachable
-    // 2. WiFi is connected
-    // 3. There are files to upload
-    // 4. Battery is sufficient for upload
-    return app->isBackendReachable() && 
-           app->isWifiConnected() && 
-           isBatteryOkForUpload();
-}
-
 int BackendClient::getConsecutiveUploadFailures() {
     return consecutiveUploadFailures;
 }
 
-void BackendClient::resetConsecutiveUploadFailures() {
+BackendClient::HealthState BackendClient::getHealthState() {
+    return healthState;
+}
+
+void BackendClient::resetHealth() {
+    healthState = HEALTH_UNKNOWN;
+    consecutiveUploadFailures = 0;
+    currentBackendInterval = MIN_SCAN_INTERVAL;
+    connectionStale = true;
+    if (app) {
+        app->setBackendReachable(false);
+    }
+}
+
+void BackendClient::reportSuccess() {
+    if (healthState != HEALTH_HEALTHY) {
+        app->log("BackendClient: Backend is reachable");
+    }
+    healthState = HEALTH_HEALTHY;
     consecutiveUploadFailures = 0;
+    currentBackendInterval = MIN_SCAN_INTERVAL;
+    app->setBackendReachable(true);
 }
 
-void BackendClient::incrementConsecutiveUploadFailures() {
+void BackendClient::reportFailure() {
+    // A request cut off by a WiFi drop says nothing about the backend
+    if (!app->isWifiConnected()) {
+        return;
+    }
+    
     consecutiveUploadFailures++;
+    if (healthState == HEALTH_UNREACHABLE) {
+        return;
+    }
     
-    // Check if we've reached the maximum allowed failures
-    if (consecutiveUploadFailures >= MAX_CONSECUTIVE_UPLOAD_FAILURES) {
-        app->log("BackendClient: Too many consecutive upload failures (" + 
-                 String(consecutiveUploadFailures) + ")");
-        
-        // Reset backend status 
-        app->setBackendReachable(false);
-        
-        // Trigger immediate backend check
-        setNextBackendCheckTime(millis());
-        setCurrentBackendInterval(MIN_SCAN_INTERVAL);
-        
-        // Restart reachability task if it's not already running
-        if (reachabilityTaskHandle == nullptr) {
-            app->log("BackendClient: Starting reachability task to check backend");
-            if (startReachabilityTask()) {
-                app->log("BackendClient: Reachability task started successfully");
-            } else {
-                app->log("BackendClient: Failed to start reachability task");
-            }
-        } else {
-            app->log("BackendClient: Reachability task already running");
-        }
-        
-        // Stop the upload task
-        if (uploadTaskHandle != nullptr) {
-            app->log("BackendClient: Stopping upload task due to consecutive failures");
-            vTaskDelete(uploadTaskHandle);
-            uploadTaskHandle = nullptr;
-            app->setUploadTaskHandle(nullptr);
-            app->log("BackendClient: Upload task stopped");
-        }
-        
-        // Reset flag since we've handled the restart
-        shouldRestartReachabilityTask = false;
+    if (consecutiveUploadFailures < MAX_CONSECUTIVE_UPLOAD_FAILURES) {
+        healthState = HEALTH_DEGRADED;
+        return;
     }
+    
+    // Stop uploading, the upload task probes the backend once the backoff has passed
+    app->log("BackendClient: Too many consecutive upload failures (" + 
+             String(consecutiveUploadFailures) + "), backend marked unreachable");
+    healthState = HEALTH_UNREACHABLE;
+    app->setBackendReachable(false);
+    setNextBackendCheckTime(millis() + currentBackendInterval);
+}
+
+bool BackendClient::probeBackend() {
+    app->log("Checking backend reachability...");
+    if (checkBackendReachability()) {
+        reportSuccess();
+        return true;
+    }
+    
+    // Apply exponential backoff for next check
+    unsigned long newInterval = std::min(currentBackendInterval * 2UL, (unsigned long)MAX_SCAN_INTERVAL);
+    setCurrentBackendInterval(newInterval);
+    setNextBackendCheckTime(millis() + newInterval);
+    app->log("Backend is not reachable, next check in " + String(newInterval / 1000) + " seconds");
+    return false;
 }
 
 void BackendClient::fileUploadTaskFunction(void* parameter) {
-    // Check if uploadBuffer was properly allocated in PSRAM
-    if (!uploadBuffer) {
-        app->log("ERROR: Upload buffer was not allocated in PSRAM. Terminating upload task.");
+    // Check if the upload stream was allocated
+    if (!uploadStream) {
+        app->log("ERROR: Upload stream was not allocated. Terminating upload task.");
         vTaskDelete(nullptr);
         return;
     }
 
+    // Queue bookkeeping of the upload gives way to recording and logs
+    SDScheduler::setTaskPriority(SD_PRIORITY_UPLOAD);
+
     // Unsubscribe from the watchdog timer
     esp_err_t err = esp_task_wdt_delete(NULL); 
     if (err == ESP_OK) {
@@ -292,130 +274,347 @@ void BackendClient::fileUploadTaskFunction(void* parameter) {
     }
 
     while (true) {
-        // Check if all conditions for upload are met
-        if (canUploadFiles()) {
-            // Check if we're already uploading
-            if (xSemaphoreTake(uploadMutex, 0) == pdTRUE) {
-                app->setUploadInProgress(true);
-                
+        // Sleep until WiFi is up and a file is queued
+        const EventBits_t required = EVENT_WIFI_CONNECTED | EVENT_UPLOAD_PENDING;
+        xEventGroupWaitBits(app->getEventGroup(), required, pdFALSE, pdTRUE, portMAX_DELAY);
+        
+        // The connection of a previous WiFi session is dead
+        if (connectionStale) {
+            connectionStale = false;
+            closeConnection();
+        }
+        
+        if (!isBatteryOkForUpload()) {
+            vTaskDelay(pdMS_TO_TICKS(UPLOAD_CHECK_INTERVAL));
+            continue;
+        }
+        
+        // After repeated failures only a probe, once the backoff has passed, resumes uploads
+        if (healthState == HEALTH_UNREACHABLE) {
+            long wait = (long)(nextBackendCheckTime - millis());
+            if (wait > 0) {
+                vTaskDelay(pdMS_TO_TICKS(std::min(wait, (long)UPLOAD_CHECK_INTERVAL)));
+                continue;
+            }
+            if (!probeBackend()) {
+                continue;
+            }
+        }
+        
+        bool uploaded = false;
+        bool failed = false;
+        
+        // Check if we're already uploading
+        if (xSemaphoreTake(uploadMutex, 0) == pdTRUE) {
+            app->setUploadInProgress(true);
+            
+            if (UPLOAD_BATCH_ENABLED) {
+                int acknowledged = uploadNextBatch();
+                if (acknowledged > 0) {
+                    // More files may be waiting
+                    uploaded = true;
+                } else if (acknowledged < 0) {
+                    failed = true;
+                } else if (app->getNextUploadFile().length() == 0) {
+                    // No files in queue
+                    app->setWavFilesAvailable(false);
+                    app->log("No files in upload queue");
+                    logConnectionStats();
+                }
+            } else {
                 // Get the next file to upload from queue
                 String nextFile = app->getNextUploadFile();
-                
+            
                 if (nextFile.length() > 0) {
                     app->log("Processing next file from queue: " + nextFile);
-                    
-                    // Read file into fixed PSRAM buffer
+                
                     size_t fileSize = 0;
+                
+                    bool sized = app->getFileSize(nextFile, fileSize);
+                    if (sized && fileSize > 0) {
+                        // Stream the file straight from the card
+                        app->log("Uploading file: " + nextFile + " (" + String(fileSize) + " bytes)");
+                        int responseCode = uploadSingleFile(nextFile, fileSize);
                     
-                    if (app->readFileToFixedBuffer(nextFile, uploadBuffer, UPLOAD_BUFFER_SIZE, fileSize)) {
-                        // Upload the file from fixed buffer
-                        app->log("Uploading file from fixed buffer: " + nextFile + " (" + String(fileSize) + " bytes)");
-                        bool uploadSuccess = uploadFileFromBuffer(fileSize, nextFile);
-                        
-                        // If upload was successful, delete the file and remove from queue
-                        if (uploadSuccess) {
-                            if (app->deleteFile(nextFile)) {
-                                app->log("File deleted: " + nextFile);
-                            } else {
-                                app->log("Failed to delete file: " + nextFile);
-                            }
-                            
-                            // Remove from queue
+                        // If upload was successful, remove from queue and delete the file
+                        if (responseCode == HTTP_CODE_OK || responseCode == HTTP_CODE_CREATED) {
+                            // Retired first, the reconciler must find it in the queue or the deletions
+                            retireUploadedFile(nextFile);
+                            app->removeFirstFromUploadQueue();
+                            UploadScheduler::recordUpload(1, fileSize);
+                            uploaded = true;
+                        } else if (isPermanentRejection(responseCode)) {
+                            // Sent again it would block every file queued behind it
                             app->removeFirstFromUploadQueue();
-                            
-                            // Reset failure counter on success
-                            resetConsecutiveUploadFailures();
+                            quarantineFile(nextFile);
+                            uploaded = true;
                         } else {
                             app->log("Upload failed for: " + nextFile);
-                            
-                            // Track consecutive failures
-                            incrementConsecutiveUploadFailures();
+                            failed = true;
                         }
+                    } else if (sized) {
+                        // Deleted after an upload but before its queue entry was removed
+                        app->log("Dropping missing file from upload queue: " + nextFile);
+                        app->removeFirstFromUploadQueue();
+                        uploaded = true;
                     } else {
-                        app->log("Failed to read file into buffer: " + nextFile);
-                        
-                        // Count file read errors as upload failures too
-                        incrementConsecutiveUploadFailures();
+                        app->log("Failed to read file size: " + nextFile);
+                        failed = true;
                     }
                 } else {
                     // No files in queue
                     app->setWavFilesAvailable(false);
                     app->log("No files in upload queue");
+                    logConnectionStats();
                 }
-                
-                app->setUploadInProgress(false);
-                xSemaphoreGive(uploadMutex);
             }
+            
+            app->setUploadInProgress(false);
+            xSemaphoreGive(uploadMutex);
         }
         
-        vTaskDelay(pdMS_TO_TICKS(UPLOAD_CHECK_INTERVAL));
+        // While a backlog drains, go straight on to the next request
+        if (uploaded) {
+            vTaskDelay(1);
+        } else if (failed || app->hasWavFilesAvailable()) {
+            // The request already updated the backend health, retry after the check interval
+            vTaskDelay(pdMS_TO_TICKS(UPLOAD_CHECK_INTERVAL));
+        }
     }
 }
 
-bool BackendClient::uploadFileFromBuffer(size_t size, const String& filename) {
-    if (size == 0 || !uploadBuffer) {
-        return false;
+int BackendClient::uploadSingleFile(const String& filename, size_t size) {
+    // Extract just the filename without the path for the request
+    String bareFilename = filename.substring(filename.lastIndexOf('/') + 1);
+    
+    // The Content-Type depends on the codec named in the WAV header
+    uint8_t header[WAV_IMA_ADPCM_HEADER_SIZE];
+    uploadStream->clear();
+    uploadStream->addFile(filename, size);
+    size_t headerSize = uploadStream->readBytes((char*)header, sizeof(header));
+    const char* contentType = AudioEncoder::contentTypeForWav(header, headerSize);
+    
+    String response;
+    return postUploadStream(contentType, bareFilename, response);
+}
+
+int BackendClient::uploadNextBatch() {
+    String paths[UPLOAD_BATCH_MAX_FILES];
+    uint32_t ids[UPLOAD_BATCH_MAX_FILES];
+    size_t count = app->getNextUploadFiles(paths, ids, UPLOAD_BATCH_MAX_FILES);
+    if (count == 0 || !uploadStream) {
+        return 0;
+    }
+    
+    // Pick the files of this batch, at least one however large it is
+    String names[UPLOAD_BATCH_MAX_FILES];
+    size_t sizes[UPLOAD_BATCH_MAX_FILES];
+    size_t packedIndex[UPLOAD_BATCH_MAX_FILES];
+    size_t packed = 0;
+    size_t bodySize = UPLOAD_BATCH_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        size_t fileSize = 0;
+        if (!app->getFileSize(paths[i], fileSize)) {
+            if (packed == 0) {
+                return -1;
+            }
+            break;
+        }
+        if (fileSize == 0) {
+            // Deleted after an upload but before its queue entry was removed
+            app->log("Dropping missing file from upload queue: " + paths[i]);
+            app->removeFromUploadQueue(ids[i]);
+            continue;
+        }
+        
+        String name = paths[i].substring(paths[i].lastIndexOf('/') + 1);
+        size_t entrySize = UPLOAD_BATCH_ENTRY_HEADER_SIZE + name.length() + fileSize;
+        if (packed > 0 && bodySize + entrySize > UPLOAD_BATCH_MAX_BYTES) {
+            break;
+        }
+        
+        names[packed] = name;
+        sizes[packed] = fileSize;
+        packedIndex[packed] = i;
+        packed++;
+        bodySize += entrySize;
+    }
+    
+    if (packed == 0) {
+        return 0;
+    }
+    
+    // Describe the body as headers and file parts, the file data is read while sending
+    uint8_t batchHeader[UPLOAD_BATCH_HEADER_SIZE] = {0};
+    memcpy(batchHeader, UPLOAD_BATCH_MAGIC, 4);
+    batchHeader[4] = packed & 0xFF;
+    batchHeader[5] = (packed >> 8) & 0xFF;
+    uploadStream->clear();
+    uploadStream->addBytes(batchHeader, sizeof(batchHeader));
+    for (size_t i = 0; i < packed; i++) {
+        uint8_t entry[UPLOAD_BATCH_ENTRY_HEADER_SIZE];
+        entry[0] = names[i].length() & 0xFF;
+        entry[1] = (names[i].length() >> 8) & 0xFF;
+        entry[2] = sizes[i] & 0xFF;
+        entry[3] = (sizes[i] >> 8) & 0xFF;
+        entry[4] = (sizes[i] >> 16) & 0xFF;
+        entry[5] = (sizes[i] >> 24) & 0xFF;
+        if (!uploadStream->addBytes(entry, sizeof(entry)) ||
+            !uploadStream->addBytes((const uint8_t*)names[i].c_str(), names[i].length()) ||
+            !uploadStream->addFile(paths[packedIndex[i]], sizes[i])) {
+            app->log("BackendClient: Batch does not fit the upload stream");
+            return -1;
+        }
+    }
+    
+    app->log("Uploading batch of " + String(packed) + " file(s) (" + String(uploadStream->size()) + " bytes)");
+    String response;
+    int responseCode = postUploadStream(UPLOAD_BATCH_CONTENT_TYPE, "", response);
+    if (responseCode != HTTP_CODE_OK && responseCode != HTTP_CODE_CREATED) {
+        app->log("Batch upload failed");
+        return -1;
+    }
+
+    // Only files listed in the "acknowledged" array were stored by the backend
+    int listStart = response.indexOf("\"acknowledged\"");
+    int listEnd = listStart < 0 ? -1 : response.indexOf(']', listStart);
+    int handled = 0;
+    for (size_t i = 0; i < packed; i++) {
+        const String& path = paths[packedIndex[i]];
+        int pos = listStart < 0 ? -1 : response.indexOf("\"" + names[i] + "\"", listStart);
+        if (pos >= 0 && pos < listEnd) {
+            retireUploadedFile(path);
+            app->removeFromUploadQueue(ids[packedIndex[i]]);
+            UploadScheduler::recordUpload(1, sizes[i]);
+            handled++;
+            continue;
+        }
+        
+        // An "error" result is the backend's verdict on the file itself, a retry would get it again
+        if (batchResultStatus(response, names[i]) == "error") {
+            app->removeFromUploadQueue(ids[packedIndex[i]]);
+            quarantineFile(path);
+            handled++;
+            continue;
+        }
+        app->log("Upload not acknowledged for: " + path);
+    }
+    
+    // A batch the backend answered without settling any file counts as failed
+    return handled > 0 ? handled : -1;
+}
+
+bool BackendClient::isPermanentRejection(int httpResponseCode) {
+    // Auth, rate limits and a wrong endpoint are not the file's fault, they would reject every file
+    return httpResponseCode == HTTP_CODE_BAD_REQUEST || httpResponseCode == HTTP_CODE_PAYLOAD_TOO_LARGE ||
+           httpResponseCode == HTTP_CODE_UNSUPPORTED_MEDIATYPE || httpResponseCode == HTTP_CODE_UNPROCESSABLE_ENTITY;
+}
+
+String BackendClient::batchResultStatus(const String& response, const String& name) {
+    // "results" precedes "acknowledged", messages may contain brackets but never a quoted file name
+    int resultsStart = response.indexOf("\"results\"");
+    if (resultsStart < 0) {
+        return "";
+    }
+    int resultsEnd = response.indexOf("\"acknowledged\"", resultsStart);
+    if (resultsEnd < 0) {
+        resultsEnd = response.length();
+    }
+    
+    int entry = response.indexOf("\"" + name + "\"", resultsStart);
+    if (entry < 0 || entry >= resultsEnd) {
+        return "";
+    }
+    int key = response.indexOf("\"status\"", entry);
+    int valueStart = key < 0 ? -1 : response.indexOf('"', response.indexOf(':', key) + 1);
+    int valueEnd = valueStart < 0 ? -1 : response.indexOf('"', valueStart + 1);
+    if (valueEnd < 0 || valueEnd >= resultsEnd) {
+        return "";
+    }
+    return response.substring(valueStart + 1, valueEnd);
+}
+
+void BackendClient::quarantineFile(const String& path) {
+    String target = String(REJECTED_DIR) + path.substring(path.lastIndexOf('/'));
+    if (app->ensureDirectory(REJECTED_DIR) && app->renameFile(path, target)) {
+        app->log("File rejected by the backend, moved to " + target);
+        return;
+    }
+    
+    app->log("File rejected by the backend, failed to move it: " + path);
+    if (app->deleteFile(path)) {
+        app->log("File deleted: " + path);
+    }
+}
+
+bool BackendClient::hasPendingDeletes() {
+    return uploadStream && uploadStream->hasPendingDeletes();
+}
+
+bool BackendClient::isDeletePending(const String& path) {
+    return uploadStream && uploadStream->isDeletePending(path);
+}
+
+void BackendClient::retireUploadedFile(const String& path) {
+    // The reader task deletes it while the next request is being sent
+    if (uploadStream->deleteLater(path)) {
+        app->log("File uploaded, deletion queued: " + path);
+        return;
+    }
+    
+    if (app->deleteFile(path)) {
+        app->log("File deleted: " + path);
+    } else {
+        app->log("Failed to delete file: " + path);
+    }
+}
+
+int BackendClient::postUploadStream(const char* contentType, const String& bareFilename, String& response) {
+    if (!uploadStream || uploadStream->size() == 0) {
+        return HTTPC_ERROR_NO_STREAM;
     }
     
     SemaphoreHandle_t httpMutex = app->getHttpMutex();
     if (xSemaphoreTake(httpMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
         app->log("Could not get HTTP mutex for file upload");
-        return false;
+        return HTTPC_ERROR_CONNECTION_REFUSED;
     }
     
-    // Extract just the filename without the path for the request
-    String bareFilename = filename.substring(filename.lastIndexOf('/') + 1);
-    
     // Check WiFi connection before proceeding
     if (!app->isWifiConnected()) {
         app->log("WiFi not connected, aborting upload");
+        dropConnection();
         xSemaphoreGive(httpMutex);
-        return false;
+        return HTTPC_ERROR_NOT_CONNECTED;
     }
     
-    // Add timeout settings
-    HTTPClient client;
-    client.setTimeout(HTTP_TIMEOUT);
-
-    client.begin(API_ENDPOINT);
-    client.addHeader("Content-Type", "audio/wav");
-    client.addHeader("X-API-Key", API_KEY);  // Add the API key as a custom header
-    client.addHeader("Content-Disposition",
-                    "form-data; name=\"file\"; filename=\"" +
-                        String(bareFilename) + "\"");
-
-    // Send the request with the file data from buffer
-    int httpResponseCode = client.sendRequest("POST", uploadBuffer, size);
+    unsigned long start = millis();
+    int httpResponseCode = sendRequest("POST", API_ENDPOINT, uploadStream, contentType, bareFilename, &response);
+    uint32_t elapsed = millis() - start;
     
     if (httpResponseCode > 0) {
         app->log("HTTP Response code: " + String(httpResponseCode));
-        String response = client.getString();
         app->log("Server response: " + response);
-        client.end();
         bool success = (httpResponseCode == HTTP_CODE_OK || httpResponseCode == HTTP_CODE_CREATED);
-        if (!success) {
-            // If we get an HTTP error response, mark backend as unavailable
-            app->setBackendReachable(false);
-            setNextBackendCheckTime(millis()); // Trigger an immediate recheck
+        if (success) {
+            Metrics::observe(METRIC_UPLOAD_LATENCY_MS, elapsed);
+            Metrics::observe(METRIC_UPLOAD_KBPS, elapsed > 0 ? uploadStream->size() / elapsed : 0);
         }
         xSemaphoreGive(httpMutex);
-        return success;
-    } else {
-        app->log("Error on HTTP request: " + String(client.errorToString(httpResponseCode).c_str()));
-        client.end();
-        
-        // Increment failure counter
-        incrementConsecutiveUploadFailures();
         
-        // Only mark backend as unreachable after reaching max failures
-        if (getConsecutiveUploadFailures() >= MAX_CONSECUTIVE_UPLOAD_FAILURES) {
-            // Network error, mark backend as unavailable
-            app->setBackendReachable(false);
-            setNextBackendCheckTime(millis()); // Trigger an immediate recheck
+        // Every answer updates the backend health, no separate check is needed. A rejected
+        // file says nothing about the backend, only transport and server errors back off.
+        if (success || isPermanentRejection(httpResponseCode)) {
+            reportSuccess();
+        } else {
+            reportFailure();
         }
-        
+        return httpResponseCode;
+    } else {
+        app->log("Error on HTTP request: " + String(HTTPClient::errorToString(httpResponseCode).c_str()));
         xSemaphoreGive(httpMutex);
-        return false;
+        reportFailure();
+        return httpResponseCode;
     }
 }
 
@@ -430,84 +629,192 @@ bool BackendClient::checkBackendReachability() {
         return app->isBackendReachable();  // Return current state
     }
     
-    HTTPClient http;
-    http.setTimeout(HTTP_TIMEOUT);
-    http.begin(TEST_ENDPOINT);
-
-    http.addHeader("X-API-Key", API_KEY);  // Add the API key as a custom header
-
-    int httpResponseCode = http.GET();
+    int httpResponseCode = sendRequest("GET", TEST_ENDPOINT, nullptr, nullptr, "", nullptr);
     // app->log("Backend check response: " + String(httpResponseCode));
     
-    http.end();
     xSemaphoreGive(httpMutex);
     return httpResponseCode == 200;
 }
 
-void BackendClient::backendReachabilityTaskFunction(void* parameter) {
-    const unsigned long RECHECK_INTERVAL = 600000; // Recheck every 10 minutes even when connected
-    unsigned long lastSuccessfulCheck = 0;
+int BackendClient::sendRequest(const char* method, const char* url, UploadStream* body, const char* contentType, const String& bareFilename, String* response) {
+    if (!httpClient || !connectionClient) {
+        return HTTPC_ERROR_NOT_CONNECTED;
+    }
     
-    while (true) {
-        unsigned long currentTime = millis();
-        bool shouldCheck = false;
+    // No frequency changes or light sleep while the request is on the air
+    PowerLockGuard apbLock(POWER_LOCK_APB);
+    
+    int httpResponseCode = HTTPC_ERROR_CONNECTION_REFUSED;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = false;
+        if (!ensureConnection(url, reused)) {
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
         
-        // Only check backend if WiFi is connected
-        if (app->isWifiConnected()) {
-            // Check if:
-            // 1. Backend status is unknown (not reachable) OR
-            // 2. It's time for a periodic recheck when connected
-            if (!app->isBackendReachable() || 
-                (app->isBackendReachable() && (currentTime - lastSuccessfulCheck >= RECHECK_INTERVAL))) {
-                
-                // Check if it's time according to our backoff strategy
-                if (currentTime >= getNextBackendCheckTime()) {
-                    shouldCheck = true;
-                }
+        if (!httpClient->begin(*connectionClient, url)) {
+            dropConnection();
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        httpClient->addHeader("X-API-Key", API_KEY);  // Add the API key as a custom header
+        if (contentType) {
+            httpClient->addHeader("Content-Type", contentType);
+        }
+        if (bareFilename.length() > 0) {
+            httpClient->addHeader("Content-Disposition",
+                                  "form-data; name=\"file\"; filename=\"" + bareFilename + "\"");
+        }
+        
+        connectionStats.requests++;
+        Metrics::add(METRIC_HTTP_REQUESTS);
+        if (reused) {
+            connectionStats.reusedRequests++;
+            Metrics::add(METRIC_HTTP_REUSED);
+        }
+        if (body && METRICS_ENABLED) {
+            // Every upload carries the metrics, so they need no request of their own
+            static char snapshot[METRICS_SNAPSHOT_SIZE];
+            if (Metrics::writeSnapshot(snapshot, sizeof(snapshot)) > 0) {
+                httpClient->addHeader(METRICS_HEADER, snapshot);
             }
-            
-            if (shouldCheck) {
-                app->log("Checking backend reachability...");
-                
-                if (checkBackendReachability()) {
-                    app->log("Backend is reachable");
-                    app->setBackendReachable(true);
-                    // Reset backoff on success
-                    setCurrentBackendInterval(MIN_SCAN_INTERVAL);
-                    // Record successful check time
-                    lastSuccessfulCheck = currentTime;
-                    
-                    // Check if we should start the upload task
-                    if (shouldStartUploadTask()) {
-                        app->log("Starting file upload task as backend is now reachable");
-                        if (startUploadTask()) {
-                            app->setUploadTaskHandle(uploadTaskHandle);
-                            
-                            // Delete self (reachability task) since upload task is now running
-                            app->log("BackendClient: Terminating reachability task as upload task is now running");
-                            app->setReachabilityTaskHandle(nullptr);
-                            vTaskDelete(nullptr);
-                            return;
-                        }
-                    }
-                } else {
-                    app->log("Backend is not reachable");
-                    app->setBackendReachable(false);
-                    
-                    // Apply exponential backoff for next check
-                    unsigned long currentInterval = getCurrentBackendInterval();
-                    unsigned long newInterval = std::min(currentInterval * 2UL, (unsigned long)MAX_SCAN_INTERVAL);
-                    setCurrentBackendInterval(newInterval);
-                    app->log("Next backend check in " + String(newInterval / 1000) + " seconds");
-                }
-                
-                setNextBackendCheckTime(currentTime + getCurrentBackendInterval());
+        }
+        if (body) {
+            body->rewind();
+            httpResponseCode = httpClient->sendRequest(method, body, body->size());
+            if (body->hasError()) {
+                app->log("BackendClient: Failed to read upload body from SD card");
             }
         } else {
-            // Reset status if WiFi disconnects
-            app->setBackendReachable(false);
+            httpResponseCode = httpClient->sendRequest(method);
+        }
+        
+        if (httpResponseCode > 0) {
+            // Read the whole body so the connection is ready for the next request
+            String body = httpClient->getString();
+            if (response) {
+                *response = body;
+            }
+            httpClient->end();
+            return httpResponseCode;
         }
         
-        vTaskDelay(pdMS_TO_TICKS(5000)); // Task yield interval
+        httpClient->end();
+        dropConnection();
+        
+        // A kept-alive connection may have been closed by the server while idle. Only
+        // errors raised while sending are retried (-1 to -4): once the whole body went
+        // out, a lost connection (-5) or a timeout may follow a file the server stored.
+        bool stale = httpResponseCode >= HTTPC_ERROR_NOT_CONNECTED;
+        if (!reused || !stale) {
+            break;
+        }
+        connectionStats.retries++;
+        Metrics::add(METRIC_HTTP_RETRIES);
+        app->log("BackendClient: Reused connection was closed, reconnecting");
+    }
+    
+    return httpResponseCode;
+}
+
+bool BackendClient::ensureConnection(const char* url, bool& reused) {
+    // Split scheme://host[:port]/path
+    String endpoint(url);
+    bool secure = endpoint.startsWith("https://");
+    int hostStart = endpoint.indexOf("://");
+    hostStart = hostStart < 0 ? 0 : hostStart + 3;
+    int pathStart = endpoint.indexOf('/', hostStart);
+    String authority = pathStart < 0 ? endpoint.substring(hostStart) : endpoint.substring(hostStart, pathStart);
+    String host = authority;
+    uint16_t port = secure ? 443 : 80;
+    int colon = authority.lastIndexOf(':');
+    if (colon > 0) {
+        host = authority.substring(0, colon);
+        port = (uint16_t)authority.substring(colon + 1).toInt();
     }
+    
+    if (connectionClient->connected() && host == connectionHost && port == connectionPort) {
+        reused = true;
+        return true;
+    }
+    
+    reused = false;
+    connectionClient->stop();
+    
+    unsigned long start = millis();
+    if (!connectionClient->connect(host.c_str(), port, HTTP_TIMEOUT)) {
+        connectionStats.failedHandshakes++;
+        connectionHost = "";
+        app->log("BackendClient: Failed to connect to " + host + ":" + String(port));
+        return false;
+    }
+    
+    uint32_t elapsed = millis() - start;
+    connectionStats.handshakes++;
+    connectionStats.lastHandshakeMs = elapsed;
+    connectionStats.totalHandshakeMs += elapsed;
+    connectionHost = host;
+    connectionPort = port;
+    app->log("BackendClient: Connected to " + host + ":" + String(port) + " in " + String(elapsed) + "ms" +
+             (secure ? " (TLS)" : ""));
+    return true;
+}
+
+void BackendClient::dropConnection() {
+    if (connectionClient) {
+        connectionClient->stop();
+    }
+    connectionHost = "";
+}
+
+void BackendClient::closeConnection() {
+    if (!initialized || connectionHost.length() == 0) {
+        return;
+    }
+    
+    SemaphoreHandle_t httpMutex = app->getHttpMutex();
+    if (xSemaphoreTake(httpMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return;
+    }
+    dropConnection();
+    xSemaphoreGive(httpMutex);
+}
+
+int BackendClient::postFile(const char* url, const String& path, size_t size, bool keepAlive) {
+    if (!initialized || !uploadStream) {
+        return HTTPC_ERROR_NOT_CONNECTED;
+    }
+    
+    // The upload stream is shared with the upload task
+    if (xSemaphoreTake(uploadMutex, pdMS_TO_TICKS(HTTP_TIMEOUT)) != pdTRUE) {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    SemaphoreHandle_t httpMutex = app->getHttpMutex();
+    if (xSemaphoreTake(httpMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        xSemaphoreGive(uploadMutex);
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    
+    int httpResponseCode = HTTPC_ERROR_NOT_CONNECTED;
+    if (app->isWifiConnected()) {
+        uploadStream->clear();
+        uploadStream->addFile(path, size);
+        httpResponseCode = sendRequest("POST", url, uploadStream, "application/octet-stream",
+                                       path.substring(path.lastIndexOf('/') + 1), nullptr);
+    }
+    if (!keepAlive || httpResponseCode <= 0) {
+        dropConnection();
+    }
+    xSemaphoreGive(httpMutex);
+    xSemaphoreGive(uploadMutex);
+    return httpResponseCode;
+}
+
+BackendClient::ConnectionStats BackendClient::getConnectionStats() {
+    return connectionStats;
+}
+
+void BackendClient::logConnectionStats() {
+    app->log("BackendClient: " + String(connectionStats.requests) + " requests, " +
+             String(connectionStats.reusedRequests) + " reused, " +
+             String(connectionStats.handshakes) + " handshakes (" +
+             String(connectionStats.totalHandshakeMs) + "ms total)");
 }
@@ -4,8 +4,14 @@
  *
  * This class handles all communication with the backend server,
  * including file uploads and reachability checks. It implements
- * a singleton pattern and manages background tasks for file uploads
- * and connectivity monitoring.
+ * a singleton pattern and manages one persistent upload task.
+ *
+ * Backend health is tracked passively: every upload result updates a small
+ * state machine, and a successful upload is proof that the backend is
+ * reachable. Only after MAX_CONSECUTIVE_UPLOAD_FAILURES failures does the
+ * upload task switch to probing TEST_ENDPOINT, with exponential backoff,
+ * and only while files are waiting. The task lives as long as the device,
+ * WiFi changes just wake it or reset the health state.
  */
 
 #ifndef BACKEND_CLIENT_H
@@ -15,15 +21,20 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <HTTPClient.h>
-#include <esp_heap_caps.h>
+#include <WiFi.h>
 #include <esp_task_wdt.h>  // Include watchdog timer header
 
 #include "Application.h"
+#include "UploadStream.h"
 #include "config.h"
 #include "secrets.h"
 
-// 512KB PSRAM buffer size
-#define UPLOAD_BUFFER_SIZE (512 * 1024)
+// Batch upload body, all fields little-endian: "CCB1", u16 file count, u16 reserved,
+// then per file a u16 name length, a u32 data length, the name and the data
+#define UPLOAD_BATCH_MAGIC "CCB1"
+#define UPLOAD_BATCH_HEADER_SIZE 8
+#define UPLOAD_BATCH_ENTRY_HEADER_SIZE 6
+#define UPLOAD_BATCH_CONTENT_TYPE "application/x-coco-batch"
 
 class BackendClient {
 public:
@@ -45,22 +56,27 @@ public:
     static bool startUploadTask();
     
     /**
-     * @brief Stops the file upload background task
-     * @return true if task was successfully stopped, false otherwise
+     * @brief Health of the backend as seen by the upload task
      */
-    static bool stopUploadTask();
+    enum HealthState {
+        HEALTH_UNKNOWN,      ///< No request since WiFi came up, the next upload tells
+        HEALTH_HEALTHY,      ///< The last request succeeded
+        HEALTH_DEGRADED,     ///< Recent requests failed, uploads continue
+        HEALTH_UNREACHABLE   ///< Too many failures, only probes are sent until one succeeds
+    };
     
     /**
-     * @brief Starts the backend reachability check background task
-     * @return true if task creation succeeds, false otherwise
+     * @brief Gets the current backend health
+     * @return Health state
      */
-    static bool startReachabilityTask();
+    static HealthState getHealthState();
     
     /**
-     * @brief Stops the backend reachability check background task
-     * @return true if task was successfully stopped, false otherwise
+     * @brief Forgets the backend health and the open connection, e.g. after WiFi dropped
+     *
+     * Only sets state, the upload task closes the connection before its next request.
      */
-    static bool stopReachabilityTask();
+    static void resetHealth();
     
     /**
      * @brief Gets the handle to the upload task
@@ -68,12 +84,6 @@ public:
      */
     static TaskHandle_t getUploadTaskHandle();
     
-    /**
-     * @brief Gets the handle to the reachability task
-     * @return TaskHandle_t for the reachability task
-     */
-    static TaskHandle_t getReachabilityTaskHandle();
-    
     /**
      * @brief Gets the mutex used to protect upload operations
      * @return SemaphoreHandle_t for the upload mutex
@@ -81,7 +91,7 @@ public:
     static SemaphoreHandle_t getUploadMutex();
     
     /**
-     * @brief Sets the next time to check backend reachability
+     * @brief Sets the next time to probe an unreachable backend
      * @param time Timestamp in milliseconds for next check
      */
     static void setNextBackendCheckTime(unsigned long time);
@@ -93,7 +103,7 @@ public:
     static unsigned long getNextBackendCheckTime();
     
     /**
-     * @brief Sets the current interval for backend checks
+     * @brief Sets the current backoff interval for backend probes
      * @param interval Time in milliseconds between checks
      */
     static void setCurrentBackendInterval(unsigned long interval);
@@ -124,31 +134,69 @@ public:
     
     /**
      * @brief Checks if all upload conditions are met
-     * @return true if WiFi is connected, backend is reachable, files are in queue, and battery is above threshold
+     * @return true if WiFi is connected, files are in queue, the battery is above threshold
+     *         and the backend is not waiting for its next probe
      */
     static bool canUploadFiles();
     
     /**
-     * @brief Gets the number of consecutive upload failures
-     * @return Number of consecutive upload failures
+     * @brief Checks if uploaded files are still waiting for their deferred deletion
+     * @return true if a deletion is queued or running
      */
-    static int getConsecutiveUploadFailures();
+    static bool hasPendingDeletes();
     
     /**
-     * @brief Resets the consecutive upload failures counter
+     * @brief Checks if an uploaded file is still waiting for its deferred deletion
+     * @param path Full path of the file
+     * @return true if the deletion of that file is queued or running
      */
-    static void resetConsecutiveUploadFailures();
+    static bool isDeletePending(const String& path);
     
     /**
-     * @brief Increments the consecutive upload failures counter
+     * @brief Gets the number of consecutive upload failures
+     * @return Number of consecutive upload failures
      */
-    static void incrementConsecutiveUploadFailures();
+    static int getConsecutiveUploadFailures();
     
     /**
-     * @brief Maximum allowed consecutive upload failures before restarting reachability task
+     * @brief Maximum allowed consecutive upload failures before the backend counts as unreachable
      */
     static const int MAX_CONSECUTIVE_UPLOAD_FAILURES = 2;
 
+    /**
+     * @brief Statistics of the persistent backend connection
+     */
+    struct ConnectionStats {
+        uint32_t requests;          ///< HTTP requests sent
+        uint32_t reusedRequests;    ///< Requests sent over an already open connection
+        uint32_t handshakes;        ///< New connections (TCP and, for https, TLS handshakes)
+        uint32_t failedHandshakes;  ///< Connection attempts that failed
+        uint32_t retries;           ///< Requests repeated after a reused connection turned out stale
+        uint32_t lastHandshakeMs;   ///< Duration of the most recent handshake
+        uint32_t totalHandshakeMs;  ///< Time spent in handshakes since boot
+    };
+
+    /**
+     * @brief Gets the statistics of the persistent backend connection
+     * @return Copy of the current statistics
+     */
+    static ConnectionStats getConnectionStats();
+
+    /**
+     * @brief Closes the persistent backend connection, e.g. after WiFi dropped
+     */
+    static void closeConnection();
+
+    /**
+     * @brief Streams a file from the SD card to a URL over the persistent connection, e.g. to measure throughput
+     * @param url Endpoint to post to, the backend health is not updated by its answer
+     * @param path Full path of the file
+     * @param size File size in bytes
+     * @param keepAlive Keep the connection open for the next request instead of closing it after the answer
+     * @return HTTP status code, or a negative HTTPC_ERROR code
+     */
+    static int postFile(const char* url, const String& path, size_t size, bool keepAlive);
+
 private:
     // Private constructor (singleton pattern enforcement)
     BackendClient() = default;
@@ -156,29 +204,123 @@ private:
     // Private static state
     static bool initialized;
     static TaskHandle_t uploadTaskHandle;
-    static TaskHandle_t reachabilityTaskHandle;
     static Application* app;
     static SemaphoreHandle_t uploadMutex;
     static unsigned long nextBackendCheckTime;
     static unsigned long currentBackendInterval;
-    static uint8_t* uploadBuffer;  // Fixed-size PSRAM buffer
+    static UploadStream* uploadStream;  // Body of the upload in flight, streamed from SD
     static int consecutiveUploadFailures;
-    static bool shouldRestartReachabilityTask;
+    static volatile HealthState healthState;
+    static volatile bool connectionStale;  // WiFi dropped, close the connection before the next request
+
+    // Persistent connection, reused across uploads and reachability checks
+    static WiFiClient* connectionClient;  // WiFiClientSecure for https endpoints
+    static HTTPClient* httpClient;
+    static String connectionHost;
+    static uint16_t connectionPort;
+    static ConnectionStats connectionStats;
     
     // Internal helper functions
     static void fileUploadTaskFunction(void* parameter);
-    static void backendReachabilityTaskFunction(void* parameter);
     static bool checkBackendReachability();
-    static bool uploadFileFromBuffer(size_t size, const String& filename);
-    
-    // Upload conditions meta variable
-    static bool uploadConditionsMet();
-    
+
+    /**
+     * @brief Records a request the backend answered successfully
+     */
+    static void reportSuccess();
+
+    /**
+     * @brief Records a failed request, requests lost with the WiFi connection do not count
+     */
+    static void reportFailure();
+
+    /**
+     * @brief Probes an unreachable backend and schedules the next probe on failure
+     * @return true if the backend answered, false otherwise
+     */
+    static bool probeBackend();
+
+    /**
+     * @brief Streams one file from the SD card to the upload endpoint
+     * @param filename Full path of the file
+     * @param size File size in bytes
+     * @return HTTP response code, or a negative HTTPClient error
+     */
+    static int uploadSingleFile(const String& filename, size_t size);
+
+    /**
+     * @brief Streams files from the front of the upload queue as one batch request
+     * @return Number of files stored or rejected for good by the backend, 0 if nothing was sent, -1 on failure
+     */
+    static int uploadNextBatch();
+
+    /**
+     * @brief Checks if a response refuses the upload itself, so sending it again cannot succeed
+     * @param httpResponseCode HTTP response code
+     * @return true for validation errors, false for success, transport, auth and server errors
+     */
+    static bool isPermanentRejection(int httpResponseCode);
+
+    /**
+     * @brief Gets the status the backend reported for one file of a batch
+     * @param response Response body of the batch request
+     * @param name File name as sent in the batch
+     * @return Value of the "status" field of the file's entry in "results", empty if it is not listed
+     */
+    static String batchResultStatus(const String& response, const String& name);
+
+    /**
+     * @brief Moves a file the backend refused into REJECTED_DIR, or deletes it if that fails
+     * @param path Full path of the file
+     */
+    static void quarantineFile(const String& path);
+
+    /**
+     * @brief Deletes an uploaded file, in the background when possible
+     * @param path Full path of the file
+     */
+    static void retireUploadedFile(const String& path);
+
+    /**
+     * @brief Posts the prepared upload stream to the upload endpoint
+     * @param contentType Content-Type of the body
+     * @param bareFilename File name for the Content-Disposition header, or empty for a batch
+     * @param response Receives the response body
+     * @return HTTP response code, or a negative HTTPClient error
+     */
+    static int postUploadStream(const char* contentType, const String& bareFilename, String& response);
+
+    /**
+     * @brief Sends a request over the persistent connection, reconnecting once if it was stale
+     * @param method HTTP method
+     * @param url Full request URL
+     * @param body Request body, rewound before every attempt, may be nullptr
+     * @param contentType Content-Type of the body, or nullptr for none
+     * @param bareFilename File name for the Content-Disposition header, or empty for none
+     * @param response Receives the response body if not nullptr
+     * @return HTTP status code, or a negative HTTPClient error code
+     * @note The caller must hold the HTTP mutex
+     */
+    static int sendRequest(const char* method, const char* url, UploadStream* body, const char* contentType, const String& bareFilename, String* response);
+
+    /**
+     * @brief Makes sure the persistent connection is open to the host of a URL
+     * @param url Full request URL
+     * @param reused Set to true if an already open connection is used
+     * @return true if the connection is open, false otherwise
+     * @note The caller must hold the HTTP mutex
+     */
+    static bool ensureConnection(const char* url, bool& reused);
+
+    /**
+     * @brief Closes the persistent connection without taking the HTTP mutex
+     */
+    static void dropConnection();
+
     /**
-     * @brief Checks if conditions are right to start the upload task
-     * @return true if upload task should be started
+     * @brief Logs a one-line summary of the connection statistics
      */
-    static bool shouldStartUploadTask();
+    static void logConnectionStats();
 };
 
 #endif // BACKEND_CLIENT_H
@@ -5,27 +5,29 @@
  * Handles SD card operations, file manipulations, and upload queue management.
  */
 
+#include <SD_MMC.h>
+#include <algorithm>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <unistd.h>
+
 #include "FileSystem.h"
+#include "Metrics.h"
+#include "UploadQueue.h"
 
 // Initialize static variables
 bool FileSystem::initialized = false;
-SemaphoreHandle_t FileSystem::sdMutex = nullptr;
 Application* FileSystem::app = nullptr;
-
-// Private helper class for RAII mutex handling
-class SDLockGuard {
-private:
-    SemaphoreHandle_t& mutex;
-    bool locked;
-public:
-    SDLockGuard(SemaphoreHandle_t& mutex) : mutex(mutex), locked(false) {
-        locked = (xSemaphoreTake(mutex, pdMS_TO_TICKS(2000)) == pdTRUE);
-    }
-    ~SDLockGuard() {
-        if (locked) xSemaphoreGive(mutex);
-    }
-    bool isLocked() const { return locked; }
+bool FileSystem::sdmmcMounted = false;
+String FileSystem::knownDirectories[SD_DIRECTORY_CACHE_SIZE];
+size_t FileSystem::knownDirectoryCount = 0;
+FileSystem::Appender FileSystem::appenders[FileSystem::APPENDER_COUNT] = {
+    { LOG_FILE, File(), 0 },
+    { UPLOAD_QUEUE_FILE, File(), 0 }
 };
+SDOperationStats FileSystem::operationStats[SD_OP_COUNT] = {};
+uint32_t FileSystem::directoryCacheHits = 0;
+uint32_t FileSystem::appenderReuses = 0;
 
 bool FileSystem::init(Application* appInstance) {
     if (initialized) {
@@ -44,47 +46,31 @@ bool FileSystem::init(Application* appInstance) {
         return false;
     }
     
-    // Initialize mutex
-    sdMutex = xSemaphoreCreateMutex();
-    if (sdMutex == nullptr) {
-        app->log("ERROR: Failed to create SD card mutex");
+    if (!SDScheduler::init(app)) {
+        app->log("ERROR: Failed to initialize SD access scheduling");
         return false;
     }
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex during initialization");
         return false;
     }
 
-    // Initialize SD card with retry mechanism
-    const int maxRetries = 3;
-    int retryCount = 0;
-    bool sdInitialized = false;
-    
-    while (!sdInitialized && retryCount < maxRetries) {
-        // Attempt to initialize the SD card
-        app->log("Initializing SD card (attempt " + String(retryCount + 1) + " of " + String(maxRetries) + ")...");
-        
-        // Try initializing with different speeds if we're retrying
-        uint32_t sdSpeed = (retryCount == 0) ? SD_SPEED : (SD_SPEED / (retryCount + 1));
-        
-        if (SD.begin(21, SPI, sdSpeed)) {
-            sdInitialized = true;
-        } else {
-            app->log("SD Card initialization failed, retrying...");
-            retryCount++;
-            // Short delay before retry
-            delay(500);
+    // SDMMC moves several bits per clock without SPI framing, SPI remains the fallback
+    bool mounted = false;
+    if (SD_BUS == SD_BUS_SDMMC) {
+        mounted = mountSDMMC();
+        if (!mounted) {
+            app->log("SDMMC mount failed, falling back to SPI");
         }
     }
-    
-    if (!sdInitialized) {
+    if (!mounted && !mountSPI()) {
         app->log("ERROR: SD Card initialization failed after multiple attempts!");
         return false;
     }
 
-    uint8_t cardType = SD.cardType();
+    uint8_t cardType = sdmmcMounted ? SD_MMC.cardType() : SD.cardType();
     if (cardType == CARD_NONE) {
         app->log("ERROR: No SD card attached");
         return false;
@@ -98,18 +84,160 @@ bool FileSystem::init(Application* appInstance) {
     } else if (cardType == CARD_SDHC) {
         cardTypeStr = "SDHC";
     }
-    app->log("SD Card Type: " + cardTypeStr);
+    app->log("SD Card Type: " + cardTypeStr + " over " + String(sdmmcMounted ? "SDMMC" : "SPI"));
 
-    uint64_t cardSize = SD.cardSize() / (1024 * 1024);
+    uint64_t cardSize = (sdmmcMounted ? SD_MMC.cardSize() : SD.cardSize()) / (1024 * 1024);
     app->log("SD Card Size: " + String((unsigned long)cardSize) + "MB");
 
+    // Only after power-on, so wakes from deep sleep don't pay for it
+    if (SD_BENCHMARK_BYTES > 0 && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) {
+        benchmark();
+    }
+
     initialized = true;
     app->log("FileSystem initialized successfully");
     return true;
 }
 
-SemaphoreHandle_t FileSystem::getSDMutex() {
-    return sdMutex;
+fs::FS& FileSystem::card() {
+    if (sdmmcMounted) {
+        return SD_MMC;
+    }
+    return SD;
+}
+
+bool FileSystem::isSDMMC() {
+    return sdmmcMounted;
+}
+
+bool FileSystem::mountSDMMC() {
+    // A low DAT3 at the first command puts the card into SPI mode, in 1-bit mode it is the SPI CS line
+    if (!SD_MMC_4BIT) {
+        pinMode(21, OUTPUT);
+        digitalWrite(21, HIGH);
+    }
+
+    bool ok = SD_MMC_4BIT ? SD_MMC.setPins(SD_MMC_CLK_PIN, SD_MMC_CMD_PIN, SD_MMC_D0_PIN,
+                                           SD_MMC_D1_PIN, SD_MMC_D2_PIN, SD_MMC_D3_PIN)
+                          : SD_MMC.setPins(SD_MMC_CLK_PIN, SD_MMC_CMD_PIN, SD_MMC_D0_PIN);
+    if (!ok) {
+        app->log("ERROR: Invalid SDMMC pins");
+        return false;
+    }
+
+    // Without the dedicated pull-ups of an SD slot the bus may not run at full speed
+    const int frequencies[] = { SD_MMC_FREQ_KHZ, SDMMC_FREQ_DEFAULT };
+    for (int frequency : frequencies) {
+        app->log("Initializing SD card over SDMMC (" + String(SD_MMC_4BIT ? 4 : 1) + "-bit, " +
+                 String(frequency / 1000) + "MHz)...");
+        if (SD_MMC.begin(SD_MMC_MOUNT_POINT, !SD_MMC_4BIT, false, frequency, SD_MAX_OPEN_FILES)) {
+            sdmmcMounted = true;
+            return true;
+        }
+        delay(100);
+    }
+    return false;
+}
+
+bool FileSystem::mountSPI() {
+    // Initialize SD card with retry mechanism
+    const int maxRetries = 3;
+    
+    for (int retryCount = 0; retryCount < maxRetries; retryCount++) {
+        // Attempt to initialize the SD card
+        app->log("Initializing SD card (attempt " + String(retryCount + 1) + " of " + String(maxRetries) + ")...");
+        
+        // Try initializing with different speeds if we're retrying
+        uint32_t sdSpeed = (retryCount == 0) ? SD_SPEED : (SD_SPEED / (retryCount + 1));
+        
+        if (SD.begin(21, SPI, sdSpeed, SD_SPI_MOUNT_POINT, SD_MAX_OPEN_FILES)) {
+            return true;
+        }
+        app->log("SD Card initialization failed, retrying...");
+        // Short delay before retry
+        delay(500);
+    }
+    return false;
+}
+
+bool FileSystem::remount(uint32_t frequencyKhz) {
+    if (!initialized) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for remount");
+        return false;
+    }
+
+    // Open handles do not survive the unmount
+    for (size_t i = 0; i < APPENDER_COUNT; i++) {
+        closeAppender(appenders[i].path);
+    }
+
+    bool mounted;
+    if (sdmmcMounted) {
+        SD_MMC.end();
+        mounted = SD_MMC.begin(SD_MMC_MOUNT_POINT, !SD_MMC_4BIT, false, frequencyKhz, SD_MAX_OPEN_FILES);
+    } else {
+        SD.end();
+        mounted = SD.begin(21, SPI, frequencyKhz * 1000, SD_SPI_MOUNT_POINT, SD_MAX_OPEN_FILES);
+    }
+    if (!mounted) {
+        app->log("ERROR: SD card remount at " + String(frequencyKhz) + "kHz failed");
+        return false;
+    }
+    app->log("SD card remounted over " + String(sdmmcMounted ? "SDMMC" : "SPI") + " at " + String(frequencyKhz) + "kHz");
+    return true;
+}
+
+void FileSystem::benchmark() {
+    uint8_t* block = (uint8_t*)malloc(SD_WRITE_BLOCK_SIZE);
+    if (!block) {
+        app->log("SD benchmark skipped, out of memory");
+        return;
+    }
+    for (size_t i = 0; i < SD_WRITE_BLOCK_SIZE; i++) {
+        block[i] = (uint8_t)i;
+    }
+
+    // Sequential write in the same aligned blocks the recorder issues, including the final flush
+    size_t written = 0;
+    int64_t start = esp_timer_get_time();
+    File file = card().open(SD_BENCHMARK_FILE, FILE_WRITE);
+    if (file) {
+        size_t offset = 0;
+        while (written < SD_BENCHMARK_BYTES && writeAligned(file, block, SD_WRITE_BLOCK_SIZE, offset)) {
+            written += SD_WRITE_BLOCK_SIZE;
+        }
+        file.close();
+    }
+    int64_t writeUs = esp_timer_get_time() - start;
+
+    size_t read = 0;
+    start = esp_timer_get_time();
+    file = card().open(SD_BENCHMARK_FILE, FILE_READ);
+    if (file) {
+        size_t count;
+        while ((count = file.read(block, SD_WRITE_BLOCK_SIZE)) > 0) {
+            read += count;
+        }
+        file.close();
+    }
+    int64_t readUs = esp_timer_get_time() - start;
+
+    card().remove(SD_BENCHMARK_FILE);
+    free(block);
+
+    if (written < SD_BENCHMARK_BYTES || read != written) {
+        app->log("SD benchmark failed (" + String(written) + " bytes written, " + String(read) + " read)");
+        return;
+    }
+    // Bytes per microsecond equal MB/s
+    app->log("SD throughput over " + String(sdmmcMounted ? "SDMMC" : "SPI") + ": write " +
+             String((float)written / writeUs, 2) + " MB/s, read " + String((float)read / readUs, 2) + " MB/s (" +
+             String(written / 1024) + " KB)");
 }
 
 bool FileSystem::ensureDirectory(const char* path) {
@@ -117,22 +245,36 @@ bool FileSystem::ensureDirectory(const char* path) {
         return false;
     }
     
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for directory creation: " + String(path));
         return false;
     }
 
+    // Directories are never removed by the firmware, so one seen once stays valid
+    for (size_t i = 0; i < knownDirectoryCount; i++) {
+        if (knownDirectories[i] == path) {
+            directoryCacheHits++;
+            return true;
+        }
+    }
+
     bool result = true;
-    if (!SD.exists(path)) {
-        result = SD.mkdir(path);
-        if (result) {
-            app->log("Created directory: " + String(path));
-        } else {
-            app->log("ERROR: Failed to create directory: " + String(path));
+    {
+        SDOpTimer timer(SD_OP_META);
+        if (!card().exists(path)) {
+            result = card().mkdir(path);
+            if (result) {
+                app->log("Created directory: " + String(path));
+            } else {
+                app->log("ERROR: Failed to create directory: " + String(path));
+            }
         }
     }
 
+    if (result && knownDirectoryCount < SD_DIRECTORY_CACHE_SIZE) {
+        knownDirectories[knownDirectoryCount++] = path;
+    }
     return result;
 }
 
@@ -159,22 +301,15 @@ bool FileSystem::addToFile(const String& path, const String& content, bool isUpl
         }
     }
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file append operation");
         return false;
     }
 
-    File file = SD.open(path, FILE_APPEND);
-    if (!file) {
-        app->log("ERROR: Failed to open file for appending: " + path);
-        return false;
-    }
-
-    size_t bytesWritten = file.print(content);
-    file.close();
-
-    if (bytesWritten != content.length()) {
+    FileSegment segment = { (const uint8_t*)content.c_str(), content.length() };
+    size_t written = 0;
+    if (!appendSegments(path, &segment, 1, written)) {
         app->log("ERROR: Failed to write all data to file: " + path);
         return false;
     }
@@ -183,6 +318,16 @@ bool FileSystem::addToFile(const String& path, const String& content, bool isUpl
 }
 
 bool FileSystem::overwriteFile(const String& path, const String& content) {
+    FileSegment segment = { (const uint8_t*)content.c_str(), content.length() };
+    return writeFile(path, &segment, 1);
+}
+
+bool FileSystem::writeFile(const String& path, const uint8_t* data, size_t size) {
+    FileSegment segment = { data, size };
+    return writeFile(path, &segment, 1);
+}
+
+bool FileSystem::writeFile(const String& path, const FileSegment* segments, size_t segmentCount) {
     if (!initialized && !init()) {
         return false;
     }
@@ -197,29 +342,180 @@ bool FileSystem::overwriteFile(const String& path, const String& content) {
         }
     }
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file write operation");
         return false;
     }
 
-    File file = SD.open(path, FILE_WRITE);
+    // Truncating the file invalidates a kept open append handle
+    closeAppender(path);
+
+    File file;
+    {
+        SDOpTimer timer(SD_OP_OPEN);
+        file = card().open(path, FILE_WRITE);
+    }
     if (!file) {
         app->log("ERROR: Failed to open file for writing: " + path);
         return false;
     }
 
-    size_t bytesWritten = file.print(content);
-    file.close();
+    // Write straight from the caller's memory
+    size_t offset = 0;
+    bool complete = true;
+    {
+        SDOpTimer timer(SD_OP_WRITE);
+        for (size_t i = 0; i < segmentCount && complete; i++) {
+            complete = writeAligned(file, segments[i].data, segments[i].size, offset);
+        }
+    }
+    {
+        SDOpTimer timer(SD_OP_SYNC);
+        file.close();
+    }
 
-    if (bytesWritten != content.length()) {
-        app->log("ERROR: Failed to write all data to file: " + path);
+    if (!complete) {
+        app->log("ERROR: Failed to write all data to file: " + path + " (" + String(offset) + " bytes written)");
         return false;
     }
 
     return true;
 }
 
+bool FileSystem::appendFile(const String& path, const FileSegment* segments, size_t segmentCount) {
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for file append operation");
+        return false;
+    }
+
+    size_t written = 0;
+    if (!appendSegments(path, segments, segmentCount, written)) {
+        app->log("ERROR: Failed to append all data to file: " + path + " (" + String(written) + " bytes written)");
+        return false;
+    }
+
+    return true;
+}
+
+bool FileSystem::appendSegments(const String& path, const FileSegment* segments, size_t segmentCount, size_t& written) {
+    written = 0;
+
+    // Files appended to all the time keep their handle, others are opened per call
+    Appender* appender = findAppender(path);
+    File transient;
+    File* file = &transient;
+    size_t offset = 0;
+    if (appender && appender->file) {
+        appenderReuses++;
+        file = &appender->file;
+        offset = appender->size;
+    } else {
+        {
+            SDOpTimer timer(SD_OP_OPEN);
+            transient = card().open(path, FILE_APPEND);
+        }
+        if (!transient) {
+            return false;
+        }
+        // Continue the block alignment from the current end of the file
+        offset = transient.size();
+        if (appender) {
+            appender->file = transient;
+            file = &appender->file;
+        }
+    }
+
+    size_t start = offset;
+    bool complete = true;
+    {
+        SDOpTimer timer(SD_OP_WRITE);
+        for (size_t i = 0; i < segmentCount && complete; i++) {
+            complete = writeAligned(*file, segments[i].data, segments[i].size, offset);
+        }
+    }
+    written = offset - start;
+
+    SDOpTimer timer(SD_OP_SYNC);
+    if (appender && complete) {
+        // Commit data and directory entry, the handle stays open for the next append
+        file->flush();
+        appender->size = offset;
+    } else {
+        // A failed append leaves the handle's position unknown, the next call reopens the file
+        file->close();
+    }
+    return complete;
+}
+
+void FileSystem::closeAppender(const String& path) {
+    Appender* appender = findAppender(path);
+    if (appender && appender->file) {
+        SDOpTimer timer(SD_OP_SYNC);
+        appender->file.close();
+    }
+}
+
+FileSystem::Appender* FileSystem::findAppender(const String& path) {
+    for (size_t i = 0; i < APPENDER_COUNT; i++) {
+        if (path == appenders[i].path) {
+            return &appenders[i];
+        }
+    }
+    return nullptr;
+}
+
+bool FileSystem::writeAligned(File& file, const uint8_t* data, size_t size, size_t& offset) {
+    // Each write ends on an SD_WRITE_BLOCK_SIZE file offset, so after a short
+    // header every following write covers whole sectors.
+    while (size > 0) {
+        size_t chunk = SD_WRITE_BLOCK_SIZE - (offset % SD_WRITE_BLOCK_SIZE);
+        if (chunk > size) {
+            chunk = size;
+        }
+        size_t bytesWritten = file.write(data, chunk);
+        offset += bytesWritten;
+        if (bytesWritten != chunk) {
+            return false;
+        }
+        data += chunk;
+        size -= chunk;
+        // Between blocks, so a waiting recording write is delayed by one block at most
+        if (size > 0) {
+            SDScheduler::yield();
+        }
+    }
+    return true;
+}
+
+size_t FileSystem::readBlocks(File& file, uint8_t* buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        size_t chunk = std::min(size - total, (size_t)SD_WRITE_BLOCK_SIZE);
+        size_t bytesRead = file.read(buffer + total, chunk);
+        total += bytesRead;
+        if (bytesRead != chunk) {
+            break;
+        }
+        if (total < size) {
+            SDScheduler::yield();
+        }
+    }
+    return total;
+}
+
+bool FileSystem::truncateFile(const String& path, size_t size) {
+    // The Arduino File has no truncate, so this goes through the VFS path of the mount
+    SDOpTimer timer(SD_OP_META);
+    String fullPath = String(sdmmcMounted ? SD_MMC_MOUNT_POINT : SD_SPI_MOUNT_POINT) + path;
+    return truncate(fullPath.c_str(), size) == 0;
+}
+
 String FileSystem::readFile(const String& path) {
     String content = "";
     
@@ -227,23 +523,26 @@ String FileSystem::readFile(const String& path) {
         return content;
     }
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file read operation");
         return content;
     }
 
-    if (!SD.exists(path)) {
-        return content; // Return empty string if file doesn't exist
+    // Opening checks for the file anyway, a missing file returns an empty string
+    File file;
+    {
+        SDOpTimer timer(SD_OP_OPEN);
+        file = card().open(path, FILE_READ);
     }
-
-    File file = SD.open(path, FILE_READ);
     if (!file) {
-        app->log("ERROR: Failed to open file for reading: " + path);
         return content;
     }
 
-    content = file.readString();
+    {
+        SDOpTimer timer(SD_OP_READ);
+        content = file.readString();
+    }
     file.close();
     
     return content;
@@ -257,20 +556,19 @@ bool FileSystem::readFileToBuffer(const String& path, uint8_t** buffer, size_t&
     *buffer = nullptr;
     size = 0;
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file read operation");
         return false;
     }
 
-    if (!SD.exists(path)) {
-        app->log("ERROR: File does not exist: " + path);
-        return false;
+    File file;
+    {
+        SDOpTimer timer(SD_OP_OPEN);
+        file = card().open(path, FILE_READ);
     }
-
-    File file = SD.open(path, FILE_READ);
     if (!file) {
-        app->log("ERROR: Failed to open file for reading: " + path);
+        app->log("ERROR: File does not exist or cannot be opened: " + path);
         return false;
     }
 
@@ -283,7 +581,11 @@ bool FileSystem::readFileToBuffer(const String& path, uint8_t** buffer, size_t&
         return false;
     }
 
-    size_t bytesRead = file.read(*buffer, size);
+    size_t bytesRead;
+    {
+        SDOpTimer timer(SD_OP_READ);
+        bytesRead = readBlocks(file, *buffer, size);
+    }
     file.close();
 
     if (bytesRead != size) {
@@ -309,20 +611,19 @@ bool FileSystem::readFileToFixedBuffer(const String& path, uint8_t* buffer, size
 
     readSize = 0;
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file read operation");
         return false;
     }
 
-    if (!SD.exists(path)) {
-        app->log("ERROR: File does not exist: " + path);
-        return false;
+    File file;
+    {
+        SDOpTimer timer(SD_OP_OPEN);
+        file = card().open(path, FILE_READ);
     }
-
-    File file = SD.open(path, FILE_READ);
     if (!file) {
-        app->log("ERROR: Failed to open file for reading: " + path);
+        app->log("ERROR: File does not exist or cannot be opened: " + path);
         return false;
     }
 
@@ -334,7 +635,10 @@ bool FileSystem::readFileToFixedBuffer(const String& path, uint8_t* buffer, size
         return false;
     }
 
-    readSize = file.read(buffer, fileSize);
+    {
+        SDOpTimer timer(SD_OP_READ);
+        readSize = readBlocks(file, buffer, fileSize);
+    }
     file.close();
 
     if (readSize != fileSize) {
@@ -347,22 +651,51 @@ bool FileSystem::readFileToFixedBuffer(const String& path, uint8_t* buffer, size
     return true;
 }
 
+bool FileSystem::getFileSize(const String& path, size_t& size) {
+    size = 0;
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for file size query");
+        return false;
+    }
+
+    // A kept open appender already knows the size
+    Appender* appender = findAppender(path);
+    if (appender && appender->file) {
+        size = appender->size;
+        return true;
+    }
+
+    // A missing file has size 0
+    SDOpTimer timer(SD_OP_OPEN);
+    File file = card().open(path, FILE_READ);
+    if (file) {
+        size = file.size();
+        file.close();
+    }
+    return true;
+}
+
 bool FileSystem::deleteFile(const String& path) {
     if (!initialized && !init()) {
         return false;
     }
 
-    SDLockGuard lock(sdMutex);
+    SDLockGuard lock;
     if (!lock.isLocked()) {
         app->log("ERROR: Failed to take SD card mutex for file delete operation");
         return false;
     }
 
-    if (!SD.exists(path)) {
-        return true; // File doesn't exist, consider it "successfully deleted"
-    }
+    closeAppender(path);
 
-    if (!SD.remove(path)) {
+    // Removing a missing file fails the same way, so only an existing file is worth an error
+    SDOpTimer timer(SD_OP_META);
+    if (!card().remove(path) && card().exists(path)) {
         app->log("ERROR: Failed to delete file: " + path);
         return false;
     }
@@ -370,6 +703,85 @@ bool FileSystem::deleteFile(const String& path) {
     return true;
 }
 
+bool FileSystem::renameFile(const String& from, const String& to) {
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for file rename operation");
+        return false;
+    }
+
+    closeAppender(from);
+    closeAppender(to);
+
+    SDOpTimer timer(SD_OP_META);
+    if (card().exists(to) && !card().remove(to)) {
+        app->log("ERROR: Failed to replace existing file: " + to);
+        return false;
+    }
+
+    if (!card().rename(from, to)) {
+        app->log("ERROR: Failed to rename file: " + from + " -> " + to);
+        return false;
+    }
+
+    return true;
+}
+
+void FileSystem::recordOperation(SDOperation operation, uint32_t elapsedUs) {
+    // Timed operations run under the SD card mutex, so the counters need no lock of their own
+    SDOperationStats& stats = operationStats[operation];
+    stats.count++;
+    stats.totalUs += elapsedUs;
+    if (elapsedUs > stats.maxUs) {
+        stats.maxUs = elapsedUs;
+    }
+    if (operation == SD_OP_WRITE) {
+        Metrics::observe(METRIC_SD_WRITE_US, elapsedUs);
+    } else if (operation == SD_OP_READ) {
+        Metrics::observe(METRIC_SD_READ_US, elapsedUs);
+    }
+}
+
+void FileSystem::logOperationStats(uint32_t recordedMs) {
+    if (!initialized) {
+        return;
+    }
+
+    static const char* const names[SD_OP_COUNT] = { "open", "read", "write", "sync", "meta" };
+    String report = "SD time";
+    uint64_t totalUs = 0;
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked()) {
+            return;
+        }
+        for (int i = 0; i < SD_OP_COUNT; i++) {
+            const SDOperationStats& stats = operationStats[i];
+            totalUs += stats.totalUs;
+            if (stats.count > 0) {
+                report += String(i == 0 ? ": " : ", ") + names[i] + " " + String(stats.count) + "x avg " +
+                          String(stats.totalUs / stats.count / 1000.0f, 1) + "ms max " +
+                          String(stats.maxUs / 1000.0f, 1) + "ms";
+            }
+            operationStats[i] = {};
+        }
+        report += "; skipped " + String(directoryCacheHits) + " directory checks and " +
+                  String(appenderReuses) + " opens";
+        directoryCacheHits = 0;
+        appenderReuses = 0;
+    }
+
+    if (recordedMs > 0) {
+        report += "; " + String(totalUs / 1000.0f * 60000.0f / recordedMs, 0) + "ms per recorded minute";
+    }
+    app->log(report);
+    SDScheduler::logStats();
+}
+
 bool FileSystem::addToUploadQueue(const String &filename) {
     // Basic validation
     if (filename.length() == 0) {
@@ -377,85 +789,40 @@ bool FileSystem::addToUploadQueue(const String &filename) {
         return false;
     }
 
-    // Add to queue using addToFile method
-    return addToFile(UPLOAD_QUEUE_FILE, filename + "\n", true);
+    return UploadQueue::push(filename);
 }
 
 String FileSystem::getNextUploadFile() {
-    String content = readFile(UPLOAD_QUEUE_FILE);
-    if (content.isEmpty()) {
-        return "";
-    }
-    
-    // Extract first line
-    int newlinePos = content.indexOf('\n');
-    if (newlinePos == -1) {
-        return content; // No newline, return entire content
-    }
-    
-    return content.substring(0, newlinePos);
+    return UploadQueue::peek();
 }
 
 bool FileSystem::removeFirstFromUploadQueue() {
-    String content = readFile(UPLOAD_QUEUE_FILE);
-    if (content.isEmpty()) {
+    String removedFile = UploadQueue::peek();
+    if (removedFile.isEmpty()) {
         app->log("ERROR: Cannot remove from empty upload queue");
         return false;
     }
-    
-    // Find first newline
-    int newlinePos = content.indexOf('\n');
-    if (newlinePos == -1) {
-        // No newline, queue has just one entry
-        return deleteFile(UPLOAD_QUEUE_FILE);
-    }
-    
-    // Get the file that will be removed for logging
-    String removedFile = content.substring(0, newlinePos);
-    
-    // Extract remaining content (skip the newline)
-    String remaining = content.substring(newlinePos + 1);
-    
-    // Overwrite the file with remaining content
-    bool success = overwriteFile(UPLOAD_QUEUE_FILE, remaining);
-    
+
+    bool success = UploadQueue::pop();
     if (success) {
         app->log("Removed from upload queue: " + removedFile);
     }
-    
+
     return success;
 }
 
+size_t FileSystem::getNextUploadFiles(String* paths, uint32_t* ids, size_t maxCount) {
+    return UploadQueue::peekBatch(paths, ids, maxCount);
+}
+
+bool FileSystem::removeFromUploadQueue(uint32_t id) {
+    return UploadQueue::remove(id);
+}
+
 bool FileSystem::isUploadQueueEmpty() {
-    String content = readFile(UPLOAD_QUEUE_FILE);
-    return content.isEmpty();
+    return UploadQueue::isEmpty();
 }
 
 bool FileSystem::isFileInUploadQueue(const String &filename) {
-    String content = readFile(UPLOAD_QUEUE_FILE);
-    if (content.isEmpty()) {
-        return false;
-    }
-    
-    int pos = 0;
-    while (pos < content.length()) {
-        int newlinePos = content.indexOf('\n', pos);
-        
-        // If no more newlines, check the rest of the string
-        if (newlinePos == -1) {
-            String line = content.substring(pos);
-            return (line == filename);
-        }
-        
-        // Check the current line
-        String line = content.substring(pos, newlinePos);
-        if (line == filename) {
-            return true;
-        }
-        
-        // Move to next line
-        pos = newlinePos + 1;
-    }
-    
-    return false;
+    return UploadQueue::contains(filename);
 }
\ No newline at end of file
@@ -5,6 +5,18 @@
  * This module handles SD card initialization, file operations, 
  * and upload queue management. It provides a centralized interface
  * for all file-related operations in the system.
+ *
+ * The card is mounted through the SDMMC host when SD_BUS selects it and
+ * over SPI otherwise, or when the SDMMC mount fails. Modules open files
+ * through card(), which returns whichever bus is mounted.
+ *
+ * To save FAT metadata I/O, directories known to exist are cached and the
+ * files appended to all the time (LOG_FILE, UPLOAD_QUEUE_FILE) keep their
+ * handle open between appends. Every SD access is timed per operation
+ * type, logOperationStats() reports the time spent per recorded minute.
+ *
+ * Access is serialized by SDLockGuard through SDScheduler, which hands the
+ * card to recording before logs and uploads.
  */
 
 #ifndef FILESYSTEM_H
@@ -15,10 +27,67 @@
 #include <SD.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <esp_timer.h>
 
 #include "Application.h"
+#include "PowerManager.h"
+#include "SDScheduler.h"
 #include "config.h"
 
+/**
+ * @brief RAII helper that holds the SD card for its lifetime, granted by SDScheduler
+ */
+class SDLockGuard {
+private:
+    bool locked;
+public:
+    SDLockGuard() : locked(false) {
+        locked = SDScheduler::acquire(pdMS_TO_TICKS(SD_LOCK_TIMEOUT));
+        // Keep the SPI clock steady while the card is in use
+        if (locked) PowerManager::acquireLock(POWER_LOCK_APB);
+    }
+    ~SDLockGuard() {
+        if (locked) {
+            PowerManager::releaseLock(POWER_LOCK_APB);
+            SDScheduler::release();
+        }
+    }
+    bool isLocked() const { return locked; }
+};
+
+// VFS mount points of the two buses
+#define SD_SPI_MOUNT_POINT "/sd"
+#define SD_MMC_MOUNT_POINT "/sdcard"
+
+/**
+ * @brief SD operations timed by the latency counters
+ */
+enum SDOperation {
+    SD_OP_OPEN,     ///< Opening a file, including the directory walk
+    SD_OP_READ,     ///< Reading file data
+    SD_OP_WRITE,    ///< Writing file data
+    SD_OP_SYNC,     ///< Flushing or closing a file
+    SD_OP_META,     ///< exists, mkdir, remove, rename and truncate
+    SD_OP_COUNT
+};
+
+/**
+ * @brief Latency totals of one operation type
+ */
+struct SDOperationStats {
+    uint32_t count;     ///< Operations since the last report
+    uint64_t totalUs;   ///< Time spent in them
+    uint32_t maxUs;     ///< Slowest one
+};
+
+/**
+ * @brief One contiguous piece of a scatter write
+ */
+struct FileSegment {
+    const uint8_t* data;    ///< Start of the segment
+    size_t size;            ///< Length of the segment in bytes
+};
+
 /**
  * Static class for file system operations
  */
@@ -32,10 +101,23 @@ public:
     static bool init(Application* app = nullptr);
 
     /**
-     * @brief Get the mutex for SD card operations
-     * @return Semaphore handle for SD card mutex
+     * @brief Get the mounted card, SD_MMC or SD depending on the bus in use
+     * @return File system to open files on, the caller must hold the SD card mutex
+     */
+    static fs::FS& card();
+
+    /**
+     * @brief Check if the card is mounted through the SDMMC host
+     * @return true for SDMMC, false for SPI
+     */
+    static bool isSDMMC();
+
+    /**
+     * @brief Mount the card again on the same bus at another clock, e.g. to compare bus speeds
+     * @param frequencyKhz Bus clock in kHz, SD_SPEED / 1000 and SD_MMC_FREQ_KHZ are the defaults
+     * @return true if the card was mounted at that clock, false if it is not mounted any more
      */
-    static SemaphoreHandle_t getSDMutex();
+    static bool remount(uint32_t frequencyKhz);
 
     /**
      * @brief Create a directory if it doesn't exist
@@ -68,13 +150,88 @@ public:
     static bool createEmptyFile(const String& path);
 
     /**
-     * @brief Overwrite a file with new content
+     * @brief Overwrite a file with new text content
      * @param path File path
-     * @param content String content to write
+     * @param content String content to write (text only, use writeFile() for binary data)
      * @return true if operation was successful, false otherwise
      */
     static bool overwriteFile(const String& path, const String& content);
 
+    /**
+     * @brief Overwrite a file with binary data
+     * @param path File path
+     * @param data Data to write
+     * @param size Number of bytes to write
+     * @return true if all bytes were written, false otherwise
+     */
+    static bool writeFile(const String& path, const uint8_t* data, size_t size);
+
+    /**
+     * @brief Overwrite a file with several binary segments written back to back
+     * @param path File path
+     * @param segments Segments to write, in file order
+     * @param segmentCount Number of segments
+     * @return true if all bytes were written, false otherwise
+     */
+    static bool writeFile(const String& path, const FileSegment* segments, size_t segmentCount);
+
+    /**
+     * @brief Append several binary segments to a file, creating it if needed
+     * @param path File path
+     * @param segments Segments to append, in file order
+     * @param segmentCount Number of segments
+     * @return true if all bytes were written, false otherwise
+     */
+    static bool appendFile(const String& path, const FileSegment* segments, size_t segmentCount);
+
+    /**
+     * @brief Append segments to a file, the caller must hold the SD card mutex
+     *
+     * LOG_FILE and UPLOAD_QUEUE_FILE keep their handle open and are flushed
+     * after every call, other files are opened and closed per call.
+     * @param path File path
+     * @param segments Segments to append, in file order
+     * @param segmentCount Number of segments
+     * @param written Receives the number of bytes written
+     * @return true if all bytes were written, false otherwise
+     */
+    static bool appendSegments(const String& path, const FileSegment* segments, size_t segmentCount, size_t& written);
+
+    /**
+     * @brief Close the kept open append handle of a file, the caller must hold the SD card mutex
+     *
+     * Needed before the file is rewritten, renamed, removed or written through another handle.
+     * @param path File path, nothing happens if the file has no kept open handle
+     */
+    static void closeAppender(const String& path);
+
+    /**
+     * @brief Cut a file to a size, the caller must hold the SD card mutex
+     * @param path File path, the file must be closed
+     * @param size New size in bytes
+     * @return true if the file was truncated, false otherwise
+     */
+    static bool truncateFile(const String& path, size_t size);
+
+    /**
+     * @brief Write to an open file in blocks that end on SD_WRITE_BLOCK_SIZE file offsets
+     * @param file Open file, the caller must hold the SD card mutex
+     * @param data Data to write
+     * @param size Number of bytes to write
+     * @param offset Current file offset, advanced by the bytes written
+     * @return true if all bytes were written, false otherwise
+     */
+    static bool writeAligned(File& file, const uint8_t* data, size_t size, size_t& offset);
+
+    /**
+     * @brief Read from an open file in SD_WRITE_BLOCK_SIZE blocks, yielding the card between them
+     * @param file Open file, the caller must hold the SD card mutex
+     * @param buffer Receives the data
+     * @param size Number of bytes to read
+     * @return Number of bytes read
+     */
+    static size_t readBlocks(File& file, uint8_t* buffer, size_t size);
+
     /**
      * @brief Read entire file content
      * @param path File path
@@ -92,6 +249,14 @@ public:
      */
     static bool readFileToFixedBuffer(const String& path, uint8_t* buffer, size_t bufferSize, size_t& readSize);
 
+    /**
+     * @brief Get the size of a file
+     * @param path Full path of the file
+     * @param size Receives the size in bytes, 0 if the file does not exist
+     * @return true if the card could be queried, false otherwise
+     */
+    static bool getFileSize(const String& path, size_t& size);
+
     /**
      * @brief Read a file into a binary buffer
      * @param path File path
@@ -110,6 +275,14 @@ public:
      */
     static bool deleteFile(const String& path);
 
+    /**
+     * @brief Rename a file, replacing the destination if it exists
+     * @param from Current file path
+     * @param to New file path
+     * @return true if file was renamed successfully, false otherwise
+     */
+    static bool renameFile(const String& from, const String& to);
+
     /**
      * @brief Add a file to the upload queue
      * @param filename Full path of the file to add
@@ -129,6 +302,22 @@ public:
      */
     static bool removeFirstFromUploadQueue();
 
+    /**
+     * @brief Get several files from the front of the upload queue
+     * @param paths Receives up to maxCount file paths
+     * @param ids Receives the queue entry id of each file
+     * @param maxCount Capacity of paths and ids
+     * @return Number of files returned
+     */
+    static size_t getNextUploadFiles(String* paths, uint32_t* ids, size_t maxCount);
+
+    /**
+     * @brief Remove a file returned by getNextUploadFiles from the upload queue
+     * @param id Queue entry id of the file
+     * @return true if file was removed successfully, false otherwise
+     */
+    static bool removeFromUploadQueue(uint32_t id);
+
     /**
      * @brief Check if the upload queue is empty
      * @return true if queue is empty, false otherwise
@@ -142,6 +331,19 @@ public:
      */
     static bool isFileInUploadQueue(const String &filename);
 
+    /**
+     * @brief Account the time of one SD operation, the caller must hold the SD card mutex
+     * @param operation Operation type
+     * @param elapsedUs Duration in microseconds
+     */
+    static void recordOperation(SDOperation operation, uint32_t elapsedUs);
+
+    /**
+     * @brief Log the latency counters and the metadata I/O the caches saved, then reset them
+     * @param recordedMs Audio recorded since the last report, to scale the SD time per minute
+     */
+    static void logOperationStats(uint32_t recordedMs);
+
     // Prevent copying and assignment
     FileSystem(const FileSystem&) = delete;
     FileSystem& operator=(const FileSystem&) = delete;
@@ -149,11 +351,70 @@ public:
 private:
     // Private static state
     static bool initialized;
-    static SemaphoreHandle_t sdMutex;
     static Application* app;
+    static bool sdmmcMounted;
+
+    /**
+     * @brief Append handle of a file that is kept open
+     */
+    struct Appender {
+        const char* path;   ///< File the handle belongs to
+        File file;          ///< Open handle, closed if the file is not in use
+        size_t size;        ///< File size, tracked so appends need no stat
+    };
+
+    static const size_t APPENDER_COUNT = 2;
+    static Appender appenders[APPENDER_COUNT];
+
+    // Directories known to exist
+    static String knownDirectories[SD_DIRECTORY_CACHE_SIZE];
+    static size_t knownDirectoryCount;
+
+    // Latency counters and the operations the caches saved
+    static SDOperationStats operationStats[SD_OP_COUNT];
+    static uint32_t directoryCacheHits;
+    static uint32_t appenderReuses;
+
+    /**
+     * @brief Find the kept open appender of a file
+     * @param path File path
+     * @return Appender, or nullptr if the file is opened per call
+     */
+    static Appender* findAppender(const String& path);
+    
+    /**
+     * @brief Mount the card through the SDMMC host
+     * @return true if the card was mounted, false otherwise
+     */
+    static bool mountSDMMC();
+
+    /**
+     * @brief Mount the card over SPI, retrying at lower speeds
+     * @return true if the card was mounted, false otherwise
+     */
+    static bool mountSPI();
+
+    /**
+     * @brief Measure sequential write and read throughput with SD_BENCHMARK_BYTES
+     */
+    static void benchmark();
     
     // Private constructor (singleton pattern enforcement)
     FileSystem() = default;
 };
 
+/**
+ * @brief RAII timer that accounts its scope to an SD operation type
+ */
+class SDOpTimer {
+private:
+    SDOperation operation;
+    int64_t start;
+public:
+    SDOpTimer(SDOperation operation) : operation(operation), start(esp_timer_get_time()) {}
+    ~SDOpTimer() {
+        FileSystem::recordOperation(operation, (uint32_t)(esp_timer_get_time() - start));
+    }
+};
+
 #endif // FILESYSTEM_H
\ No newline at end of file
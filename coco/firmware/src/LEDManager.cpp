@@ -3,6 +3,8 @@
  * @brief Implementation of LED management functionality
  */
 
+#include <algorithm>
+
 #include "LEDManager.h"
 #include "Application.h"
 #include "config.h"
@@ -14,18 +16,23 @@ SemaphoreHandle_t LEDManager::ledMutex = nullptr;
 int LEDManager::ledPin = LED_PIN;
 int LEDManager::ledFrequency = LED_FREQUENCY;
 int LEDManager::ledResolution = LED_RESOLUTION;
+QueueHandle_t LEDManager::commandQueue = nullptr;
+TaskHandle_t LEDManager::ledTaskHandle = nullptr;
+bool LEDManager::steadyOn = false;
 int LEDManager::brightness = 255;  // Default to full brightness
+uint32_t LEDManager::duty = 0;
+bool LEDManager::fading = false;
 
 bool LEDManager::init(Application* appInstance, int pin, int frequency, int resolution) {
     if (initialized) {
         return true;
     }
-    
+
     // Create mutex if not already created
     if (ledMutex == nullptr) {
         ledMutex = xSemaphoreCreateMutex();
     }
-    
+
     // Store Application instance if provided
     if (appInstance != nullptr) {
         app = appInstance;
@@ -33,132 +40,194 @@ bool LEDManager::init(Application* appInstance, int pin, int frequency, int reso
         // If not provided and not previously set, get the singleton instance
         app = Application::getInstance();
     }
-    
+
     // Override default values if provided
     if (pin >= 0) ledPin = pin;
     if (frequency >= 0) ledFrequency = frequency;
     if (resolution >= 0) ledResolution = resolution;
-    
+
     // Initialize LED
     ledcAttach(ledPin, ledFrequency, ledResolution);
     ledcWrite(ledPin, 0);  // LED off initially
-    
+
+    if (commandQueue == nullptr) {
+        commandQueue = xQueueCreate(LED_QUEUE_SIZE, sizeof(Command));
+        if (commandQueue == nullptr) {
+            app->log("Failed to create LED command queue!");
+            return false;
+        }
+    }
+
+    if (xTaskCreatePinnedToCore(
+        ledTask,
+        "LED",
+        2048,
+        NULL,
+        1,
+        &ledTaskHandle,
+        0  // Run on Core 0
+    ) != pdPASS) {
+        app->log("Failed to create LED task!");
+        return false;
+    }
+
     if (app) {
         app->log("LEDManager initialized");
     }
-    
+
     initialized = true;
     return true;
 }
 
-void LEDManager::setLEDState(bool state) {
-    if (!initialized) {
-        init();
-    }
-    
-    if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-        ledcWrite(ledPin, state ? brightness : 0);  // Use stored brightness when turning on
-        xSemaphoreGive(ledMutex);
+bool LEDManager::send(const Command& command) {
+    if (!initialized && !init()) {
+        return false;
     }
+    return xQueueSend(commandQueue, &command, 0) == pdPASS;
+}
+
+void LEDManager::setLEDState(bool state) {
+    send({Command::STATE, state ? 1 : 0, 0, 0, 0});
 }
 
 void LEDManager::setLEDBrightness(int newBrightness) {
-    if (!initialized) {
-        init();
-    }
-    
-    if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-        brightness = newBrightness;  // Store the brightness value
-        
-        // If recording is active, update the LED with new brightness immediately
-        if (app->isRecordingRequested()) {
-            ledcWrite(ledPin, brightness);
+    send({Command::BRIGHTNESS, newBrightness, 0, 0, 0});
+}
+
+void LEDManager::errorBlinkLED(int interval) {
+    send({Command::ERROR_BLINK, 0, interval, 0, 0});
+}
+
+bool LEDManager::timedErrorBlinkLED(int interval, unsigned long duration) {
+    return send({Command::ERROR_BLINK, 0, interval, 0, duration});
+}
+
+void LEDManager::indicateBatteryLevel(int batteryLevel, int blinkDuration, int pauseDuration) {
+    // Constrain battery level to 1-4 for safety
+    send({Command::BATTERY, constrain(batteryLevel, 1, 4), blinkDuration, pauseDuration, 0});
+}
+
+SemaphoreHandle_t LEDManager::getLEDMutex() {
+    return ledMutex;
+}
+
+void LEDManager::ledTask(void* parameter) {
+    Command command;
+
+    while (true) {
+        if (xQueueReceive(commandQueue, &command, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if (applySteady(command)) {
+            output(steadyOn ? brightness : 0, LED_FADE_TIME);
+            continue;
+        }
+
+        if (command.type == Command::BATTERY) {
+            playBatteryLevel(command);
+        } else {
+            playError(command);
         }
-        
-        xSemaphoreGive(ledMutex);
+
+        // A pattern cut short leaves the next one in the queue, it starts from the steady state
+        output(steadyOn ? brightness : 0, LED_BLINK_FADE_TIME);
     }
 }
 
-void LEDManager::errorBlinkLED(int interval) {
-    if (!initialized) {
-        init();
+bool LEDManager::applySteady(const Command& command) {
+    if (command.type == Command::STATE) {
+        steadyOn = command.value != 0;
+        return true;
     }
-    
-    bool led_state = HIGH;
-    while (true) {
-        if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-            led_state = !led_state;
-            ledcWrite(ledPin, led_state ? brightness : 20);  // Use stored brightness for ON state
-            xSemaphoreGive(ledMutex);
+    if (command.type == Command::BRIGHTNESS) {
+        brightness = constrain(command.value, 0, 255);
+        return true;
+    }
+    return false;
+}
+
+void LEDManager::playBatteryLevel(const Command& command) {
+    uint32_t fade = std::min((uint32_t)LED_BLINK_FADE_TIME, (uint32_t)command.interval / 2);
+
+    // Blink from dark, whatever the steady state
+    output(0, fade);
+    if (!hold(command.pause)) {
+        return;
+    }
+
+    for (int i = 0; i < command.value; i++) {
+        output(brightness, fade);
+        if (!hold(command.interval)) {
+            return;
+        }
+
+        output(0, fade);
+        // A longer pause after the last blink, before the steady state returns
+        if (!hold(i < command.value - 1 ? command.pause : command.pause * 2)) {
+            return;
         }
-        vTaskDelay(pdMS_TO_TICKS(interval));
     }
 }
 
-bool LEDManager::timedErrorBlinkLED(int interval, unsigned long duration) {
-    if (!initialized) {
-        init();
-    }
-    
-    bool led_state = HIGH;
-    unsigned long startTime = millis();
-    bool infinite = (duration == 0);
-    
-    while (infinite || (millis() - startTime < duration)) {
-        if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-            led_state = !led_state;
-            ledcWrite(ledPin, led_state ? brightness : 20);  // Use stored brightness for ON state
-            xSemaphoreGive(ledMutex);
+void LEDManager::playError(const Command& command) {
+    uint32_t fade = std::min((uint32_t)LED_BLINK_FADE_TIME, (uint32_t)command.interval / 2);
+    TickType_t start = xTaskGetTickCount();
+    bool infinite = (command.duration == 0);
+    bool ledState = true;
+
+    while (infinite || xTaskGetTickCount() - start < pdMS_TO_TICKS(command.duration)) {
+        ledState = !ledState;
+        output(ledState ? brightness : LED_ERROR_LOW_DUTY, fade);
+        if (!hold(command.interval)) {
+            return;
         }
-        
-        // Short delay to allow other tasks to run
-        vTaskDelay(pdMS_TO_TICKS(interval));
     }
-    
-    // Turn off LED at the end
-    if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-        ledcWrite(ledPin, 0);  // LED off
-        xSemaphoreGive(ledMutex);
+}
+
+bool LEDManager::hold(uint32_t ms) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(ms);
+    Command command;
+
+    while (true) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait || xQueuePeek(commandQueue, &command, wait - elapsed) != pdTRUE) {
+            return true;
+        }
+        if (command.type != Command::STATE && command.type != Command::BRIGHTNESS) {
+            // Leave the new pattern for the task loop
+            return false;
+        }
+        xQueueReceive(commandQueue, &command, 0);
+        applySteady(command);
     }
-    
-    return true;
 }
 
-void LEDManager::indicateBatteryLevel(int batteryLevel, int blinkDuration, int pauseDuration) {
-    if (!initialized) {
-        init();
+void LEDManager::output(uint32_t target, uint32_t fadeMs) {
+    // The fade hardware takes one fade per channel at a time
+    if (fading) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LED_FADE_TIME * 4));
+        fading = false;
     }
-    
-    // Constrain battery level to 1-4 for safety
-    batteryLevel = constrain(batteryLevel, 1, 4);
-    
-    if (xSemaphoreTake(ledMutex, portMAX_DELAY) == pdPASS) {
-        // Store the current LED state
-        bool originalState = ledcRead(ledPin) > 0;
-        
-        // Blink the LED the specified number of times
-        for (int i = 0; i < batteryLevel; i++) {
-            // Turn on LED
-            ledcWrite(ledPin, brightness);
-            delay(blinkDuration);
-            
-            // Turn off LED
-            ledcWrite(ledPin, 0);
-            
-            // Only pause between blinks, not after the last one
-            if (i < batteryLevel - 1) {
-                delay(pauseDuration);
-            }
+
+    if (xSemaphoreTake(ledMutex, portMAX_DELAY) != pdPASS) {
+        return;
+    }
+    // A fade without a step might never report its end, so the duty has to change
+    if (target != duty) {
+        if (fadeMs > 0 && ledcFadeWithInterrupt(ledPin, duty, target, fadeMs, onFadeEnd)) {
+            fading = true;
+        } else {
+            ledcWrite(ledPin, target);
         }
-        
-        // Restore original LED state after a pause
-        delay(pauseDuration * 2);
-        ledcWrite(ledPin, originalState ? brightness : 0);
-        
-        xSemaphoreGive(ledMutex);
     }
+    duty = target;
+    xSemaphoreGive(ledMutex);
 }
 
-SemaphoreHandle_t LEDManager::getLEDMutex() {
-    return ledMutex;
+void IRAM_ATTR LEDManager::onFadeEnd() {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(ledTaskHandle, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
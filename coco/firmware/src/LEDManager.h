@@ -1,6 +1,13 @@
 /**
  * @file LEDManager.h
  * @brief Header file for LED management functionality
+ *
+ * Every request is queued for the LED task and returns immediately, so it
+ * can be made from the timer service task or while holding other locks.
+ * The LED task plays patterns as LEDC hardware fades and sleeps while they
+ * run. A pattern returns to the steady state (on or off, at the battery
+ * brightness) when it ends, and is cut short by the next pattern. Steady
+ * state changes during a pattern take effect once it ends.
  */
 
 #ifndef LED_MANAGER_H
@@ -9,6 +16,8 @@
 #include <Arduino.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 
 // Forward declaration
 class Application;
@@ -16,7 +25,7 @@ class Application;
 class LEDManager {
 public:
     /**
-     * @brief Initialize the LED manager
+     * @brief Initialize the LED manager and start the LED task
      * @param appInstance Pointer to the Application instance
      * @param pin LED pin number
      * @param frequency LED PWM frequency
@@ -24,19 +33,19 @@ public:
      * @return true if initialization was successful, false otherwise
      */
     static bool init(Application* appInstance = nullptr, int pin = -1, int frequency = -1, int resolution = -1);
-    
+
     /**
-     * @brief Set the LED state
+     * @brief Set the steady LED state
      * @param state true for ON, false for OFF
      */
     static void setLEDState(bool state);
-    
+
     /**
-     * @brief Set the LED brightness
+     * @brief Set the LED brightness, a lit LED fades to it
      * @param brightness Brightness value (0-255)
      */
     static void setLEDBrightness(int brightness);
-    
+
     /**
      * @brief Indicate battery level by blinking the LED
      * @param batteryLevel Battery level (1-4) where 1 is lowest and 4 is highest
@@ -44,44 +53,118 @@ public:
      * @param pauseDuration Duration between blinks in milliseconds
      */
     static void indicateBatteryLevel(int batteryLevel, int blinkDuration = 200, int pauseDuration = 200);
-    
+
     /**
-     * @brief Blink the LED in an error pattern
+     * @brief Blink the LED in an error pattern until another pattern is requested
      * @param interval Interval between state changes in milliseconds
-     * @note This function does not return
      */
     static void errorBlinkLED(int interval);
-    
+
     /**
      * @brief Blink the LED in an error pattern for a specific duration
      * @param interval Interval between state changes in milliseconds
      * @param duration Total duration in milliseconds to blink (0 for infinite)
-     * @return True if completed successfully
+     * @return True if the pattern was queued
      */
     static bool timedErrorBlinkLED(int interval, unsigned long duration = 0);
-    
+
     /**
-     * @brief Get the LED mutex
+     * @brief Get the LED mutex, held by the LED task while it drives the LED
      * @return LED mutex handle
      */
     static SemaphoreHandle_t getLEDMutex();
 
+    /**
+     * @brief Get the LED task handle
+     * @return Handle of the task playing the LED patterns
+     */
+    static TaskHandle_t getLEDTaskHandle() { return ledTaskHandle; }
+
 private:
     // Private constructor for static-only class
     LEDManager() = default;
     LEDManager(const LEDManager&) = delete;
     LEDManager& operator=(const LEDManager&) = delete;
-    
+
+    /**
+     * @brief A request for the LED task
+     */
+    struct Command {
+        enum { STATE, BRIGHTNESS, BATTERY, ERROR_BLINK } type;
+        int value;               ///< State, brightness or battery level
+        int interval;            ///< Blink or error interval (ms)
+        int pause;               ///< Pause between battery blinks (ms)
+        unsigned long duration;  ///< Length of the error pattern, 0 for infinite (ms)
+    };
+
+    /**
+     * @brief Queue a request for the LED task
+     * @param command Request
+     * @return true if the request was queued, false if the queue was full
+     */
+    static bool send(const Command& command);
+
+    /**
+     * @brief Play the queued requests
+     * @param parameter Task parameters (unused)
+     */
+    static void ledTask(void* parameter);
+
+    /**
+     * @brief LED task side: blink the battery level
+     * @param command BATTERY request
+     */
+    static void playBatteryLevel(const Command& command);
+
+    /**
+     * @brief LED task side: alternate between full and low brightness
+     * @param command ERROR_BLINK request
+     */
+    static void playError(const Command& command);
+
+    /**
+     * @brief LED task side: wait while a pattern step shows, taking steady state requests meanwhile
+     * @param ms Time to wait
+     * @return true if the step completed, false if another pattern was requested
+     */
+    static bool hold(uint32_t ms);
+
+    /**
+     * @brief LED task side: take a STATE or BRIGHTNESS request into the steady state
+     * @param command Request
+     * @return true if it was a steady state request
+     */
+    static bool applySteady(const Command& command);
+
+    /**
+     * @brief LED task side: fade to a duty, after the running fade ended
+     * @param duty Target duty
+     * @param fadeMs Fade time, 0 to set the duty at once
+     */
+    static void output(uint32_t duty, uint32_t fadeMs);
+
+    /**
+     * @brief Called from the LEDC interrupt when a fade ended
+     */
+    static void onFadeEnd();
+
     // Static members
     static bool initialized;
     static Application* app;
-    
+
     // LED related variables
     static SemaphoreHandle_t ledMutex;
     static int ledPin;
     static int ledFrequency;
     static int ledResolution;
-    static int brightness;  // Store current brightness value
+
+    // LED task and its state
+    static QueueHandle_t commandQueue;
+    static TaskHandle_t ledTaskHandle;
+    static bool steadyOn;       // Steady state, shown whenever no pattern plays
+    static int brightness;      // Duty of a lit LED, follows the battery level
+    static uint32_t duty;       // Duty currently shown, or faded to
+    static bool fading;         // A hardware fade is running
 };
 
 #endif // LED_MANAGER_H
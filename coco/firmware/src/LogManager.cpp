@@ -6,41 +6,47 @@
  * including the asynchronous log writing mechanism.
  */
 
+#include <esp_heap_caps.h>
+#include <algorithm>
+
 #include "LogManager.h"
+#include "FileSystem.h"
+
+// Ring indices wrap around at 2^32, which keeps them aligned only with a power of two ring
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
 
 // Initialize static members
 Application* LogManager::app = nullptr;
-QueueHandle_t LogManager::logQueue = NULL;
 int LogManager::bootSession = 0;
 int LogManager::logIndex = 0;
 TaskHandle_t LogManager::logTaskHandle = NULL;
 bool LogManager::initialized = false;
-String (*LogManager::getTimestampFunc)() = NULL;
+size_t (*LogManager::getTimestampFunc)(char*, size_t) = NULL;
+char* LogManager::ring = nullptr;
+volatile uint32_t LogManager::ringHead = 0;
+volatile uint32_t LogManager::ringTail = 0;
+volatile uint32_t LogManager::droppedCount = 0;
+volatile bool LogManager::flushRequested = false;
+portMUX_TYPE LogManager::ringLock = portMUX_INITIALIZER_UNLOCKED;
+size_t LogManager::logFileSize = 0;
 
 bool LogManager::init(Application* application) {
     // Store application reference
     app = application;
     
-    // Create our own log queue
-    logQueue = xQueueCreate(LOG_QUEUE_SIZE, sizeof(char*));
-    if (logQueue == NULL) {
-        Serial.println("Failed to create log queue!");
+    // Allocate the log ring, in PSRAM if available
+    ring = (char*)heap_caps_malloc(LOG_RING_SIZE, MALLOC_CAP_SPIRAM);
+    if (ring == nullptr) {
+        ring = (char*)malloc(LOG_RING_SIZE);
+    }
+    if (ring == nullptr) {
+        Serial.println("Failed to allocate log ring!");
         return false;
     }
     
-    // Set initialized flag early for basic logging
+    // Messages are collected from here on, the file is only opened by startLogTask()
     initialized = true;
     
-    // Read current log file using Application wrapper
-    String currentLogContent = app->readFile(LOG_FILE);
-    if (currentLogContent.isEmpty()) {
-        // Create initial log file if it doesn't exist or is empty
-        if (!app->overwriteFile(LOG_FILE, "=== Device Log Started ===\n")) {
-            Serial.println("Failed to initialize log file!");
-            return false;
-        }
-    }
-    
     // Reset log index
     logIndex = 0;
     
@@ -56,37 +62,83 @@ void LogManager::log(const String &message) {
     }
     
     // Get timestamp using the provided function - use a fallback if not set
-    String timestamp = getTimestampFunc ? getTimestampFunc() : "unknown";
+    char timestamp[TIMESTAMP_SIZE];
+    if (!getTimestampFunc || getTimestampFunc(timestamp, sizeof(timestamp)) == 0) {
+        snprintf(timestamp, sizeof(timestamp), "unknown");
+    }
     
-    String logMessage = String(bootSession) + "_" + String(logIndex) + "_" + timestamp + ": " + message;
+    // Format on the stack, leaving room for the newline
+    char line[LOG_MESSAGE_MAX];
+    int length = snprintf(line, sizeof(line) - 1, "%d_%d_%s: %s", bootSession, logIndex, timestamp,
+                          message.c_str());
+    if (length < 0) {
+        return;
+    }
+    length = std::min(length, (int)sizeof(line) - 2);
+    line[length++] = '\n';
     logIndex++;
     
     // Print to Serial for debugging
-    Serial.println(logMessage);
-    
-    // If queue is available, use it
-    if (logQueue != NULL) {
-        // Allocate a copy on the heap
-        char *msgCopy = strdup(logMessage.c_str());
-        if (xQueueSend(logQueue, &msgCopy, portMAX_DELAY) != pdPASS) {
-            Serial.println("Failed to enqueue log message!");
-            free(msgCopy);
-        }
+    Serial.write((const uint8_t*)line, length);
+    
+    append(line, length);
+}
+
+void LogManager::append(const char* line, size_t length) {
+    size_t used;
+    bool stored = false;
+    
+    portENTER_CRITICAL(&ringLock);
+    used = ringHead - ringTail;
+    if (ring != nullptr && LOG_RING_SIZE - used >= length) {
+        uint32_t offset = ringHead & (LOG_RING_SIZE - 1);
+        size_t first = std::min(length, (size_t)(LOG_RING_SIZE - offset));
+        memcpy(ring + offset, line, first);
+        memcpy(ring, line + first, length - first);
+        ringHead += length;
+        stored = true;
+    } else {
+        droppedCount++;
     }
+    portEXIT_CRITICAL(&ringLock);
+    
+    // Wake the log task to start its batch timer, and again once the batch is large enough
+    if (stored && (used == 0 || (used < LOG_FLUSH_BYTES && used + length >= LOG_FLUSH_BYTES))) {
+        xEventGroupSetBits(app->getEventGroup(), EVENT_LOGS_PENDING);
+    }
+}
+
+size_t LogManager::pendingBytes() {
+    portENTER_CRITICAL(&ringLock);
+    size_t used = ringHead - ringTail;
+    portEXIT_CRITICAL(&ringLock);
+    return used;
 }
 
 bool LogManager::hasPendingLogs() {
     if (!initialized) {
         return false;
     }
-    return uxQueueMessagesWaiting(logQueue) > 0;
+    return pendingBytes() > 0;
+}
+
+void LogManager::flush() {
+    if (!initialized) {
+        return;
+    }
+    flushRequested = true;
+    xEventGroupSetBits(app->getEventGroup(), EVENT_LOGS_PENDING);
+}
+
+uint32_t LogManager::getDroppedCount() {
+    return droppedCount;
 }
 
 void LogManager::setBootSession(int session) {
     bootSession = session;
 }
 
-void LogManager::setTimestampProvider(String (*timestampFunc)()) {
+void LogManager::setTimestampProvider(size_t (*timestampFunc)(char*, size_t)) {
     getTimestampFunc = timestampFunc;
 }
 
@@ -96,6 +148,23 @@ bool LogManager::startLogTask() {
         return false;
     }
     
+    // Only the size of the current log file is needed, to know when to rotate it
+    size_t size = 0;
+    if (!app->getFileSize(LOG_FILE, size)) {
+        Serial.println("Failed to read log file size!");
+        return false;
+    }
+    if (size == 0) {
+        // Create initial log file if it doesn't exist or is empty
+        const char* header = "=== Device Log Started ===\n";
+        if (!app->overwriteFile(LOG_FILE, header)) {
+            Serial.println("Failed to initialize log file!");
+            return false;
+        }
+        size = strlen(header);
+    }
+    logFileSize = size;
+    
     // Start log flush task
     if (xTaskCreatePinnedToCore(
         logFlushTask,
@@ -114,25 +183,76 @@ bool LogManager::startLogTask() {
 }
 
 void LogManager::logFlushTask(void *parameter) {
+    uint32_t reportedDropped = 0;
+    // Flushes wait behind recording, but not behind uploads
+    SDScheduler::setTaskPriority(SD_PRIORITY_LOG);
+    
     while (true) {
-        if (uxQueueMessagesWaiting(logQueue) > 0) {
-            // Collect all pending messages
-            String pendingLogs = "";
-            char *pendingLog;
-            
-            // Dequeue all messages into a string
-            while (xQueueReceive(logQueue, &pendingLog, 0) == pdTRUE) {
-                pendingLogs += String(pendingLog) + "\n";
-                free(pendingLog);
-            }
-            
-            // Append collected logs to the log file using Application wrapper
-            if (!pendingLogs.isEmpty()) {
-                if (!app->addToFile(LOG_FILE, pendingLogs)) {
-                    Serial.println("Failed to write logs to file!");
-                }
+        // Clearing on exit keeps any message logged while writing for the next round
+        xEventGroupWaitBits(app->getEventGroup(), EVENT_LOGS_PENDING, pdTRUE, pdTRUE, portMAX_DELAY);
+        
+        // Collect a batch until it is large enough, old enough or a flush is requested
+        TickType_t batchStart = xTaskGetTickCount();
+        while (!flushRequested && pendingBytes() < LOG_FLUSH_BYTES) {
+            TickType_t waited = xTaskGetTickCount() - batchStart;
+            if (waited >= pdMS_TO_TICKS(LOG_FLUSH_INTERVAL)) {
+                break;
             }
+            xEventGroupWaitBits(app->getEventGroup(), EVENT_LOGS_PENDING, pdTRUE, pdTRUE,
+                                pdMS_TO_TICKS(LOG_FLUSH_INTERVAL) - waited);
+        }
+        flushRequested = false;
+        
+        writePending();
+        
+        // Report drops once there is room again, the report itself goes through the ring
+        uint32_t dropped = droppedCount;
+        if (dropped != reportedDropped) {
+            log("Log ring full, dropped " + String(dropped - reportedDropped) + " messages");
+            reportedDropped = dropped;
         }
-        vTaskDelay(pdMS_TO_TICKS(10));
     }
-}
\ No newline at end of file
+}
+
+void LogManager::writePending() {
+    // Only this task moves the tail, so [tail, head) is stable while it is written
+    portENTER_CRITICAL(&ringLock);
+    uint32_t head = ringHead;
+    uint32_t tail = ringTail;
+    portEXIT_CRITICAL(&ringLock);
+    
+    size_t count = head - tail;
+    if (count == 0) {
+        return;
+    }
+    
+    if (logFileSize + count > LOG_MAX_FILE_SIZE) {
+        rotate();
+    }
+    
+    // Write straight from the ring, in two pieces if the pending bytes wrap around
+    uint32_t offset = tail & (LOG_RING_SIZE - 1);
+    size_t first = std::min(count, (size_t)(LOG_RING_SIZE - offset));
+    FileSegment segments[2] = {
+        { (const uint8_t*)ring + offset, first },
+        { (const uint8_t*)ring, count - first }
+    };
+    if (app->appendFile(LOG_FILE, segments, count > first ? 2 : 1)) {
+        logFileSize += count;
+    } else {
+        Serial.println("Failed to write logs to file!");
+    }
+    
+    portENTER_CRITICAL(&ringLock);
+    ringTail = head;
+    portEXIT_CRITICAL(&ringLock);
+}
+
+void LogManager::rotate() {
+    // Keep one previous log, the oldest one is lost
+    if (!app->deleteFile(LOG_ROTATED_FILE) || !app->renameFile(LOG_FILE, LOG_ROTATED_FILE)) {
+        Serial.println("Failed to rotate log file!");
+        return;
+    }
+    logFileSize = 0;
+}
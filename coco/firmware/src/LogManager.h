@@ -2,8 +2,14 @@
  * @file LogManager.h
  * @brief Log management system for the Coco firmware
  * 
- * This module handles structured logging, with queue-based asynchronous writes
+ * This module handles structured logging, with buffered asynchronous writes
  * to maintain system performance while ensuring logs are properly stored.
+ *
+ * Formatted lines are copied into a fixed-size ring in PSRAM. Logging never
+ * blocks: while the ring is full, messages are dropped and counted. The log
+ * task writes the ring to the card in large batches, once LOG_FLUSH_BYTES
+ * are pending or the oldest line has waited LOG_FLUSH_INTERVAL. The log file
+ * is rotated to LOG_ROTATED_FILE when it reaches LOG_MAX_FILE_SIZE.
  */
 
 #ifndef LOG_MANAGER_H
@@ -13,7 +19,6 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
-#include <freertos/queue.h>
 
 #include "config.h"
 #include "Application.h"
@@ -21,7 +26,7 @@
 class LogManager {
 public:
     /**
-     * @brief Initialize the log management system
+     * @brief Initialize the log management system, without touching the SD card
      * @param app Pointer to the Application singleton
      * @return True if initialization succeeded, false otherwise
      */
@@ -30,17 +35,29 @@ public:
     /**
      * @brief Log a message to the log file
      * 
-     * The message will be enqueued and written asynchronously
+     * The message is copied into the log ring and written asynchronously.
+     * It is dropped if the ring is full.
      * @param message The message to log
      */
     static void log(const String &message);
     
     /**
-     * @brief Check if there are pending logs in the queue
+     * @brief Check if there are pending logs in the ring
      * @return True if there are logs waiting to be written, false otherwise
      */
     static bool hasPendingLogs();
     
+    /**
+     * @brief Ask the log task to write all pending logs without waiting for a full batch
+     */
+    static void flush();
+    
+    /**
+     * @brief Get the number of messages dropped because the ring was full
+     * @return Dropped messages since boot
+     */
+    static uint32_t getDroppedCount();
+    
     // Session management
     /**
      * @brief Set the current boot session number
@@ -50,13 +67,13 @@ public:
     
     /**
      * @brief Set a function to provide timestamps for log entries
-     * @param timestampFunc Function pointer that returns a timestamp string
+     * @param timestampFunc Function that formats the current time into a buffer and returns its length, 0 on failure
      */
-    static void setTimestampProvider(String (*timestampFunc)());
+    static void setTimestampProvider(size_t (*timestampFunc)(char* buffer, size_t size));
     
     // Task management
     /**
-     * @brief Start the log flush task
+     * @brief Open the log file and start the log flush task, the SD card must be mounted
      * @return True if task creation succeeded, false otherwise
      */
     static bool startLogTask();
@@ -79,14 +96,47 @@ private:
      */
     static void logFlushTask(void *parameter);
     
+    /**
+     * @brief Copy a formatted line into the ring, or count it as dropped
+     * @param line Line including its newline
+     * @param length Line length in bytes
+     */
+    static void append(const char* line, size_t length);
+    
+    /**
+     * @brief Get the number of bytes waiting in the ring
+     * @return Pending bytes
+     */
+    static size_t pendingBytes();
+    
+    /**
+     * @brief Log task side: write everything pending in the ring to the log file
+     */
+    static void writePending();
+    
+    /**
+     * @brief Log task side: replace the rotated log with the current one
+     */
+    static void rotate();
+    
     // Static state variables
     static Application* app;           // Reference to the Application singleton
-    static QueueHandle_t logQueue;     // Queue managed by LogManager
     static int bootSession;            // Current boot session number
     static int logIndex;               // Index for log entries
     static TaskHandle_t logTaskHandle; // Task handle for the log flush task
     static bool initialized;           // Initialization flag
-    static String (*getTimestampFunc)(); // Function pointer for timestamp provider
+    static size_t (*getTimestampFunc)(char*, size_t); // Function pointer for timestamp provider
+    
+    // Log ring, bytes [ringTail, ringHead) are pending. Both only grow and wrap
+    // around with the ring size, the producers move the head, the log task the tail.
+    static char* ring;
+    static volatile uint32_t ringHead;
+    static volatile uint32_t ringTail;
+    static volatile uint32_t droppedCount;
+    static volatile bool flushRequested;
+    static portMUX_TYPE ringLock;
+    
+    static size_t logFileSize;         // Size of LOG_FILE, tracked to rotate it
 };
 
 #endif // LOG_MANAGER_H
@@ -0,0 +1,238 @@
+/**
+ * @file Metrics.cpp
+ * @brief Implementation of the runtime metrics registry
+ */
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include "Metrics.h"
+#include "PowerManager.h"
+
+// Guards the arena, every update is a few instructions
+static portMUX_TYPE metricsLock = portMUX_INITIALIZER_UNLOCKED;
+
+const Metrics::Definition Metrics::definitions[METRIC_COUNT] = {
+    { "capture_overrun_samples", METRIC_COUNTER, {} },
+    { "capture_dropped_samples", METRIC_COUNTER, {} },
+    { "upload_files", METRIC_COUNTER, {} },
+    { "upload_bytes", METRIC_COUNTER, {} },
+    { "http_requests", METRIC_COUNTER, {} },
+    { "http_reused", METRIC_COUNTER, {} },
+    { "http_retries", METRIC_COUNTER, {} },
+    { "heap_min_free", METRIC_GAUGE, {} },
+    { "psram_min_free", METRIC_GAUGE, {} },
+    { "battery_mv", METRIC_GAUGE, {} },
+    { "battery_drain_mv_h", METRIC_GAUGE, {} },
+    { "audio_queue_depth", METRIC_HISTOGRAM, { 1, 2, 3, 4, 6, 8, AUDIO_QUEUE_SIZE } },
+    { "sd_write_us", METRIC_HISTOGRAM, { 500, 1000, 2000, 5000, 10000, 50000, 200000 } },
+    { "sd_read_us", METRIC_HISTOGRAM, { 500, 1000, 2000, 5000, 10000, 50000, 200000 } },
+    { "upload_latency_ms", METRIC_HISTOGRAM, { 250, 500, 1000, 2000, 5000, 10000, 30000 } },
+    { "upload_kbps", METRIC_HISTOGRAM, { 16, 32, 64, 128, 256, 512, 1024 } },
+    { "wifi_time_to_ip_ms", METRIC_HISTOGRAM, { 500, 1000, 2000, 3000, 5000, 10000, 20000 } },
+};
+
+bool Metrics::initialized = false;
+Application* Metrics::app = nullptr;
+TaskHandle_t Metrics::samplerTaskHandle = NULL;
+Metrics::Value Metrics::values[METRIC_COUNT] = {};
+Metrics::TaskCpu Metrics::taskCpu[METRICS_MAX_TASKS] = {};
+size_t Metrics::taskCpuCount = 0;
+int64_t Metrics::drainStartUs = 0;
+int32_t Metrics::drainStartMv = 0;
+
+bool Metrics::init(Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    // Store Application instance if provided
+    if (appInstance != nullptr) {
+        app = appInstance;
+    } else if (app == nullptr) {
+        app = Application::getInstance();
+    }
+
+    initialized = true;
+    return true;
+}
+
+bool Metrics::startSamplerTask() {
+    if (!METRICS_ENABLED) {
+        return true;
+    }
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(
+        samplerTask,
+        "Metrics",
+        4096,
+        NULL,
+        1,
+        &samplerTaskHandle,
+        0 // Run on Core 0
+    ) != pdPASS) {
+        app->log("Failed to create metrics sampler task!");
+        return false;
+    }
+    return true;
+}
+
+void Metrics::add(MetricId id, uint32_t amount) {
+    portENTER_CRITICAL(&metricsLock);
+    values[id].value += amount;
+    portEXIT_CRITICAL(&metricsLock);
+}
+
+void Metrics::set(MetricId id, int32_t value) {
+    portENTER_CRITICAL(&metricsLock);
+    values[id].value = value;
+    portEXIT_CRITICAL(&metricsLock);
+}
+
+void Metrics::observe(MetricId id, uint32_t value) {
+    const uint32_t* bounds = definitions[id].bounds;
+    int bucket = 0;
+    while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && value >= bounds[bucket]) {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&metricsLock);
+    Value& v = values[id];
+    v.count++;
+    v.sum += value;
+    if (value > v.max) {
+        v.max = value;
+    }
+    v.buckets[bucket]++;
+    portEXIT_CRITICAL(&metricsLock);
+}
+
+size_t Metrics::writeSnapshot(char* buffer, size_t size) {
+    // Copy first, so the critical section does not cover the formatting
+    static Value copy[METRIC_COUNT];
+    static TaskCpu cpu[METRICS_MAX_TASKS];
+    portENTER_CRITICAL(&metricsLock);
+    memcpy(copy, values, sizeof(copy));
+    memcpy(cpu, taskCpu, sizeof(cpu));
+    size_t cpuCount = taskCpuCount;
+    portEXIT_CRITICAL(&metricsLock);
+
+    size_t used = 0;
+    bool fits = true;
+    auto append = [&](const char* format, auto... args) {
+        if (!fits) {
+            return;
+        }
+        int written = snprintf(buffer + used, size - used, format, args...);
+        if (written < 0 || (size_t)written >= size - used) {
+            fits = false;
+            return;
+        }
+        used += written;
+    };
+
+    append("{\"v\":1,\"boot\":%d,\"up\":%lu", app ? app->getBootSession() : 0,
+           (unsigned long)(esp_timer_get_time() / 1000000));
+
+    // Counters and gauges share one object, their names tell them apart
+    append(",\"m\":{");
+    bool first = true;
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        if (definitions[i].type == METRIC_HISTOGRAM) {
+            continue;
+        }
+        append("%s\"%s\":%lld", first ? "" : ",", definitions[i].name, (long long)copy[i].value);
+        first = false;
+    }
+    append("}");
+
+    append(",\"h\":{");
+    first = true;
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        if (definitions[i].type != METRIC_HISTOGRAM) {
+            continue;
+        }
+        const Value& v = copy[i];
+        append("%s\"%s\":{\"n\":%lu,\"sum\":%llu,\"max\":%lu,\"le\":[", first ? "" : ",", definitions[i].name,
+               (unsigned long)v.count, (unsigned long long)v.sum, (unsigned long)v.max);
+        for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS - 1; b++) {
+            append("%s%lu", b == 0 ? "" : ",", (unsigned long)definitions[i].bounds[b]);
+        }
+        append("],\"b\":[");
+        for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+            append("%s%lu", b == 0 ? "" : ",", (unsigned long)v.buckets[b]);
+        }
+        append("]}");
+        first = false;
+    }
+    append("}");
+
+    if (cpuCount > 0) {
+        append(",\"cpu\":{");
+        for (size_t i = 0; i < cpuCount; i++) {
+            append("%s\"%s\":%u", i == 0 ? "" : ",", cpu[i].name, (unsigned)cpu[i].permille);
+        }
+        append("}");
+    }
+    append("}");
+
+    if (!fits) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    return used;
+}
+
+void Metrics::samplerTask(void* parameter) {
+    while (true) {
+        sample();
+        vTaskDelay(pdMS_TO_TICKS(METRICS_SAMPLE_INTERVAL));
+    }
+}
+
+void Metrics::sample() {
+    set(METRIC_HEAP_MIN_FREE, heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    set(METRIC_PSRAM_MIN_FREE, heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+
+    int32_t batteryMv = (int32_t)(PowerManager::getBatteryVoltage() * 1000.0f);
+    set(METRIC_BATTERY_MV, batteryMv);
+
+    // Drain over the whole measurement, the filtered voltage moves too little for shorter spans
+    int64_t now = esp_timer_get_time();
+    if (drainStartUs == 0) {
+        drainStartUs = now;
+        drainStartMv = batteryMv;
+    } else if (now - drainStartUs >= 60LL * 1000000) {
+        int64_t drain = (int64_t)(drainStartMv - batteryMv) * 3600LL * 1000000 / (now - drainStartUs);
+        set(METRIC_BATTERY_DRAIN_MV_H, (int32_t)drain);
+    }
+
+    sampleTaskCpu();
+}
+
+void Metrics::sampleTaskCpu() {
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+    static TaskStatus_t tasks[METRICS_MAX_TASKS];
+    uint32_t totalRunTime = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, &totalRunTime);
+    if (count == 0 || totalRunTime == 0) {
+        // More tasks than slots, the state is only returned complete
+        return;
+    }
+
+    TaskCpu sampled[METRICS_MAX_TASKS];
+    for (UBaseType_t i = 0; i < count; i++) {
+        strncpy(sampled[i].name, tasks[i].pcTaskName, sizeof(sampled[i].name) - 1);
+        sampled[i].name[sizeof(sampled[i].name) - 1] = '\0';
+        sampled[i].permille = (uint16_t)((uint64_t)tasks[i].ulRunTimeCounter * 1000 / totalRunTime);
+    }
+
+    portENTER_CRITICAL(&metricsLock);
+    memcpy(taskCpu, sampled, count * sizeof(TaskCpu));
+    taskCpuCount = count;
+    portEXIT_CRITICAL(&metricsLock);
+#endif
+}
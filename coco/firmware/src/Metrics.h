@@ -0,0 +1,183 @@
+/**
+ * @file Metrics.h
+ * @brief Runtime metrics registry and the snapshot sent along with uploads
+ *
+ * Every metric has a fixed slot in a static arena, so recording one never
+ * allocates and only takes a short critical section:
+ *
+ * - Counters only grow, add() is called where the event happens.
+ * - Gauges hold the last value set().
+ * - Histograms count observe()d values into METRICS_HISTOGRAM_BUCKETS
+ *   buckets with fixed upper bounds per metric, plus count, sum and max.
+ *
+ * A sampler task sets the gauges that have no event of their own every
+ * METRICS_SAMPLE_INTERVAL: heap and PSRAM low-water marks, battery voltage
+ * and drain, and the CPU share of every task when the FreeRTOS run time
+ * statistics are compiled in.
+ *
+ * All values count from boot. writeSnapshot() renders them as compact JSON,
+ * which BackendClient sends as the METRICS_HEADER of every upload, so a lost
+ * snapshot loses nothing and the backend gets the deltas by subtraction.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "Application.h"
+
+// Buckets per histogram, the last one counts everything above the last bound
+#define METRICS_HISTOGRAM_BUCKETS 8
+
+// Upload request header that carries the snapshot
+#define METRICS_HEADER "X-Coco-Metrics"
+
+/**
+ * @brief Kind of a metric
+ */
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+};
+
+/**
+ * @brief All metrics, the order matches the definitions in Metrics.cpp
+ */
+enum MetricId {
+    // Counters
+    METRIC_CAPTURE_OVERRUN_SAMPLES,  ///< Samples lost because the capture ring was full
+    METRIC_CAPTURE_DROPPED_SAMPLES,  ///< Samples lost because no block buffer was free
+    METRIC_UPLOAD_FILES,             ///< Files acknowledged by the backend
+    METRIC_UPLOAD_BYTES,             ///< Bytes of those files
+    METRIC_HTTP_REQUESTS,            ///< Requests sent to the backend
+    METRIC_HTTP_REUSED,              ///< Requests sent on a kept-alive connection
+    METRIC_HTTP_RETRIES,             ///< Requests repeated after a stale connection
+
+    // Gauges
+    METRIC_HEAP_MIN_FREE,            ///< Lowest free internal heap since boot (bytes)
+    METRIC_PSRAM_MIN_FREE,           ///< Lowest free PSRAM since boot (bytes)
+    METRIC_BATTERY_MV,               ///< Filtered battery voltage (mV)
+    METRIC_BATTERY_DRAIN_MV_H,       ///< Battery voltage drop since the sampler started (mV per hour)
+
+    // Histograms
+    METRIC_AUDIO_QUEUE_DEPTH,        ///< Blocks waiting for the audio file task at every receive
+    METRIC_SD_WRITE_US,              ///< Duration of SD writes
+    METRIC_SD_READ_US,               ///< Duration of SD reads
+    METRIC_UPLOAD_LATENCY_MS,        ///< Duration of successful upload requests
+    METRIC_UPLOAD_KBPS,              ///< Throughput of successful upload requests (KB/s)
+    METRIC_WIFI_TIME_TO_IP_MS,       ///< Time from connecting to an IP address
+
+    METRIC_COUNT
+};
+
+class Metrics {
+public:
+    /**
+     * @brief Initialize the registry
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if initialization was successful
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Start the task that samples the gauges
+     * @return true if the task was created or metrics are disabled
+     */
+    static bool startSamplerTask();
+
+    /**
+     * @brief Increment a counter
+     * @param id Counter
+     * @param amount Increment
+     */
+    static void add(MetricId id, uint32_t amount = 1);
+
+    /**
+     * @brief Set a gauge
+     * @param id Gauge
+     * @param value New value
+     */
+    static void set(MetricId id, int32_t value);
+
+    /**
+     * @brief Count a value into a histogram
+     * @param id Histogram
+     * @param value Observed value
+     */
+    static void observe(MetricId id, uint32_t value);
+
+    /**
+     * @brief Render all metrics as compact JSON
+     * @param buffer Receives the zero terminated snapshot
+     * @param size Capacity of buffer, METRICS_SNAPSHOT_SIZE fits all metrics
+     * @return Length of the snapshot, 0 if it did not fit
+     */
+    static size_t writeSnapshot(char* buffer, size_t size);
+
+private:
+    // Private constructor for static-only class
+    Metrics() = default;
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /**
+     * @brief Name, kind and histogram bounds of a metric
+     */
+    struct Definition {
+        const char* name;                                    ///< Key in the snapshot
+        MetricType type;                                     ///< Kind of metric
+        uint32_t bounds[METRICS_HISTOGRAM_BUCKETS - 1];      ///< Exclusive upper bounds of the histogram buckets
+    };
+
+    /**
+     * @brief State of one metric in the arena
+     */
+    struct Value {
+        int64_t value;                                  ///< Counter total or gauge value
+        uint32_t count;                                 ///< Histogram observations
+        uint32_t max;                                   ///< Largest observation
+        uint64_t sum;                                   ///< Sum of the observations
+        uint32_t buckets[METRICS_HISTOGRAM_BUCKETS];    ///< Observations per bucket
+    };
+
+    /**
+     * @brief CPU share of one task
+     */
+    struct TaskCpu {
+        char name[configMAX_TASK_NAME_LEN];  ///< Task name
+        uint16_t permille;                   ///< Run time since boot in 1/1000 of one core
+    };
+
+    static void samplerTask(void* parameter);
+
+    /**
+     * @brief Sample the gauges without an event of their own
+     */
+    static void sample();
+
+    /**
+     * @brief Read the run time of every task into taskCpu
+     */
+    static void sampleTaskCpu();
+
+    static const Definition definitions[METRIC_COUNT];
+
+    static bool initialized;
+    static Application* app;
+    static TaskHandle_t samplerTaskHandle;
+
+    static Value values[METRIC_COUNT];
+    static TaskCpu taskCpu[METRICS_MAX_TASKS];
+    static size_t taskCpuCount;
+
+    // Start of the battery drain measurement
+    static int64_t drainStartUs;
+    static int32_t drainStartMv;
+};
+
+#endif // METRICS_H
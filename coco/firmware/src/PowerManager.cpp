@@ -3,15 +3,27 @@
  * @brief Implementation of power management functionality
  */
 
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+
 #include "PowerManager.h"
 
 // Initialize static member variables
 bool PowerManager::initialized = false;
-float PowerManager::batteryVoltage = 0.0f;
-int PowerManager::batteryPercentage = 0;
+float PowerManager::filteredVoltage = 0.0f;
+bool PowerManager::recordingAllowed = false;
+bool PowerManager::uploadAllowed = false;
+std::atomic<uint32_t> PowerManager::batteryState(0);
 esp_sleep_wakeup_cause_t PowerManager::wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
 TaskHandle_t PowerManager::batteryMonitorTaskHandle = NULL;
 Application* PowerManager::app = nullptr;
+esp_pm_lock_handle_t PowerManager::lockHandles[POWER_LOCK_COUNT] = {nullptr, nullptr};
+portMUX_TYPE PowerManager::lockMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t PowerManager::lockDepth[POWER_LOCK_COUNT] = {0, 0};
+int64_t PowerManager::lockSince[POWER_LOCK_COUNT] = {0, 0};
+int64_t PowerManager::lockHeldUs[POWER_LOCK_COUNT] = {0, 0};
+int64_t PowerManager::lockWindowStart = 0;
 
 // Constants definition
 const int PowerManager::BATTERY_ADC_PIN = BATTERY_PIN;  // ADC pin used for battery voltage reading (from config.h)
@@ -38,58 +50,190 @@ bool PowerManager::init(Application* appInstance) {
     // Check if we woke from deep sleep
     wakeupCause = esp_sleep_get_wakeup_cause();
     
-    // Initial battery reading
-    updateBatteryStatus();
+    // Seed the filter with an average, so the first published state is not a single noisy reading
+    float total = 0.0f;
+    for (int i = 0; i < BATTERY_SEED_SAMPLES; i++) {
+        total += readBatteryVoltage();
+    }
+    filteredVoltage = total / BATTERY_SEED_SAMPLES;
+    recordingAllowed = filteredVoltage >= BATTERY_RECORDING_THRESHOLD;
+    uploadAllowed = filteredVoltage >= BATTERY_UPLOAD_THRESHOLD;
+    updateBatteryStatus(filteredVoltage);
+    initialized = true;
+    
+    initPowerManagement();
     
     if (app) {
-        app->log("PowerManager initialized, battery: " + String(batteryVoltage, 2) + "V (" + 
-                    String(batteryPercentage) + "%)");
+        BatteryState state = getBatteryState();
+        app->log("PowerManager initialized, battery: " + String(state.voltage, 2) + "V (" + 
+                    String(state.percentage) + "%)");
         // Log the wakeup cause
         app->log("Woke up from: " + String(wakeupCause));
     }
     
-    initialized = true;
     return true;
 }
 
-float PowerManager::getBatteryVoltage() {
+BatteryState PowerManager::getBatteryState() {
     if (!initialized) {
         init();
     }
-    // Only update battery status when needed
-    updateBatteryStatus();
-    return batteryVoltage;
+    
+    uint32_t packed = batteryState.load(std::memory_order_relaxed);
+    BatteryState state;
+    state.voltage = (packed & 0xFFFF) / 1000.0f;
+    state.percentage = (packed >> 16) & 0xFF;
+    state.recordingOk = (packed >> 24) & 1;
+    state.uploadOk = (packed >> 25) & 1;
+    state.charging = (packed >> 26) & 1;
+    return state;
+}
+
+float PowerManager::getBatteryVoltage() {
+    return getBatteryState().voltage;
 }
 
 int PowerManager::getBatteryPercentage() {
-    if (!initialized) {
-        init();
+    return getBatteryState().percentage;
+}
+
+bool PowerManager::isBatteryOkForRecording() {
+    return getBatteryState().recordingOk;
+}
+
+bool PowerManager::isBatteryOkForUpload() {
+    return getBatteryState().uploadOk;
+}
+
+float PowerManager::readBatteryVoltage() {
+    // analogReadMilliVolts applies the eFuse calibration of the ADC
+    return analogReadMilliVolts(BATTERY_ADC_PIN) / 1000.0f * VOLTAGE_DIVIDER_RATIO;
+}
+
+void PowerManager::updateBatteryStatus(float voltage) {
+    filteredVoltage += BATTERY_EMA_ALPHA * (voltage - filteredVoltage);
+    
+    // Switch off below a threshold, but only back on once clearly above it
+    if (recordingAllowed && filteredVoltage < BATTERY_RECORDING_THRESHOLD) {
+        recordingAllowed = false;
+    } else if (!recordingAllowed && filteredVoltage >= BATTERY_RECORDING_THRESHOLD + BATTERY_HYSTERESIS) {
+        recordingAllowed = true;
     }
-    // Only update battery status when needed
-    updateBatteryStatus();
-    return batteryPercentage;
+    if (uploadAllowed && filteredVoltage < BATTERY_UPLOAD_THRESHOLD) {
+        uploadAllowed = false;
+    } else if (!uploadAllowed && filteredVoltage >= BATTERY_UPLOAD_THRESHOLD + BATTERY_HYSTERESIS) {
+        uploadAllowed = true;
+    }
+    
+    // Calculate battery percentage
+    float percentage = ((filteredVoltage - BATTERY_MIN_VOLTAGE) / 
+                       (BATTERY_MAX_VOLTAGE - BATTERY_MIN_VOLTAGE)) * 100.0f;
+    uint32_t millivolts = constrain((int)(filteredVoltage * 1000.0f + 0.5f), 0, 0xFFFF);
+    
+    // Publish everything in one word, so readers never see a half updated state
+    uint32_t packed = millivolts |
+                      ((uint32_t)constrain((int)percentage, 0, 100) << 16) |
+                      ((uint32_t)recordingAllowed << 24) |
+                      ((uint32_t)uploadAllowed << 25) |
+                      ((uint32_t)(filteredVoltage >= BATTERY_CHARGING_VOLTAGE) << 26);
+    batteryState.store(packed, std::memory_order_relaxed);
 }
 
-void PowerManager::updateBatteryStatus() {
-    // Take multiple readings for more stable results
-    const int numReadings = 10;
-    long total = 0;
+void PowerManager::initPowerManagement() {
+    lockWindowStart = esp_timer_get_time();
     
-    for (int i = 0; i < numReadings; i++) {
-        total += analogRead(BATTERY_ADC_PIN);
-        delay(5); // Brief delay between readings
+#if CONFIG_PM_ENABLE
+    if (!PM_ENABLED) {
+        return;
     }
     
-    int averagedRawValue = total / numReadings;
+    // Light sleep is only allowed by the driver when FreeRTOS can skip ticks
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    const bool lightSleep = PM_LIGHT_SLEEP;
+#else
+    const bool lightSleep = false;
+#endif
+    
+    esp_pm_config_t pmConfig = {};
+    pmConfig.max_freq_mhz = PM_MAX_CPU_FREQ_MHZ;
+    pmConfig.min_freq_mhz = PM_MIN_CPU_FREQ_MHZ;
+    pmConfig.light_sleep_enable = lightSleep;
+    esp_err_t err = esp_pm_configure(&pmConfig);
+    if (err != ESP_OK) {
+        if (app) {
+            app->log("Power management not configured: " + String(esp_err_to_name(err)));
+        }
+        return;
+    }
     
-    // Convert ADC value to voltage
-    // For a 12-bit ADC with a 3.3V reference and voltage divider
-    batteryVoltage = ((float)averagedRawValue / 4095.0) * 3.3 * VOLTAGE_DIVIDER_RATIO;
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "coco_cpu", &lockHandles[POWER_LOCK_CPU]) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "coco_apb", &lockHandles[POWER_LOCK_APB]) != ESP_OK) {
+        if (app) {
+            app->log("Failed to create power management locks");
+        }
+        return;
+    }
+    
+    // Only a level wakes the CPU from light sleep. The button interrupt alternates
+    // between both levels (see handleButtonPress), so the wakeup takes the level
+    // it waits for: setting the other one would fire it while the button is held.
+    if (lightSleep) {
+        gpio_num_t button = static_cast<gpio_num_t>(BUTTON_PIN);
+        gpio_wakeup_enable(button, gpio_get_level(button) == 0 ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+        esp_sleep_enable_gpio_wakeup();
+    }
+    
+    if (app) {
+        app->log("Power management: " + String(PM_MIN_CPU_FREQ_MHZ) + "-" + String(PM_MAX_CPU_FREQ_MHZ) +
+                 "MHz, light sleep " + String(lightSleep ? "on" : "off"));
+    }
+#else
+    if (app) {
+        app->log("Power management not available in this build (CONFIG_PM_ENABLE)");
+    }
+#endif
+}
 
-    // Calculate battery percentage
-    float percentage = ((batteryVoltage - BATTERY_MIN_VOLTAGE) / 
-                       (BATTERY_MAX_VOLTAGE - BATTERY_MIN_VOLTAGE)) * 100.0f;
-    batteryPercentage = constrain(percentage, 0, 100);
+void PowerManager::acquireLock(PowerLock lock) {
+    if (lockHandles[lock]) {
+        esp_pm_lock_acquire(lockHandles[lock]);
+    }
+    
+    portENTER_CRITICAL(&lockMux);
+    if (lockDepth[lock]++ == 0) {
+        lockSince[lock] = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&lockMux);
+}
+
+void PowerManager::releaseLock(PowerLock lock) {
+    portENTER_CRITICAL(&lockMux);
+    if (lockDepth[lock] > 0 && --lockDepth[lock] == 0) {
+        lockHeldUs[lock] += esp_timer_get_time() - lockSince[lock];
+    }
+    portEXIT_CRITICAL(&lockMux);
+    
+    if (lockHandles[lock]) {
+        esp_pm_lock_release(lockHandles[lock]);
+    }
+}
+
+void PowerManager::takeLockDutyCycles(float percent[POWER_LOCK_COUNT]) {
+    portENTER_CRITICAL(&lockMux);
+    int64_t now = esp_timer_get_time();
+    int64_t window = now - lockWindowStart;
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        // A lock held right now counts up to this moment and starts the next window
+        int64_t held = lockHeldUs[i];
+        if (lockDepth[i] > 0) {
+            held += now - lockSince[i];
+            lockSince[i] = now;
+        }
+        percent[i] = window > 0 ? held * 100.0f / window : 0.0f;
+        lockHeldUs[i] = 0;
+    }
+    lockWindowStart = now;
+    portEXIT_CRITICAL(&lockMux);
 }
 
 void PowerManager::enterDeepSleep() {
@@ -166,22 +310,32 @@ bool PowerManager::startBatteryMonitorTask() {
 }
 
 void PowerManager::batteryMonitorTask(void* parameter) {
+    TickType_t lastReport = xTaskGetTickCount() - pdMS_TO_TICKS(BATTERY_MONITOR_INTERVAL);
+    
     while (true) {
-        float voltage = getBatteryVoltage();
-        int percentage = getBatteryPercentage();
+        updateBatteryStatus(readBatteryVoltage());
         
-        if (app) {
-            app->log("Battery: " + String(voltage, 2) + "V (" + String(percentage) + "%)");
+        // Report at the monitor interval, the filter is updated at every sample
+        if (xTaskGetTickCount() - lastReport >= pdMS_TO_TICKS(BATTERY_MONITOR_INTERVAL)) {
+            lastReport = xTaskGetTickCount();
+            BatteryState state = getBatteryState();
             
-            // Set LED brightness based on battery percentage
-            // Map 0-100% to a brightness range (we'll use 5-255)
-            // Using a minimum of 5 to ensure LED is still visible even at very low battery
-            int brightness = map(percentage, 0, 100, 5, 255);
-            app->setLEDBrightness(brightness);
+            if (app) {
+                float duty[POWER_LOCK_COUNT];
+                takeLockDutyCycles(duty);
+                app->log("Battery: " + String(state.voltage, 2) + "V (" + String(state.percentage) + "%), CPU lock " +
+                         String(duty[POWER_LOCK_CPU], 1) + "%, APB lock " + String(duty[POWER_LOCK_APB], 1) + "%");
+                
+                // Set LED brightness based on battery percentage
+                // Map 0-100% to a brightness range (we'll use 5-255)
+                // Using a minimum of 5 to ensure LED is still visible even at very low battery
+                int brightness = map(state.percentage, 0, 100, 5, 255);
+                app->setLEDBrightness(brightness);
+            }
         }
         
-        // Wait before next measurement
-        vTaskDelay(pdMS_TO_TICKS(BATTERY_MONITOR_INTERVAL));
+        // Wait before next sample
+        vTaskDelay(pdMS_TO_TICKS(BATTERY_SAMPLE_INTERVAL));
     }
 }
 
@@ -210,6 +364,7 @@ void PowerManager::initDeepSleep() {
     // Wait until there are no pending logs
     if (app) {
         while (app->hasPendingLogs()) {
+            app->flushLogs();
             vTaskDelay(pdMS_TO_TICKS(500));
         }
         
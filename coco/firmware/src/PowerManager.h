@@ -5,15 +5,50 @@
  * This class handles battery voltage measurements, deep sleep modes, and wakeup sources.
  * It implements a singleton pattern and provides methods for monitoring battery levels
  * and controlling ESP32 sleep modes.
+ *
+ * The battery is sampled in the background by the battery monitor task, one
+ * calibrated ADC reading every BATTERY_SAMPLE_INTERVAL, smoothed by an
+ * exponential moving average. Readers get the last published state in O(1)
+ * without touching the ADC. The recording and upload thresholds use
+ * BATTERY_HYSTERESIS, so a voltage hovering around a threshold does not
+ * toggle recording or uploads on every sample.
+ *
+ * With PM_ENABLED the CPU runs at PM_MIN_CPU_FREQ_MHZ and enters automatic
+ * light sleep when idle. Stages that need the CPU hold the CPU lock
+ * (PM_MAX_CPU_FREQ_MHZ), SD and WiFi transfers hold the APB lock, best
+ * taken through PowerLockGuard. The battery report includes the share of
+ * time each lock was held, to relate measured currents to the workload.
  */
 
 #ifndef POWER_MANAGER_H
 #define POWER_MANAGER_H
 
 #include <Arduino.h>
+#include <atomic>
+#include <esp_pm.h>
 #include "config.h"
 #include "Application.h"
 
+/**
+ * @brief Battery state published by the sampler
+ */
+struct BatteryState {
+    float voltage;      ///< Filtered battery voltage in volts
+    int percentage;     ///< Charge estimate (0-100)
+    bool recordingOk;   ///< Voltage is sufficient for recording, with hysteresis
+    bool uploadOk;      ///< Voltage is sufficient for uploads, with hysteresis
+    bool charging;      ///< Voltage is in the range only reached on the charger
+};
+
+/**
+ * @brief Power management locks held by the firmware
+ */
+enum PowerLock {
+    POWER_LOCK_CPU,     ///< CPU at PM_MAX_CPU_FREQ_MHZ, for DSP and encoding
+    POWER_LOCK_APB,     ///< APB at its maximum and no light sleep, for SD and WiFi transfers
+    POWER_LOCK_COUNT
+};
+
 class PowerManager {
 public:
     /**
@@ -37,9 +72,15 @@ public:
     static bool init(Application* app = nullptr);
     
     // Battery monitoring
+    /**
+     * @brief Get a consistent snapshot of the sampled battery state
+     * @return BatteryState Last published state
+     */
+    static BatteryState getBatteryState();
+    
     /**
      * @brief Get the current battery voltage
-     * @return float Battery voltage in volts
+     * @return float Filtered battery voltage in volts
      */
     static float getBatteryVoltage();
     
@@ -49,6 +90,18 @@ public:
      */
     static int getBatteryPercentage();
     
+    /**
+     * @brief Check if the battery allows recording
+     * @return bool True above BATTERY_RECORDING_THRESHOLD, with hysteresis
+     */
+    static bool isBatteryOkForRecording();
+    
+    /**
+     * @brief Check if the battery allows uploads
+     * @return bool True above BATTERY_UPLOAD_THRESHOLD, with hysteresis
+     */
+    static bool isBatteryOkForUpload();
+    
     // Deep sleep functions
     /**
      * @brief Enter deep sleep mode
@@ -81,7 +134,7 @@ public:
     static bool startBatteryMonitorTask();
     
     /**
-     * @brief Battery monitoring task function
+     * @brief Battery monitoring task function, samples the battery and logs it periodically
      * @param parameter Task parameters (not used)
      */
     static void batteryMonitorTask(void* parameter);
@@ -106,6 +159,19 @@ public:
      * @brief Initialize and enter deep sleep mode
      */
     static void initDeepSleep();
+    
+    // Power management locks
+    /**
+     * @brief Acquire a power management lock, calls nest
+     * @param lock Lock to acquire
+     */
+    static void acquireLock(PowerLock lock);
+    
+    /**
+     * @brief Release a power management lock acquired before
+     * @param lock Lock to release
+     */
+    static void releaseLock(PowerLock lock);
 
 private:
     // Private constructor for singleton pattern
@@ -113,8 +179,6 @@ private:
     
     // Private static variables for state
     static bool initialized;
-    static float batteryVoltage;
-    static int batteryPercentage;
     static esp_sleep_wakeup_cause_t wakeupCause;
     static TaskHandle_t batteryMonitorTaskHandle;
     static Application* app;
@@ -122,10 +186,62 @@ private:
     // Battery monitoring configuration
     static const int BATTERY_ADC_PIN;
     
+    // Sampler state, only touched by init() and the battery monitor task
+    static float filteredVoltage;
+    static bool recordingAllowed;
+    static bool uploadAllowed;
+    
+    // Published state: millivolts in bits 0-15, percentage in bits 16-23,
+    // recording, upload and charging flags in bits 24 to 26
+    static std::atomic<uint32_t> batteryState;
+    
+    /**
+     * @brief Read the battery voltage once through the calibrated ADC driver
+     * @return float Battery voltage in volts
+     */
+    static float readBatteryVoltage();
+    
+    /**
+     * @brief Feed one reading into the filter and publish the new state
+     * @param voltage Battery voltage in volts
+     */
+    static void updateBatteryStatus(float voltage);
+    
+    /**
+     * @brief Configure frequency scaling and light sleep and create the locks
+     */
+    static void initPowerManagement();
+    
     /**
-     * @brief Update the battery voltage and percentage values
+     * @brief Get the share of time each lock was held since the last call
+     * @param percent Receives one percentage per lock
      */
-    static void updateBatteryStatus();
+    static void takeLockDutyCycles(float percent[POWER_LOCK_COUNT]);
+    
+    // Lock handles, nullptr if power management is not available
+    static esp_pm_lock_handle_t lockHandles[POWER_LOCK_COUNT];
+    
+    // Hold time accounting, guarded by lockMux
+    static portMUX_TYPE lockMux;
+    static uint32_t lockDepth[POWER_LOCK_COUNT];
+    static int64_t lockSince[POWER_LOCK_COUNT];
+    static int64_t lockHeldUs[POWER_LOCK_COUNT];
+    static int64_t lockWindowStart;
+};
+
+/**
+ * @brief RAII guard for a power management lock
+ */
+class PowerLockGuard {
+private:
+    PowerLock lock;
+public:
+    PowerLockGuard(PowerLock lock) : lock(lock) {
+        PowerManager::acquireLock(lock);
+    }
+    ~PowerLockGuard() {
+        PowerManager::releaseLock(lock);
+    }
 };
 
 #endif // POWER_MANAGER_H
@@ -0,0 +1,250 @@
+/**
+ * @file RecordingReconciler.cpp
+ * @brief Implementation of the recordings and upload queue reconciliation
+ */
+
+#include <algorithm>
+#include <esp_rom_crc.h>
+#include <esp_sleep.h>
+
+#include "RecordingReconciler.h"
+#include "BackendClient.h"
+#include "FileSystem.h"
+#include "SDScheduler.h"
+#include "UploadQueue.h"
+
+bool RecordingReconciler::initialized = false;
+Application* RecordingReconciler::app = nullptr;
+TaskHandle_t RecordingReconciler::reconcileTaskHandle = NULL;
+volatile bool RecordingReconciler::running = false;
+String RecordingReconciler::sessionPrefix;
+
+bool RecordingReconciler::init(Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    // Store Application instance if provided
+    if (appInstance != nullptr) {
+        app = appInstance;
+    } else if (app == nullptr) {
+        app = Application::getInstance();
+    }
+
+    // Recordings of this session are named after the boot session, see AudioManager::openSegmentFile()
+    sessionPrefix = String(RECORDINGS_DIR) + "/" + String(app->getBootSession()) + "_";
+    initialized = true;
+    return true;
+}
+
+bool RecordingReconciler::startReconcileTask() {
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    // Only a reset can leave the two apart, deep sleep is entered between operations
+    if (!RECONCILE_ENABLED || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+        return true;
+    }
+
+    running = true;
+    if (xTaskCreatePinnedToCore(
+        reconcileTask,
+        "Reconcile",
+        4096,
+        NULL,
+        1,
+        &reconcileTaskHandle,
+        0 // Run on Core 0
+    ) != pdPASS) {
+        running = false;
+        app->log("Failed to create reconciliation task!");
+        return false;
+    }
+    return true;
+}
+
+bool RecordingReconciler::isRunning() {
+    return running;
+}
+
+void RecordingReconciler::reconcileTask(void* parameter) {
+    SDScheduler::setTaskPriority(SD_PRIORITY_UPLOAD);
+
+    // Let recording and the first log flushes have the card first
+    vTaskDelay(pdMS_TO_TICKS(RECONCILE_START_DELAY));
+    TickType_t start = xTaskGetTickCount();
+
+    std::vector<PendingEntry> pending;
+    uint32_t generation = collectPending(pending);
+
+    std::vector<uint32_t> listed;
+    uint32_t recordings = 0;
+    uint32_t queued = queueOrphans(pending, generation, listed, recordings);
+    pending.clear();
+    pending.shrink_to_fit();
+
+    uint32_t discarded = discardStale(listed);
+
+    if (queued > 0) {
+        app->setWavFilesAvailable(true);
+    }
+    app->log("Reconciled " + String(recordings) + " recordings with the upload queue in " +
+             String((xTaskGetTickCount() - start) * portTICK_PERIOD_MS) + "ms: queued " + String(queued) +
+             " orphaned files, discarded " + String(discarded) + " stale entries");
+
+    running = false;
+    reconcileTaskHandle = NULL;
+    vTaskDelete(NULL);
+}
+
+uint32_t RecordingReconciler::collectPending(std::vector<PendingEntry>& entries) {
+    String paths[RECONCILE_BATCH_SIZE];
+    uint32_t ids[RECONCILE_BATCH_SIZE];
+    UploadQueueCursor cursor = {};
+    entries.clear();
+    entries.reserve(UploadQueue::size());
+
+    while (true) {
+        bool restart = cursor.index != 0;
+        uint32_t generation = cursor.generation;
+        size_t count = UploadQueue::scanPending(cursor, paths, ids, RECONCILE_BATCH_SIZE);
+        if (restart && cursor.generation != generation) {
+            // Compacted meanwhile, the scan started over at the new head
+            entries.clear();
+        }
+        if (count == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            entries.push_back({hashPath(paths[i]), ids[i]});
+        }
+        vTaskDelay(1);
+    }
+
+    std::sort(entries.begin(), entries.end());
+    return cursor.generation;
+}
+
+uint32_t RecordingReconciler::queueOrphans(std::vector<PendingEntry>& pending, uint32_t& generation,
+                                           std::vector<uint32_t>& listed, uint32_t& recordings) {
+    File dir;
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked()) {
+            app->log("Reconcile: Failed to take SD card mutex for directory listing");
+            return 0;
+        }
+        dir = FileSystem::card().open(RECORDINGS_DIR);
+        if (!dir || !dir.isDirectory()) {
+            return 0;
+        }
+    }
+
+    uint32_t queued = 0;
+    bool done = false;
+    while (!done) {
+        String names[RECONCILE_BATCH_SIZE];
+        uint32_t hashes[RECONCILE_BATCH_SIZE];
+        size_t nameCount = 0;
+        {
+            SDLockGuard lock;
+            if (!lock.isLocked()) {
+                break;
+            }
+            // Names only, opening every file would cost a directory walk each
+            for (int i = 0; i < RECONCILE_BATCH_SIZE; i++) {
+                bool isDir = false;
+                String path = dir.getNextFileName(&isDir);
+                if (path.length() == 0) {
+                    done = true;
+                    break;
+                }
+                if (isDir || !path.endsWith(".wav") || !isReconciled(path)) {
+                    continue;
+                }
+                recordings++;
+                hashes[nameCount] = hashPath(path);
+                listed.push_back(hashes[nameCount]);
+                names[nameCount++] = path;
+            }
+            if (done) {
+                dir.close();
+            }
+        }
+
+        // Checked and queued outside the listing access, both take the card themselves
+        for (size_t i = 0; i < nameCount; i++) {
+            // The upload task defers the deletion before it removes the entry, one of the two holds an uploaded file
+            if (isPending(names[i], hashes[i], pending, generation) || BackendClient::isDeletePending(names[i])) {
+                continue;
+            }
+            if (app->addToUploadQueue(names[i])) {
+                app->log("Reconcile: Queued orphaned recording " + names[i]);
+                queued++;
+            }
+        }
+        vTaskDelay(1);
+    }
+
+    if (dir) {
+        SDLockGuard lock;
+        dir.close();
+    }
+    std::sort(listed.begin(), listed.end());
+    return queued;
+}
+
+uint32_t RecordingReconciler::discardStale(const std::vector<uint32_t>& listed) {
+    String paths[RECONCILE_BATCH_SIZE];
+    uint32_t ids[RECONCILE_BATCH_SIZE];
+    UploadQueueCursor cursor = {};
+    uint32_t discarded = 0;
+
+    size_t count;
+    while ((count = UploadQueue::scanPending(cursor, paths, ids, RECONCILE_BATCH_SIZE)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (!isReconciled(paths[i]) || std::binary_search(listed.begin(), listed.end(), hashPath(paths[i]))) {
+                continue;
+            }
+            // Not listed, either deleted after its upload or lost with the card
+            if (UploadQueue::discard(ids[i], paths[i])) {
+                app->log("Reconcile: Discarded queue entry without a file: " + paths[i]);
+                discarded++;
+            }
+        }
+        vTaskDelay(1);
+    }
+    return discarded;
+}
+
+bool RecordingReconciler::isPending(const String& path, uint32_t hash, std::vector<PendingEntry>& pending,
+                                    uint32_t& generation) {
+    PendingEntry key = {hash, 0};
+    for (int attempt = 0; attempt < 2; attempt++) {
+        auto range = std::equal_range(pending.begin(), pending.end(), key);
+        if (range.first == range.second) {
+            return false;
+        }
+        // Different paths can share a hash, the entry has to hold this one
+        for (auto it = range.first; it != range.second; ++it) {
+            if (UploadQueue::holds(it->id, path)) {
+                return true;
+            }
+        }
+        if (UploadQueue::getGeneration() == generation) {
+            return false;
+        }
+        // A compaction renumbered the entries since they were collected
+        generation = collectPending(pending);
+    }
+    return false;
+}
+
+bool RecordingReconciler::isReconciled(const String& path) {
+    return path.startsWith(String(RECORDINGS_DIR) + "/") && !path.startsWith(sessionPrefix);
+}
+
+uint32_t RecordingReconciler::hashPath(const String& path) {
+    return esp_rom_crc32_le(0, (const uint8_t*)path.c_str(), path.length());
+}
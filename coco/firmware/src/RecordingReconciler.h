@@ -0,0 +1,133 @@
+/**
+ * @file RecordingReconciler.h
+ * @brief Brings RECORDINGS_DIR and the upload queue back in line after a reset
+ *
+ * A power loss between closing a recording and queueing it leaves a WAV
+ * that never uploads, one between deleting an uploaded file and removing
+ * its entry leaves an entry that points at nothing. After power-on a
+ * background task therefore compares the two once:
+ *
+ * 1. The hashes of all pending paths are collected from the queue.
+ * 2. RECORDINGS_DIR is listed, every WAV of an earlier boot session that
+ *    is not pending is queued again. A hash match is confirmed against the
+ *    path of its entry, and uploaded files still waiting for their deferred
+ *    deletion are left alone. A queue that was lost or reset is rebuilt
+ *    this way.
+ * 3. Pending entries in RECORDINGS_DIR whose file was not listed are
+ *    discarded.
+ *
+ * Every step handles RECONCILE_BATCH_SIZE entries per SD access at upload
+ * priority, so recording starts right away and is never held up by it.
+ * Files of the running session are left to the audio task, which queues
+ * them itself. Wakes from deep sleep skip the pass, the queue is only
+ * left behind by a reset.
+ */
+
+#ifndef RECORDING_RECONCILER_H
+#define RECORDING_RECONCILER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <vector>
+
+#include "config.h"
+#include "Application.h"
+
+class RecordingReconciler {
+public:
+    /**
+     * @brief Initialize the reconciler
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if initialization was successful
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Start the reconciliation task if this boot needs it
+     * @return true if the task was started or is not needed
+     */
+    static bool startReconcileTask();
+
+    /**
+     * @brief Check if a reconciliation is in progress
+     * @return true until the task has finished, deep sleep waits for it
+     */
+    static bool isRunning();
+
+private:
+    // Private constructor for static-only class
+    RecordingReconciler() = default;
+    RecordingReconciler(const RecordingReconciler&) = delete;
+    RecordingReconciler& operator=(const RecordingReconciler&) = delete;
+
+    /**
+     * @brief Pending entry as collected from the queue
+     */
+    struct PendingEntry {
+        uint32_t hash;  ///< Hash of the path
+        uint32_t id;    ///< Entry id, to confirm the path with UploadQueue::holds()
+
+        bool operator<(const PendingEntry& other) const { return hash < other.hash; }
+    };
+
+    static void reconcileTask(void* parameter);
+
+    /**
+     * @brief Collect all pending entries, sorted by path hash
+     * @param entries Receives the entries
+     * @return Queue generation the entry ids belong to
+     */
+    static uint32_t collectPending(std::vector<PendingEntry>& entries);
+
+    /**
+     * @brief Queue the recordings that have no pending entry
+     * @param pending Sorted pending entries, collected again after a compaction
+     * @param generation Generation of the pending entries
+     * @param listed Receives the sorted hashes of all listed recordings
+     * @param recordings Incremented for every recording listed
+     * @return Number of recordings queued
+     */
+    static uint32_t queueOrphans(std::vector<PendingEntry>& pending, uint32_t& generation,
+                                 std::vector<uint32_t>& listed, uint32_t& recordings);
+
+    /**
+     * @brief Check if a recording has a pending entry
+     * @param path Full file path
+     * @param hash Hash of the path
+     * @param pending Sorted pending entries, collected again after a compaction
+     * @param generation Generation of the pending entries
+     * @return true if an entry holds the path
+     */
+    static bool isPending(const String& path, uint32_t hash, std::vector<PendingEntry>& pending,
+                          uint32_t& generation);
+
+    /**
+     * @brief Discard the pending entries whose recording was not listed
+     * @param listed Sorted hashes of all listed recordings
+     * @return Number of entries discarded
+     */
+    static uint32_t discardStale(const std::vector<uint32_t>& listed);
+
+    /**
+     * @brief Check if a path is a recording of an earlier session, the only ones reconciled
+     * @param path Full file path
+     * @return true if the path is reconciled
+     */
+    static bool isReconciled(const String& path);
+
+    /**
+     * @brief Hash a path for the comparison
+     * @param path Full file path
+     * @return Path hash
+     */
+    static uint32_t hashPath(const String& path);
+
+    static bool initialized;
+    static Application* app;
+    static TaskHandle_t reconcileTaskHandle;
+    static volatile bool running;
+    static String sessionPrefix;
+};
+
+#endif // RECORDING_RECONCILER_H
@@ -0,0 +1,233 @@
+/**
+ * @file SDScheduler.cpp
+ * @brief Implementation of the priority ordered SD card access
+ */
+
+#include <esp_timer.h>
+
+#include "SDScheduler.h"
+
+// Guards the owner, the wait queues and the statistics
+static portMUX_TYPE schedulerLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Access class of the running task and the semaphore its grants arrive on
+static thread_local SDPriority taskPriority = SD_PRIORITY_NORMAL;
+static thread_local SemaphoreHandle_t grantSemaphore = nullptr;
+
+Application* SDScheduler::app = nullptr;
+TaskHandle_t SDScheduler::owner = nullptr;
+SDPriority SDScheduler::ownerPriority = SD_PRIORITY_NORMAL;
+SDScheduler::Waiter SDScheduler::waiters[SD_PRIORITY_COUNT][SD_SCHEDULER_MAX_WAITERS] = {};
+uint32_t SDScheduler::waiterCount[SD_PRIORITY_COUNT] = {};
+SDPriorityStats SDScheduler::stats[SD_PRIORITY_COUNT] = {};
+uint32_t SDScheduler::maxDepth = 0;
+uint64_t SDScheduler::depthSum = 0;
+uint32_t SDScheduler::depthSamples = 0;
+uint32_t SDScheduler::yields = 0;
+
+bool SDScheduler::init(Application* appInstance) {
+    // Store Application instance if provided
+    if (appInstance != nullptr) {
+        app = appInstance;
+    } else if (app == nullptr) {
+        app = Application::getInstance();
+    }
+    return app != nullptr;
+}
+
+void SDScheduler::setTaskPriority(SDPriority priority) {
+    taskPriority = priority;
+}
+
+bool SDScheduler::acquire(TickType_t timeout) {
+    SDPriority priority = taskPriority;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (grantSemaphore == nullptr) {
+        grantSemaphore = xSemaphoreCreateBinary();
+        if (grantSemaphore == nullptr) {
+            return false;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool queued = false;
+    bool full = false;
+
+    portENTER_CRITICAL(&schedulerLock);
+    if (owner == nullptr) {
+        owner = self;
+        ownerPriority = priority;
+    } else if (waiterCount[priority] < SD_SCHEDULER_MAX_WAITERS) {
+        waiters[priority][waiterCount[priority]++] = { self, grantSemaphore };
+        queued = true;
+    } else {
+        full = true;
+    }
+    uint32_t depth = waitingTasks();
+    depthSum += depth;
+    depthSamples++;
+    if (depth > maxDepth) {
+        maxDepth = depth;
+    }
+    if (!queued && !full) {
+        recordGrant(priority, 0);
+    }
+    portEXIT_CRITICAL(&schedulerLock);
+
+    if (full) {
+        if (app) app->log("ERROR: Too many tasks waiting for the SD card");
+        return false;
+    }
+    if (!queued) {
+        return true;
+    }
+
+    if (xSemaphoreTake(grantSemaphore, timeout) != pdTRUE) {
+        portENTER_CRITICAL(&schedulerLock);
+        bool granted = (owner == self);
+        if (!granted) {
+            removeWaiter(priority, self);
+            stats[priority].timeouts++;
+        }
+        portEXIT_CRITICAL(&schedulerLock);
+
+        if (!granted) {
+            if (app) {
+                TaskHandle_t holder = owner;
+                app->log("SD access of " + String(pcTaskGetName(self)) + " timed out after " +
+                         String((uint32_t)((esp_timer_get_time() - start) / 1000)) + "ms, card held by " +
+                         String(holder ? pcTaskGetName(holder) : "nobody"));
+            }
+            return false;
+        }
+        // Handed over right at the timeout, the grant is given just after
+        xSemaphoreTake(grantSemaphore, portMAX_DELAY);
+    }
+
+    portENTER_CRITICAL(&schedulerLock);
+    recordGrant(priority, esp_timer_get_time() - start);
+    portEXIT_CRITICAL(&schedulerLock);
+    return true;
+}
+
+void SDScheduler::release() {
+    Waiter next = { nullptr, nullptr };
+
+    portENTER_CRITICAL(&schedulerLock);
+    owner = nullptr;
+    for (int p = 0; p < SD_PRIORITY_COUNT; p++) {
+        if (waiterCount[p] > 0) {
+            next = waiters[p][0];
+            memmove(&waiters[p][0], &waiters[p][1], (waiterCount[p] - 1) * sizeof(Waiter));
+            waiterCount[p]--;
+            // Owned from here on, so a late timeout of the waiter still finds its grant
+            owner = next.task;
+            ownerPriority = (SDPriority)p;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&schedulerLock);
+
+    if (next.grant != nullptr) {
+        xSemaphoreGive(next.grant);
+    }
+}
+
+void SDScheduler::yield() {
+    bool contended = false;
+
+    portENTER_CRITICAL(&schedulerLock);
+    for (int p = 0; p < ownerPriority; p++) {
+        if (waiterCount[p] > 0) {
+            contended = true;
+            break;
+        }
+    }
+    if (contended) {
+        yields++;
+    }
+    portEXIT_CRITICAL(&schedulerLock);
+
+    if (contended) {
+        // The caller's scope still expects the card, so wait as long as it takes
+        release();
+        acquire(portMAX_DELAY);
+    }
+}
+
+void SDScheduler::logStats() {
+    static const char* const names[SD_PRIORITY_COUNT] = { "audio", "normal", "log", "upload" };
+    static const uint32_t bounds[SD_WAIT_BUCKETS - 1] = SD_WAIT_BUCKET_BOUNDS;
+
+    portENTER_CRITICAL(&schedulerLock);
+    SDPriorityStats current[SD_PRIORITY_COUNT];
+    memcpy(current, stats, sizeof(current));
+    memset(stats, 0, sizeof(stats));
+    uint32_t depthMax = maxDepth;
+    float depthAverage = depthSamples > 0 ? (float)depthSum / depthSamples : 0.0f;
+    uint32_t yieldCount = yields;
+    maxDepth = 0;
+    depthSum = 0;
+    depthSamples = 0;
+    yields = 0;
+    portEXIT_CRITICAL(&schedulerLock);
+
+    String report = "SD waits";
+    for (int p = 0; p < SD_PRIORITY_COUNT; p++) {
+        const SDPriorityStats& s = current[p];
+        if (s.grants == 0 && s.timeouts == 0) {
+            continue;
+        }
+        report += String(report.length() == 8 ? ": " : "; ") + names[p] + " " + String(s.grants) + "x, " +
+                  String(s.contended) + " contended, max " + String(s.maxWaitMs) + "ms [";
+        for (int b = 0; b < SD_WAIT_BUCKETS; b++) {
+            report += String(b == 0 ? "" : " ") +
+                      (b < SD_WAIT_BUCKETS - 1 ? "<" + String(bounds[b]) : ">=" + String(bounds[b - 1])) +
+                      ":" + String(s.waitHistogram[b]);
+        }
+        report += "]";
+        if (s.timeouts > 0) {
+            report += " " + String(s.timeouts) + " timeouts";
+        }
+    }
+    report += "; queue depth avg " + String(depthAverage, 2) + " max " + String(depthMax) +
+              ", " + String(yieldCount) + " yields";
+    if (app) app->log(report);
+}
+
+void SDScheduler::removeWaiter(SDPriority priority, TaskHandle_t task) {
+    for (uint32_t i = 0; i < waiterCount[priority]; i++) {
+        if (waiters[priority][i].task == task) {
+            memmove(&waiters[priority][i], &waiters[priority][i + 1], (waiterCount[priority] - i - 1) * sizeof(Waiter));
+            waiterCount[priority]--;
+            return;
+        }
+    }
+}
+
+uint32_t SDScheduler::waitingTasks() {
+    uint32_t count = 0;
+    for (int p = 0; p < SD_PRIORITY_COUNT; p++) {
+        count += waiterCount[p];
+    }
+    return count;
+}
+
+void SDScheduler::recordGrant(SDPriority priority, int64_t waitedUs) {
+    static const uint32_t bounds[SD_WAIT_BUCKETS - 1] = SD_WAIT_BUCKET_BOUNDS;
+
+    SDPriorityStats& s = stats[priority];
+    uint32_t waitedMs = (uint32_t)(waitedUs / 1000);
+    s.grants++;
+    if (waitedUs > 0) {
+        s.contended++;
+    }
+    if (waitedMs > s.maxWaitMs) {
+        s.maxWaitMs = waitedMs;
+    }
+    int bucket = 0;
+    while (bucket < SD_WAIT_BUCKETS - 1 && waitedMs >= bounds[bucket]) {
+        bucket++;
+    }
+    s.waitHistogram[bucket]++;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file SDScheduler.h
+ * @brief Priority ordered access to the SD card
+ *
+ * All tasks share one card. Instead of a plain mutex, where the next owner
+ * is whichever waiter the kernel wakes, a released card is handed to the
+ * waiting task of the highest SDPriority, in arrival order within one
+ * priority. Every task states its class once with setTaskPriority(), so a
+ * WAV write waiting behind an upload read gets the card next even if log
+ * and upload tasks are waiting as well.
+ *
+ * Long writes call yield() between blocks, which passes the card to a
+ * waiting task of higher priority and takes it back afterwards, so no
+ * single operation keeps the audio task waiting for more than one block.
+ *
+ * Wait times are collected per priority into a histogram together with the
+ * number of waiting tasks, logStats() reports and resets them.
+ */
+
+#ifndef SD_SCHEDULER_H
+#define SD_SCHEDULER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "Application.h"
+
+/**
+ * @brief Access classes, a lower value is served first
+ */
+enum SDPriority {
+    SD_PRIORITY_AUDIO,   ///< Recording, must never wait behind background work
+    SD_PRIORITY_NORMAL,  ///< Default of every task that sets nothing
+    SD_PRIORITY_LOG,     ///< Log flushes
+    SD_PRIORITY_UPLOAD,  ///< Upload reads, queue bookkeeping and deletions
+    SD_PRIORITY_COUNT
+};
+
+// Upper bounds (ms) of the wait time histogram buckets, the last bucket takes the rest
+#define SD_WAIT_BUCKET_BOUNDS { 1, 5, 20, 100, 500 }
+#define SD_WAIT_BUCKETS 6
+
+/**
+ * @brief Waits and grants of one priority since the last report
+ */
+struct SDPriorityStats {
+    uint32_t grants;                          ///< Accesses granted
+    uint32_t contended;                       ///< Grants that had to wait for another task
+    uint32_t timeouts;                        ///< Accesses given up after SD_LOCK_TIMEOUT
+    uint32_t maxWaitMs;                       ///< Longest wait
+    uint32_t waitHistogram[SD_WAIT_BUCKETS];  ///< Grants per wait time bucket
+};
+
+class SDScheduler {
+public:
+    /**
+     * @brief Initialize the scheduler
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if initialization was successful
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Set the access class of the calling task, called once at task start
+     * @param priority Priority of all later accesses of this task
+     */
+    static void setTaskPriority(SDPriority priority);
+
+    /**
+     * @brief Take the card for the calling task
+     * @param timeout Longest wait for the card
+     * @return true if the caller owns the card, false on timeout
+     */
+    static bool acquire(TickType_t timeout);
+
+    /**
+     * @brief Hand the card to the next waiting task, called by the owner
+     */
+    static void release();
+
+    /**
+     * @brief Let a waiting task of higher priority run its access, called by the owner between blocks
+     *
+     * The caller owns the card again when this returns and its open handles
+     * stay valid, but other tasks may have written to the card meanwhile.
+     */
+    static void yield();
+
+    /**
+     * @brief Log the wait time histograms and queue depths, then reset them
+     */
+    static void logStats();
+
+private:
+    // Private constructor for static-only class
+    SDScheduler() = default;
+    SDScheduler(const SDScheduler&) = delete;
+    SDScheduler& operator=(const SDScheduler&) = delete;
+
+    /**
+     * @brief A task waiting for the card
+     */
+    struct Waiter {
+        TaskHandle_t task;          ///< Waiting task
+        SemaphoreHandle_t grant;    ///< Given when the card is handed to the task
+    };
+
+    // The helpers below expect the caller to be in the scheduler critical section
+
+    /**
+     * @brief Remove a waiter that gave up
+     * @param priority Queue the task waits in
+     * @param task Waiting task
+     */
+    static void removeWaiter(SDPriority priority, TaskHandle_t task);
+
+    /**
+     * @brief Count the tasks waiting in all queues
+     * @return Number of waiting tasks
+     */
+    static uint32_t waitingTasks();
+
+    /**
+     * @brief Account a granted access
+     * @param priority Priority of the access
+     * @param waitedUs Time spent waiting
+     */
+    static void recordGrant(SDPriority priority, int64_t waitedUs);
+
+    static Application* app;
+
+    // Current owner, nullptr while the card is free
+    static TaskHandle_t owner;
+    static SDPriority ownerPriority;
+
+    // Waiting tasks of each priority in arrival order
+    static Waiter waiters[SD_PRIORITY_COUNT][SD_SCHEDULER_MAX_WAITERS];
+    static uint32_t waiterCount[SD_PRIORITY_COUNT];
+
+    // Statistics since the last report
+    static SDPriorityStats stats[SD_PRIORITY_COUNT];
+    static uint32_t maxDepth;
+    static uint64_t depthSum;
+    static uint32_t depthSamples;
+    static uint32_t yields;
+};
+
+#endif // SD_SCHEDULER_H
@@ -6,6 +6,9 @@
  * formatting, and persistence functions.
  */
 
+#include <esp_timer.h>
+#include <esp_sntp.h>
+
 #include "TimeManager.h"
 
 // Initialize static members
@@ -13,14 +16,19 @@ Application* TimeManager::app = nullptr;
 time_t TimeManager::storedTime = 0;
 TaskHandle_t TimeManager::persistTimeTaskHandle = nullptr;
 bool TimeManager::initialized = false;
+volatile int64_t TimeManager::epochOffset = 0;
+volatile bool TimeManager::epochValid = false;
+volatile int64_t TimeManager::clockStep = 0;
+time_t TimeManager::cachedSecond = -1;
+char TimeManager::cachedTimestamp[TIMESTAMP_SIZE] = "";
+size_t TimeManager::cachedLength = 0;
+portMUX_TYPE TimeManager::timeLock = portMUX_INITIALIZER_UNLOCKED;
 
 bool TimeManager::init(Application* application) {
     // Store application instance
     app = application;
     
-    // Set timezone
-    setenv("TZ", TIMEZONE, 1);
-    tzset();
+    applyTimezone();
     
     struct timeval tv;
     time_t currentRtcTime = time(NULL);
@@ -60,6 +68,7 @@ bool TimeManager::init(Application* application) {
         tv.tv_usec = 0;
         settimeofday(&tv, NULL);
     }
+    rebase();
         
     initialized = true;
 
@@ -68,13 +77,120 @@ bool TimeManager::init(Application* application) {
     return true;
 }
 
+void TimeManager::applyTimezone() {
+    setenv("TZ", TIMEZONE, 1);
+    tzset();
+    
+    // The cached second was formatted for the previous zone
+    portENTER_CRITICAL(&timeLock);
+    cachedSecond = -1;
+    portEXIT_CRITICAL(&timeLock);
+}
+
+void TimeManager::rebase() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t offset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - esp_timer_get_time();
+    
+    portENTER_CRITICAL(&timeLock);
+    epochOffset = offset;
+    epochValid = true;
+    portEXIT_CRITICAL(&timeLock);
+}
+
+void TimeManager::onTimeSync(struct timeval* tv) {
+    portENTER_CRITICAL(&timeLock);
+    int64_t previous = epochOffset;
+    bool wasValid = epochValid;
+    portEXIT_CRITICAL(&timeLock);
+    
+    rebase();
+    
+    if (wasValid) {
+        portENTER_CRITICAL(&timeLock);
+        clockStep += epochOffset - previous;
+        portEXIT_CRITICAL(&timeLock);
+    }
+}
+
+int64_t TimeManager::getClockStepMicros() {
+    portENTER_CRITICAL(&timeLock);
+    int64_t step = clockStep;
+    portEXIT_CRITICAL(&timeLock);
+    return step;
+}
+
+int64_t TimeManager::toEpochMicros(int64_t timerMicros) {
+    // Before init() the RTC time kept through deep sleep is the best there is
+    if (!epochValid) {
+        rebase();
+    }
+    
+    portENTER_CRITICAL(&timeLock);
+    int64_t offset = epochOffset;
+    portEXIT_CRITICAL(&timeLock);
+    return timerMicros + offset;
+}
+
+int64_t TimeManager::getEpochMicros() {
+    return toEpochMicros(esp_timer_get_time());
+}
+
+size_t TimeManager::formatTimestamp(char* buffer, size_t size) {
+    return formatTimestamp(buffer, size, getEpochMicros());
+}
+
+size_t TimeManager::formatTimestamp(char* buffer, size_t size, int64_t epochMicros) {
+    time_t second = (time_t)(epochMicros / 1000000);
+    
+    // Most calls fall into the second formatted last
+    size_t length = 0;
+    portENTER_CRITICAL(&timeLock);
+    if (second == cachedSecond && cachedLength < size) {
+        memcpy(buffer, cachedTimestamp, cachedLength + 1);
+        length = cachedLength;
+    }
+    portEXIT_CRITICAL(&timeLock);
+    if (length > 0) {
+        return length;
+    }
+    
+    char formatted[TIMESTAMP_SIZE];
+    if (second < TIME_VALID_AFTER) {
+        length = snprintf(formatted, sizeof(formatted), "unknown");
+    } else {
+        struct tm timeinfo;
+        localtime_r(&second, &timeinfo);
+        length = strftime(formatted, sizeof(formatted), "%y-%m-%d_%H-%M-%S", &timeinfo);
+    }
+    if (length == 0 || length >= size) {
+        return 0;
+    }
+    memcpy(buffer, formatted, length + 1);
+    
+    // Only move the cache forward, so stamping an older time does not evict the current second
+    portENTER_CRITICAL(&timeLock);
+    if (second > cachedSecond) {
+        memcpy(cachedTimestamp, formatted, length + 1);
+        cachedLength = length;
+        cachedSecond = second;
+    }
+    portEXIT_CRITICAL(&timeLock);
+    return length;
+}
+
 String TimeManager::getTimestamp() {
-    return getTimestamp("%y-%m-%d_%H-%M-%S");
+    char buffer[TIMESTAMP_SIZE];
+    if (formatTimestamp(buffer, sizeof(buffer)) == 0) {
+        return "unknown";
+    }
+    return String(buffer);
 }
 
 String TimeManager::getTimestamp(const char* format) {
     struct tm timeinfo;
-    if (getLocalTime(&timeinfo)) {
+    time_t now = getCurrentTime();
+    if (now >= TIME_VALID_AFTER && localtime_r(&now, &timeinfo)) {
         char buffer[64];
         strftime(buffer, sizeof(buffer), format, &timeinfo);
         return String(buffer);
@@ -83,7 +199,7 @@ String TimeManager::getTimestamp(const char* format) {
 }
 
 time_t TimeManager::getCurrentTime() {
-    return time(NULL);
+    return (time_t)(getEpochMicros() / 1000000);
 }
 
 bool TimeManager::updateFromNTP() {
@@ -93,10 +209,13 @@ bool TimeManager::updateFromNTP() {
     }
     
     app->log("Updating time from NTP servers...");
+    // Every later SNTP correction moves the wall clock as well
+    sntp_set_time_sync_notification_cb(onTimeSync);
     configTime(0, 0, "pool.ntp.org", "time.google.com", "time.nist.gov");
     struct tm timeinfo;
 
     if (getLocalTime(&timeinfo)) {
+        rebase();
         storedTime = mktime(&timeinfo);
         app->log("Current time obtained from NTP.");
         storeCurrentTime();
@@ -118,7 +237,7 @@ bool TimeManager::storeCurrentTime() {
         return false;
     }
     
-    time_t current = time(NULL);
+    time_t current = getCurrentTime();
     storedTime = current;
     
     // Store time to SD card using Application wrapper
@@ -165,6 +284,9 @@ void TimeManager::persistTimeTask(void *parameter) {
     TickType_t lastPersistTime = xTaskGetTickCount();
     
     while (true) {
+        // Follow the system time, in case it was adjusted behind our back
+        rebase();
+        
         // Store current time
         bool success = storeCurrentTime();
         
@@ -5,6 +5,13 @@
  * This module handles time initialization, synchronization with NTP,
  * and persistent storage of time to maintain time across reboots and sleep.
  * It provides functionality for timestamp formatting and time persistence.
+ *
+ * The wall clock is kept as an offset to esp_timer, taken whenever the
+ * system time is set (TIME_FILE, RTC or NTP). Reading the time is then a
+ * single esp_timer_get_time() call, and any esp_timer timestamp, e.g. of
+ * an I2S read, converts to wall-clock time with microsecond resolution.
+ * Timestamps are formatted into caller buffers without allocating, the
+ * formatted second is cached so strftime runs at most once per second.
  */
 
 #ifndef TIME_MANAGER_H
@@ -12,6 +19,7 @@
 
 // Standard libraries
 #include <time.h>
+#include <stdint.h>
 
 // ESP libraries
 #include <Arduino.h>
@@ -33,8 +41,51 @@ public:
      */
     static bool init(Application* app = nullptr);
     
+    /**
+     * @brief Set the local timezone, so timestamps taken before init() already use it
+     */
+    static void applyTimezone();
+    
     // Time retrieval and formatting
     
+    /**
+     * @brief Format the current time as "%y-%m-%d_%H-%M-%S" into a caller buffer, without allocating
+     * @param buffer Destination, TIMESTAMP_SIZE bytes hold every timestamp
+     * @param size Size of the destination in bytes
+     * @return Length of the timestamp, 0 if the buffer is too small
+     */
+    static size_t formatTimestamp(char* buffer, size_t size);
+    
+    /**
+     * @brief Format a wall-clock time as "%y-%m-%d_%H-%M-%S" into a caller buffer, without allocating
+     * @param buffer Destination, TIMESTAMP_SIZE bytes hold every timestamp
+     * @param size Size of the destination in bytes
+     * @param epochMicros Time in microseconds since the epoch, e.g. from toEpochMicros()
+     * @return Length of the timestamp, 0 if the buffer is too small
+     */
+    static size_t formatTimestamp(char* buffer, size_t size, int64_t epochMicros);
+    
+    /**
+     * @brief Get the current wall-clock time with microsecond resolution
+     * @return Microseconds since the epoch
+     */
+    static int64_t getEpochMicros();
+    
+    /**
+     * @brief Convert an esp_timer timestamp of this boot to wall-clock time
+     * @param timerMicros Value returned by esp_timer_get_time()
+     * @return Microseconds since the epoch
+     */
+    static int64_t toEpochMicros(int64_t timerMicros);
+    
+    /**
+     * @brief Get how far SNTP moved the wall clock since boot
+     *
+     * Epoch times stored before a sync are moved by the change since then to stay comparable.
+     * @return Sum of all steps in microseconds, positive when the clock moved forward
+     */
+    static int64_t getClockStepMicros();
+    
     /**
      * @brief Get current time as formatted string (no-parameter version for LogManager compatibility)
      * @return Formatted timestamp string with default format
@@ -96,11 +147,33 @@ private:
      */
     static void persistTimeTask(void *parameter);
     
+    /**
+     * @brief Take the offset between the system time and esp_timer, after the system time was set
+     */
+    static void rebase();
+    
+    /**
+     * @brief Called by SNTP whenever it set the system time
+     * @param tv New system time
+     */
+    static void onTimeSync(struct timeval* tv);
+    
     // Static state variables
     static Application* app;
     static time_t storedTime;
     static TaskHandle_t persistTimeTaskHandle;
     static bool initialized;
+    
+    // Wall clock, the system time minus esp_timer, taken by rebase()
+    static volatile int64_t epochOffset;
+    static volatile bool epochValid;
+    static volatile int64_t clockStep;  // Sum of the offset changes made by SNTP
+    
+    // Last formatted second, shared by all callers
+    static time_t cachedSecond;
+    static char cachedTimestamp[TIMESTAMP_SIZE];
+    static size_t cachedLength;
+    static portMUX_TYPE timeLock;
 };
 
 #endif // TIME_MANAGER_H
@@ -0,0 +1,732 @@
+/**
+ * @file UploadQueue.cpp
+ * @brief Implementation of the persistent upload queue
+ */
+
+#include <esp_rom_crc.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include "UploadQueue.h"
+#include "FileSystem.h"
+
+// Record and slot types
+#define UPLOAD_QUEUE_LOG_MAGIC 0x474C5155    // "UQLG"
+#define UPLOAD_QUEUE_RECORD_MAGIC 0x43455255 // "UREC"
+#define UPLOAD_QUEUE_HEAD_MAGIC 0x44485155   // "UQHD"
+#define UPLOAD_QUEUE_TOMBSTONE_MAGIC 0x424D5455 // "UTMB"
+
+// Temporary log written during compaction
+#define UPLOAD_QUEUE_COMPACT_FILE "/upload_queue.tmp"
+
+// Offset in the legacy file up to which its lines are in the log
+#define UPLOAD_QUEUE_MIGRATION_FILE "/upload_queue.migrated"
+
+// Initialize static member variables
+bool UploadQueue::initialized = false;
+Application* UploadQueue::app = nullptr;
+uint32_t UploadQueue::head = 1;
+uint32_t UploadQueue::tail = 1;
+uint32_t UploadQueue::pending = 0;
+bool UploadQueue::tailDamaged = false;
+uint32_t UploadQueue::generation = 0;
+uint32_t UploadQueue::headSequence = 0;
+uint32_t UploadQueue::compactedRecords = 0;
+
+bool UploadQueue::init(Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    if (appInstance == nullptr) {
+        app = Application::getInstance();
+    } else {
+        app = appInstance;
+    }
+
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked()) {
+            app->log("UploadQueue: Failed to take SD card mutex");
+            return false;
+        }
+
+        // Finish or discard a compaction that was interrupted by a reset
+        if (FileSystem::card().exists(UPLOAD_QUEUE_COMPACT_FILE)) {
+            if (FileSystem::card().exists(UPLOAD_QUEUE_FILE)) {
+                FileSystem::card().remove(UPLOAD_QUEUE_COMPACT_FILE);
+            } else if (!FileSystem::card().rename(UPLOAD_QUEUE_COMPACT_FILE, UPLOAD_QUEUE_FILE)) {
+                app->log("UploadQueue: Failed to finish interrupted compaction");
+                return false;
+            }
+        }
+
+        HeadSlot slot;
+        bool haveHead = loadHead(slot);
+        headSequence = haveHead ? slot.sequence : 0;
+
+        File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+        Record header;
+        bool haveLog = file && readRecord(file, 0, header) && header.magic == UPLOAD_QUEUE_LOG_MAGIC;
+        size_t fileSize = file ? file.size() : 0;
+        if (haveLog) {
+            memcpy(&generation, header.path, sizeof(generation));
+        }
+        if (file) {
+            file.close();
+        }
+
+        if (!haveLog) {
+            if (fileSize > 0) {
+                app->log("UploadQueue: Log header is damaged, starting a new queue");
+            }
+            // Pick a generation no stored head can belong to
+            generation = haveHead ? slot.generation + 2 : 1;
+            if (!createLog(UPLOAD_QUEUE_FILE, generation)) {
+                app->log("UploadQueue: Failed to create queue log");
+                return false;
+            }
+            fileSize = UPLOAD_QUEUE_RECORD_SIZE;
+        }
+
+        // A reset during push can leave a partial record, pad it so it fails its CRC
+        size_t partial = fileSize % UPLOAD_QUEUE_RECORD_SIZE;
+        if (partial != 0) {
+            File log = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_APPEND);
+            if (log) {
+                uint8_t zeros[UPLOAD_QUEUE_RECORD_SIZE] = {0};
+                log.write(zeros, UPLOAD_QUEUE_RECORD_SIZE - partial);
+                log.close();
+            }
+            fileSize += UPLOAD_QUEUE_RECORD_SIZE - partial;
+            app->log("UploadQueue: Padded a partial record left by a reset");
+        }
+        tail = fileSize / UPLOAD_QUEUE_RECORD_SIZE;
+
+        if (haveHead && slot.generation == generation) {
+            head = slot.head;
+        } else {
+            // No head yet, or the reset hit between a compaction and its head update
+            head = 1;
+        }
+        if (head < 1) {
+            head = 1;
+        }
+        if (head > tail) {
+            head = tail;
+        }
+        if (!haveHead || slot.generation != generation || slot.head != head) {
+            storeHead();
+        }
+
+        // Count the intact entries once, push and remove keep the count from here on
+        pending = 0;
+        File log = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+        if (log) {
+            Record record;
+            for (uint32_t i = head; i < tail; i++) {
+                if (readRecord(log, i, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC) {
+                    pending++;
+                }
+            }
+            log.close();
+        }
+    }
+
+    initialized = true;
+    migrateLegacyQueue();
+
+    compactIfNeeded();
+
+    app->log("UploadQueue initialized with " + String(size()) + " pending file(s)");
+    return true;
+}
+
+bool UploadQueue::push(const String& path) {
+    if (!initialized) {
+        return false;
+    }
+
+    if (path.length() == 0 || path.length() > UPLOAD_QUEUE_PATH_MAX) {
+        app->log("UploadQueue: Invalid path length for " + path);
+        return false;
+    }
+
+    Record record;
+    sealRecord(record, UPLOAD_QUEUE_RECORD_MAGIC, path.c_str(), path.length());
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("UploadQueue: Failed to take SD card mutex for push");
+        return false;
+    }
+
+    // Appending behind a partial record would shift every later record off its slot
+    if (tailDamaged && !repairTail()) {
+        app->log("UploadQueue: Queue log has a partial record, not pushing " + path);
+        return false;
+    }
+
+    // The log keeps its append handle, so a push costs no directory walk
+    FileSegment segment = { (const uint8_t*)&record, sizeof(record) };
+    size_t written = 0;
+    if (!FileSystem::appendSegments(UPLOAD_QUEUE_FILE, &segment, 1, written)) {
+        if (written == 0) {
+            app->log("UploadQueue: Failed to open queue log for appending");
+            return false;
+        }
+        // Drop the partial record now, or on the next push if the card refuses
+        tailDamaged = true;
+        repairTail();
+        app->log("UploadQueue: Failed to write record for " + path);
+        return false;
+    }
+
+    tail++;
+    pending++;
+    return true;
+}
+
+String UploadQueue::peek() {
+    if (!initialized) {
+        return "";
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked() || head >= tail) {
+        return "";
+    }
+
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    if (!file) {
+        return "";
+    }
+
+    String path;
+    bool skipped = false;
+    Record record;
+    while (head < tail) {
+        if (readRecord(file, head, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC) {
+            path = String(record.path);
+            break;
+        }
+        // Removed, torn or padded record
+        head++;
+        skipped = true;
+    }
+    file.close();
+
+    if (skipped) {
+        storeHead();
+    }
+    return path;
+}
+
+size_t UploadQueue::peekBatch(String* paths, uint32_t* ids, size_t maxCount) {
+    if (!initialized || maxCount == 0) {
+        return 0;
+    }
+
+    // Renumbering is safe here, the ids of the previous batch are no longer used
+    compactIfNeeded();
+
+    // Skips removed records at the front and persists the new head
+    if (peek().isEmpty()) {
+        return 0;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        return 0;
+    }
+
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    if (!file) {
+        return 0;
+    }
+
+    size_t count = 0;
+    Record record;
+    for (uint32_t i = head; i < tail && count < maxCount; i++) {
+        if (readRecord(file, i, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC) {
+            paths[count] = String(record.path);
+            ids[count] = i;
+            count++;
+        }
+    }
+    file.close();
+    return count;
+}
+
+bool UploadQueue::remove(uint32_t id) {
+    if (!initialized) {
+        return false;
+    }
+
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked()) {
+            app->log("UploadQueue: Failed to take SD card mutex for remove");
+            return false;
+        }
+
+        // Removed already, by the reconciler or an earlier call
+        if (id < head || id >= tail || !isLive(id)) {
+            return false;
+        }
+
+        if (id != head) {
+            if (!writeTombstone(id)) {
+                return false;
+            }
+            pending--;
+            return true;
+        }
+    }
+
+    // Ids handed out by peekBatch() stay valid, compaction waits for the next peekBatch()
+    return advanceHead();
+}
+
+bool UploadQueue::pop() {
+    if (!initialized || !advanceHead()) {
+        return false;
+    }
+
+    compactIfNeeded();
+    return true;
+}
+
+bool UploadQueue::advanceHead() {
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("UploadQueue: Failed to take SD card mutex for pop");
+        return false;
+    }
+
+    if (head >= tail) {
+        return false;
+    }
+
+    // The head may be a removed or torn record when peek() did not skip it first
+    bool live = isLive(head);
+    head++;
+    if (!storeHead()) {
+        head--;
+        app->log("UploadQueue: Failed to persist queue head");
+        return false;
+    }
+    if (live) {
+        pending--;
+    }
+    return true;
+}
+
+void UploadQueue::compactIfNeeded() {
+    // A compaction copies the pending records, so it waits until at least as many were consumed
+    uint32_t consumed = head - 1;
+    if ((head == tail && head > 1) || consumed > std::max((uint32_t)UPLOAD_QUEUE_COMPACT_RECORDS, tail - head)) {
+        compact();
+    }
+}
+
+bool UploadQueue::isEmpty() {
+    return size() == 0;
+}
+
+uint32_t UploadQueue::size() {
+    return pending;
+}
+
+bool UploadQueue::contains(const String& path) {
+    if (!initialized) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        return false;
+    }
+
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    if (!file) {
+        return false;
+    }
+
+    bool found = false;
+    Record record;
+    for (uint32_t i = head; i < tail && !found; i++) {
+        found = readRecord(file, i, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC &&
+                path.equals(record.path);
+    }
+    file.close();
+    return found;
+}
+
+size_t UploadQueue::scanPending(UploadQueueCursor& cursor, String* paths, uint32_t* ids, size_t maxCount) {
+    if (!initialized || maxCount == 0) {
+        return 0;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        return 0;
+    }
+
+    if (cursor.index == 0 || cursor.generation != generation) {
+        cursor.generation = generation;
+        cursor.index = head;
+    }
+    if (cursor.index < head) {
+        cursor.index = head;
+    }
+    if (cursor.index >= tail) {
+        return 0;
+    }
+
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    if (!file) {
+        return 0;
+    }
+
+    size_t count = 0;
+    Record record;
+    for (; cursor.index < tail && count < maxCount; cursor.index++) {
+        if (readRecord(file, cursor.index, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC) {
+            paths[count] = String(record.path);
+            ids[count] = cursor.index;
+            count++;
+        }
+    }
+    file.close();
+    return count;
+}
+
+bool UploadQueue::discard(uint32_t id, const String& path) {
+    if (!initialized) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked() || id < head || id >= tail) {
+        return false;
+    }
+
+    // The id may have been renumbered by a compaction since the scan
+    if (!isLive(id, path.c_str())) {
+        return false;
+    }
+
+    // Also at the head, so the upload task keeps sole control of the head pointer
+    if (!writeTombstone(id)) {
+        return false;
+    }
+    pending--;
+    return true;
+}
+
+bool UploadQueue::holds(uint32_t id, const String& path) {
+    if (!initialized) {
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked() || id < head || id >= tail) {
+        return false;
+    }
+    return isLive(id, path.c_str());
+}
+
+bool UploadQueue::loadHead(HeadSlot& slot) {
+    File file = FileSystem::card().open(UPLOAD_QUEUE_HEAD_FILE, FILE_READ);
+    if (!file) {
+        return false;
+    }
+
+    bool found = false;
+    HeadSlot candidate;
+    for (int i = 0; i < 2; i++) {
+        if (file.read((uint8_t*)&candidate, sizeof(candidate)) != sizeof(candidate)) {
+            break;
+        }
+        if (candidate.magic != UPLOAD_QUEUE_HEAD_MAGIC ||
+            candidate.crc != esp_rom_crc32_le(0, (const uint8_t*)&candidate, offsetof(HeadSlot, crc))) {
+            continue;
+        }
+        // Sequence numbers are compared with wraparound
+        if (!found || (int32_t)(candidate.sequence - slot.sequence) > 0) {
+            slot = candidate;
+            found = true;
+        }
+    }
+    file.close();
+    return found;
+}
+
+bool UploadQueue::storeHead() {
+    HeadSlot slot;
+    slot.magic = UPLOAD_QUEUE_HEAD_MAGIC;
+    slot.sequence = headSequence + 1;
+    slot.generation = generation;
+    slot.head = head;
+    slot.crc = esp_rom_crc32_le(0, (const uint8_t*)&slot, offsetof(HeadSlot, crc));
+
+    // Overwrite the older slot in place, the newer one stays valid if this write tears
+    bool exists = FileSystem::card().exists(UPLOAD_QUEUE_HEAD_FILE);
+    File file = FileSystem::card().open(UPLOAD_QUEUE_HEAD_FILE, exists ? "r+" : FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+
+    if (file.size() < 2 * sizeof(HeadSlot)) {
+        HeadSlot empty = {};
+        file.seek(0);
+        file.write((const uint8_t*)&empty, sizeof(empty));
+        file.write((const uint8_t*)&empty, sizeof(empty));
+    }
+
+    bool success = file.seek((slot.sequence & 1) * sizeof(HeadSlot)) &&
+                   file.write((const uint8_t*)&slot, sizeof(slot)) == sizeof(slot);
+    file.close();
+
+    if (success) {
+        headSequence = slot.sequence;
+    }
+    return success;
+}
+
+bool UploadQueue::readRecord(File& file, uint32_t index, Record& record) {
+    if (!file.seek((size_t)index * UPLOAD_QUEUE_RECORD_SIZE) ||
+        file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) {
+        return false;
+    }
+
+    if (record.length > UPLOAD_QUEUE_PATH_MAX ||
+        record.crc != esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(Record, crc))) {
+        return false;
+    }
+
+    // Entries are stored zero padded, make sure the path is terminated
+    if (record.magic == UPLOAD_QUEUE_RECORD_MAGIC) {
+        if (record.length == UPLOAD_QUEUE_PATH_MAX || record.path[record.length] != '\0') {
+            return false;
+        }
+    } else if (record.magic != UPLOAD_QUEUE_LOG_MAGIC && record.magic != UPLOAD_QUEUE_TOMBSTONE_MAGIC) {
+        return false;
+    }
+    return true;
+}
+
+void UploadQueue::sealRecord(Record& record, uint32_t magic, const void* data, uint16_t length) {
+    static_assert(sizeof(Record) == UPLOAD_QUEUE_RECORD_SIZE, "Upload queue record must fill its slot");
+
+    memset(&record, 0, sizeof(record));
+    record.magic = magic;
+    record.length = length;
+    if (length > 0) {
+        memcpy(record.path, data, length);
+    }
+    record.crc = esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(Record, crc));
+}
+
+bool UploadQueue::createLog(const char* path, uint32_t logGeneration) {
+    Record header;
+    sealRecord(header, UPLOAD_QUEUE_LOG_MAGIC, &logGeneration, sizeof(logGeneration));
+
+    FileSystem::closeAppender(path);
+    File file = FileSystem::card().open(path, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    size_t written = file.write((const uint8_t*)&header, sizeof(header));
+    file.close();
+    return written == sizeof(header);
+}
+
+bool UploadQueue::writeTombstone(uint32_t id) {
+    // A torn tombstone fails its CRC and is skipped just the same
+    Record tombstone;
+    sealRecord(tombstone, UPLOAD_QUEUE_TOMBSTONE_MAGIC, nullptr, 0);
+
+    // The append handle caches the last sector, it must not write over the tombstone later
+    FileSystem::closeAppender(UPLOAD_QUEUE_FILE);
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, "r+");
+    if (!file) {
+        app->log("UploadQueue: Failed to open queue log for remove");
+        return false;
+    }
+    bool success = file.seek((size_t)id * UPLOAD_QUEUE_RECORD_SIZE) &&
+                   file.write((const uint8_t*)&tombstone, sizeof(tombstone)) == sizeof(tombstone);
+    file.close();
+    return success;
+}
+
+bool UploadQueue::isLive(uint32_t id, const char* path) {
+    File file = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    Record record;
+    bool live = readRecord(file, id, record) && record.magic == UPLOAD_QUEUE_RECORD_MAGIC &&
+                (path == nullptr || strcmp(path, record.path) == 0);
+    file.close();
+    return live;
+}
+
+bool UploadQueue::repairTail() {
+    // The failed append closed the handle, the next one reopens at the new end
+    FileSystem::closeAppender(UPLOAD_QUEUE_FILE);
+    if (!FileSystem::truncateFile(UPLOAD_QUEUE_FILE, (size_t)tail * UPLOAD_QUEUE_RECORD_SIZE)) {
+        app->log("UploadQueue: Failed to drop partial record");
+        return false;
+    }
+    tailDamaged = false;
+    return true;
+}
+
+bool UploadQueue::compact() {
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        return false;
+    }
+
+    uint32_t nextGeneration = generation + 1;
+    if (!createLog(UPLOAD_QUEUE_COMPACT_FILE, nextGeneration)) {
+        app->log("UploadQueue: Failed to create compacted log");
+        return false;
+    }
+
+    File source = FileSystem::card().open(UPLOAD_QUEUE_FILE, FILE_READ);
+    File target = FileSystem::card().open(UPLOAD_QUEUE_COMPACT_FILE, FILE_APPEND);
+    if (!source || !target) {
+        if (source) source.close();
+        if (target) target.close();
+        FileSystem::card().remove(UPLOAD_QUEUE_COMPACT_FILE);
+        app->log("UploadQueue: Failed to open logs for compaction");
+        return false;
+    }
+
+    // Copy the pending entries, dropping removed and torn records on the way
+    uint32_t kept = 0;
+    bool success = true;
+    Record record;
+    for (uint32_t i = head; i < tail; i++) {
+        if (!readRecord(source, i, record) || record.magic != UPLOAD_QUEUE_RECORD_MAGIC) {
+            continue;
+        }
+        if (target.write((const uint8_t*)&record, sizeof(record)) != sizeof(record)) {
+            success = false;
+            break;
+        }
+        kept++;
+    }
+    compactedRecords += kept;
+    source.close();
+    target.close();
+
+    if (!success) {
+        FileSystem::card().remove(UPLOAD_QUEUE_COMPACT_FILE);
+        app->log("UploadQueue: Failed to write compacted log");
+        return false;
+    }
+
+    // From here on init() completes the swap if a reset interrupts it
+    FileSystem::closeAppender(UPLOAD_QUEUE_FILE);
+    if (!FileSystem::card().remove(UPLOAD_QUEUE_FILE) || !FileSystem::card().rename(UPLOAD_QUEUE_COMPACT_FILE, UPLOAD_QUEUE_FILE)) {
+        app->log("UploadQueue: Failed to replace queue log");
+        return false;
+    }
+
+    generation = nextGeneration;
+    head = 1;
+    tail = 1 + kept;
+    pending = kept;
+    tailDamaged = false;
+    if (!storeHead()) {
+        // init() still finds the right head, the generation no longer matches the stored one
+        app->log("UploadQueue: Failed to persist head after compaction");
+    }
+    return true;
+}
+
+void UploadQueue::migrateLegacyQueue() {
+    File legacy;
+    uint32_t resumeOffset = 0;
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked() || !FileSystem::card().exists(UPLOAD_QUEUE_LEGACY_FILE)) {
+            return;
+        }
+
+        // An interrupted migration continues after the last line it stored
+        File progress = FileSystem::card().open(UPLOAD_QUEUE_MIGRATION_FILE, FILE_READ);
+        if (progress) {
+            if (progress.read((uint8_t*)&resumeOffset, sizeof(resumeOffset)) != sizeof(resumeOffset)) {
+                resumeOffset = 0;
+            }
+            progress.close();
+        }
+
+        legacy = FileSystem::card().open(UPLOAD_QUEUE_LEGACY_FILE, FILE_READ);
+        if (!legacy) {
+            return;
+        }
+        if (resumeOffset > legacy.size() || !legacy.seek(resumeOffset)) {
+            resumeOffset = 0;
+            legacy.seek(0);
+        }
+    }
+
+    // push() takes the SD mutex itself, so the file is read line by line in between
+    uint32_t migrated = 0;
+    bool complete = false;
+    bool resuming = true;
+    String line;
+    while (true) {
+        uint32_t offset;
+        {
+            SDLockGuard lock;
+            if (!lock.isLocked()) {
+                break;
+            }
+            if (!legacy.available()) {
+                complete = true;
+                break;
+            }
+            line = legacy.readStringUntil('\n');
+            offset = legacy.position();
+        }
+        line.trim();
+        if (line.length() == 0) {
+            continue;
+        }
+
+        // A line pushed just before a reset may be missing from the progress file
+        if (resuming && contains(line)) {
+            continue;
+        }
+        resuming = false;
+        if (!push(line)) {
+            continue;
+        }
+        migrated++;
+
+        SDLockGuard lock;
+        File progress = FileSystem::card().open(UPLOAD_QUEUE_MIGRATION_FILE, FILE_WRITE);
+        if (progress) {
+            progress.write((const uint8_t*)&offset, sizeof(offset));
+            progress.close();
+        }
+    }
+
+    SDLockGuard lock;
+    legacy.close();
+    if (!complete || !lock.isLocked()) {
+        app->log("UploadQueue: Legacy queue migration interrupted, retrying on next boot");
+        return;
+    }
+    // Without the progress file a retry only checks the log, so it goes first
+    FileSystem::card().remove(UPLOAD_QUEUE_MIGRATION_FILE);
+    FileSystem::card().remove(UPLOAD_QUEUE_LEGACY_FILE);
+    app->log("UploadQueue: Migrated " + String(migrated) + " file(s) from the legacy queue");
+}
@@ -0,0 +1,279 @@
+/**
+ * @file UploadQueue.h
+ * @brief Persistent FIFO of recordings waiting for upload
+ *
+ * The queue is an append-only log of fixed-size, CRC-protected records
+ * (UPLOAD_QUEUE_FILE) plus a small head file (UPLOAD_QUEUE_HEAD_FILE) that
+ * stores the index of the first pending record. The head file holds two
+ * alternating slots with a sequence number, so a torn write always leaves
+ * the previous head intact. Push, peek and pop touch a single record and
+ * head and tail are cached in RAM, so all three are O(1) in SD I/O.
+ *
+ * Entries acknowledged out of order are overwritten in place with a
+ * tombstone, which is skipped like a torn record and dropped on compaction.
+ *
+ * Once the consumed prefix grows past UPLOAD_QUEUE_COMPACT_RECORDS and past
+ * the pending part, the pending records are copied into a new log of the
+ * next generation. Each copy is paid for by at least as many pops, so pops
+ * stay O(1) amortised however long the backlog is. The
+ * generation stored in both files tells init() whether the head belongs
+ * to the current log, so a reset at any point neither loses nor repeats
+ * entries.
+ */
+
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+#include "Application.h"
+
+// On-card layout
+#define UPLOAD_QUEUE_RECORD_SIZE 128
+#define UPLOAD_QUEUE_PATH_MAX (UPLOAD_QUEUE_RECORD_SIZE - 12)
+
+/**
+ * @brief Position of an incremental scan over the pending entries
+ */
+struct UploadQueueCursor {
+    uint32_t generation;  ///< Log generation the index belongs to
+    uint32_t index;       ///< Next record to read, 0 starts at the head
+};
+
+class UploadQueue {
+public:
+    /**
+     * @brief Open the queue, repair it after a reset and migrate a legacy text queue
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if the queue is usable, false otherwise
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Append a file to the end of the queue
+     * @param path Full path of the file
+     * @return true if the record was written, false otherwise
+     */
+    static bool push(const String& path);
+
+    /**
+     * @brief Get the file at the front of the queue
+     * @return File path, or empty string if the queue is empty
+     */
+    static String peek();
+
+    /**
+     * @brief Remove the file at the front of the queue
+     * @return true if an entry was removed and the new head persisted, false otherwise
+     */
+    static bool pop();
+
+    /**
+     * @brief Get several files from the front of the queue
+     * @param paths Receives up to maxCount file paths
+     * @param ids Receives the entry id of each path, for remove()
+     * @param maxCount Capacity of paths and ids
+     * @return Number of entries returned
+     */
+    static size_t peekBatch(String* paths, uint32_t* ids, size_t maxCount);
+
+    /**
+     * @brief Remove an entry returned by peekBatch(), wherever it is in the queue
+     *
+     * Ids stay valid until the next peekBatch() or pop(), which may compact the log.
+     * @param id Entry id
+     * @return true if the entry was removed, false otherwise
+     */
+    static bool remove(uint32_t id);
+
+    /**
+     * @brief Check if the queue has no pending entries
+     * @return true if the queue is empty, false otherwise
+     */
+    static bool isEmpty();
+
+    /**
+     * @brief Get the number of pending entries
+     * @return Pending entry count, removed entries and damaged records are not counted
+     */
+    static uint32_t size();
+
+    /**
+     * @brief Check if a file is pending (scans the pending records)
+     * @param path Full path of the file
+     * @return true if the file is queued, false otherwise
+     */
+    static bool contains(const String& path);
+
+    /**
+     * @brief Read the next pending entries of an incremental scan
+     *
+     * A cursor with index 0, or one of an older generation because the log
+     * was compacted meanwhile, restarts at the head and takes the current
+     * generation, so callers compare it to tell a restart.
+     * @param cursor Scan position, advanced past the records read
+     * @param paths Receives up to maxCount file paths
+     * @param ids Receives the entry id of each path, for discard()
+     * @param maxCount Capacity of paths and ids
+     * @return Number of entries returned, 0 once the scan reached the tail
+     */
+    static size_t scanPending(UploadQueueCursor& cursor, String* paths, uint32_t* ids, size_t maxCount);
+
+    /**
+     * @brief Remove an entry found by scanPending() if it still holds that path
+     * @param id Entry id
+     * @param path Path the entry must hold
+     * @return true if the entry was removed, false if it changed or is gone
+     */
+    static bool discard(uint32_t id, const String& path);
+
+    /**
+     * @brief Check if an entry found by scanPending() still holds that path
+     * @param id Entry id
+     * @param path Path the entry must hold
+     * @return true if the entry is pending with that path, false if it changed or is gone
+     */
+    static bool holds(uint32_t id, const String& path);
+
+    /**
+     * @brief Get the log generation, a compaction renumbers the entries and moves to the next one
+     * @return Current generation
+     */
+    static uint32_t getGeneration() { return generation; }
+
+    /**
+     * @brief Get the number of records copied by compactions since boot
+     * @return Copied record count
+     */
+    static uint32_t getCompactedRecords() { return compactedRecords; }
+
+private:
+    // Private constructor for static-only class
+    UploadQueue() = default;
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+    /**
+     * @brief One queue entry as stored on the card
+     */
+    struct Record {
+        uint32_t magic;                   ///< Entry or log header magic
+        uint16_t length;                  ///< Payload length in bytes
+        uint16_t flags;                   ///< Reserved, 0
+        char path[UPLOAD_QUEUE_PATH_MAX]; ///< Zero padded payload, the file path of an entry
+        uint32_t crc;                     ///< CRC32 of all preceding bytes
+    };
+
+    /**
+     * @brief One slot of the head file
+     */
+    struct HeadSlot {
+        uint32_t magic;      ///< UPLOAD_QUEUE_HEAD_MAGIC
+        uint32_t sequence;   ///< Incremented on every write, the newer valid slot wins
+        uint32_t generation; ///< Log generation the head belongs to
+        uint32_t head;       ///< Index of the first pending record
+        uint32_t crc;        ///< CRC32 of all preceding bytes
+    };
+
+    // The helpers below expect the caller to hold the SD card mutex
+
+    /**
+     * @brief Read the newest valid head slot
+     * @param slot Receives the slot
+     * @return true if a valid slot was found, false otherwise
+     */
+    static bool loadHead(HeadSlot& slot);
+
+    /**
+     * @brief Persist the cached head into the older slot
+     * @return true if the slot was written, false otherwise
+     */
+    static bool storeHead();
+
+    /**
+     * @brief Read and validate a record
+     * @param file Open log file
+     * @param index Record index, 0 is the log header
+     * @param record Receives the record
+     * @return true if the record is intact, false otherwise
+     */
+    static bool readRecord(File& file, uint32_t index, Record& record);
+
+    /**
+     * @brief Fill a record with a payload and seal it with its CRC
+     * @param record Record to fill
+     * @param magic Record type
+     * @param data Payload, the path of an entry or the generation of a log header
+     * @param length Payload length in bytes
+     */
+    static void sealRecord(Record& record, uint32_t magic, const void* data, uint16_t length);
+
+    /**
+     * @brief Create a log containing only a header
+     * @param path File to create
+     * @param logGeneration Generation to store in the header
+     * @return true if the file was written, false otherwise
+     */
+    static bool createLog(const char* path, uint32_t logGeneration);
+
+    /**
+     * @brief Overwrite a record with a tombstone
+     * @param id Record index
+     * @return true if the tombstone was written, false otherwise
+     */
+    static bool writeTombstone(uint32_t id);
+
+    /**
+     * @brief Check if a record holds a pending entry
+     * @param id Record index
+     * @param path Path the entry must hold, nullptr for any
+     * @return true if the record is an intact entry, false if it is removed, torn or unreadable
+     */
+    static bool isLive(uint32_t id, const char* path = nullptr);
+
+    /**
+     * @brief Cut the log back to the cached tail after a short append
+     * @return true if the log ends at the tail, false otherwise
+     */
+    static bool repairTail();
+
+    // The helpers below take the SD card mutex themselves
+
+    /**
+     * @brief Consume the record at the head and persist the new head
+     * @return true if the head moved, false otherwise
+     */
+    static bool advanceHead();
+
+    /**
+     * @brief Compact the log once it is drained or its consumed prefix outweighs the pending records
+     */
+    static void compactIfNeeded();
+
+    /**
+     * @brief Rewrite the pending records into a log of the next generation
+     * @return true if the log was compacted, false otherwise
+     */
+    static bool compact();
+
+    /**
+     * @brief Import the entries of the old text queue file, resuming an interrupted migration
+     */
+    static void migrateLegacyQueue();
+
+    static bool initialized;
+    static Application* app;
+
+    // Cached pointers, records [head, tail) are pending
+    static uint32_t head;
+    static uint32_t tail;
+    static uint32_t pending;     // Intact entries in [head, tail)
+    static bool tailDamaged;     // A short append left bytes past the tail
+    static uint32_t generation;
+    static uint32_t headSequence;
+    static uint32_t compactedRecords;
+};
+
+#endif // UPLOAD_QUEUE_H
@@ -0,0 +1,241 @@
+/**
+ * @file UploadScheduler.cpp
+ * @brief Implementation of the upload window scheduling
+ */
+
+#include <esp_attr.h>
+#include <time.h>
+
+#include "UploadScheduler.h"
+#include "Metrics.h"
+#include "PowerManager.h"
+#include "TimeManager.h"
+#include "UploadQueue.h"
+#include "WifiManager.h"
+
+// Epoch time the queue became non-empty, kept across deep sleep so the backlog age survives it
+RTC_DATA_ATTR static time_t backlogSince = 0;
+
+// Clock steps of this boot already applied to backlogSince
+static int64_t appliedClockStep = 0;
+
+// Guards the counters the upload task updates
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+bool UploadScheduler::initialized = false;
+Application* UploadScheduler::app = nullptr;
+TaskHandle_t UploadScheduler::schedulerTaskHandle = NULL;
+volatile bool UploadScheduler::windowOpen = false;
+TickType_t UploadScheduler::windowStart = 0;
+float UploadScheduler::windowStartVoltage = 0.0f;
+uint32_t UploadScheduler::windowStartFiles = 0;
+uint64_t UploadScheduler::windowStartBytes = 0;
+TickType_t UploadScheduler::nextWindowTime = 0;
+volatile uint32_t UploadScheduler::uploadedFiles = 0;
+volatile uint64_t UploadScheduler::uploadedBytes = 0;
+UploadSchedulerStats UploadScheduler::stats = {};
+
+static const char* policyName() {
+    switch (UPLOAD_POLICY) {
+        case UPLOAD_POLICY_IMMEDIATE: return "immediate";
+        case UPLOAD_POLICY_BACKLOG: return "backlog";
+        case UPLOAD_POLICY_CHARGING: return "charging";
+        default: return "unknown";
+    }
+}
+
+bool UploadScheduler::init(Application* appInstance) {
+    if (initialized) {
+        return true;
+    }
+
+    // Store Application instance if provided
+    if (appInstance != nullptr) {
+        app = appInstance;
+    } else if (app == nullptr) {
+        app = Application::getInstance();
+    }
+
+    // Files left from earlier sessions count as pending right away
+    if (!UploadQueue::isEmpty()) {
+        app->setWavFilesAvailable(true);
+    } else {
+        backlogSince = 0;
+    }
+
+    app->log("UploadScheduler initialized, policy: " + String(policyName()));
+    initialized = true;
+    return true;
+}
+
+bool UploadScheduler::startSchedulerTask() {
+    if (!initialized && !init()) {
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(
+        schedulerTask,
+        "UploadScheduler",
+        4096,
+        NULL,
+        1,
+        &schedulerTaskHandle,
+        0 // Run on Core 0
+    ) != pdPASS) {
+        app->log("Failed to create upload scheduler task!");
+        return false;
+    }
+
+    app->log("Upload scheduler task started");
+    return true;
+}
+
+TaskHandle_t UploadScheduler::getSchedulerTaskHandle() {
+    return schedulerTaskHandle;
+}
+
+bool UploadScheduler::isWindowOpen() {
+    return windowOpen;
+}
+
+void UploadScheduler::recordUpload(size_t files, size_t bytes) {
+    portENTER_CRITICAL(&statsLock);
+    uploadedFiles += files;
+    uploadedBytes += bytes;
+    portEXIT_CRITICAL(&statsLock);
+    Metrics::add(METRIC_UPLOAD_FILES, files);
+    Metrics::add(METRIC_UPLOAD_BYTES, bytes);
+}
+
+UploadSchedulerStats UploadScheduler::getStats() {
+    portENTER_CRITICAL(&statsLock);
+    UploadSchedulerStats copy = stats;
+    copy.uploadedFiles = uploadedFiles;
+    copy.uploadedBytes = uploadedBytes;
+    portEXIT_CRITICAL(&statsLock);
+    return copy;
+}
+
+void UploadScheduler::schedulerTask(void* parameter) {
+    while (true) {
+        // Track the backlog age across windows and deep sleep. A start taken before SNTP set
+        // the clock moves with it, or the age would jump by the correction.
+        int64_t clockStep = TimeManager::getClockStepMicros();
+        if (backlogSince != 0) {
+            backlogSince += (time_t)((clockStep - appliedClockStep) / 1000000);
+        }
+        appliedClockStep = clockStep;
+        
+        bool pending = app->hasWavFilesAvailable();
+        if (!pending) {
+            backlogSince = 0;
+        } else if (backlogSince == 0) {
+            backlogSince = time(nullptr);
+        }
+
+        if (!windowOpen) {
+            if (shouldOpenWindow()) {
+                openWindow();
+            } else if (!pending) {
+                // Nothing queued, sleep until a recording is added
+                xEventGroupWaitBits(app->getEventGroup(), EVENT_UPLOAD_PENDING, pdFALSE, pdTRUE, portMAX_DELAY);
+            } else {
+                // Files wait for the policy, re-evaluate as the backlog ages
+                vTaskDelay(pdMS_TO_TICKS(UPLOAD_SCHEDULER_INTERVAL));
+            }
+            continue;
+        }
+
+        // The radio is on anyway, so the window is watched at a short interval
+        if (!pending) {
+            closeWindow("queue drained");
+        } else if (!app->isBatteryOkForUpload()) {
+            closeWindow("battery low");
+        } else if (xTaskGetTickCount() - windowStart >= pdMS_TO_TICKS(UPLOAD_WINDOW_MAX_DURATION)) {
+            // The backend could not be reached or the backlog is too large, try again later
+            closeWindow("time limit");
+            nextWindowTime = xTaskGetTickCount() + pdMS_TO_TICKS(UPLOAD_WINDOW_RETRY_INTERVAL);
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+}
+
+bool UploadScheduler::shouldOpenWindow() {
+    if (!app->hasWavFilesAvailable() || !app->isBatteryOkForUpload()) {
+        return false;
+    }
+    if ((int32_t)(xTaskGetTickCount() - nextWindowTime) < 0) {
+        return false;
+    }
+
+    switch (UPLOAD_POLICY) {
+        case UPLOAD_POLICY_IMMEDIATE:
+            return true;
+        case UPLOAD_POLICY_BACKLOG:
+            return UploadQueue::size() >= UPLOAD_BACKLOG_MIN_FILES ||
+                   getBacklogAge() >= UPLOAD_BACKLOG_MAX_AGE * 60UL;
+        case UPLOAD_POLICY_CHARGING:
+            return PowerManager::getBatteryState().charging;
+        default:
+            return false;
+    }
+}
+
+uint32_t UploadScheduler::getBacklogAge() {
+    time_t now = time(nullptr);
+    if (backlogSince == 0 || now < backlogSince) {
+        return 0;
+    }
+    return (uint32_t)(now - backlogSince);
+}
+
+void UploadScheduler::openWindow() {
+    UploadSchedulerStats current = getStats();
+    windowStart = xTaskGetTickCount();
+    windowStartVoltage = app->getBatteryVoltage();
+    windowStartFiles = current.uploadedFiles;
+    windowStartBytes = current.uploadedBytes;
+    windowOpen = true;
+
+    portENTER_CRITICAL(&statsLock);
+    stats.windows++;
+    portEXIT_CRITICAL(&statsLock);
+
+    app->log("UploadScheduler: opening upload window (" + String(UploadQueue::size()) + " files queued, oldest " +
+             String(getBacklogAge() / 60) + " min)");
+    WifiManager::enable();
+}
+
+void UploadScheduler::closeWindow(const char* reason) {
+    WifiManager::disable();
+    windowOpen = false;
+
+    // Energy estimate of the radio: average battery voltage times the assumed radio current
+    uint32_t airtimeMs = (xTaskGetTickCount() - windowStart) * portTICK_PERIOD_MS;
+    float voltage = (windowStartVoltage + app->getBatteryVoltage()) / 2.0f;
+    float joules = voltage * (WIFI_ACTIVE_CURRENT_MA / 1000.0f) * (airtimeMs / 1000.0f);
+
+    portENTER_CRITICAL(&statsLock);
+    stats.airtimeMs += airtimeMs;
+    stats.energyJoules += joules;
+    portEXIT_CRITICAL(&statsLock);
+
+    UploadSchedulerStats current = getStats();
+    uint32_t files = current.uploadedFiles - windowStartFiles;
+    float megabytes = (current.uploadedBytes - windowStartBytes) / (1024.0f * 1024.0f);
+    float totalMegabytes = current.uploadedBytes / (1024.0f * 1024.0f);
+
+    String report = "UploadScheduler: window closed (" + String(reason) + ") after " +
+                    String(airtimeMs / 1000.0f, 1) + "s, " + String(files) + " files, " +
+                    String(megabytes, 2) + "MB, ~" + String(joules, 1) + "J";
+    if (megabytes > 0.0f) {
+        report += " (" + String(joules / megabytes, 1) + " J/MB, " +
+                  String(airtimeMs / 1000.0f / megabytes, 1) + " s/MB)";
+    }
+    if (totalMegabytes > 0.0f) {
+        report += ", " + String(policyName()) + " policy since boot: " +
+                  String(current.energyJoules / totalMegabytes, 1) + " J/MB over " + String(current.windows) + " windows";
+    }
+    app->log(report);
+}
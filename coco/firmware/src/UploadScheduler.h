@@ -0,0 +1,130 @@
+/**
+ * @file UploadScheduler.h
+ * @brief Decides when the radio is switched on to drain the upload queue
+ *
+ * The radio is only enabled for upload windows. A window opens when the
+ * configured UPLOAD_POLICY allows it and closes once the queue is drained
+ * or after UPLOAD_WINDOW_MAX_DURATION, then the radio is switched off again.
+ *
+ * - UPLOAD_POLICY_IMMEDIATE opens a window as soon as a file is queued.
+ * - UPLOAD_POLICY_BACKLOG waits for UPLOAD_BACKLOG_MIN_FILES files or until
+ *   the oldest one has waited UPLOAD_BACKLOG_MAX_AGE minutes.
+ * - UPLOAD_POLICY_CHARGING only uploads while the battery is charging.
+ *
+ * Every window reports its airtime and an energy estimate per uploaded MB
+ * (battery voltage from PowerManager times WIFI_ACTIVE_CURRENT_MA), so the
+ * policies can be compared on real recordings.
+ */
+
+#ifndef UPLOAD_SCHEDULER_H
+#define UPLOAD_SCHEDULER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "Application.h"
+
+/**
+ * @brief Totals of all upload windows since boot
+ */
+struct UploadSchedulerStats {
+    uint32_t windows;           ///< Windows opened
+    uint32_t airtimeMs;         ///< Time the radio was enabled
+    uint32_t uploadedFiles;     ///< Files acknowledged by the backend
+    uint64_t uploadedBytes;     ///< Bytes of those files
+    float energyJoules;         ///< Estimated radio energy
+};
+
+class UploadScheduler {
+public:
+    /**
+     * @brief Initialize the scheduler
+     * @param app Pointer to Application instance (uses singleton if nullptr)
+     * @return true if initialization was successful
+     */
+    static bool init(Application* app = nullptr);
+
+    /**
+     * @brief Start the scheduler task, which owns the radio from then on
+     * @return true if the task was created
+     */
+    static bool startSchedulerTask();
+
+    /**
+     * @brief Get the scheduler task handle
+     * @return Task handle, or NULL if the task is not running
+     */
+    static TaskHandle_t getSchedulerTaskHandle();
+
+    /**
+     * @brief Check if an upload window is open
+     * @return true while the radio is enabled for uploads
+     */
+    static bool isWindowOpen();
+
+    /**
+     * @brief Account files the backend acknowledged, called by the upload task
+     * @param files Number of files
+     * @param bytes Total size of those files
+     */
+    static void recordUpload(size_t files, size_t bytes);
+
+    /**
+     * @brief Get the totals of all windows since boot
+     * @return Copy of the statistics
+     */
+    static UploadSchedulerStats getStats();
+
+private:
+    // Private constructor for static-only class
+    UploadScheduler() = default;
+    UploadScheduler(const UploadScheduler&) = delete;
+    UploadScheduler& operator=(const UploadScheduler&) = delete;
+
+    static void schedulerTask(void* parameter);
+
+    /**
+     * @brief Evaluate the policy for the current backlog
+     * @return true if a window should open now
+     */
+    static bool shouldOpenWindow();
+
+    /**
+     * @brief Get how long the oldest queued file has waited
+     * @return Age in seconds, 0 if unknown or the queue is empty
+     */
+    static uint32_t getBacklogAge();
+
+    /**
+     * @brief Switch the radio on for uploads
+     */
+    static void openWindow();
+
+    /**
+     * @brief Switch the radio off and report the window
+     * @param reason Why the window closed, for the log
+     */
+    static void closeWindow(const char* reason);
+
+    static bool initialized;
+    static Application* app;
+    static TaskHandle_t schedulerTaskHandle;
+
+    // Current window
+    static volatile bool windowOpen;
+    static TickType_t windowStart;
+    static float windowStartVoltage;
+    static uint32_t windowStartFiles;
+    static uint64_t windowStartBytes;
+    static TickType_t nextWindowTime;
+
+    // Updated by the upload task
+    static volatile uint32_t uploadedFiles;
+    static volatile uint64_t uploadedBytes;
+
+    static UploadSchedulerStats stats;
+};
+
+#endif // UPLOAD_SCHEDULER_H
@@ -0,0 +1,356 @@
+/**
+ * @file UploadStream.cpp
+ * @brief Implementation of the streaming upload body and its reader task
+ */
+
+#include <algorithm>
+
+#include "UploadStream.h"
+#include "FileSystem.h"
+
+UploadStream::UploadStream()
+    : partCount(0), totalSize(0), inlineUsed(0), position(0), running(false), error(false), currentBlock(-1),
+      currentLength(0), currentOffset(0), readerPart(0), readerOffset(0), readerTaskHandle(nullptr),
+      commandQueue(NULL), freeQueue(NULL), filledQueue(NULL), deleteQueue(NULL),
+      deleteLock(portMUX_INITIALIZER_UNLOCKED), stoppedSemaphore(NULL) {
+    for (int i = 0; i < UPLOAD_STREAM_BLOCKS; i++) {
+        blocks[i] = nullptr;
+    }
+    for (int i = 0; i < UPLOAD_STREAM_DELETE_QUEUE_SIZE; i++) {
+        deleteSlots[i].path[0] = '\0';
+    }
+}
+
+bool UploadStream::begin() {
+    if (readerTaskHandle != nullptr) {
+        return true;
+    }
+
+    commandQueue = xQueueCreate(2, sizeof(bool));
+    freeQueue = xQueueCreate(UPLOAD_STREAM_BLOCKS, sizeof(int));
+    filledQueue = xQueueCreate(UPLOAD_STREAM_BLOCKS, sizeof(FilledBlock));
+    deleteQueue = xQueueCreate(UPLOAD_STREAM_DELETE_QUEUE_SIZE, sizeof(int));
+    stoppedSemaphore = xSemaphoreCreateBinary();
+    if (commandQueue == NULL || freeQueue == NULL || filledQueue == NULL || deleteQueue == NULL ||
+        stoppedSemaphore == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < UPLOAD_STREAM_BLOCKS; i++) {
+        blocks[i] = (uint8_t*)malloc(UPLOAD_STREAM_BLOCK_SIZE);
+        if (!blocks[i]) {
+            return false;
+        }
+        xQueueSend(freeQueue, &i, 0);
+    }
+
+    // Above the upload task, so a block is refilled as soon as the sender returns it
+    BaseType_t result = xTaskCreatePinnedToCore(
+        readerTaskFunction,
+        "UploadReader",
+        4096,
+        this,
+        2,
+        &readerTaskHandle,
+        0 // Core 0
+    );
+    return result == pdPASS;
+}
+
+void UploadStream::clear() {
+    stop();
+    for (size_t i = 0; i < partCount; i++) {
+        parts[i].path = "";
+    }
+    partCount = 0;
+    totalSize = 0;
+    inlineUsed = 0;
+    position = 0;
+    error = false;
+}
+
+bool UploadStream::addBytes(const uint8_t* data, size_t size) {
+    if (running || partCount >= UPLOAD_STREAM_MAX_PARTS || inlineUsed + size > UPLOAD_STREAM_INLINE_BYTES) {
+        return false;
+    }
+
+    memcpy(inlineData + inlineUsed, data, size);
+    parts[partCount].path = "";
+    parts[partCount].offset = inlineUsed;
+    parts[partCount].size = size;
+    partCount++;
+    inlineUsed += size;
+    totalSize += size;
+    return true;
+}
+
+bool UploadStream::addFile(const String& path, size_t size) {
+    if (running || partCount >= UPLOAD_STREAM_MAX_PARTS || path.length() == 0) {
+        return false;
+    }
+
+    parts[partCount].path = path;
+    parts[partCount].offset = 0;
+    parts[partCount].size = size;
+    partCount++;
+    totalSize += size;
+    return true;
+}
+
+size_t UploadStream::size() const {
+    return totalSize;
+}
+
+void UploadStream::rewind() {
+    stop();
+    position = 0;
+    error = false;
+    start();
+}
+
+bool UploadStream::hasError() const {
+    return error;
+}
+
+bool UploadStream::deleteLater(const String& path) {
+    if (readerTaskHandle == nullptr || path.length() > UPLOAD_QUEUE_PATH_MAX) {
+        return false;
+    }
+
+    // The path stays in its slot until deleted, so isDeletePending() can find it
+    int slot = -1;
+    portENTER_CRITICAL(&deleteLock);
+    for (int i = 0; i < UPLOAD_STREAM_DELETE_QUEUE_SIZE && slot < 0; i++) {
+        if (deleteSlots[i].path[0] == '\0') {
+            strncpy(deleteSlots[i].path, path.c_str(), sizeof(deleteSlots[i].path));
+            deleteSlots[i].path[sizeof(deleteSlots[i].path) - 1] = '\0';
+            slot = i;
+        }
+    }
+    portEXIT_CRITICAL(&deleteLock);
+    if (slot < 0) {
+        return false;
+    }
+
+    if (xQueueSend(deleteQueue, &slot, 0) != pdTRUE) {
+        releaseDeleteSlot(slot);
+        return false;
+    }
+    xTaskNotifyGive(readerTaskHandle);
+    return true;
+}
+
+bool UploadStream::hasPendingDeletes() const {
+    return deleteQueue != NULL && uxQueueMessagesWaiting(deleteQueue) > 0;
+}
+
+bool UploadStream::isDeletePending(const String& path) {
+    bool found = false;
+    portENTER_CRITICAL(&deleteLock);
+    for (int i = 0; i < UPLOAD_STREAM_DELETE_QUEUE_SIZE && !found; i++) {
+        found = deleteSlots[i].path[0] != '\0' && strcmp(deleteSlots[i].path, path.c_str()) == 0;
+    }
+    portEXIT_CRITICAL(&deleteLock);
+    return found;
+}
+
+void UploadStream::releaseDeleteSlot(int slot) {
+    portENTER_CRITICAL(&deleteLock);
+    deleteSlots[slot].path[0] = '\0';
+    portEXIT_CRITICAL(&deleteLock);
+}
+
+int UploadStream::available() {
+    if (error) {
+        return -1;
+    }
+    return (int)(totalSize - position);
+}
+
+int UploadStream::read() {
+    if (!acquireBlock()) {
+        return -1;
+    }
+    position++;
+    return blocks[currentBlock][currentOffset++];
+}
+
+int UploadStream::peek() {
+    if (!acquireBlock()) {
+        return -1;
+    }
+    return blocks[currentBlock][currentOffset];
+}
+
+size_t UploadStream::readBytes(char* buffer, size_t length) {
+    size_t copied = 0;
+    while (copied < length && acquireBlock()) {
+        size_t count = std::min(length - copied, currentLength - currentOffset);
+        memcpy(buffer + copied, blocks[currentBlock] + currentOffset, count);
+        currentOffset += count;
+        position += count;
+        copied += count;
+    }
+    return copied;
+}
+
+bool UploadStream::acquireBlock() {
+    if (currentBlock >= 0) {
+        if (currentOffset < currentLength) {
+            return true;
+        }
+        releaseBlock(currentBlock);
+        currentBlock = -1;
+    }
+    if (error || position >= totalSize || readerTaskHandle == nullptr) {
+        return false;
+    }
+    if (!running) {
+        start();
+    }
+
+    FilledBlock filled;
+    if (xQueueReceive(filledQueue, &filled, pdMS_TO_TICKS(HTTP_TIMEOUT)) != pdTRUE) {
+        error = true;
+        return false;
+    }
+    if (filled.error) {
+        releaseBlock(filled.index);
+        error = true;
+        return false;
+    }
+
+    currentBlock = filled.index;
+    currentLength = filled.length;
+    currentOffset = 0;
+    return true;
+}
+
+void UploadStream::releaseBlock(int index) {
+    xQueueSend(freeQueue, &index, 0);
+    xTaskNotifyGive(readerTaskHandle);
+}
+
+void UploadStream::start() {
+    bool run = true;
+    xQueueSend(commandQueue, &run, portMAX_DELAY);
+    xTaskNotifyGive(readerTaskHandle);
+    running = true;
+}
+
+void UploadStream::stop() {
+    if (readerTaskHandle == nullptr) {
+        return;
+    }
+
+    if (running) {
+        bool run = false;
+        xQueueSend(commandQueue, &run, portMAX_DELAY);
+        xTaskNotifyGive(readerTaskHandle);
+        xSemaphoreTake(stoppedSemaphore, portMAX_DELAY);
+        running = false;
+    }
+
+    // The reader is idle now, take back every block it filled
+    if (currentBlock >= 0) {
+        releaseBlock(currentBlock);
+        currentBlock = -1;
+    }
+    FilledBlock filled;
+    while (xQueueReceive(filledQueue, &filled, 0) == pdTRUE) {
+        releaseBlock(filled.index);
+    }
+}
+
+void UploadStream::readerTaskFunction(void* parameter) {
+    UploadStream* stream = static_cast<UploadStream*>(parameter);
+    bool reading = false;
+    SDScheduler::setTaskPriority(SD_PRIORITY_UPLOAD);
+
+    while (true) {
+        bool progressed = false;
+
+        // Commands restart or stop the body, always at a block boundary
+        bool run;
+        while (xQueueReceive(stream->commandQueue, &run, 0) == pdTRUE) {
+            if (stream->readerFile) {
+                SDLockGuard lock;
+                stream->readerFile.close();
+            }
+            stream->readerPart = 0;
+            stream->readerOffset = 0;
+            reading = run;
+            if (!run) {
+                xSemaphoreGive(stream->stoppedSemaphore);
+            }
+            progressed = true;
+        }
+
+        int index;
+        if (reading && xQueueReceive(stream->freeQueue, &index, 0) == pdTRUE) {
+            reading = stream->readNextBlock(index);
+            progressed = true;
+        }
+
+        // Deletions only run while the sender has data to send
+        int slot;
+        if (!reading || uxQueueMessagesWaiting(stream->filledQueue) > 0) {
+            // Dequeued only once deleted, so hasPendingDeletes() covers the running one
+            if (xQueuePeek(stream->deleteQueue, &slot, 0) == pdTRUE) {
+                FileSystem::deleteFile(stream->deleteSlots[slot].path);
+                stream->releaseDeleteSlot(slot);
+                xQueueReceive(stream->deleteQueue, &slot, 0);
+                progressed = true;
+            }
+        }
+
+        if (!progressed) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+bool UploadStream::readNextBlock(int index) {
+    FilledBlock filled = {index, 0, false};
+
+    while (readerPart < partCount) {
+        Part& part = parts[readerPart];
+        size_t remaining = part.size - readerOffset;
+        if (remaining == 0) {
+            if (readerFile) {
+                SDLockGuard lock;
+                readerFile.close();
+            }
+            readerPart++;
+            readerOffset = 0;
+            continue;
+        }
+
+        size_t count = std::min(remaining, (size_t)UPLOAD_STREAM_BLOCK_SIZE);
+        if (part.path.length() == 0) {
+            memcpy(blocks[index], inlineData + part.offset + readerOffset, count);
+        } else {
+            // Hold the card only for this block so recording is not blocked by the upload
+            SDLockGuard lock;
+            bool ok = lock.isLocked();
+            if (ok && !readerFile) {
+                readerFile = FileSystem::card().open(part.path, FILE_READ);
+                ok = readerFile && (readerOffset == 0 || readerFile.seek(readerOffset));
+            }
+            if (!ok || (size_t)readerFile.read(blocks[index], count) != count) {
+                filled.error = true;
+                xQueueSend(filledQueue, &filled, portMAX_DELAY);
+                return false;
+            }
+        }
+
+        readerOffset += count;
+        filled.length = count;
+        xQueueSend(filledQueue, &filled, portMAX_DELAY);
+        return true;
+    }
+
+    // Body complete, the block was not needed
+    xQueueSend(freeQueue, &index, 0);
+    return false;
+}
@@ -0,0 +1,212 @@
+/**
+ * @file UploadStream.h
+ * @brief Stream over a sequence of small memory parts and SD card files
+ *
+ * An upload body is described as a list of parts, either bytes copied into
+ * the stream (e.g. batch headers) or files on the SD card. HTTPClient reads
+ * the body through the Stream interface while it sends.
+ *
+ * A reader task fills UPLOAD_STREAM_BLOCKS blocks of UPLOAD_STREAM_BLOCK_SIZE
+ * ahead of the sender, so the next block is read from the card while the
+ * current one is on the air. The SD card is only held for each block
+ * read, so recording can keep writing while a large file is in flight, and
+ * memory use does not depend on the file size. The reader task also deletes
+ * uploaded files, so the upload task does not wait for the card between
+ * requests.
+ */
+
+#ifndef UPLOAD_STREAM_H
+#define UPLOAD_STREAM_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "UploadQueue.h"
+
+// Largest number of parts and inline bytes one stream can describe
+#define UPLOAD_STREAM_MAX_PARTS (2 * UPLOAD_BATCH_MAX_FILES + 1)
+#define UPLOAD_STREAM_INLINE_BYTES 1024
+
+// Uploaded files waiting for deletion by the reader task
+#define UPLOAD_STREAM_DELETE_QUEUE_SIZE (2 * UPLOAD_BATCH_MAX_FILES)
+
+class UploadStream : public Stream {
+public:
+    UploadStream();
+
+    /**
+     * @brief Allocate the blocks and start the reader task
+     * @return true if the stream is ready, false otherwise
+     */
+    bool begin();
+
+    /**
+     * @brief Stop reading and remove all parts
+     */
+    void clear();
+
+    /**
+     * @brief Append bytes to the body, they are copied into the stream
+     * @param data Bytes to append
+     * @param size Number of bytes
+     * @return true if the bytes fit, false otherwise
+     */
+    bool addBytes(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Append a file from the SD card to the body
+     * @param path Full path of the file
+     * @param size File size in bytes, the body length relies on it
+     * @return true if the part was added, false otherwise
+     */
+    bool addFile(const String& path, size_t size);
+
+    /**
+     * @brief Get the number of bytes the body will produce
+     * @return Body length in bytes
+     */
+    size_t size() const;
+
+    /**
+     * @brief Start reading the body from the beginning, e.g. for a retry
+     */
+    void rewind();
+
+    /**
+     * @brief Check if a file could not be read or was shorter than announced
+     * @return true if the body is incomplete
+     */
+    bool hasError() const;
+
+    /**
+     * @brief Let the reader task delete a file once it is idle between blocks
+     * @param path Full path of the file
+     * @return true if the deletion was queued, false if the queue is full
+     */
+    bool deleteLater(const String& path);
+
+    /**
+     * @brief Check if deletions queued with deleteLater() have not completed yet
+     * @return true if a deletion is queued or running
+     */
+    bool hasPendingDeletes() const;
+
+    /**
+     * @brief Check if a file waits for its deferred deletion
+     * @param path Full path of the file
+     * @return true if the deletion of that file is queued or running
+     */
+    bool isDeletePending(const String& path);
+
+    // Stream interface, available() returns -1 after an error to abort the send
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(char* buffer, size_t length) override;
+    size_t write(uint8_t) override { return 0; }
+    void flush() override {}
+
+private:
+    UploadStream(const UploadStream&) = delete;
+    UploadStream& operator=(const UploadStream&) = delete;
+
+    /**
+     * @brief One piece of the body
+     */
+    struct Part {
+        String path;    ///< File to read, empty for inline bytes
+        size_t offset;  ///< Start of inline bytes in inlineData
+        size_t size;    ///< Length of the part
+    };
+
+    /**
+     * @brief Block handed from the reader task to the sender
+     */
+    struct FilledBlock {
+        int index;      ///< Block index
+        size_t length;  ///< Valid bytes, 0 together with error
+        bool error;     ///< The read failed, the body is incomplete
+    };
+
+    /**
+     * @brief Path handed to the reader task for deletion, the queue carries the slot index
+     */
+    struct DeleteRequest {
+        char path[UPLOAD_QUEUE_PATH_MAX + 1];  ///< Empty while the slot is free
+    };
+
+    /**
+     * @brief Free a deletion slot once its file is deleted or the request was not queued
+     * @param slot Index into deleteSlots
+     */
+    void releaseDeleteSlot(int slot);
+
+    /**
+     * @brief Make sure a filled block is available to the sender
+     * @return true if data is available, false at the end or after an error
+     */
+    bool acquireBlock();
+
+    /**
+     * @brief Return a block to the reader task
+     * @param index Block index
+     */
+    void releaseBlock(int index);
+
+    /**
+     * @brief Ask the reader task to start reading from the beginning
+     */
+    void start();
+
+    /**
+     * @brief Stop the reader task and take back all blocks
+     */
+    void stop();
+
+    static void readerTaskFunction(void* parameter);
+
+    /**
+     * @brief Reader task side: fill one block with the next bytes of the body
+     * @param index Block index
+     * @return false once the body is complete or a read failed
+     */
+    bool readNextBlock(int index);
+
+    // Body description, only changed while the reader is stopped
+    Part parts[UPLOAD_STREAM_MAX_PARTS];
+    size_t partCount;
+    size_t totalSize;
+    uint8_t inlineData[UPLOAD_STREAM_INLINE_BYTES];
+    size_t inlineUsed;
+
+    // Sender side
+    size_t position;
+    bool running;
+    bool error;
+    int currentBlock;
+    size_t currentLength;
+    size_t currentOffset;
+
+    // Reader side
+    size_t readerPart;
+    size_t readerOffset;
+    File readerFile;
+
+    // Shared
+    uint8_t* blocks[UPLOAD_STREAM_BLOCKS];
+    TaskHandle_t readerTaskHandle;
+    QueueHandle_t commandQueue;
+    QueueHandle_t freeQueue;
+    QueueHandle_t filledQueue;
+    QueueHandle_t deleteQueue;
+    DeleteRequest deleteSlots[UPLOAD_STREAM_DELETE_QUEUE_SIZE];
+    portMUX_TYPE deleteLock;
+    SemaphoreHandle_t stoppedSemaphore;
+};
+
+#endif // UPLOAD_STREAM_H
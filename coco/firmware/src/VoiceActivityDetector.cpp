@@ -0,0 +1,99 @@
+/**
+ * @file VoiceActivityDetector.cpp
+ * @brief Implementation of the energy and zero-crossing voice activity detector
+ */
+
+#include <math.h>
+
+#include "VoiceActivityDetector.h"
+
+// Frames the hangover lasts
+#define VAD_HANGOVER_FRAMES ((VAD_HANGOVER_MS * SAMPLING_RATE / 1000) / VAD_FRAME_SAMPLES)
+
+VoiceActivityDetector::VoiceActivityDetector() {
+    reset();
+}
+
+void VoiceActivityDetector::reset() {
+    frameSum = 0;
+    frameSumSquares = 0;
+    frameCrossings = 0;
+    frameCount = 0;
+    previousSample = 0;
+    dcOffset = 0;
+    dcSeeded = false;
+    noiseFloor = VAD_ENERGY_THRESHOLD;
+    hangoverFrames = 0;
+}
+
+bool VoiceActivityDetector::process(const int16_t* samples, size_t count) {
+    bool voiced = false;
+
+    for (size_t i = 0; i < count; i++) {
+        int32_t sample = samples[i];
+        int32_t centered = sample - dcOffset;
+        frameSum += sample;
+        frameSumSquares += (uint64_t)((int64_t)sample * sample);
+
+        // Count sign changes around the DC level of the previous frames
+        if (frameCount > 0 && ((centered < 0) != (previousSample - dcOffset < 0))) {
+            frameCrossings++;
+        }
+        previousSample = samples[i];
+
+        if (++frameCount == VAD_FRAME_SAMPLES) {
+            voiced |= finishFrame();
+        }
+    }
+
+    return voiced || isVoiced();
+}
+
+bool VoiceActivityDetector::isVoiced() const {
+    return hangoverFrames > 0;
+}
+
+uint32_t VoiceActivityDetector::getNoiseFloor() const {
+    return noiseFloor;
+}
+
+bool VoiceActivityDetector::finishFrame() {
+    // Energy around the frame's own mean, so the microphone's DC offset does not count
+    int32_t mean = frameSum / (int32_t)frameCount;
+    int64_t variance = (int64_t)(frameSumSquares / frameCount) - (int64_t)mean * mean;
+    uint32_t rms = variance > 0 ? (uint32_t)sqrtf((float)variance) : 0;
+    uint32_t zcrPercent = frameCrossings * 100 / frameCount;
+    if (!dcSeeded) {
+        dcOffset = mean;
+        dcSeeded = true;
+    }
+
+    uint32_t threshold = noiseFloor * VAD_SNR_FACTOR;
+    if (threshold < VAD_ENERGY_THRESHOLD) {
+        threshold = VAD_ENERGY_THRESHOLD;
+    }
+    bool speech = rms >= threshold && zcrPercent <= VAD_MAX_ZCR_PERCENT;
+
+    if (speech) {
+        hangoverFrames = VAD_HANGOVER_FRAMES + 1;
+    } else {
+        // Follow the background quickly when it gets quieter, slowly when it gets louder
+        if (rms < noiseFloor) {
+            noiseFloor = (noiseFloor * 3 + rms) / 4;
+        } else {
+            noiseFloor += (rms - noiseFloor) / 64;
+        }
+        if (hangoverFrames > 0) {
+            hangoverFrames--;
+        }
+    }
+
+    // Track the DC offset, zero crossings are counted around it
+    dcOffset += (mean - dcOffset) / 8;
+
+    frameSum = 0;
+    frameSumSquares = 0;
+    frameCrossings = 0;
+    frameCount = 0;
+    return speech || hangoverFrames > 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file VoiceActivityDetector.h
+ * @brief Lightweight energy and zero-crossing voice activity detector
+ *
+ * The captured stream is cut into frames of VAD_FRAME_SAMPLES. A frame counts
+ * as speech when its energy is clearly above the tracked noise floor and its
+ * zero-crossing rate is low enough to rule out hiss. Speech is held for
+ * VAD_HANGOVER_MS after the last voiced frame so word gaps are not cut.
+ */
+
+#ifndef VOICE_ACTIVITY_DETECTOR_H
+#define VOICE_ACTIVITY_DETECTOR_H
+
+#include <Arduino.h>
+
+#include "config.h"
+
+class VoiceActivityDetector {
+public:
+    VoiceActivityDetector();
+
+    /**
+     * @brief Forget the noise floor and any partial frame, e.g. at session start
+     */
+    void reset();
+
+    /**
+     * @brief Analyze captured samples
+     * @param samples 16-bit mono samples
+     * @param count Number of samples
+     * @return true if any part of the input was speech (including hangover)
+     */
+    bool process(const int16_t* samples, size_t count);
+
+    /**
+     * @brief Check if the detector currently considers the stream to be speech
+     * @return true while a voiced frame or its hangover is active
+     */
+    bool isVoiced() const;
+
+    /**
+     * @brief Get the current noise floor estimate
+     * @return RMS amplitude of the background noise
+     */
+    uint32_t getNoiseFloor() const;
+
+private:
+    /**
+     * @brief Classify the frame accumulated so far and start a new one
+     * @return true if the frame was voiced or inside the hangover
+     */
+    bool finishFrame();
+
+    // Partial frame accumulators
+    int32_t frameSum;
+    uint64_t frameSumSquares;
+    uint32_t frameCrossings;
+    size_t frameCount;
+    int16_t previousSample;
+
+    // Detector state
+    int32_t dcOffset;
+    bool dcSeeded;
+    uint32_t noiseFloor;
+    uint32_t hangoverFrames;
+};
+
+#endif // VOICE_ACTIVITY_DETECTOR_H
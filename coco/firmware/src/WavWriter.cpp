@@ -0,0 +1,333 @@
+/**
+ * @file WavWriter.cpp
+ * @brief Implementation of the streaming WAV writer
+ */
+
+
+#include "WavWriter.h"
+#include "FileSystem.h"
+
+// Largest header recover() looks at to find the data chunk
+#define WAV_RECOVER_HEADER_MAX 128
+
+WavWriter::WavWriter()
+    : app(Application::getInstance()), encoder(AudioEncoder::create()), encodeBuffer(nullptr),
+      dataSize(0), unflushedBytes(0), reservedSize(0), startTime(0) {
+    if (!encoder->isPassthrough()) {
+        encodeBuffer = (uint8_t*)malloc(encoder->getMaxEncodedSize(WAV_ENCODE_SLICE));
+    }
+}
+
+WavWriter::~WavWriter() {
+    if (isOpen()) {
+        close();
+    }
+    free(encodeBuffer);
+    delete encoder;
+}
+
+bool WavWriter::open(const String& filePath, size_t expectedPcmBytes, int64_t fileStartTime) {
+    if (isOpen()) {
+        close();
+    }
+
+    if (!encoder->isPassthrough() && !encodeBuffer) {
+        app->log("ERROR: No encode buffer for " + String(encoder->getName()) + " WAV writer");
+        return false;
+    }
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for WAV open");
+        return false;
+    }
+
+    {
+        SDOpTimer timer(SD_OP_OPEN);
+        file = FileSystem::card().open(filePath, FILE_WRITE);
+    }
+    if (!file) {
+        app->log("ERROR: Failed to open WAV file for writing: " + filePath);
+        return false;
+    }
+
+    // Placeholder header, the sizes are filled in by close() or recover()
+    bool preallocate = AUDIO_WAV_PREALLOCATE && expectedPcmBytes > 0;
+    uint8_t header[WAV_RECOVER_HEADER_MAX];
+    size_t headerSize = getHeaderSize();
+    encoder->begin();
+    startTime = fileStartTime;
+    dataSize = 0;
+    buildHeader(header);
+    if (preallocate) {
+        // The data chunk closes the header, its size field marks the file as preallocated
+        uint32_t unknown = WAV_DATA_SIZE_UNKNOWN;
+        memcpy(header + headerSize - 4, &unknown, 4);
+    }
+    if (file.write(header, headerSize) != headerSize) {
+        app->log("ERROR: Failed to write WAV header: " + filePath);
+        file.close();
+        return false;
+    }
+
+    // Seeking past the end in write mode makes FAT allocate the clusters without writing them
+    reservedSize = 0;
+    if (preallocate) {
+        SDOpTimer timer(SD_OP_META);
+        size_t reserve = headerSize + encoder->getMaxEncodedSize(expectedPcmBytes);
+        if (file.seek(reserve) && file.seek(headerSize)) {
+            // Commit the chain to the directory entry, so a reset cannot leak it
+            file.flush();
+            reservedSize = reserve;
+        }
+    }
+
+    path = filePath;
+    unflushedBytes = 0;
+    return true;
+}
+
+bool WavWriter::append(const uint8_t* data, size_t size) {
+    if (!isOpen()) {
+        return false;
+    }
+
+    if (encoder->isPassthrough()) {
+        // Let the encoder count the samples, the payload is the input itself
+        encoder->encode(data, size, nullptr);
+        return writePayload(data, size);
+    }
+
+    // Encode in small slices; the codec work runs without holding the SD card mutex
+    bool complete = true;
+    while (size > 0 && complete) {
+        size_t slice = size < WAV_ENCODE_SLICE ? size : WAV_ENCODE_SLICE;
+        size_t encoded;
+        {
+            // Encode at full speed, so the CPU can drop back sooner
+            PowerLockGuard cpuLock(POWER_LOCK_CPU);
+            encoded = encoder->encode(data, slice, encodeBuffer);
+        }
+        if (encoded > 0) {
+            complete = writePayload(encodeBuffer, encoded);
+        }
+        data += slice;
+        size -= slice;
+    }
+    return complete;
+}
+
+bool WavWriter::writePayload(const uint8_t* data, size_t size) {
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for WAV append");
+        return false;
+    }
+
+    size_t offset = getHeaderSize() + dataSize;
+    bool complete;
+    {
+        SDOpTimer timer(SD_OP_WRITE);
+        complete = FileSystem::writeAligned(file, data, size, offset);
+    }
+    dataSize = offset - getHeaderSize();
+    unflushedBytes += size;
+
+    // Flush regularly so the directory entry keeps up with the data. After a
+    // brownout recover() can then only lose the last unflushed part.
+    if (unflushedBytes >= AUDIO_WAV_FLUSH_BYTES) {
+        SDOpTimer timer(SD_OP_SYNC);
+        // The size of a preallocated file says nothing, the header has to record the progress
+        if (reservedSize > 0 && !(patchHeader() && file.seek(offset))) {
+            complete = false;
+        }
+        file.flush();
+        unflushedBytes = 0;
+    }
+
+    if (!complete) {
+        app->log("ERROR: Failed to append audio to WAV file: " + path);
+    }
+    return complete;
+}
+
+bool WavWriter::close() {
+    if (!isOpen()) {
+        return false;
+    }
+
+    // Emit the last, partially filled codec block
+    if (!encoder->isPassthrough()) {
+        size_t encoded = encoder->finish(encodeBuffer);
+        if (encoded > 0) {
+            writePayload(encodeBuffer, encoded);
+        }
+    }
+
+    bool patched;
+    {
+        SDLockGuard lock;
+        if (!lock.isLocked()) {
+            app->log("ERROR: Failed to take SD card mutex for WAV close");
+            return false;
+        }
+
+        SDOpTimer timer(SD_OP_SYNC);
+        patched = patchHeader();
+        file.close();
+        
+        // Give the unused part of the reserve back to the card
+        size_t fileSize = getHeaderSize() + dataSize;
+        if (reservedSize > fileSize && !FileSystem::truncateFile(path, fileSize)) {
+            patched = false;
+        }
+        reservedSize = 0;
+    }
+
+    if (!patched) {
+        app->log("ERROR: Failed to finalize WAV header: " + path);
+    }
+    path = "";
+    return patched;
+}
+
+bool WavWriter::patchHeader() {
+    uint8_t header[WAV_RECOVER_HEADER_MAX];
+    size_t headerSize = getHeaderSize();
+    buildHeader(header);
+    return file.seek(0) && file.write(header, headerSize) == headerSize;
+}
+
+void WavWriter::buildHeader(uint8_t* header) const {
+    // Every codec header ends with the 8 byte header of the data chunk
+    size_t codecHeaderSize = encoder->getHeaderSize();
+    encoder->writeHeader(header, dataSize, encoder->getSampleFrames());
+    memmove(header + codecHeaderSize - 8 + WAV_TIME_CHUNK_SIZE, header + codecHeaderSize - 8, 8);
+
+    uint8_t* chunk = header + codecHeaderSize - 8;
+    uint32_t chunkBodySize = WAV_TIME_CHUNK_SIZE - 8;
+    memcpy(chunk, WAV_TIME_CHUNK_ID, 4);
+    memcpy(chunk + 4, &chunkBodySize, 4);
+    memcpy(chunk + 8, &startTime, 8);
+
+    uint32_t riffSize;
+    memcpy(&riffSize, header + 4, 4);
+    riffSize += WAV_TIME_CHUNK_SIZE;
+    memcpy(header + 4, &riffSize, 4);
+}
+
+bool WavWriter::isOpen() const {
+    return path.length() > 0;
+}
+
+const String& WavWriter::getPath() const {
+    return path;
+}
+
+size_t WavWriter::getDataSize() const {
+    return dataSize;
+}
+
+size_t WavWriter::getHeaderSize() const {
+    return encoder->getHeaderSize() + WAV_TIME_CHUNK_SIZE;
+}
+
+const AudioEncoder& WavWriter::getEncoder() const {
+    return *encoder;
+}
+
+bool WavWriter::recover(const String& filePath, size_t& recoveredSize) {
+    Application* app = Application::getInstance();
+    recoveredSize = 0;
+
+    SDLockGuard lock;
+    if (!lock.isLocked()) {
+        app->log("ERROR: Failed to take SD card mutex for WAV recovery");
+        return false;
+    }
+
+    if (!FileSystem::card().exists(filePath)) {
+        return false;
+    }
+
+    File target = FileSystem::card().open(filePath, "r+");
+    if (!target) {
+        app->log("ERROR: Failed to open WAV file for recovery: " + filePath);
+        return false;
+    }
+
+    uint8_t header[WAV_RECOVER_HEADER_MAX];
+    size_t fileSize = target.size();
+    size_t headerBytes = target.read(header, sizeof(header));
+
+    // Walk the chunks up to the start of the payload
+    uint16_t formatTag = 0;
+    uint16_t blockAlign = 0;
+    uint16_t samplesPerBlock = 0;
+    size_t factOffset = 0;
+    size_t dataOffset = 0;
+    if (headerBytes >= 12 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0) {
+        size_t pos = 12;
+        while (pos + 8 <= headerBytes) {
+            uint32_t chunkSize;
+            memcpy(&chunkSize, header + pos + 4, 4);
+            if (memcmp(header + pos, "fmt ", 4) == 0 && pos + 24 <= headerBytes) {
+                memcpy(&formatTag, header + pos + 8, 2);
+                memcpy(&blockAlign, header + pos + 20, 2);
+                if (chunkSize >= 20 && pos + 28 <= headerBytes) {
+                    memcpy(&samplesPerBlock, header + pos + 26, 2);
+                }
+            } else if (memcmp(header + pos, "fact", 4) == 0) {
+                factOffset = pos + 8;
+            } else if (memcmp(header + pos, "data", 4) == 0) {
+                dataOffset = pos + 8;
+                break;
+            }
+            pos += 8 + chunkSize;
+        }
+    }
+
+    // A preallocated file records its progress in the header, the rest of it is reserve
+    size_t payloadSize = fileSize > dataOffset ? fileSize - dataOffset : 0;
+    uint32_t headerDataSize = 0;
+    if (dataOffset > 0) {
+        memcpy(&headerDataSize, header + dataOffset - 4, 4);
+    }
+    if (headerDataSize == WAV_DATA_SIZE_UNKNOWN) {
+        payloadSize = 0;
+    } else if (headerDataSize > 0 && headerDataSize < payloadSize) {
+        payloadSize = headerDataSize;
+    }
+
+    if (dataOffset == 0 || blockAlign == 0 || payloadSize == 0) {
+        // Nothing but the placeholder header made it to the card
+        target.close();
+        FileSystem::card().remove(filePath);
+        return false;
+    }
+
+    // Drop a trailing partial sample or codec block
+    recoveredSize = payloadSize / blockAlign * blockAlign;
+    uint32_t frames = recoveredSize / blockAlign;
+    if (formatTag == WAV_FORMAT_IMA_ADPCM) {
+        frames *= samplesPerBlock;
+    }
+
+    uint32_t riffSize = dataOffset + recoveredSize - 8;
+    uint32_t dataSizeField = recoveredSize;
+    memcpy(header + 4, &riffSize, 4);
+    memcpy(header + dataOffset - 4, &dataSizeField, 4);
+    if (factOffset > 0) {
+        memcpy(header + factOffset, &frames, 4);
+    }
+    bool repaired = target.seek(0) && target.write(header, dataOffset) == dataOffset;
+    target.close();
+    if (repaired && dataOffset + recoveredSize < fileSize) {
+        repaired = FileSystem::truncateFile(filePath, dataOffset + recoveredSize);
+    }
+
+    if (!repaired) {
+        app->log("ERROR: Failed to rewrite WAV header during recovery: " + filePath);
+    }
+    return repaired && recoveredSize > 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file WavWriter.h
+ * @brief Streaming WAV writer for the SD card
+ *
+ * A WAV file is opened with a placeholder header when a segment starts,
+ * PCM blocks are encoded with the configured AudioEncoder and appended as
+ * they are captured, and the header sizes are rewritten when the segment is
+ * closed. Files that were cut short by a reset or brownout can be repaired
+ * at boot with recover().
+ *
+ * With AUDIO_WAV_PREALLOCATE the clusters of the expected segment size are
+ * allocated when the file is created, so appends do not extend the FAT
+ * chain. The header then starts with an unknown data size and is patched at
+ * every flush, which tells recover() how much of the file holds audio. The
+ * unused reserve is cut off when the file is closed or recovered.
+ *
+ * A "time" chunk in front of the data chunk records the wall-clock time of
+ * the first sample, so the backend can place every file on the timeline.
+ */
+
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "config.h"
+#include "Application.h"
+#include "AudioEncoder.h"
+
+// PCM bytes handed to the encoder at a time
+#define WAV_ENCODE_SLICE 2048
+
+// Data size of a preallocated file before its first flush
+#define WAV_DATA_SIZE_UNKNOWN 0xFFFFFFFF
+
+// Chunk with the start time of the file: int64 microseconds since the epoch (UTC), little-endian
+#define WAV_TIME_CHUNK_ID "time"
+#define WAV_TIME_CHUNK_SIZE 16   // Chunk header and body (bytes)
+
+class WavWriter {
+public:
+    WavWriter();
+    ~WavWriter();
+
+    /**
+     * @brief Create the file and write a placeholder header
+     * @param path File path
+     * @param expectedPcmBytes PCM bytes the file will probably receive, 0 disables preallocation
+     * @param startTime Wall-clock time of the first sample in microseconds since the epoch, 0 if unknown
+     * @return true if the file was created, false otherwise
+     */
+    bool open(const String& path, size_t expectedPcmBytes = 0, int64_t startTime = 0);
+
+    /**
+     * @brief Encode PCM data and append it to the open file
+     * @param data PCM samples
+     * @param size Number of bytes to append
+     * @return true if all bytes were written, false otherwise
+     */
+    bool append(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Rewrite the header with the final sizes and close the file
+     * @return true if the header was patched, false otherwise
+     */
+    bool close();
+
+    /**
+     * @brief Check if a file is currently open
+     * @return true if a file is open, false otherwise
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Get the path of the open file
+     * @return File path, or empty string if no file is open
+     */
+    const String& getPath() const;
+
+    /**
+     * @brief Get the number of encoded bytes written after the header so far
+     * @return Payload size in bytes
+     */
+    size_t getDataSize() const;
+
+    /**
+     * @brief Get the size of the header in front of the payload
+     * @return Header size in bytes, including the time chunk
+     */
+    size_t getHeaderSize() const;
+
+    /**
+     * @brief Get the encoder used for new files
+     * @return Encoder instance owned by the writer
+     */
+    const AudioEncoder& getEncoder() const;
+
+    /**
+     * @brief Repair the header of a WAV file that was not closed
+     *
+     * Works for any codec by walking the RIFF chunks, the payload is cut
+     * back to whole codec blocks.
+     * @param path File path
+     * @param dataSize Receives the recovered payload size
+     * @return true if the file holds audio and was repaired, false otherwise
+     */
+    static bool recover(const String& path, size_t& dataSize);
+
+private:
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    /**
+     * @brief Write encoded bytes at the end of the open file
+     * @param data Encoded data
+     * @param size Number of bytes
+     * @return true if all bytes were written, false otherwise
+     */
+    bool writePayload(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Rewrite the header with the current sizes, the caller must hold the SD card mutex
+     * @return true if the header was written, false otherwise
+     */
+    bool patchHeader();
+
+    /**
+     * @brief Write the codec header with the time chunk inserted in front of the data chunk
+     * @param header Destination, must hold getHeaderSize() bytes
+     */
+    void buildHeader(uint8_t* header) const;
+
+    Application* app;
+    AudioEncoder* encoder;
+    uint8_t* encodeBuffer;
+    File file;
+    String path;
+    size_t dataSize;
+    size_t unflushedBytes;
+    size_t reservedSize;
+    int64_t startTime;
+};
+
+#endif // WAV_WRITER_H
@@ -7,7 +7,14 @@
  * exponential backoff.
  */
 
+#include <esp_attr.h>
+#include <esp_rom_crc.h>
+
 #include "WifiManager.h"
+#include "Metrics.h"
+
+// Marks an initialized connection cache, RTC memory is random after power loss
+#define WIFI_CACHE_MAGIC 0x57494643  // "WIFC"
 
 // Initialize static members
 Application* WifiManager::app = nullptr;
@@ -15,6 +22,10 @@ TaskHandle_t WifiManager::wifiConnectionTaskHandle = nullptr;
 bool WifiManager::initialized = false;
 unsigned long WifiManager::currentScanInterval = MIN_SCAN_INTERVAL;
 unsigned long WifiManager::nextWifiScanTime = 0;
+unsigned long WifiManager::connectStartTime = 0;
+bool WifiManager::fastConnectAttempt = false;
+volatile bool WifiManager::radioEnabled = false;
+RTC_DATA_ATTR WifiManager::ConnectionCache WifiManager::cache;
 
 // Getter and setter implementations for state properties
 unsigned long WifiManager::getCurrentScanInterval() {
@@ -41,8 +52,8 @@ bool WifiManager::init(Application* application) {
         return false;
     }
     
-    // Initialize WiFi in station mode
-    WiFi.mode(WIFI_STA);
+    // The radio stays off until enable(), the upload scheduler decides when
+    WiFi.mode(WIFI_OFF);
     WiFi.setAutoReconnect(false);  // We'll handle reconnection ourselves
     
     // Register event handlers
@@ -87,18 +98,90 @@ int WifiManager::scanNetworks() {
     return WiFi.scanNetworks();
 }
 
-bool WifiManager::connect() {
+bool WifiManager::connect(const uint8_t* bssid, int32_t channel) {
     if (!initialized) {
         if (app) app->log("WifiManager not initialized!");
         return false;
     }
     
     app->log("Attempting to connect to: " + String(SS_ID));
-    WiFi.begin(SS_ID, PASSWORD);
+    connectStartTime = millis();
+    WiFi.begin(SS_ID, PASSWORD, channel, bssid);
     WiFi.setTxPower(WIFI_POWER_8_5dBm); // Highest: WIFI_POWER_19_5dBm, Lowest: WIFI_POWER_2dBm (logarithmic)
     return true;
 }
 
+bool WifiManager::enable() {
+    if (!initialized) {
+        if (app) app->log("WifiManager not initialized!");
+        return false;
+    }
+    
+    radioEnabled = true;
+    WiFi.mode(WIFI_STA);
+    currentScanInterval = MIN_SCAN_INTERVAL;
+    nextWifiScanTime = millis();
+    if (wifiConnectionTaskHandle != nullptr) {
+        return true;
+    }
+    return startConnectionTask();
+}
+
+void WifiManager::disable() {
+    radioEnabled = false;
+    deleteConnectionTask();
+    
+    // The disconnect event stops the backend tasks, and does not reconnect any more
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+    app->log("WiFi radio switched off");
+}
+
+bool WifiManager::isEnabled() {
+    return radioEnabled;
+}
+
+bool WifiManager::hasValidCache() {
+    return cache.magic == WIFI_CACHE_MAGIC &&
+           cache.crc == esp_rom_crc32_le(0, (const uint8_t*)&cache, offsetof(ConnectionCache, crc));
+}
+
+void WifiManager::storeCache() {
+    uint8_t* bssid = WiFi.BSSID();
+    if (bssid == nullptr) {
+        return;
+    }
+    
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = WIFI_CACHE_MAGIC;
+    memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = (uint32_t)WiFi.localIP();
+    cache.gateway = (uint32_t)WiFi.gatewayIP();
+    cache.subnet = (uint32_t)WiFi.subnetMask();
+    cache.dns = (uint32_t)WiFi.dnsIP();
+    cache.crc = esp_rom_crc32_le(0, (const uint8_t*)&cache, offsetof(ConnectionCache, crc));
+}
+
+void WifiManager::invalidateCache() {
+    cache.magic = 0;
+}
+
+bool WifiManager::connectCached() {
+    if (!WIFI_FAST_RECONNECT || !hasValidCache()) {
+        return false;
+    }
+    
+    // Reusing the lease also skips DHCP, the address stays ours until the lease expires
+    if (WIFI_FAST_RECONNECT_STATIC_IP && cache.ip != 0) {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    }
+    
+    app->log("Fast reconnect to cached access point on channel " + String(cache.channel));
+    fastConnectAttempt = true;
+    return connect(cache.bssid, cache.channel);
+}
+
 bool WifiManager::disconnect() {
     return WiFi.disconnect();
 }
@@ -126,6 +209,14 @@ void WifiManager::wifiConnectionTask(void *parameter) {
     bool connectionInProgress = false;
     unsigned long connectionStartTime = 0;
     const unsigned long CONNECTION_TIMEOUT = 15000; // 15 seconds timeout for connection attempts
+    unsigned long connectionTimeout = CONNECTION_TIMEOUT;
+    
+    // Skip the scan while the access point of the last connection is known
+    if (connectCached()) {
+        connectionInProgress = true;
+        connectionStartTime = millis();
+        connectionTimeout = WIFI_FAST_CONNECT_TIMEOUT;
+    }
 
     while (true) {
         unsigned long currentTime = millis();
@@ -138,8 +229,22 @@ void WifiManager::wifiConnectionTask(void *parameter) {
                 connectionInProgress = false;
                 setCurrentScanInterval(MIN_SCAN_INTERVAL);
             } 
+            // If the fast reconnect failed, the access point moved or is gone: scan right away
+            else if (fastConnectAttempt && currentTime - connectionStartTime > connectionTimeout) {
+                app->log("Fast reconnect failed after " + String(connectionTimeout) + "ms, falling back to scan");
+                fastConnectAttempt = false;
+                invalidateCache();
+                WiFi.disconnect();
+                if (WIFI_FAST_RECONNECT_STATIC_IP) {
+                    // Back to DHCP for the regular connection
+                    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+                }
+                connectionInProgress = false;
+                connectionTimeout = CONNECTION_TIMEOUT;
+                setNextWifiScanTime(currentTime);
+            }
             // If connection attempt has timed out
-            else if (currentTime - connectionStartTime > CONNECTION_TIMEOUT) {
+            else if (currentTime - connectionStartTime > connectionTimeout) {
                 app->log("WiFi connection attempt timed out after " + 
                                String(CONNECTION_TIMEOUT/1000) + " seconds");
                 connectionInProgress = false;
@@ -151,8 +256,10 @@ void WifiManager::wifiConnectionTask(void *parameter) {
             } 
             // Still waiting for connection
             else {
-                // Wait and continue the loop without scanning
-                vTaskDelay(pdMS_TO_TICKS(1000));
+                // Wait for the got-IP handler or the timeout, without scanning
+                unsigned long remaining = connectionTimeout - (currentTime - connectionStartTime);
+                xEventGroupWaitBits(app->getEventGroup(), EVENT_WIFI_CONNECTED, pdFALSE, pdTRUE,
+                                    pdMS_TO_TICKS(remaining + 1));
                 continue;
             }
         }
@@ -212,7 +319,15 @@ void WifiManager::wifiConnectionTask(void *parameter) {
             setCurrentScanInterval(MIN_SCAN_INTERVAL);
         }
         
-        vTaskDelay(pdMS_TO_TICKS(1000)); // Check again after a delay
+        if (app->isWifiConnected()) {
+            vTaskDelay(pdMS_TO_TICKS(1000)); // Check again after a delay
+        } else {
+            // Sleep until the next scan is due, a connection event wakes us early
+            unsigned long nextScan = getNextWifiScanTime();
+            unsigned long now = millis();
+            xEventGroupWaitBits(app->getEventGroup(), EVENT_WIFI_CONNECTED, pdFALSE, pdTRUE,
+                                pdMS_TO_TICKS(nextScan > now ? nextScan - now : 1));
+        }
     }
 }
 
@@ -233,6 +348,11 @@ void WifiManager::WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info) {
     if (!app) return;
     
     app->log("WiFi connected with IP: " + WiFi.localIP().toString());
+    Metrics::observe(METRIC_WIFI_TIME_TO_IP_MS, millis() - connectStartTime);
+    app->log("WiFi time-to-IP: " + String(millis() - connectStartTime) + "ms" +
+             (fastConnectAttempt ? " (fast reconnect)" : " (scan)") + ", " + String(millis()) + "ms since boot");
+    fastConnectAttempt = false;
+    storeCache();
     setCurrentScanInterval(MIN_SCAN_INTERVAL);
     app->setWifiConnected(true);
     
@@ -255,13 +375,6 @@ void WifiManager::WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info) {
             app->log("Failed to create NTP retry task");
         }
     }
-    
-    // Start backend reachability task now that we have a connection
-    if (app->startBackendReachabilityTask()) {
-        app->log("Backend reachability task started after WiFi connection");
-    } else {
-        app->log("Failed to start backend reachability task after WiFi connection");
-    }
 }
 
 void WifiManager::WiFiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
@@ -270,22 +383,15 @@ void WifiManager::WiFiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
     app->log("Disconnected from WiFi access point");
     app->setWifiConnected(false);
     
-    // Stop the backend reachability task since we lost WiFi
-    if (app->stopBackendReachabilityTask()) {
-        app->log("Backend reachability task stopped due to WiFi disconnection");
-    }
-    
-    // Stop the file upload task if it's running
-    if (app->stopFileUploadTask()) {
-        app->log("File upload task stopped due to WiFi disconnection");
-    }
+    // The upload task keeps running, the next connection starts with an unknown backend
+    app->resetBackendHealth();
     
     // Reset scan interval to minimum when disconnected to attempt reconnection faster
     setCurrentScanInterval(MIN_SCAN_INTERVAL);
     setNextWifiScanTime(millis() + MIN_SCAN_INTERVAL);
     
-    // Restart the WiFi connection task to handle reconnection
-    if (wifiConnectionTaskHandle == nullptr) {
+    // Restart the WiFi connection task to handle reconnection, unless the radio was switched off
+    if (radioEnabled && wifiConnectionTaskHandle == nullptr) {
         app->log("Restarting WiFi connection task");
         startConnectionTask();
     }
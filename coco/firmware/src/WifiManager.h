@@ -39,9 +39,28 @@ public:
     // Connection management methods
     /**
      * @brief Attempt to connect to the configured WiFi network
-     * @return True if connection attempt initiated, false otherwise
+     * @param bssid Access point to join directly, nullptr to let the driver search for SS_ID
+     * @param channel Channel of that access point, 0 if unknown
+     * @return True if the connection attempt was started, false otherwise
      */
-    static bool connect();
+    static bool connect(const uint8_t* bssid = nullptr, int32_t channel = 0);
+    
+    /**
+     * @brief Switch the radio on and start connecting
+     * @return True if the connection task is running, false otherwise
+     */
+    static bool enable();
+    
+    /**
+     * @brief Disconnect, switch the radio off and stop reconnecting
+     */
+    static void disable();
+    
+    /**
+     * @brief Check if the radio is enabled
+     * @return True between enable() and disable()
+     */
+    static bool isEnabled();
     
     /**
      * @brief Disconnect from the current WiFi network
@@ -144,12 +163,53 @@ private:
      */
     static void WiFiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info);
     
+    /**
+     * @brief Last good connection, kept in RTC memory across deep sleep
+     */
+    struct ConnectionCache {
+        uint32_t magic;     ///< WIFI_CACHE_MAGIC
+        uint8_t bssid[6];   ///< Access point the station was associated with
+        uint8_t channel;    ///< Channel of that access point
+        uint8_t reserved;   ///< Padding, 0
+        uint32_t ip;        ///< Address leased by DHCP
+        uint32_t gateway;   ///< Gateway of the lease
+        uint32_t subnet;    ///< Netmask of the lease
+        uint32_t dns;       ///< DNS server of the lease
+        uint32_t crc;       ///< CRC32 of all preceding bytes
+    };
+    
+    /**
+     * @brief Check if the RTC cache holds an intact connection
+     * @return True if the cache can be used, false otherwise
+     */
+    static bool hasValidCache();
+    
+    /**
+     * @brief Record the current connection in the RTC cache
+     */
+    static void storeCache();
+    
+    /**
+     * @brief Forget the cached connection, e.g. after a failed fast reconnect
+     */
+    static void invalidateCache();
+    
+    /**
+     * @brief Join the cached access point without scanning
+     * @return True if an attempt was started, false if there is no usable cache
+     */
+    static bool connectCached();
+    
     // Static state variables
     static Application* app;
     static TaskHandle_t wifiConnectionTaskHandle;
     static bool initialized;
     static unsigned long currentScanInterval;
     static unsigned long nextWifiScanTime;
+    static unsigned long connectStartTime;  // millis() of the last WiFi.begin, for time-to-IP
+    static bool fastConnectAttempt;         // The current attempt uses the RTC cache
+    static volatile bool radioEnabled;      // Reconnect after a disconnect
+    static ConnectionCache cache;
 };
 
 #endif // WIFI_MANAGER_H
@@ -9,6 +9,7 @@
 #include <freertos/semphr.h>
 #include <time.h>
 #include <esp_task_wdt.h>
+#include <driver/gpio.h>
 
 #include "config.h"  // Keep configuration header
 #include "secrets.h" // Keep secrets
@@ -34,9 +35,16 @@ void HandleInitError();
  **********************************/
 void IRAM_ATTR handleButtonPress() {
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-  // Start the timer if it is not already active.
-  if (xTimerIsTimerActive(buttonTimer) == pdFALSE) {
-    xTimerStartFromISR(buttonTimer, &xHigherPriorityTaskWoken);
+  // The pin is level triggered, the only type that also wakes the CPU from light sleep.
+  // Waiting for the opposite level next fires the interrupt once per press and release.
+  if (gpio_get_level((gpio_num_t)BUTTON_PIN) == 0) {
+    gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_HIGH_LEVEL);
+    // Start the timer if it is not already active.
+    if (xTimerIsTimerActive(buttonTimer) == pdFALSE) {
+      xTimerStartFromISR(buttonTimer, &xHigherPriorityTaskWoken);
+    }
+  } else {
+    gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_LOW_LEVEL);
   }
   portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
@@ -96,14 +104,14 @@ void setup() {
   // Initialize the application
   app = Application::getInstance();
   
-  // Set up the button pin
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
-  // Attach interrupt to the button pin
-  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), handleButtonPress, FALLING);
-
   // Create and set timer
   buttonTimer = xTimerCreate("ButtonTimer", pdMS_TO_TICKS(BUTTON_PRESS_TIME), pdFALSE, NULL, buttonTimerCallback);
 
+  // Set up the button pin
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+  // Attach interrupt to the button pin, a button held since the wake fires it right away
+  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), handleButtonPress, ONLOW);
+
   // Handle different wake-up scenarios
   handleWakeup();
 
@@ -0,0 +1,89 @@
+/**
+ * @file Arduino.h
+ * @brief Host implementation of the Arduino core for the native environment
+ *
+ * Like the ESP32 core, this also pulls in FreeRTOS and the ESP-IDF headers
+ * the firmware relies on without including them itself. Serial output is
+ * discarded unless COCO_NATIVE_SERIAL is set in the environment, so the
+ * firmware logs do not distort the measurements.
+ */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "WString.h"
+#include "Stream.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+using std::max;
+using std::min;
+
+template <typename T, typename L, typename H>
+inline T constrain(T value, L low, H high) {
+    return value < (T)low ? (T)low : (value > (T)high ? (T)high : value);
+}
+
+// Nominal clock matching esp_cpu_get_cycle_count(), which counts nanoseconds
+inline uint32_t getCpuFrequencyMhz() { return 1000; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline uint16_t analogReadMilliVolts(uint8_t) { return 0; }
+
+/**
+ * @brief Serial port writing to stdout when enabled
+ */
+class HardwareSerial {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t print(const String& value) { return write((const uint8_t*)value.c_str(), value.length()); }
+    size_t print(const char* value) { return write((const uint8_t*)value, strlen(value)); }
+    template <typename T>
+    size_t print(T value) { return print(String(value)); }
+    size_t println() { return print("\n"); }
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void flush() {}
+    explicit operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // NATIVE_ARDUINO_H
@@ -0,0 +1,76 @@
+/**
+ * @file ESP_I2S.h
+ * @brief Host implementation of the ESP32 I2S driver for the native environment
+ *
+ * There is no microphone on the host. A PDM receiver reads a synthetic
+ * signal instead: a 440 Hz tone that is on for one second and off for the
+ * next, over a DC offset and low noise, like speech in a quiet room. The
+ * samples are deterministic and continue across reads, so every run
+ * processes the same audio. Reads return at once; the capture path is not
+ * paced to the sample rate.
+ */
+
+#ifndef NATIVE_ESP_I2S_H
+#define NATIVE_ESP_I2S_H
+
+#include <Arduino.h>
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+} i2s_port_t;
+
+typedef enum {
+    I2S_MODE_STD,
+    I2S_MODE_TDM,
+    I2S_MODE_PDM_TX,
+    I2S_MODE_PDM_RX,
+} i2s_mode_t;
+
+typedef enum {
+    I2S_DATA_BIT_WIDTH_8BIT = 8,
+    I2S_DATA_BIT_WIDTH_16BIT = 16,
+    I2S_DATA_BIT_WIDTH_24BIT = 24,
+    I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef enum {
+    I2S_SLOT_MODE_MONO = 1,
+    I2S_SLOT_MODE_STEREO = 2,
+} i2s_slot_mode_t;
+
+class I2SClass : public Stream {
+public:
+    void setPinsPdmRx(int8_t clk, int8_t din0, int8_t din1 = -1, int8_t din2 = -1, int8_t din3 = -1) {}
+
+    /**
+     * @brief Start the receiver, only 16-bit mono PDM reception is available
+     */
+    bool begin(i2s_mode_t mode, uint32_t rate, i2s_data_bit_width_t bits, i2s_slot_mode_t slots,
+               int8_t slotMask = -1);
+    bool end();
+
+    /**
+     * @brief Read whole 16-bit samples of the synthetic signal
+     * @return Number of bytes read, 0 if the receiver is not running
+     */
+    size_t readBytes(char* buffer, size_t size) override;
+
+    esp_err_t lastError() const { return error; }
+
+    int available() override { return running ? AUDIO_BLOCK_BYTES : 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    static const int AUDIO_BLOCK_BYTES = 1024;
+
+    bool running = false;
+    uint32_t sampleRate = 0;
+    uint64_t position = 0;   // Samples produced since begin()
+    uint32_t noise = 12345;  // Noise generator state
+    esp_err_t error = ESP_OK;
+};
+
+#endif // NATIVE_ESP_I2S_H
@@ -0,0 +1,115 @@
+/**
+ * @file FS.h
+ * @brief Host implementation of the Arduino file system API
+ *
+ * Paths are relative to a root directory on the host, so a mounted card is
+ * one directory. Files are opened with the same stdio modes as the ESP32
+ * VFS: FILE_WRITE truncates, FILE_APPEND always writes at the end. Copies
+ * of a File share the open handle, and close() closes it for all of them.
+ */
+
+#ifndef NATIVE_FS_H
+#define NATIVE_FS_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+class File {
+public:
+    File(FileImplPtr impl = FileImplPtr()) : impl(impl) {}
+
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t print(const String& value) { return write((const uint8_t*)value.c_str(), value.length()); }
+    size_t print(const char* value) { return write((const uint8_t*)value, strlen(value)); }
+    size_t println(const String& value) { return print(value) + print("\n"); }
+    int available();
+    int read();
+    int peek();
+    size_t read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length) { return read((uint8_t*)buffer, length); }
+    String readString();
+    String readStringUntil(char terminator);
+    void flush();
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    explicit operator bool() const;
+    const char* path() const;
+    const char* name() const;
+    bool isDirectory() const;
+    File openNextFile(const char* mode = FILE_READ);
+    String getNextFileName(bool* isDir = nullptr);
+    void rewindDirectory();
+
+private:
+    FileImplPtr impl;
+};
+
+class FS {
+public:
+    File open(const char* path, const char* mode = FILE_READ, bool create = false);
+    File open(const String& path, const char* mode = FILE_READ, bool create = false) {
+        return open(path.c_str(), mode, create);
+    }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to);
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char* path);
+    bool mkdir(const String& path) { return mkdir(path.c_str()); }
+    bool rmdir(const char* path);
+    bool rmdir(const String& path) { return rmdir(path.c_str()); }
+
+    /**
+     * @brief Serve the file system from a host directory
+     * @param hostDirectory Existing directory that holds the files
+     * @param mountPoint VFS path the firmware uses for POSIX calls like truncate()
+     */
+    void mountAt(const char* hostDirectory, const char* mountPoint);
+    void unmount();
+    bool isMounted() const { return !root.empty(); }
+
+    /**
+     * @brief Map a VFS path below the mount point to the host
+     * @param vfsPath Path including the mount point
+     * @param hostPath Receives the host path
+     * @return true if the path is below the mount point
+     */
+    bool mapVfsPath(const char* vfsPath, std::string& hostPath) const;
+
+protected:
+    std::string hostPath(const char* path) const;
+
+    std::string root;
+    std::string vfsMountPoint;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif // NATIVE_FS_H
@@ -0,0 +1,96 @@
+/**
+ * @file HTTPClient.h
+ * @brief Host implementation of the ESP32 HTTP client for the native environment
+ *
+ * Requests are written to the WiFiClient like on the device, the request
+ * line and headers first and then the body, read from the payload stream
+ * in blocks of HTTP_TCP_BUFFER_SIZE. There is no server; every request is
+ * answered with the response set by nativeHttpSetResponse(), 200 with an
+ * empty JSON object by default.
+ */
+
+#ifndef NATIVE_HTTP_CLIENT_H
+#define NATIVE_HTTP_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTP_TCP_BUFFER_SIZE (1460)
+
+typedef enum {
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_CREATED = 201,
+    HTTP_CODE_NO_CONTENT = 204,
+    HTTP_CODE_BAD_REQUEST = 400,
+    HTTP_CODE_UNAUTHORIZED = 401,
+    HTTP_CODE_NOT_FOUND = 404,
+    HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+    HTTP_CODE_SERVICE_UNAVAILABLE = 503,
+} t_http_codes;
+
+class HTTPClient {
+public:
+    bool begin(WiFiClient& client, const String& url);
+    void end();
+
+    void setReuse(bool reuse) { this->reuse = reuse; }
+    void setTimeout(uint16_t timeout) { this->timeout = timeout; }
+    void setConnectTimeout(int32_t timeout) { connectTimeout = timeout; }
+
+    void addHeader(const String& name, const String& value);
+
+    int GET() { return sendRequest("GET"); }
+    int POST(const String& payload) { return sendRequest("POST", (uint8_t*)payload.c_str(), payload.length()); }
+
+    int sendRequest(const char* type, uint8_t* payload = nullptr, size_t size = 0);
+    int sendRequest(const char* type, Stream* stream, size_t size = 0);
+
+    String getString() { return responseBody; }
+    int getSize() { return responseBody.length(); }
+
+    static String errorToString(int error);
+
+private:
+    bool sendHeader(const char* type, size_t size);
+
+    WiFiClient* client = nullptr;
+    String host;
+    uint16_t port = 80;
+    String uri;
+    String headers;
+    String responseBody;
+    bool reuse = true;
+    uint16_t timeout = 5000;
+    int32_t connectTimeout = 5000;
+};
+
+/**
+ * @brief Set the answer to every following request
+ * @param code Status code, or a negative HTTPC_ERROR to fail the request
+ * @param body Response body
+ */
+void nativeHttpSetResponse(int code, const char* body = "{}");
+
+/**
+ * @brief Get the request line and headers of the last request, e.g. to check a header
+ */
+const String& nativeHttpLastHeaders();
+
+/**
+ * @brief Get the body bytes sent with the last request
+ */
+size_t nativeHttpLastBodySize();
+
+#endif // NATIVE_HTTP_CLIENT_H
@@ -0,0 +1,67 @@
+/**
+ * @file SD.h
+ * @brief SD card over SPI in the native environment
+ *
+ * Both card drivers serve the directory set with nativeSdSetRoot(), by
+ * default COCO_NATIVE_SD_ROOT or a fresh directory below /tmp. A card that
+ * was set absent with nativeSdSetPresent(false) fails to mount.
+ */
+
+#ifndef NATIVE_SD_H
+#define NATIVE_SD_H
+
+#include <FS.h>
+#include <SPI.h>
+
+typedef enum {
+    CARD_NONE,
+    CARD_MMC,
+    CARD_SD,
+    CARD_SDHC,
+    CARD_UNKNOWN
+} sdcard_type_t;
+
+namespace fs {
+
+class SDFS : public FS {
+public:
+    bool begin(uint8_t ssPin = 21, SPIClass& spi = SPI, uint32_t frequency = 4000000, const char* mountpoint = "/sd",
+               uint8_t maxFiles = 5, bool formatIfMountFailed = false);
+    void end() { unmount(); }
+    sdcard_type_t cardType() { return isMounted() ? CARD_SDHC : CARD_NONE; }
+    uint64_t cardSize();
+    uint64_t totalBytes() { return cardSize(); }
+    uint64_t usedBytes();
+};
+
+} // namespace fs
+
+extern fs::SDFS SD;
+
+/**
+ * @brief Get the host directory backing the card, created on the first call
+ */
+const char* nativeSdRoot();
+
+/**
+ * @brief Back the card with another host directory, takes effect at the next mount
+ */
+void nativeSdSetRoot(const char* directory);
+
+/**
+ * @brief Insert or remove the card, takes effect at the next mount
+ */
+void nativeSdSetPresent(bool present);
+
+/**
+ * @brief Delete every file on the card, like formatting it
+ */
+void nativeSdFormat();
+
+/**
+ * @brief Let the card take only this many more bytes, a write beyond is cut short
+ * @param bytes Bytes written before writes fail, negative for no limit
+ */
+void nativeSdSetWriteBudget(long bytes);
+
+#endif // NATIVE_SD_H
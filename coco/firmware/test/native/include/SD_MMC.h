@@ -0,0 +1,33 @@
+/**
+ * @file SD_MMC.h
+ * @brief SD card over SDMMC in the native environment, see SD.h
+ */
+
+#ifndef NATIVE_SD_MMC_H
+#define NATIVE_SD_MMC_H
+
+#include <SD.h>
+
+#define SDMMC_FREQ_DEFAULT 20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+
+namespace fs {
+
+class SDMMCFS : public FS {
+public:
+    bool setPins(int clk, int cmd, int d0) { return true; }
+    bool setPins(int clk, int cmd, int d0, int d1, int d2, int d3) { return true; }
+    bool begin(const char* mountpoint = "/sdcard", bool mode1bit = false, bool formatIfMountFailed = false,
+               int sdmmcFrequency = SDMMC_FREQ_DEFAULT, uint8_t maxOpenFiles = 5);
+    void end() { unmount(); }
+    sdcard_type_t cardType() { return isMounted() ? CARD_SDHC : CARD_NONE; }
+    uint64_t cardSize();
+    uint64_t totalBytes() { return cardSize(); }
+    uint64_t usedBytes();
+};
+
+} // namespace fs
+
+extern fs::SDMMCFS SD_MMC;
+
+#endif // NATIVE_SD_MMC_H
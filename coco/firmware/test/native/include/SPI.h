@@ -0,0 +1,19 @@
+/**
+ * @file SPI.h
+ * @brief SPI bus placeholder, the native SD card needs no bus
+ */
+
+#ifndef NATIVE_SPI_H
+#define NATIVE_SPI_H
+
+#include <stdint.h>
+
+class SPIClass {
+public:
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+    void end() {}
+};
+
+extern SPIClass SPI;
+
+#endif // NATIVE_SPI_H
@@ -0,0 +1,51 @@
+/**
+ * @file Stream.h
+ * @brief Host implementation of the Arduino Print and Stream interfaces
+ */
+
+#ifndef NATIVE_STREAM_H
+#define NATIVE_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print {
+public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t written = 0;
+        while (written < size && write(buffer[written])) {
+            written++;
+        }
+        return written;
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    /**
+     * @brief Read up to length bytes, stops at the first byte that is not available
+     */
+    virtual size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        int value;
+        while (count < length && (value = read()) >= 0) {
+            buffer[count++] = (char)value;
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+
+protected:
+    unsigned long timeout = 1000;
+};
+
+#endif // NATIVE_STREAM_H
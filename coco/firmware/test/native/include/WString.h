@@ -0,0 +1,102 @@
+/**
+ * @file WString.h
+ * @brief Host implementation of the Arduino String for the native environment
+ *
+ * Covers the part of the Arduino API the firmware modules use, with the
+ * same semantics: indices are 0-based, failed searches return -1 and
+ * substring() clamps its bounds.
+ */
+
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+class String {
+public:
+    String() = default;
+    String(const char* value) : data(value ? value : "") {}
+    explicit String(const std::string& value) : data(value) {}
+    String(char value) : data(1, value) {}
+    String(int value, unsigned char base = 10);
+    String(unsigned int value, unsigned char base = 10);
+    String(long value, unsigned char base = 10);
+    String(unsigned long value, unsigned char base = 10);
+    String(long long value, unsigned char base = 10);
+    String(unsigned long long value, unsigned char base = 10);
+    String(float value, unsigned int decimalPlaces = 2);
+    String(double value, unsigned int decimalPlaces = 2);
+
+    const char* c_str() const { return data.c_str(); }
+    unsigned int length() const { return (unsigned int)data.length(); }
+    bool isEmpty() const { return data.empty(); }
+    bool reserve(unsigned int size) { data.reserve(size); return true; }
+
+    char charAt(unsigned int index) const { return index < data.length() ? data[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return data[index]; }
+
+    bool concat(const String& value) { data += value.data; return true; }
+    bool concat(const char* value) { if (value) data += value; return true; }
+    bool concat(char value) { data += value; return true; }
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+    bool concat(T value) { return concat(String(value)); }
+
+    String& operator+=(const String& value) { concat(value); return *this; }
+    String& operator+=(const char* value) { concat(value); return *this; }
+    String& operator+=(char value) { concat(value); return *this; }
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+    String& operator+=(T value) { concat(String(value)); return *this; }
+
+    bool equals(const String& other) const { return data == other.data; }
+    bool equals(const char* other) const { return data == (other ? other : ""); }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator==(const char* other) const { return equals(other); }
+    bool operator!=(const String& other) const { return !equals(other); }
+    bool operator!=(const char* other) const { return !equals(other); }
+    bool operator<(const String& other) const { return data < other.data; }
+    int compareTo(const String& other) const { return data.compare(other.data); }
+
+    bool startsWith(const String& prefix) const { return data.compare(0, prefix.data.length(), prefix.data) == 0; }
+    bool endsWith(const String& suffix) const {
+        return data.length() >= suffix.data.length() &&
+               data.compare(data.length() - suffix.data.length(), suffix.data.length(), suffix.data) == 0;
+    }
+
+    int indexOf(char value, unsigned int from = 0) const { return toIndex(data.find(value, from)); }
+    int indexOf(const String& value, unsigned int from = 0) const { return toIndex(data.find(value.data, from)); }
+    int lastIndexOf(char value) const { return toIndex(data.rfind(value)); }
+    int lastIndexOf(const String& value) const { return toIndex(data.rfind(value.data)); }
+
+    String substring(unsigned int from) const { return substring(from, length()); }
+    String substring(unsigned int from, unsigned int to) const;
+
+    void trim();
+    void toLowerCase();
+    void toUpperCase();
+    void replace(const String& find, const String& replacement);
+    void remove(unsigned int index) { if (index < data.length()) data.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < data.length()) data.erase(index, count); }
+
+    long toInt() const;
+    float toFloat() const;
+
+    explicit operator bool() const { return true; }
+
+private:
+    static int toIndex(size_t position) { return position == std::string::npos ? -1 : (int)position; }
+
+    std::string data;
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const String& lhs, const char* rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const char* lhs, const String& rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const String& lhs, char rhs) { String result(lhs); result += rhs; return result; }
+template <typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+inline String operator+(const String& lhs, T rhs) { String result(lhs); result += String(rhs); return result; }
+
+#endif // NATIVE_WSTRING_H
@@ -0,0 +1,52 @@
+/**
+ * @file WiFiClient.h
+ * @brief Host implementation of the ESP32 TCP client for the native environment
+ *
+ * The client talks to no network. A connection always succeeds, written
+ * bytes are counted and dropped, and nothing is ever received. HTTPClient
+ * answers requests itself, see nativeHttpSetResponse().
+ */
+
+#ifndef NATIVE_WIFI_CLIENT_H
+#define NATIVE_WIFI_CLIENT_H
+
+#include <Arduino.h>
+
+class WiFiClient : public Stream {
+public:
+    virtual ~WiFiClient() = default;
+
+    virtual int connect(const char* host, uint16_t port, int32_t timeout = 0) {
+        connectedFlag = true;
+        connections++;
+        return 1;
+    }
+    virtual uint8_t connected() { return connectedFlag; }
+    virtual void stop() { connectedFlag = false; }
+
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        if (!connectedFlag) {
+            return 0;
+        }
+        bytesWritten += size;
+        return size;
+    }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    explicit operator bool() { return connectedFlag; }
+
+    // Native only: traffic since the client was created
+    uint64_t getBytesWritten() const { return bytesWritten; }
+    uint32_t getConnectionCount() const { return connections; }
+
+private:
+    bool connectedFlag = false;
+    uint64_t bytesWritten = 0;
+    uint32_t connections = 0;
+};
+
+#endif // NATIVE_WIFI_CLIENT_H
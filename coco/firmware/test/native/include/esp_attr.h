@@ -0,0 +1,15 @@
+/**
+ * @file esp_attr.h
+ * @brief Placement attributes, without effect on the host
+ */
+
+#ifndef NATIVE_ESP_ATTR_H
+#define NATIVE_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_BSS_ATTR
+
+#endif // NATIVE_ESP_ATTR_H
@@ -0,0 +1,19 @@
+/**
+ * @file esp_cpu.h
+ * @brief Cycle counter of the native environment
+ *
+ * The host has no fixed clock, so one "cycle" is one nanosecond of a
+ * monotonic clock. Cycles per sample measured natively compare builds on
+ * the same machine, not with the ESP32-S3.
+ */
+
+#ifndef NATIVE_ESP_CPU_H
+#define NATIVE_ESP_CPU_H
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count();
+
+#endif // NATIVE_ESP_CPU_H
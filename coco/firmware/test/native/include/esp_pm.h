@@ -0,0 +1,17 @@
+/**
+ * @file esp_pm.h
+ * @brief Power management lock types, locks have no effect on the host
+ */
+
+#ifndef NATIVE_ESP_PM_H
+#define NATIVE_ESP_PM_H
+
+typedef struct esp_pm_lock* esp_pm_lock_handle_t;
+
+typedef enum {
+    ESP_PM_CPU_FREQ_MAX,
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_NO_LIGHT_SLEEP,
+} esp_pm_lock_type_t;
+
+#endif // NATIVE_ESP_PM_H
@@ -0,0 +1,16 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief CRC routines of the ESP32 ROM, implemented in software
+ */
+
+#ifndef NATIVE_ESP_ROM_CRC_H
+#define NATIVE_ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+/**
+ * @brief Update a little-endian CRC-32 (IEEE 802.3), crc 0 starts a new one
+ */
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif // NATIVE_ESP_ROM_CRC_H
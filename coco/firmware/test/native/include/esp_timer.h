@@ -0,0 +1,17 @@
+/**
+ * @file esp_timer.h
+ * @brief Microsecond clock of the native environment
+ */
+
+#ifndef NATIVE_ESP_TIMER_H
+#define NATIVE_ESP_TIMER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Get the time since the process started
+ * @return Microseconds from a monotonic clock
+ */
+int64_t esp_timer_get_time();
+
+#endif // NATIVE_ESP_TIMER_H
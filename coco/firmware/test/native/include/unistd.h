@@ -0,0 +1,18 @@
+/**
+ * @file unistd.h
+ * @brief POSIX header with truncate() mapped onto the native SD card
+ *
+ * The firmware truncates files through the VFS path of the SD mount point,
+ * which on the host is redirected into the directory backing the card.
+ */
+
+#ifndef NATIVE_UNISTD_H
+#define NATIVE_UNISTD_H
+
+#include_next <unistd.h>
+
+int nativeTruncate(const char* path, off_t length);
+
+#define truncate(path, length) nativeTruncate(path, length)
+
+#endif // NATIVE_UNISTD_H
@@ -0,0 +1,153 @@
+/**
+ * @file Arduino.cpp
+ * @brief Host implementation of the Arduino core for the native environment
+ */
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+static const auto bootTime = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static bool serialEnabled() {
+    static const bool enabled = getenv("COCO_NATIVE_SERIAL") != nullptr;
+    return enabled;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (serialEnabled()) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+}
+
+size_t HardwareSerial::printf(const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) {
+        return 0;
+    }
+    return write((const uint8_t*)line, std::min((size_t)length, sizeof(line) - 1));
+}
+
+// String
+
+static std::string formatInteger(unsigned long long value, bool negative, unsigned char base) {
+    if (base < 2 || base > 36) {
+        base = 10;
+    }
+    std::string digits;
+    do {
+        int digit = (int)(value % base);
+        digits.insert(digits.begin(), (char)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+        value /= base;
+    } while (value > 0);
+    if (negative) {
+        digits.insert(digits.begin(), '-');
+    }
+    return digits;
+}
+
+static std::string formatSigned(long long value, unsigned char base) {
+    // Like the Arduino core, only base 10 prints a sign
+    if (base == 10 && value < 0) {
+        return formatInteger(0ULL - (unsigned long long)value, true, base);
+    }
+    return formatInteger((unsigned long long)value, false, base);
+}
+
+String::String(int value, unsigned char base) : data(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : data(formatInteger(value, false, base)) {}
+String::String(long value, unsigned char base) : data(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : data(formatInteger(value, false, base)) {}
+String::String(long long value, unsigned char base) : data(formatSigned(value, base)) {}
+String::String(unsigned long long value, unsigned char base) : data(formatInteger(value, false, base)) {}
+
+String::String(float value, unsigned int decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned int decimalPlaces) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimalPlaces, value);
+    data = buffer;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+        std::swap(from, to);
+    }
+    if (from >= data.length()) {
+        return String();
+    }
+    to = std::min(to, (unsigned int)data.length());
+    return String(data.substr(from, to - from));
+}
+
+void String::trim() {
+    size_t start = data.find_first_not_of(" \t\r\n\f\v");
+    if (start == std::string::npos) {
+        data.clear();
+        return;
+    }
+    size_t end = data.find_last_not_of(" \t\r\n\f\v");
+    data = data.substr(start, end - start + 1);
+}
+
+void String::toLowerCase() {
+    for (char& c : data) {
+        c = (char)tolower((unsigned char)c);
+    }
+}
+
+void String::toUpperCase() {
+    for (char& c : data) {
+        c = (char)toupper((unsigned char)c);
+    }
+}
+
+void String::replace(const String& find, const String& replacement) {
+    if (find.data.empty()) {
+        return;
+    }
+    size_t position = 0;
+    while ((position = data.find(find.data, position)) != std::string::npos) {
+        data.replace(position, find.data.length(), replacement.data);
+        position += replacement.data.length();
+    }
+}
+
+long String::toInt() const {
+    return strtol(data.c_str(), nullptr, 10);
+}
+
+float String::toFloat() const {
+    return strtof(data.c_str(), nullptr);
+}
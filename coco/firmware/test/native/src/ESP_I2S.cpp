@@ -0,0 +1,45 @@
+/**
+ * @file ESP_I2S.cpp
+ * @brief Host implementation of the ESP32 I2S driver for the native environment
+ */
+
+#include <ESP_I2S.h>
+
+bool I2SClass::begin(i2s_mode_t mode, uint32_t rate, i2s_data_bit_width_t bits, i2s_slot_mode_t slots,
+                     int8_t slotMask) {
+    if (mode != I2S_MODE_PDM_RX || bits != I2S_DATA_BIT_WIDTH_16BIT || slots != I2S_SLOT_MODE_MONO || rate == 0) {
+        error = ESP_ERR_INVALID_ARG;
+        return false;
+    }
+    running = true;
+    sampleRate = rate;
+    position = 0;
+    noise = 12345;
+    error = ESP_OK;
+    return true;
+}
+
+bool I2SClass::end() {
+    running = false;
+    return true;
+}
+
+size_t I2SClass::readBytes(char* buffer, size_t size) {
+    if (!running) {
+        error = ESP_ERR_INVALID_STATE;
+        return 0;
+    }
+
+    int16_t* samples = (int16_t*)buffer;
+    size_t count = size / sizeof(int16_t);
+    for (size_t i = 0; i < count; i++, position++) {
+        noise = noise * 1664525 + 1013904223;
+        float sample = 1200.0f + (float)((int32_t)(noise >> 16) % 200);
+        // One second on, one second off
+        if ((position / sampleRate) % 2 == 0) {
+            sample += 4000.0f * sinf(2.0f * (float)M_PI * 440.0f * (float)(position % sampleRate) / sampleRate);
+        }
+        samples[i] = (int16_t)sample;
+    }
+    return count * sizeof(int16_t);
+}
@@ -0,0 +1,372 @@
+/**
+ * @file FS.cpp
+ * @brief Host implementation of the Arduino file system and SD card API
+ */
+
+#include <FS.h>
+#include <SD.h>
+#include <SD_MMC.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <filesystem>
+
+// The firmware's truncate() calls land here, the host call is needed below
+#undef truncate
+
+fs::SDFS SD;
+fs::SDMMCFS SD_MMC;
+SPIClass SPI;
+
+// Nominal card capacity reported to the firmware
+static const uint64_t NATIVE_SD_CAPACITY = 32ULL * 1024 * 1024 * 1024;
+
+static std::string sdRoot;
+static bool sdPresent = true;
+static long writeBudget = -1;
+
+namespace fs {
+
+class FileImpl {
+public:
+    FileImpl(const std::string& path, const std::string& host, FILE* file, DIR* dir)
+        : path(path), host(host), file(file), dir(dir) {
+        size_t slash = path.find_last_of('/');
+        name = slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+    ~FileImpl() { close(); }
+
+    void close() {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+        if (dir) {
+            closedir(dir);
+            dir = nullptr;
+        }
+    }
+
+    std::string path;   // Path on the card
+    std::string host;   // Path on the host
+    std::string name;   // Last path component
+    FILE* file;
+    DIR* dir;
+};
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (!impl || !impl->file) {
+        return 0;
+    }
+    if (writeBudget >= 0) {
+        size = std::min(size, (size_t)writeBudget);
+        writeBudget -= size;
+    }
+    return fwrite(buffer, 1, size, impl->file);
+}
+
+int File::available() {
+    if (!impl || !impl->file) {
+        return 0;
+    }
+    return (int)(size() - position());
+}
+
+int File::read() {
+    if (!impl || !impl->file) {
+        return -1;
+    }
+    int value = fgetc(impl->file);
+    return value == EOF ? -1 : value;
+}
+
+int File::peek() {
+    int value = read();
+    if (value >= 0) {
+        ungetc(value, impl->file);
+    }
+    return value;
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+    if (!impl || !impl->file) {
+        return 0;
+    }
+    return fread(buffer, 1, size, impl->file);
+}
+
+String File::readString() {
+    std::string text;
+    int value;
+    while ((value = read()) >= 0) {
+        text += (char)value;
+    }
+    return String(text);
+}
+
+String File::readStringUntil(char terminator) {
+    std::string text;
+    int value;
+    while ((value = read()) >= 0 && value != terminator) {
+        text += (char)value;
+    }
+    return String(text);
+}
+
+void File::flush() {
+    if (impl && impl->file) {
+        fflush(impl->file);
+    }
+}
+
+bool File::seek(uint32_t position, SeekMode mode) {
+    if (!impl || !impl->file) {
+        return false;
+    }
+    int whence = mode == SeekCur ? SEEK_CUR : (mode == SeekEnd ? SEEK_END : SEEK_SET);
+    return fseek(impl->file, (long)position, whence) == 0;
+}
+
+size_t File::position() const {
+    if (!impl || !impl->file) {
+        return 0;
+    }
+    long position = ftell(impl->file);
+    return position < 0 ? 0 : (size_t)position;
+}
+
+size_t File::size() const {
+    if (!impl || !impl->file) {
+        return 0;
+    }
+    // Buffered writes count, like on the VFS
+    fflush(impl->file);
+    struct stat info;
+    return fstat(fileno(impl->file), &info) == 0 ? (size_t)info.st_size : 0;
+}
+
+void File::close() {
+    if (impl) {
+        impl->close();
+        impl.reset();
+    }
+}
+
+File::operator bool() const {
+    return impl && (impl->file || impl->dir);
+}
+
+const char* File::path() const {
+    return impl ? impl->path.c_str() : nullptr;
+}
+
+const char* File::name() const {
+    return impl ? impl->name.c_str() : nullptr;
+}
+
+bool File::isDirectory() const {
+    return impl && impl->dir;
+}
+
+String File::getNextFileName(bool* isDir) {
+    if (!impl || !impl->dir) {
+        return String();
+    }
+    struct dirent* entry;
+    while ((entry = readdir(impl->dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        std::string child = impl->path == "/" ? "/" + std::string(entry->d_name)
+                                              : impl->path + "/" + entry->d_name;
+        if (isDir) {
+            struct stat info;
+            *isDir = stat((impl->host + "/" + entry->d_name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+        }
+        return String(child);
+    }
+    return String();
+}
+
+File File::openNextFile(const char* mode) {
+    if (!impl || !impl->dir) {
+        return File();
+    }
+    String next = getNextFileName();
+    if (next.isEmpty()) {
+        return File();
+    }
+    size_t slash = impl->path.length() + (impl->path == "/" ? 0 : 1);
+    std::string host = impl->host + "/" + std::string(next.c_str()).substr(slash);
+    struct stat info;
+    if (stat(host.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        return File(std::make_shared<FileImpl>(next.c_str(), host, nullptr, opendir(host.c_str())));
+    }
+    FILE* file = fopen(host.c_str(), mode);
+    return file ? File(std::make_shared<FileImpl>(next.c_str(), host, file, nullptr)) : File();
+}
+
+void File::rewindDirectory() {
+    if (impl && impl->dir) {
+        rewinddir(impl->dir);
+    }
+}
+
+File FS::open(const char* path, const char* mode, bool create) {
+    if (!isMounted() || path == nullptr || path[0] != '/') {
+        return File();
+    }
+    std::string host = hostPath(path);
+
+    struct stat info;
+    if (stat(host.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(host.c_str());
+        return dir ? File(std::make_shared<FileImpl>(path, host, nullptr, dir)) : File();
+    }
+    if (create && mode[0] != 'r') {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(host).parent_path(), error);
+    }
+    FILE* file = fopen(host.c_str(), mode);
+    return file ? File(std::make_shared<FileImpl>(path, host, file, nullptr)) : File();
+}
+
+bool FS::exists(const char* path) {
+    struct stat info;
+    return isMounted() && stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool FS::remove(const char* path) {
+    return isMounted() && unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char* from, const char* to) {
+    // FAT refuses to replace an existing file, unlike POSIX
+    if (!isMounted() || exists(to)) {
+        return false;
+    }
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+    return isMounted() && ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char* path) {
+    return isMounted() && ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+void FS::mountAt(const char* hostDirectory, const char* mountPoint) {
+    root = hostDirectory;
+    vfsMountPoint = mountPoint;
+}
+
+void FS::unmount() {
+    root.clear();
+    vfsMountPoint.clear();
+}
+
+bool FS::mapVfsPath(const char* vfsPath, std::string& host) const {
+    if (!isMounted() || strncmp(vfsPath, vfsMountPoint.c_str(), vfsMountPoint.length()) != 0 ||
+        vfsPath[vfsMountPoint.length()] != '/') {
+        return false;
+    }
+    host = hostPath(vfsPath + vfsMountPoint.length());
+    return true;
+}
+
+std::string FS::hostPath(const char* path) const {
+    return root + path;
+}
+
+static uint64_t usedBytesOnCard() {
+    uint64_t used = 0;
+    std::error_code error;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(nativeSdRoot(), error)) {
+        if (entry.is_regular_file(error)) {
+            used += entry.file_size(error);
+        }
+    }
+    return used;
+}
+
+bool SDFS::begin(uint8_t ssPin, SPIClass& spi, uint32_t frequency, const char* mountpoint, uint8_t maxFiles,
+                 bool formatIfMountFailed) {
+    if (!sdPresent) {
+        return false;
+    }
+    mountAt(nativeSdRoot(), mountpoint);
+    return true;
+}
+
+uint64_t SDFS::cardSize() {
+    return isMounted() ? NATIVE_SD_CAPACITY : 0;
+}
+
+uint64_t SDFS::usedBytes() {
+    return isMounted() ? usedBytesOnCard() : 0;
+}
+
+bool SDMMCFS::begin(const char* mountpoint, bool mode1bit, bool formatIfMountFailed, int sdmmcFrequency,
+                    uint8_t maxOpenFiles) {
+    if (!sdPresent) {
+        return false;
+    }
+    mountAt(nativeSdRoot(), mountpoint);
+    return true;
+}
+
+uint64_t SDMMCFS::cardSize() {
+    return isMounted() ? NATIVE_SD_CAPACITY : 0;
+}
+
+uint64_t SDMMCFS::usedBytes() {
+    return isMounted() ? usedBytesOnCard() : 0;
+}
+
+} // namespace fs
+
+const char* nativeSdRoot() {
+    if (sdRoot.empty()) {
+        const char* configured = getenv("COCO_NATIVE_SD_ROOT");
+        if (configured) {
+            std::error_code error;
+            std::filesystem::create_directories(configured, error);
+            sdRoot = configured;
+        } else {
+            char pattern[] = "/tmp/coco-sd-XXXXXX";
+            const char* created = mkdtemp(pattern);
+            sdRoot = created ? created : "/tmp";
+        }
+    }
+    return sdRoot.c_str();
+}
+
+void nativeSdSetRoot(const char* directory) {
+    sdRoot = directory;
+}
+
+void nativeSdSetPresent(bool present) {
+    sdPresent = present;
+}
+
+void nativeSdSetWriteBudget(long bytes) {
+    writeBudget = bytes;
+}
+
+void nativeSdFormat() {
+    std::error_code error;
+    for (auto& entry : std::filesystem::directory_iterator(nativeSdRoot(), error)) {
+        std::filesystem::remove_all(entry.path(), error);
+    }
+}
+
+int nativeTruncate(const char* path, off_t length) {
+    std::string host;
+    if (SD_MMC.mapVfsPath(path, host) || SD.mapVfsPath(path, host)) {
+        return truncate(host.c_str(), length);
+    }
+    return truncate(path, length);
+}
@@ -0,0 +1,141 @@
+/**
+ * @file HTTPClient.cpp
+ * @brief Host implementation of the ESP32 HTTP client for the native environment
+ */
+
+#include <HTTPClient.h>
+
+static int responseCode = HTTP_CODE_OK;
+static String responseBody = "{}";
+static String lastHeaders;
+static size_t lastBodySize = 0;
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+    int scheme = url.indexOf("://");
+    if (scheme < 0) {
+        return false;
+    }
+    String rest = url.substring(scheme + 3);
+    port = url.startsWith("https") ? 443 : 80;
+
+    int slash = rest.indexOf('/');
+    String authority = slash < 0 ? rest : rest.substring(0, slash);
+    uri = slash < 0 ? String("/") : rest.substring(slash);
+    int colon = authority.indexOf(':');
+    if (colon >= 0) {
+        port = (uint16_t)authority.substring(colon + 1).toInt();
+        authority = authority.substring(0, colon);
+    }
+    host = authority;
+    this->client = &client;
+    headers = "";
+    return true;
+}
+
+void HTTPClient::end() {
+    if (client && !reuse) {
+        client->stop();
+    }
+    headers = "";
+}
+
+void HTTPClient::addHeader(const String& name, const String& value) {
+    headers += name + ": " + value + "\r\n";
+}
+
+bool HTTPClient::sendHeader(const char* type, size_t size) {
+    if (!client) {
+        return false;
+    }
+    if (!client->connected() && !client->connect(host.c_str(), port, connectTimeout)) {
+        return false;
+    }
+    String request = String(type) + " " + uri + " HTTP/1.1\r\nHost: " + host + "\r\n" +
+                     (reuse ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    if (size > 0) {
+        request += "Content-Length: " + String((unsigned long)size) + "\r\n";
+    }
+    request += headers + "\r\n";
+    lastHeaders = request;
+    lastBodySize = 0;
+    return client->write((const uint8_t*)request.c_str(), request.length()) == request.length();
+}
+
+int HTTPClient::sendRequest(const char* type, uint8_t* payload, size_t size) {
+    if (!sendHeader(type, size)) {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+    if (payload && size > 0) {
+        if (client->write(payload, size) != size) {
+            return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+        }
+        lastBodySize = size;
+    }
+    this->responseBody = ::responseBody;
+    return responseCode;
+}
+
+int HTTPClient::sendRequest(const char* type, Stream* stream, size_t size) {
+    if (!stream) {
+        return HTTPC_ERROR_NO_STREAM;
+    }
+    if (!sendHeader(type, size)) {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+
+    // Like the ESP32 core: copy in TCP-sized blocks, a negative available() aborts
+    uint8_t buffer[HTTP_TCP_BUFFER_SIZE];
+    size_t remaining = size;
+    while (remaining > 0 && client->connected()) {
+        int available = stream->available();
+        if (available < 0) {
+            break;
+        }
+        if (available == 0) {
+            delay(1);
+            continue;
+        }
+        size_t chunk = std::min(std::min((size_t)available, sizeof(buffer)), remaining);
+        size_t read = stream->readBytes((char*)buffer, chunk);
+        if (read == 0 || client->write(buffer, read) != read) {
+            break;
+        }
+        remaining -= read;
+        lastBodySize += read;
+    }
+    if (remaining > 0) {
+        return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+    this->responseBody = ::responseBody;
+    return responseCode;
+}
+
+String HTTPClient::errorToString(int error) {
+    switch (error) {
+        case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+        case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+        case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return "send payload failed";
+        case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+        case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+        case HTTPC_ERROR_NO_STREAM: return "no stream";
+        case HTTPC_ERROR_NO_HTTP_SERVER: return "no HTTP server";
+        case HTTPC_ERROR_TOO_LESS_RAM: return "too less ram";
+        case HTTPC_ERROR_ENCODING: return "Transfer-Encoding not supported";
+        case HTTPC_ERROR_STREAM_WRITE: return "Stream write error";
+        case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+        default: return String();
+    }
+}
+
+void nativeHttpSetResponse(int code, const char* body) {
+    responseCode = code;
+    responseBody = body ? body : "";
+}
+
+const String& nativeHttpLastHeaders() {
+    return lastHeaders;
+}
+
+size_t nativeHttpLastBodySize() {
+    return lastBodySize;
+}
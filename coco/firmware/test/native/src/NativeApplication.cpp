@@ -0,0 +1,87 @@
+/**
+ * @file NativeApplication.cpp
+ * @brief Application and PowerManager members used by the natively built modules
+ *
+ * Application.cpp and PowerManager.cpp depend on WiFi, I2S and the ADC, so
+ * the native environment links these instead. The Application wrappers
+ * forward to the modules exactly like the firmware ones. Power locks and
+ * the battery have no equivalent on the host.
+ */
+
+#include "Application.h"
+#include "FileSystem.h"
+#include "LogManager.h"
+#include "PowerManager.h"
+
+Application* Application::instance = nullptr;
+
+Application* Application::getInstance() {
+    if (instance == nullptr) {
+        instance = new Application();
+    }
+    return instance;
+}
+
+Application::Application()
+    : recordingRequested(false),
+      externalWakeTriggered(false),
+      externalWakeValid(-1),
+      wavFilesAvailable(false),
+      bootSession(0),
+      audioFileIndex(0),
+      backendReachable(false),
+      uploadInProgress(false),
+      wifiConnected(false),
+      recordAudioTaskHandle(NULL),
+      audioFileTaskHandle(NULL),
+      wifiConnectionTaskHandle(NULL),
+      uploadTaskHandle(NULL),
+      batteryMonitorTaskHandle(NULL),
+      deepSleepTaskHandle(NULL),
+      stackMonitorTaskHandle(NULL) {
+    ledMutex = xSemaphoreCreateMutex();
+    httpMutex = xSemaphoreCreateMutex();
+    eventGroup = xEventGroupCreate();
+}
+
+int Application::getBootSession() const {
+    return bootSession;
+}
+
+EventGroupHandle_t Application::getEventGroup() const {
+    return eventGroup;
+}
+
+void Application::log(const String& message) {
+    LogManager::log(message);
+}
+
+bool Application::overwriteFile(const String& filename, const String& content) {
+    return FileSystem::overwriteFile(filename, content);
+}
+
+bool Application::appendFile(const String& filename, const FileSegment* segments, size_t segmentCount) {
+    return FileSystem::appendFile(filename, segments, segmentCount);
+}
+
+bool Application::getFileSize(const String& path, size_t& size) {
+    return FileSystem::getFileSize(path, size);
+}
+
+bool Application::deleteFile(const String& filename) {
+    return FileSystem::deleteFile(filename);
+}
+
+bool Application::renameFile(const String& from, const String& to) {
+    return FileSystem::renameFile(from, to);
+}
+
+void PowerManager::acquireLock(PowerLock lock) {
+}
+
+void PowerManager::releaseLock(PowerLock lock) {
+}
+
+float PowerManager::getBatteryVoltage() {
+    return 4.2f;
+}
@@ -0,0 +1,398 @@
+/**
+ * @file freertos.cpp
+ * @brief Host implementation of the FreeRTOS kernel API on std::thread
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Kernel objects are never freed, detached tasks may still use them while the process exits
+
+struct NativeTask {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifyValue = 0;
+};
+
+struct NativeSemaphore {
+    std::mutex mutex;
+    std::condition_variable available;
+    UBaseType_t count;
+    UBaseType_t maxCount;
+    bool recursive;
+    TaskHandle_t owner;
+    UBaseType_t depth;
+};
+
+struct NativeQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+};
+
+struct NativeEventGroup {
+    std::mutex mutex;
+    std::condition_variable changed;
+    EventBits_t bits;
+};
+
+// Thrown by vTaskDelete(NULL) to leave the task function, caught by the thread entry
+struct NativeTaskExit {};
+
+static std::atomic<UBaseType_t> taskCount{1};
+static thread_local TaskHandle_t currentTask = nullptr;
+static thread_local const char criticalOwner = 0;
+
+/**
+ * @brief Wait on a condition with a timeout in ticks
+ * @return true if the predicate holds
+ */
+template <typename Predicate>
+static bool waitTicks(std::condition_variable& condition, std::unique_lock<std::mutex>& lock, TickType_t ticks,
+                      Predicate predicate) {
+    if (ticks == portMAX_DELAY) {
+        condition.wait(lock, predicate);
+        return true;
+    }
+    return condition.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), predicate);
+}
+
+// Critical sections
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+    const void* self = &criticalOwner;
+    if (mux->owner.load(std::memory_order_acquire) == self) {
+        mux->count++;
+        return;
+    }
+    const void* expected = nullptr;
+    while (!mux->owner.compare_exchange_weak(expected, self, std::memory_order_acquire)) {
+        expected = nullptr;
+        std::this_thread::yield();
+    }
+    mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+    if (--mux->count == 0) {
+        mux->owner.store(nullptr, std::memory_order_release);
+    }
+}
+
+// Tasks
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    TaskHandle_t task = new NativeTask{ name ? name : "" };
+    if (handle) {
+        *handle = task;
+    }
+    taskCount++;
+    std::thread([function, parameter, task]() {
+        currentTask = task;
+        try {
+            function(parameter);
+        } catch (const NativeTaskExit&) {
+        }
+        taskCount--;
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameter,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // Threads cannot be stopped from outside, only the calling task ends
+    if (task == nullptr || task == xTaskGetCurrentTaskHandle()) {
+        throw NativeTaskExit();
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount() {
+    static const auto start = std::chrono::steady_clock::now();
+    return (TickType_t)(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count() / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (currentTask == nullptr) {
+        // A thread not created through xTaskCreate, i.e. the test runner
+        currentTask = new NativeTask{ "main" };
+    }
+    return currentTask;
+}
+
+const char* pcTaskGetName(TaskHandle_t task) {
+    return (task ? task : xTaskGetCurrentTaskHandle())->name.c_str();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks() {
+    return taskCount;
+}
+
+void taskYIELD() {
+    std::this_thread::yield();
+}
+
+// Task notifications, used as counting semaphores like the firmware does
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifyValue++;
+    }
+    task->notified.notify_all();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    waitTicks(task->notified, lock, ticks, [task]() { return task->notifyValue > 0; });
+    uint32_t value = task->notifyValue;
+    if (value > 0) {
+        task->notifyValue = clearCountOnExit ? 0 : value - 1;
+    }
+    return value;
+}
+
+// Semaphores
+
+static SemaphoreHandle_t createSemaphore(UBaseType_t maxCount, UBaseType_t initialCount, bool recursive) {
+    SemaphoreHandle_t semaphore = new NativeSemaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    semaphore->recursive = recursive;
+    semaphore->owner = nullptr;
+    semaphore->depth = 0;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return createSemaphore(1, 1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return createSemaphore(1, 1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return createSemaphore(1, 0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    return createSemaphore(maxCount, initialCount, false);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!waitTicks(semaphore->available, lock, ticks, [semaphore] { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    semaphore->owner = xTaskGetCurrentTaskHandle();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->maxCount) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->owner = nullptr;
+    semaphore->available.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    {
+        std::lock_guard<std::mutex> lock(semaphore->mutex);
+        if (semaphore->owner == self && semaphore->depth > 0) {
+            semaphore->depth++;
+            return pdTRUE;
+        }
+    }
+    if (xSemaphoreTake(semaphore, ticks) != pdTRUE) {
+        return pdFALSE;
+    }
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    semaphore->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    {
+        std::lock_guard<std::mutex> lock(semaphore->mutex);
+        if (semaphore->owner != xTaskGetCurrentTaskHandle() || semaphore->depth == 0) {
+            return pdFALSE;
+        }
+        if (--semaphore->depth > 0) {
+            return pdTRUE;
+        }
+    }
+    return xSemaphoreGive(semaphore);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    return semaphore->count;
+}
+
+// Queues
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    QueueHandle_t queue = new NativeQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticks, bool front) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitTicks(queue->changed, lock, ticks, [queue] { return queue->items.size() < queue->length; })) {
+        return errQUEUE_FULL;
+    }
+    const uint8_t* bytes = (const uint8_t*)item;
+    std::vector<uint8_t> copy(bytes, bytes + queue->itemSize);
+    if (front) {
+        queue->items.push_front(std::move(copy));
+    } else {
+        queue->items.push_back(std::move(copy));
+    }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, true);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void* item, TickType_t ticks, bool remove) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitTicks(queue->changed, lock, ticks, [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    if (remove) {
+        queue->items.pop_front();
+        queue->changed.notify_all();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->items.clear();
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return (UBaseType_t)queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->length - (UBaseType_t)queue->items.size();
+}
+
+// Event groups
+
+EventGroupHandle_t xEventGroupCreate() {
+    EventGroupHandle_t group = new NativeEventGroup();
+    group->bits = 0;
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->changed.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [group, bits, waitForAll] {
+        return waitForAll ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool met = waitTicks(group->changed, lock, ticks, satisfied);
+    EventBits_t result = group->bits;
+    if (met && clearOnExit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
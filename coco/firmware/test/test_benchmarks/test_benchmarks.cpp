@@ -0,0 +1,432 @@
+/**
+ * @file test_benchmarks.cpp
+ * @brief Host benchmarks of the storage, log, upload and audio processing paths
+ *
+ * Runs the firmware modules against the HAL shims in test/native, with the
+ * SD card backed by a temporary host directory, the microphone replaced by
+ * a synthetic signal and uploads sent to a counting sink. Every benchmark prints one
+ * "BENCH <name> <value> <unit>" line per result and fails when a result
+ * exceeds its budget. The budgets are several times the numbers of a
+ * typical CI runner, so they catch algorithmic regressions (a scan per
+ * push, a rewrite per pop) rather than noise. COCO_BENCH_BUDGET_SCALE
+ * scales all of them for slower machines.
+ *
+ * Run with: pio test -e native -v
+ */
+
+#include <unity.h>
+#include <unistd.h>
+#include <ESP_I2S.h>
+#include <HTTPClient.h>
+#include <SD.h>
+
+#include "Application.h"
+#include "AudioDSP.h"
+#include "AudioEncoder.h"
+#include "FileSystem.h"
+#include "LogManager.h"
+#include "UploadQueue.h"
+#include "UploadStream.h"
+#include "VoiceActivityDetector.h"
+#include "WavWriter.h"
+
+// Upload queue entries pushed and popped
+#define BENCH_QUEUE_ENTRIES 10000
+
+// Seconds of audio per DSP and codec measurement
+#define BENCH_AUDIO_SECONDS 60
+
+// Recordings written by the WAV benchmark, RECORD_TIME seconds each
+#define BENCH_WAV_FILES 6
+
+// Requests sent by the upload benchmark, each carrying all WAV benchmark recordings
+#define BENCH_STREAM_REQUESTS 10
+
+// Log bursts and messages per burst, one burst fits the log ring
+#define BENCH_LOG_BURSTS 8
+#define BENCH_LOG_BURST_MESSAGES 200
+
+// Budgets, see the file comment
+#define BUDGET_QUEUE_PUSH_US 200.0
+#define BUDGET_QUEUE_POP_US 400.0
+#define BUDGET_QUEUE_COMPACT_COPIES 2.0
+#define BUDGET_WAV_WRITE_MIN_MBPS 20.0
+#define BUDGET_UPLOAD_MIN_MBPS 5.0
+#define BUDGET_LOG_CALL_US 20.0
+#define BUDGET_LOG_DRAIN_MS 200.0
+#define BUDGET_DSP_NS_PER_SAMPLE 40.0
+#define BUDGET_ADPCM_NS_PER_SAMPLE 150.0
+#define BUDGET_VAD_NS_PER_SAMPLE 40.0
+
+static Application* app = nullptr;
+static int16_t* testSignal = nullptr;
+static const size_t testSignalSamples = SAMPLING_RATE * BENCH_AUDIO_SECONDS;
+
+static double budgetScale() {
+    const char* scale = getenv("COCO_BENCH_BUDGET_SCALE");
+    return scale ? atof(scale) : 1.0;
+}
+
+/**
+ * @brief Print a result and fail if it is above its budget
+ */
+static void reportMax(const char* name, double value, const char* unit, double budget) {
+    budget *= budgetScale();
+    printf("BENCH %-24s %12.2f %-9s (budget <= %.2f)\n", name, value, unit, budget);
+    char message[128];
+    snprintf(message, sizeof(message), "%s is %.2f %s, budget %.2f", name, value, unit, budget);
+    TEST_ASSERT_TRUE_MESSAGE(value <= budget, message);
+}
+
+/**
+ * @brief Print a result and fail if it is below its budget
+ */
+static void reportMin(const char* name, double value, const char* unit, double budget) {
+    budget /= budgetScale();
+    printf("BENCH %-24s %12.2f %-9s (budget >= %.2f)\n", name, value, unit, budget);
+    char message[128];
+    snprintf(message, sizeof(message), "%s is %.2f %s, budget %.2f", name, value, unit, budget);
+    TEST_ASSERT_TRUE_MESSAGE(value >= budget, message);
+}
+
+/**
+ * @brief Print a result without a budget
+ */
+static void report(const char* name, double value, const char* unit) {
+    printf("BENCH %-24s %12.2f %s\n", name, value, unit);
+}
+
+static size_t benchTimestamp(char* buffer, size_t size) {
+    int length = snprintf(buffer, size, "24-15-03_10-30-00");
+    return length > 0 && (size_t)length < size ? length : 0;
+}
+
+static String recordingPath(uint32_t index) {
+    return String(RECORDINGS_DIR) + "/1_" + String(index) + "_24-15-03_10-30-00_middle.wav";
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/**
+ * @brief Upload queue push and pop at BENCH_QUEUE_ENTRIES pending entries
+ */
+static void test_upload_queue_push_pop() {
+    TEST_ASSERT_TRUE(UploadQueue::init(app));
+    TEST_ASSERT_TRUE(UploadQueue::isEmpty());
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_QUEUE_ENTRIES; i++) {
+        TEST_ASSERT_TRUE(UploadQueue::push(recordingPath(i)));
+    }
+    int64_t pushUs = esp_timer_get_time() - start;
+    TEST_ASSERT_EQUAL_UINT32(BENCH_QUEUE_ENTRIES, UploadQueue::size());
+
+    // Peek and pop like the upload task, including the compactions on the way
+    uint32_t copiedBefore = UploadQueue::getCompactedRecords();
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_QUEUE_ENTRIES; i++) {
+        String path = UploadQueue::peek();
+        TEST_ASSERT_EQUAL_STRING(recordingPath(i).c_str(), path.c_str());
+        TEST_ASSERT_TRUE(UploadQueue::pop());
+    }
+    int64_t popUs = esp_timer_get_time() - start;
+    uint32_t copied = UploadQueue::getCompactedRecords() - copiedBefore;
+    TEST_ASSERT_TRUE(UploadQueue::isEmpty());
+
+    reportMax("queue_push", (double)pushUs / BENCH_QUEUE_ENTRIES, "us/op", BUDGET_QUEUE_PUSH_US);
+    reportMax("queue_peek_pop", (double)popUs / BENCH_QUEUE_ENTRIES, "us/op", BUDGET_QUEUE_POP_US);
+    // Records rewritten by compactions per pop, constant with the backlog when compaction is amortised
+    reportMax("queue_compact_copies", (double)copied / BENCH_QUEUE_ENTRIES, "rec/pop", BUDGET_QUEUE_COMPACT_COPIES);
+}
+
+/**
+ * @brief Upload queue keeps its records on their slots after a short write
+ */
+static void test_upload_queue_short_write() {
+    TEST_ASSERT_TRUE(UploadQueue::init(app));
+    TEST_ASSERT_TRUE(UploadQueue::isEmpty());
+
+    TEST_ASSERT_TRUE(UploadQueue::push(recordingPath(0)));
+    // The card takes half a record, like one filling up
+    nativeSdSetWriteBudget(UPLOAD_QUEUE_RECORD_SIZE / 2);
+    bool pushed = UploadQueue::push(recordingPath(1));
+    nativeSdSetWriteBudget(-1);
+    TEST_ASSERT_FALSE(pushed);
+    TEST_ASSERT_TRUE(UploadQueue::push(recordingPath(2)));
+    TEST_ASSERT_TRUE(UploadQueue::push(recordingPath(3)));
+    TEST_ASSERT_EQUAL_UINT32(3, UploadQueue::size());
+
+    // An entry acknowledged out of order no longer counts
+    String paths[3];
+    uint32_t ids[3];
+    TEST_ASSERT_EQUAL_UINT32(3, UploadQueue::peekBatch(paths, ids, 3));
+    TEST_ASSERT_EQUAL_STRING(recordingPath(2).c_str(), paths[1].c_str());
+    TEST_ASSERT_TRUE(UploadQueue::remove(ids[1]));
+    TEST_ASSERT_FALSE(UploadQueue::remove(ids[1]));
+    TEST_ASSERT_EQUAL_UINT32(2, UploadQueue::size());
+
+    TEST_ASSERT_EQUAL_STRING(recordingPath(0).c_str(), UploadQueue::peek().c_str());
+    TEST_ASSERT_TRUE(UploadQueue::pop());
+    TEST_ASSERT_EQUAL_STRING(recordingPath(3).c_str(), UploadQueue::peek().c_str());
+    TEST_ASSERT_TRUE(UploadQueue::pop());
+    TEST_ASSERT_TRUE(UploadQueue::isEmpty());
+}
+
+/**
+ * @brief WAV recording throughput with the configured codec, in captured PCM per second
+ */
+static void test_wav_write_throughput() {
+    TEST_ASSERT_TRUE(FileSystem::ensureDirectory(RECORDINGS_DIR));
+
+    const size_t segmentBytes = (size_t)RECORD_TIME * SAMPLING_RATE * AUDIO_SAMPLE_BYTES;
+    const size_t blockBytes = AUDIO_WRITE_BLOCK_SIZE;
+    WavWriter writer;
+    size_t pcmBytes = 0;
+    size_t encodedBytes = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_WAV_FILES; i++) {
+        String path = String(RECORDINGS_DIR) + "/bench_" + String(i) + ".wav";
+        TEST_ASSERT_TRUE(writer.open(path, segmentBytes));
+        for (size_t offset = 0; offset < segmentBytes; offset += blockBytes) {
+            size_t size = std::min(blockBytes, segmentBytes - offset);
+            TEST_ASSERT_TRUE(writer.append((const uint8_t*)testSignal + offset % (testSignalSamples * 2), size));
+            pcmBytes += size;
+        }
+        TEST_ASSERT_TRUE(writer.close());
+        // Includes the last codec block, written by close()
+        encodedBytes += writer.getDataSize() + writer.getHeaderSize();
+    }
+    int64_t elapsedUs = esp_timer_get_time() - start;
+
+    // The closed file holds the header and the whole payload, without the preallocated reserve
+    size_t size = 0;
+    TEST_ASSERT_TRUE(FileSystem::getFileSize(String(RECORDINGS_DIR) + "/bench_0.wav", size));
+    TEST_ASSERT_EQUAL_UINT32(encodedBytes / BENCH_WAV_FILES, size);
+
+    report("wav_encoded_ratio", (double)pcmBytes / encodedBytes, ":1");
+    // Bytes per microsecond equal MB/s
+    reportMin("wav_write", (double)pcmBytes / elapsedUs, "MB/s PCM", BUDGET_WAV_WRITE_MIN_MBPS);
+}
+
+/**
+ * @brief Upload body throughput, the SD reader task streaming the WAV benchmark recordings
+ */
+static void test_upload_stream_throughput() {
+    // Lives as long as its reader task, like the one in BackendClient
+    static UploadStream stream;
+    TEST_ASSERT_TRUE(stream.begin());
+
+    // A batch body like the upload task builds, a part header before each file
+    for (int i = 0; i < BENCH_WAV_FILES; i++) {
+        String path = String(RECORDINGS_DIR) + "/bench_" + String(i) + ".wav";
+        size_t size = 0;
+        TEST_ASSERT_TRUE(FileSystem::getFileSize(path, size));
+        String header = "--coco\r\nContent-Disposition: form-data; name=\"file\"; filename=\"bench_" +
+                        String(i) + ".wav\"\r\n\r\n";
+        TEST_ASSERT_TRUE(stream.addBytes((const uint8_t*)header.c_str(), header.length()));
+        TEST_ASSERT_TRUE(stream.addFile(path, size));
+    }
+    const char* trailer = "\r\n--coco--\r\n";
+    TEST_ASSERT_TRUE(stream.addBytes((const uint8_t*)trailer, strlen(trailer)));
+
+    WiFiClient client;
+    HTTPClient http;
+    http.setReuse(true);
+    nativeHttpSetResponse(HTTP_CODE_OK);
+
+    size_t sent = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_STREAM_REQUESTS; i++) {
+        TEST_ASSERT_TRUE(http.begin(client, "http://backend.local:8000/api/upload_audio"));
+        stream.rewind();
+        TEST_ASSERT_EQUAL_UINT32(HTTP_CODE_OK, http.sendRequest("POST", &stream, stream.size()));
+        TEST_ASSERT_FALSE(stream.hasError());
+        TEST_ASSERT_EQUAL_UINT32(stream.size(), nativeHttpLastBodySize());
+        http.end();
+        sent += stream.size();
+    }
+    int64_t elapsedUs = esp_timer_get_time() - start;
+    stream.clear();
+
+    // Kept alive, so all requests went over one connection
+    TEST_ASSERT_EQUAL_UINT32(1, client.getConnectionCount());
+    reportMin("upload_stream", (double)sent / elapsedUs, "MB/s", BUDGET_UPLOAD_MIN_MBPS);
+}
+
+/**
+ * @brief Log call cost and flush latency for bursts of messages
+ */
+static void test_log_bursts() {
+    TEST_ASSERT_TRUE(LogManager::startLogTask());
+
+    // Start from an empty ring, the earlier benchmarks logged without a flush task
+    LogManager::flush();
+    for (int i = 0; i < 5000 && LogManager::hasPendingLogs(); i++) {
+        vTaskDelay(1);
+    }
+    TEST_ASSERT_FALSE(LogManager::hasPendingLogs());
+    uint32_t droppedBefore = LogManager::getDroppedCount();
+
+    int64_t callUs = 0;
+    int64_t drainUs = 0;
+    int64_t worstDrainUs = 0;
+    for (int burst = 0; burst < BENCH_LOG_BURSTS; burst++) {
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < BENCH_LOG_BURST_MESSAGES; i++) {
+            app->log("Audio file /recordings/1_" + String(i) + "_24-15-03_10-30-00_middle.wav closed, " +
+                     String(burst * 1000 + i) + " bytes");
+        }
+        int64_t logged = esp_timer_get_time();
+        callUs += logged - start;
+
+        // Drained by the flush task as a burst would be on the device, a flush skips the batch timer
+        LogManager::flush();
+        while (LogManager::hasPendingLogs()) {
+            vTaskDelay(1);
+        }
+        int64_t drained = esp_timer_get_time() - logged;
+        drainUs += drained;
+        worstDrainUs = std::max(worstDrainUs, drained);
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+
+    const int messages = BENCH_LOG_BURSTS * BENCH_LOG_BURST_MESSAGES;
+    TEST_ASSERT_EQUAL_UINT32(droppedBefore, LogManager::getDroppedCount());
+    reportMax("log_call", (double)callUs / messages, "us/msg", BUDGET_LOG_CALL_US);
+    report("log_drain_avg", drainUs / 1000.0 / BENCH_LOG_BURSTS, "ms/burst");
+    reportMax("log_drain_worst", worstDrainUs / 1000.0, "ms/burst", BUDGET_LOG_DRAIN_MS);
+}
+
+/**
+ * @brief Conditioning chain cost, in DMA-sized blocks like the capture task
+ */
+static void test_dsp_cost() {
+    TEST_ASSERT_TRUE(AudioDSP::init(app));
+    static int16_t block[AUDIO_DMA_BLOCK_SIZE / AUDIO_SAMPLE_BYTES];
+    const size_t blockSamples = sizeof(block) / sizeof(block[0]);
+
+    int64_t elapsedUs = 0;
+    size_t done = 0;
+    for (; done + blockSamples <= testSignalSamples; done += blockSamples) {
+        memcpy(block, testSignal + done, sizeof(block));
+        int64_t start = esp_timer_get_time();
+        AudioDSP::process(block, blockSamples);
+        elapsedUs += esp_timer_get_time() - start;
+    }
+    AudioDSP::reset();
+
+    reportMax("dsp_process", elapsedUs * 1000.0 / done, "ns/sample", BUDGET_DSP_NS_PER_SAMPLE);
+}
+
+/**
+ * @brief IMA-ADPCM encoder cost, in the slices WavWriter hands it
+ */
+static void test_adpcm_cost() {
+    ImaAdpcmEncoder encoder;
+    const size_t sliceBytes = WAV_ENCODE_SLICE;
+    uint8_t* out = (uint8_t*)malloc(encoder.getMaxEncodedSize(sliceBytes));
+    TEST_ASSERT_NOT_NULL(out);
+
+    const uint8_t* pcm = (const uint8_t*)testSignal;
+    const size_t pcmBytes = testSignalSamples * AUDIO_SAMPLE_BYTES;
+    size_t encoded = 0;
+    encoder.begin();
+    int64_t start = esp_timer_get_time();
+    for (size_t offset = 0; offset < pcmBytes; offset += sliceBytes) {
+        encoded += encoder.encode(pcm + offset, std::min(sliceBytes, pcmBytes - offset), out);
+    }
+    encoded += encoder.finish(out);
+    int64_t elapsedUs = esp_timer_get_time() - start;
+    free(out);
+
+    TEST_ASSERT_EQUAL_UINT32(testSignalSamples, encoder.getSampleFrames());
+    report("adpcm_ratio", (double)pcmBytes / encoded, ":1");
+    reportMax("adpcm_encode", elapsedUs * 1000.0 / testSignalSamples, "ns/sample", BUDGET_ADPCM_NS_PER_SAMPLE);
+}
+
+/**
+ * @brief Voice activity detection cost per captured block
+ */
+static void test_vad_cost() {
+    VoiceActivityDetector vad;
+    const size_t blockSamples = AUDIO_DMA_BLOCK_SIZE / AUDIO_SAMPLE_BYTES;
+    size_t voicedBlocks = 0;
+
+    int64_t start = esp_timer_get_time();
+    size_t done = 0;
+    for (; done + blockSamples <= testSignalSamples; done += blockSamples) {
+        if (vad.process(testSignal + done, blockSamples)) {
+            voicedBlocks++;
+        }
+    }
+    int64_t elapsedUs = esp_timer_get_time() - start;
+
+    report("vad_voiced_share", 100.0 * voicedBlocks / (done / blockSamples), "%");
+    reportMax("vad_process", elapsedUs * 1000.0 / done, "ns/sample", BUDGET_VAD_NS_PER_SAMPLE);
+}
+
+/**
+ * @brief Capture the test signal through the I2S driver, in DMA blocks like the capture task
+ */
+static bool captureTestSignal() {
+    I2SClass i2s;
+    if (!i2s.begin(I2S_MODE_PDM_RX, SAMPLING_RATE, I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO)) {
+        return false;
+    }
+    testSignal = (int16_t*)malloc(testSignalSamples * sizeof(int16_t));
+    if (!testSignal) {
+        return false;
+    }
+    const size_t totalBytes = testSignalSamples * sizeof(int16_t);
+    for (size_t offset = 0; offset < totalBytes;) {
+        size_t size = std::min((size_t)AUDIO_DMA_BLOCK_SIZE, totalBytes - offset);
+        size_t read = i2s.readBytes((char*)testSignal + offset, size);
+        if (read == 0) {
+            return false;
+        }
+        offset += read;
+    }
+    i2s.end();
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!captureTestSignal()) {
+        printf("Test signal could not be captured\n");
+        return 1;
+    }
+
+    // Boot order of the firmware: the log ring first, then the card
+    nativeSdFormat();
+    app = Application::getInstance();
+    LogManager::init(app);
+    LogManager::setTimestampProvider(benchTimestamp);
+    if (!FileSystem::init(app)) {
+        printf("FileSystem could not be initialized on %s\n", nativeSdRoot());
+        return 1;
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_dsp_cost);
+    RUN_TEST(test_adpcm_cost);
+    RUN_TEST(test_vad_cost);
+    RUN_TEST(test_upload_queue_push_pop);
+    RUN_TEST(test_upload_queue_short_write);
+    RUN_TEST(test_wav_write_throughput);
+    RUN_TEST(test_upload_stream_throughput);
+    RUN_TEST(test_log_bursts);
+    int failures = UNITY_END();
+
+    free(testSignal);
+    // A temporary card is removed, one given in COCO_NATIVE_SD_ROOT is kept for inspection
+    if (getenv("COCO_NATIVE_SD_ROOT") == nullptr) {
+        nativeSdFormat();
+        rmdir(nativeSdRoot());
+    }
+    return failures;
+}
@@ -4,6 +4,8 @@ from fastapi.security.api_key import APIKeyHeader
 from fastapi import status, HTTPException
 
 import aiofiles
+import datetime
+import json
 import logging
 import threading
 import httpx
@@ -11,10 +13,20 @@ import asyncio
 
 import os
 import sys
+from typing import Tuple
 
 
 from coco import CocoClient
-from utils import PathManager
+from utils import (
+    PathManager,
+    to_pcm_wav,
+    resolve_unknown_timestamp,
+    parse_upload_batch,
+    parse_metrics_snapshot,
+    BATCH_CONTENT_TYPE,
+    METRICS_HEADER,
+    METRICS_FILE,
+)
 
 # Add threading for thread-safe counter
 active_tasks = 0
@@ -199,6 +211,66 @@ async def is_transcription_available():
         return False
 
 
+async def store_audio_file(
+    filename: str, body: bytes, background_tasks: BackgroundTasks
+) -> Tuple[bool, str]:
+    """
+    Validate, decode and save one uploaded audio file and queue its processing
+
+    Args:
+        filename (str): File name as sent by the device
+        body (bytes): WAV file contents
+        background_tasks (BackgroundTasks): Tasks run after the response is sent
+
+    Returns:
+        Tuple[bool, str]: Whether the file was stored, and a status message
+    """
+    # Recordings made before the device clock was set carry "unknown" instead of a time
+    stored_name = resolve_unknown_timestamp(filename, body)
+    if stored_name != filename:
+        logger.info(f"Named {filename} as {stored_name}")
+    audio_path = PathManager.get_raw_path(stored_name)
+    if not audio_path:
+        return (
+            False,
+            "Invalid filename, expected format: int_int_YY-DD-MM_HH-MM-SS_suffix.wav, suffix in ['start', 'end', 'middle']",
+        )
+
+    # Compressed uploads (IMA-ADPCM) are stored as PCM for the rest of the pipeline
+    try:
+        pcm_body = to_pcm_wav(body)
+    except ValueError as e:
+        return False, f"Invalid audio file: {e}"
+    if pcm_body is not body:
+        logger.info(f"Decoded {filename}: {len(body)} -> {len(pcm_body)} bytes")
+    body = pcm_body
+
+    # Function to save the file to local storage
+    async with aiofiles.open(audio_path, "wb") as f:
+        await f.write(body)
+    logger.info(f"File saved to: {audio_path}")
+
+    background_tasks.add_task(kick_off_processing, audio_path, store_in_db=True)
+    logger.info(f"Background task added for file: {audio_path}")
+    return True, ".wav successfully received"
+
+
+async def store_metrics_snapshot(value: str) -> None:
+    """
+    Append the metrics snapshot of an upload to METRICS_FILE
+
+    Args:
+        value (str): Value of the metrics header
+    """
+    snapshot = parse_metrics_snapshot(value)
+    if snapshot is None:
+        logger.warning("Ignoring malformed device metrics snapshot")
+        return
+    snapshot["received"] = datetime.datetime.now(datetime.timezone.utc).isoformat()
+    async with aiofiles.open(METRICS_FILE, "a") as f:
+        await f.write(json.dumps(snapshot, separators=(",", ":")) + "\n")
+
+
 # Route to upload audio data
 @app.post("/uploadAudio")
 async def upload_audio(
@@ -207,6 +279,11 @@ async def upload_audio(
     api_key: str = Depends(get_api_key),
 ):
     try:
+        # Kept even when the upload is refused, the device sends it with every attempt
+        metrics = request.headers.get(METRICS_HEADER)
+        if metrics:
+            await store_metrics_snapshot(metrics)
+
         # Check if transcription service is available
         if not await is_transcription_available():
             return JSONResponse(
@@ -230,6 +307,50 @@ async def upload_audio(
 
         # Get the raw body content
         body = await request.body()
+        content_type = request.headers.get("Content-Type", "audio/wav")
+
+        if content_type == BATCH_CONTENT_TYPE:
+            try:
+                files = parse_upload_batch(body)
+            except ValueError as e:
+                return JSONResponse(
+                    content={"status": "error", "message": f"Invalid batch: {e}"},
+                    status_code=400,
+                )
+            logger.info(f"Batch of {len(files)} audio files received")
+
+            # Report every file, the device removes exactly the acknowledged ones and sets
+            # aside those with an error, a verdict on the file that a retry would repeat.
+            # Failures that may pass later raise and answer the whole batch with a 500.
+            results = []
+            acknowledged = []
+            for filename, data in files:
+                ok, message = await store_audio_file(filename, data, background_tasks)
+                results.append(
+                    {
+                        "filename": filename,
+                        "status": "success" if ok else "error",
+                        "message": message,
+                    }
+                )
+                if ok:
+                    acknowledged.append(filename)
+
+            if len(acknowledged) == len(files):
+                batch_status = "success"
+            elif acknowledged:
+                batch_status = "partial"
+            else:
+                batch_status = "error"
+            return JSONResponse(
+                content={
+                    "status": batch_status,
+                    "results": results,
+                    "acknowledged": acknowledged,
+                },
+                status_code=200,
+            )
+
         logger.info("Audio file received")
 
         # Extract filename from headers
@@ -239,26 +360,15 @@ async def upload_audio(
             .strip('"')
         )
 
-        audio_path = PathManager.get_raw_path(filename)
-        if not audio_path:
+        ok, message = await store_audio_file(filename, body, background_tasks)
+        if not ok:
             return JSONResponse(
-                content={
-                    "status": "error",
-                    "message": "Invalid filename, expected format: int_int_YY-DD-MM_HH-MM-SS_suffix.wav, suffix in ['start', 'end', 'middle']",
-                },
+                content={"status": "error", "message": message},
                 status_code=400,
             )
 
-        # Function to save the file to local storage
-        async with aiofiles.open(audio_path, "wb") as f:
-            await f.write(body)
-        logger.info(f"File saved to: {audio_path}")
-
-        background_tasks.add_task(kick_off_processing, audio_path, store_in_db=True)
-        logger.info(f"Background task added for file: {audio_path}")
-
         return JSONResponse(
-            content={"status": "success", "message": ".wav successfully received"},
+            content={"status": "success", "message": message},
             status_code=200,
         )
 
@@ -276,6 +386,15 @@ async def test_endpoint(api_key: str = Depends(get_api_key)):
     }
 
 
+# Upload sink of the firmware benchmark build (env:bench), the body is counted and discarded
+@app.post("/benchmarkUpload")
+async def benchmark_upload(request: Request, api_key: str = Depends(get_api_key)):
+    received = 0
+    async for chunk in request.stream():
+        received += len(chunk)
+    return {"status": "success", "bytes": received}
+
+
 @app.get("/status")
 async def get_system_status(api_key: str = Depends(get_api_key)):
     with task_lock:
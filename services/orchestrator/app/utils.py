@@ -3,6 +3,8 @@ from pathlib import Path
 import logging
 import sys
 import datetime
+import json
+import struct
 from typing import Dict, Optional, Tuple, List
 from pydub import AudioSegment
 
@@ -371,11 +373,24 @@ class AudioPathManager:
             if not os.path.exists(snippet_dir):
                 os.makedirs(snippet_dir)
 
-            # Combine audio files
+            # Combine audio files, on the timeline the device recorded them on
             combined = AudioSegment.empty()
+            previous_end = None
             for file_path in files_to_combine:
                 audio = AudioSegment.from_wav(file_path)
+                start = read_wav_start_time(file_path)
+                if start is not None and previous_end is not None:
+                    gap_ms = (start - previous_end).total_seconds() * 1000
+                    if 0 < gap_ms <= STITCH_MAX_GAP_MS:
+                        combined += AudioSegment.silent(
+                            duration=gap_ms, frame_rate=audio.frame_rate
+                        )
                 combined += audio
+                previous_end = (
+                    start + datetime.timedelta(milliseconds=len(audio))
+                    if start is not None
+                    else None
+                )
 
             # Export the combined audio
             combined.export(snippet_path, format="wav")
@@ -429,5 +444,299 @@ def parse_coco_filename(
     }
 
 
+WAV_FORMAT_PCM = 0x0001
+WAV_FORMAT_IMA_ADPCM = 0x0011
+
+# Start time of a recording, see WAV_TIME_CHUNK_ID in the firmware's WavWriter.h
+WAV_TIME_CHUNK_ID = b"time"
+# Gaps between consecutive recordings up to this length are lost samples, restored as silence
+STITCH_MAX_GAP_MS = 1000
+
+# IMA-ADPCM quantizer step sizes and step index adjustments
+IMA_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
+    34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+    157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+IMA_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def parse_wav_chunks(data: bytes) -> Optional[Dict[str, object]]:
+    """
+    Locate the fmt, fact, time and data chunks of a RIFF/WAVE file
+
+    Args:
+        data: Complete WAV file contents
+
+    Returns:
+        Dictionary with the fmt fields, the fact sample count (or None), the
+        start time in microseconds since the epoch (or None) and the payload
+        bytes, or None if the data is not a WAV file
+    """
+    if len(data) < 12 or data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+        return None
+
+    info = {
+        "format_tag": None,
+        "sample_frames": None,
+        "start_us": None,
+        "payload": None,
+    }
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id = data[pos : pos + 4]
+        (chunk_size,) = struct.unpack_from("<I", data, pos + 4)
+        body = pos + 8
+        if chunk_id == b"fmt " and chunk_size >= 16:
+            (
+                info["format_tag"],
+                info["channels"],
+                info["sample_rate"],
+                _,
+                info["block_align"],
+                info["bits_per_sample"],
+            ) = struct.unpack_from("<HHIIHH", data, body)
+            if chunk_size >= 20:
+                (info["samples_per_block"],) = struct.unpack_from("<H", data, body + 18)
+        elif chunk_id == b"fact" and chunk_size >= 4:
+            (info["sample_frames"],) = struct.unpack_from("<I", data, body)
+        elif chunk_id == WAV_TIME_CHUNK_ID and chunk_size >= 8:
+            (start_us,) = struct.unpack_from("<q", data, body)
+            # Zero marks a recording made before the clock was set
+            info["start_us"] = start_us or None
+        elif chunk_id == b"data":
+            info["payload"] = data[body : body + chunk_size]
+            break
+        pos = body + chunk_size + (chunk_size & 1)
+
+    if info["format_tag"] is None or info["payload"] is None:
+        return None
+    return info
+
+
+def decode_ima_adpcm(
+    payload: bytes, block_align: int, samples_per_block: int, sample_frames: Optional[int]
+) -> bytes:
+    """
+    Decode mono IMA-ADPCM blocks as stored in WAV files to 16-bit PCM
+
+    Args:
+        payload: Contents of the data chunk
+        block_align: Bytes per ADPCM block
+        samples_per_block: Samples encoded in each block
+        sample_frames: Real sample count from the fact chunk, trims block padding
+
+    Returns:
+        Little-endian 16-bit PCM samples
+    """
+    samples = []
+    for start in range(0, len(payload) - block_align + 1, block_align):
+        predictor, index = struct.unpack_from("<hB", payload, start)
+        index = min(max(index, 0), 88)
+        block = [predictor]
+        # Two codes per byte, the earlier sample in the low nibble
+        for byte in payload[start + 4 : start + block_align]:
+            for code in (byte & 0x0F, byte >> 4):
+                step = IMA_STEP_TABLE[index]
+                delta = step >> 3
+                if code & 4:
+                    delta += step
+                if code & 2:
+                    delta += step >> 1
+                if code & 1:
+                    delta += step >> 2
+                predictor += -delta if code & 8 else delta
+                predictor = min(max(predictor, -32768), 32767)
+                index = min(max(index + IMA_INDEX_TABLE[code & 7], 0), 88)
+                block.append(predictor)
+        samples.extend(block[:samples_per_block])
+
+    if sample_frames is not None:
+        del samples[sample_frames:]
+    return struct.pack(f"<{len(samples)}h", *samples)
+
+
+def to_pcm_wav(data: bytes) -> bytes:
+    """
+    Convert an uploaded WAV file to 16-bit PCM if it uses a compressed codec
+
+    Args:
+        data: Complete WAV file contents
+
+    Returns:
+        PCM WAV file contents (the input itself if it already is PCM)
+
+    Raises:
+        ValueError: If the file is not a WAV file or uses an unsupported codec
+    """
+    info = parse_wav_chunks(data)
+    if info is None:
+        raise ValueError("Not a valid WAV file")
+
+    if info["format_tag"] == WAV_FORMAT_PCM:
+        return data
+    if info["format_tag"] != WAV_FORMAT_IMA_ADPCM or info["channels"] != 1:
+        raise ValueError(f"Unsupported WAV format tag: {info['format_tag']:#06x}")
+
+    pcm = decode_ima_adpcm(
+        info["payload"],
+        info["block_align"],
+        info["samples_per_block"],
+        info["sample_frames"],
+    )
+    # Keep the start time, it places the recording when files are stitched
+    time_chunk = b""
+    if info["start_us"] is not None:
+        time_chunk = struct.pack("<4sIq", WAV_TIME_CHUNK_ID, 8, info["start_us"])
+
+    header = struct.pack(
+        "<4sI4s4sIHHIIHH",
+        b"RIFF",
+        36 + len(time_chunk) + len(pcm),
+        b"WAVE",
+        b"fmt ",
+        16,
+        WAV_FORMAT_PCM,
+        1,
+        info["sample_rate"],
+        info["sample_rate"] * 2,
+        2,
+        16,
+    )
+    return header + time_chunk + struct.pack("<4sI", b"data", len(pcm)) + pcm
+
+
+# Timestamp in the name of a recording made before the device clock was set
+UNKNOWN_TIMESTAMP = "unknown"
+# Earlier start times come from an unset device clock, see TIME_VALID_AFTER in the firmware's config.h
+TIME_VALID_AFTER_US = 1451606400 * 1_000_000
+
+
+def resolve_unknown_timestamp(filename: str, data: bytes) -> str:
+    """
+    Give a recording named before the device clock was set a timestamp
+
+    The name takes the start time from the time chunk when it is valid, and
+    the time of arrival otherwise, both in the local time of the server.
+
+    Args:
+        filename: File name as sent by the device
+        data: WAV file contents
+
+    Returns:
+        The filename in the int_int_YY-MM-DD_HH-MM-SS_suffix.wav format, or
+        the filename itself if it has a timestamp
+    """
+    parts = filename.split("_")
+    if len(parts) != 4 or parts[2] != UNKNOWN_TIMESTAMP:
+        return filename
+
+    info = parse_wav_chunks(data)
+    if info is not None and info["start_us"] is not None and info["start_us"] >= TIME_VALID_AFTER_US:
+        start = datetime.datetime.fromtimestamp(info["start_us"] / 1_000_000)
+    else:
+        start = datetime.datetime.now()
+    return f"{parts[0]}_{parts[1]}_{start.strftime('%y-%m-%d_%H-%M-%S')}_{parts[3]}"
+
+
+def read_wav_start_time(audio_path: str) -> Optional[datetime.datetime]:
+    """
+    Read the time of the first sample of a recording from its time chunk
+
+    Args:
+        audio_path: Path to the WAV file
+
+    Returns:
+        UTC datetime with microseconds, or None if the file has no start time
+    """
+    try:
+        with open(audio_path, "rb") as f:
+            # The time chunk precedes the data chunk
+            info = parse_wav_chunks(f.read(256))
+    except OSError:
+        return None
+    if info is None or info["start_us"] is None:
+        return None
+    return datetime.datetime.fromtimestamp(
+        info["start_us"] / 1_000_000, tz=datetime.timezone.utc
+    )
+
+
+# Batch uploads from the device, see UPLOAD_BATCH_* in the firmware's BackendClient.h
+BATCH_CONTENT_TYPE = "application/x-coco-batch"
+BATCH_MAGIC = b"CCB1"
+
+
+def parse_upload_batch(data: bytes) -> List[Tuple[str, bytes]]:
+    """
+    Split a batch upload into its files
+
+    The body is "CCB1", a u16 file count and a u16 reserved field, followed
+    by a u16 name length, a u32 data length, the name and the data of each
+    file. All fields are little-endian.
+
+    Args:
+        data: Complete request body
+
+    Returns:
+        List of (filename, file contents) in upload order
+
+    Raises:
+        ValueError: If the body is not a well-formed batch
+    """
+    if len(data) < 8 or data[:4] != BATCH_MAGIC:
+        raise ValueError("Not a batch upload")
+
+    (count,) = struct.unpack_from("<H", data, 4)
+    files = []
+    offset = 8
+    for _ in range(count):
+        if offset + 6 > len(data):
+            raise ValueError("Truncated batch entry header")
+        name_length, data_length = struct.unpack_from("<HI", data, offset)
+        offset += 6
+        end = offset + name_length + data_length
+        if end > len(data):
+            raise ValueError("Truncated batch entry")
+        name = data[offset : offset + name_length].decode("utf-8", errors="replace")
+        files.append((name, data[offset + name_length : end]))
+        offset = end
+
+    return files
+
+
+# Runtime metrics the device sends with every upload, see Metrics.h in the firmware
+METRICS_HEADER = "X-Coco-Metrics"
+METRICS_FILE = ROOT_PATH / "device_metrics.jsonl"
+
+
+def parse_metrics_snapshot(value: str) -> Optional[Dict[str, object]]:
+    """
+    Parse the metrics snapshot of an upload request
+
+    The snapshot is compact JSON with a version "v", the boot session
+    "boot", the uptime "up" in seconds, counters and gauges in "m",
+    histograms in "h" and, if the firmware samples it, the CPU share of
+    every task in permille in "cpu". All values count from boot, so
+    differences between snapshots of one boot session give the rates.
+
+    Args:
+        value: Header value
+
+    Returns:
+        The snapshot, or None if it is not a supported snapshot
+    """
+    try:
+        snapshot = json.loads(value)
+    except ValueError:
+        return None
+    if not isinstance(snapshot, dict) or snapshot.get("v") != 1:
+        return None
+    return snapshot
+
+
 # Initialize the path manager
 PathManager = AudioPathManager(ROOT_PATH)